@@ -0,0 +1,37 @@
+/// A single method invocation executed as part of `WireguardDart.batch`.
+class BatchCall {
+  final String method;
+  final Map<String, dynamic>? arguments;
+
+  const BatchCall(this.method, [this.arguments]);
+
+  const BatchCall.nativeInit() : this('nativeInit');
+
+  BatchCall.setupTunnel({required String bundleId, required String tunnelName, String? win32ServiceName})
+      : this('setupTunnel', {
+          'bundleId': bundleId,
+          'tunnelName': tunnelName,
+          if (win32ServiceName != null) 'win32ServiceName': win32ServiceName,
+        });
+
+  BatchCall.checkTunnelConfiguration({required String bundleId, required String tunnelName})
+      : this('checkTunnelConfiguration', {'bundleId': bundleId, 'tunnelName': tunnelName});
+
+  const BatchCall.status() : this('status');
+
+  /// See `WireguardDart.connect`: pass exactly one of [cfg] and [profileId].
+  BatchCall.connect({String? cfg, int? profileId})
+      : assert((cfg == null) != (profileId == null), 'Pass either cfg or profileId'),
+        method = 'connect',
+        arguments = {
+          if (cfg != null) 'cfg': cfg,
+          if (profileId != null) 'profileId': profileId,
+        };
+
+  const BatchCall.disconnect() : this('disconnect');
+
+  Map<String, dynamic> toMap() => {
+        'method': method,
+        if (arguments != null) 'arguments': arguments,
+      };
+}
@@ -3,6 +3,9 @@ enum ConnectionStatus {
   connected,
   disconnecting,
   disconnected,
+
+  /// The tunnel is up but its peer stopped answering handshakes; recovery is in progress.
+  degraded,
   unknown;
 
   factory ConnectionStatus.fromString(String s) {
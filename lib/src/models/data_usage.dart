@@ -0,0 +1,13 @@
+/// Bytes that went through the tunnel, as returned by
+/// `WireguardDart.dataUsage`.
+class DataUsage {
+  final int received;
+  final int sent;
+
+  const DataUsage({required this.received, required this.sent});
+
+  factory DataUsage.fromMap(Map<dynamic, dynamic> map) =>
+      DataUsage(received: map['received'] as int, sent: map['sent'] as int);
+
+  int get total => received + sent;
+}
@@ -0,0 +1,66 @@
+import 'dart:typed_data';
+
+/// A candidate endpoint for `WireguardDart.rankEndpoints`.
+class EndpointProbe {
+  /// `host:port` or `[v6]:port`, as in a peer's `Endpoint`.
+  final String endpoint;
+
+  /// Datagram to send instead of the default echo probe, e.g. a handshake
+  /// initiation for the server's public key. The default probe is only
+  /// answered by responders that reflect it.
+  final Uint8List? payload;
+
+  const EndpointProbe(this.endpoint, {this.payload});
+
+  Map<String, dynamic> toMap() => {
+        'endpoint': endpoint,
+        if (payload != null) 'payload': payload,
+      };
+}
+
+/// Latency measured for one candidate endpoint.
+class EndpointRanking {
+  final String endpoint;
+
+  /// Numeric address the probes were sent to, empty if [endpoint] did not resolve.
+  final String address;
+  final int sent;
+  final int received;
+
+  /// Median round trip time in milliseconds over the replies received.
+  final double rttMs;
+
+  /// Mean difference between consecutive round trip times in milliseconds.
+  final double jitterMs;
+
+  /// Fraction of probes that went unanswered, from 0 to 1.
+  final double loss;
+
+  /// Round trip time of every answered probe in milliseconds, in send order.
+  final List<double> samplesMs;
+
+  const EndpointRanking({
+    required this.endpoint,
+    required this.address,
+    required this.sent,
+    required this.received,
+    required this.rttMs,
+    required this.jitterMs,
+    required this.loss,
+    required this.samplesMs,
+  });
+
+  /// Whether any probe was answered.
+  bool get reachable => received > 0;
+
+  factory EndpointRanking.fromMap(Map<dynamic, dynamic> map) => EndpointRanking(
+        endpoint: map['endpoint'] as String,
+        address: map['address'] as String,
+        sent: map['sent'] as int,
+        received: map['received'] as int,
+        rttMs: (map['rttMs'] as num).toDouble(),
+        jitterMs: (map['jitterMs'] as num).toDouble(),
+        loss: (map['loss'] as num).toDouble(),
+        samplesMs: (map['samplesMs'] as List).map((e) => (e as num).toDouble()).toList(),
+      );
+}
@@ -0,0 +1,54 @@
+/// Usability of the connected tunnel as measured by the quality probes of
+/// `WireguardDart.setQualityProbe`. Times are in milliseconds.
+class LinkQuality {
+  /// Median round trip time of recent probes.
+  final double rttMedian;
+
+  /// 90th percentile of the round trip time of recent probes.
+  final double rttP90;
+
+  /// 99th percentile of the round trip time of recent probes.
+  final double rttP99;
+
+  /// Smoothed variation of the round trip time between consecutive probes.
+  final double jitter;
+
+  /// Fraction of the last 100 probes that went unanswered, from 0 to 1.
+  final double loss;
+
+  /// Probes answered or lost since probing started.
+  final int probesSent;
+
+  /// Probes answered since probing started.
+  final int probesReceived;
+
+  const LinkQuality({
+    required this.rttMedian,
+    required this.rttP90,
+    required this.rttP99,
+    required this.jitter,
+    required this.loss,
+    required this.probesSent,
+    required this.probesReceived,
+  });
+
+  factory LinkQuality.fromJson(Map<String, dynamic> json) => LinkQuality(
+        rttMedian: (json['rttMedian'] as num).toDouble(),
+        rttP90: (json['rttP90'] as num).toDouble(),
+        rttP99: (json['rttP99'] as num).toDouble(),
+        jitter: (json['jitter'] as num).toDouble(),
+        loss: (json['loss'] as num).toDouble(),
+        probesSent: json['probesSent'] as int,
+        probesReceived: json['probesReceived'] as int,
+      );
+
+  Map<String, dynamic> toJson() => {
+        'rttMedian': rttMedian,
+        'rttP90': rttP90,
+        'rttP99': rttP99,
+        'jitter': jitter,
+        'loss': loss,
+        'probesSent': probesSent,
+        'probesReceived': probesReceived,
+      };
+}
@@ -1,4 +1,10 @@
+export 'batch_call.dart';
 export 'connection_status.dart';
+export 'data_usage.dart';
+export 'endpoint_ranking.dart';
 export 'key_pair.dart';
+export 'link_quality.dart';
+export 'peer_config.dart';
+export 'traffic_history.dart';
 export 'tunnel_statistics.dart';
 export 'notification_permission.dart';
@@ -0,0 +1,47 @@
+/// A peer for `WireguardDart.addPeers`, with the settings of a `[Peer]`
+/// section.
+class PeerConfig {
+  /// Base64 public key, which identifies the peer.
+  final String publicKey;
+  final String? presharedKey;
+
+  /// `ip:port` or `[v6]:port`. Host names are not resolved here.
+  final String? endpoint;
+
+  /// Prefixes such as `10.0.0.2/32`.
+  final List<String> allowedIps;
+
+  /// Seconds between keepalive packets, 0 to disable.
+  final int persistentKeepalive;
+
+  const PeerConfig(this.publicKey,
+      {this.presharedKey, this.endpoint, this.allowedIps = const [], this.persistentKeepalive = 0});
+
+  Map<String, dynamic> toMap() => {
+        'publicKey': publicKey,
+        if (presharedKey != null) 'presharedKey': presharedKey,
+        if (endpoint != null) 'endpoint': endpoint,
+        'allowedIps': allowedIps,
+        'persistentKeepalive': persistentKeepalive,
+      };
+}
+
+/// Changes to an existing peer for `WireguardDart.updatePeers`. Fields left
+/// null keep their current value.
+class PeerUpdate {
+  final String publicKey;
+  final String? endpoint;
+
+  /// Replaces all allowed IPs of the peer.
+  final List<String>? allowedIps;
+  final int? persistentKeepalive;
+
+  const PeerUpdate(this.publicKey, {this.endpoint, this.allowedIps, this.persistentKeepalive});
+
+  Map<String, dynamic> toMap() => {
+        'publicKey': publicKey,
+        if (endpoint != null) 'endpoint': endpoint,
+        if (allowedIps != null) 'allowedIps': allowedIps,
+        if (persistentKeepalive != null) 'persistentKeepalive': persistentKeepalive,
+      };
+}
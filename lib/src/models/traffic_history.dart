@@ -0,0 +1,35 @@
+import 'dart:typed_data';
+
+/// Bucket length of `WireguardDart.trafficHistory`. Buckets of one second
+/// are kept for 10 minutes, of one minute for 24 hours and of one hour for
+/// 30 days.
+enum TrafficResolution { second, minute, hour }
+
+/// Bytes received and sent through the tunnel or a peer in consecutive
+/// buckets of equal length.
+class TrafficHistory {
+  /// When the first bucket starts.
+  final DateTime start;
+
+  /// Length of every bucket.
+  final Duration step;
+
+  /// Bytes received and sent in each bucket, interleaved: received in the
+  /// first bucket, sent in the first bucket, received in the second and so
+  /// on. Use [received] and [sent] to read them by bucket.
+  final Int64List samples;
+
+  const TrafficHistory({required this.start, required this.step, required this.samples});
+
+  factory TrafficHistory.fromMap(Map<dynamic, dynamic> map) => TrafficHistory(
+        start: DateTime.fromMillisecondsSinceEpoch((map['start'] as int) * 1000, isUtc: true),
+        step: Duration(seconds: map['step'] as int),
+        samples: map['samples'] as Int64List,
+      );
+
+  int get length => samples.length ~/ 2;
+
+  int received(int bucket) => samples[2 * bucket];
+
+  int sent(int bucket) => samples[2 * bucket + 1];
+}
@@ -1,8 +1,14 @@
+import 'link_quality.dart';
+
 class TunnelStatistics {
   final int totalDownload;
   final int totalUpload;
   final int latestHandshake;
 
+  /// Estimates of the quality probes, while `WireguardDart.setQualityProbe`
+  /// has a target and the tunnel is connected. Only reported on Linux.
+  final LinkQuality? quality;
+
   /// Constructor of the [TunnelStatistics] class that receives
   /// [totalDownload], [totalUpload], and [latestHandshake] as parameters.
   /// [totalDownload] and [totalUpload] are the total bytes downloaded
@@ -12,18 +18,21 @@ class TunnelStatistics {
     required this.totalDownload,
     required this.totalUpload,
     required this.latestHandshake,
+    this.quality,
   });
 
   /// Factory constructor that creates a [TunnelStatistics] object from a JSON map.
   factory TunnelStatistics.fromJson(Map<String, dynamic> json) => TunnelStatistics(
       totalDownload: json['totalDownload'] as int,
       totalUpload: json['totalUpload'] as int,
-      latestHandshake: json['latestHandshake'] as int);
+      latestHandshake: json['latestHandshake'] as int,
+      quality: json['quality'] == null ? null : LinkQuality.fromJson(json['quality'] as Map<String, dynamic>));
 
   /// Converts the [TunnelStatistics] object to a JSON map.
   Map<String, dynamic> toJson() => {
         'totalDownload': totalDownload,
         'totalUpload': totalUpload,
         'latestHandshake': latestHandshake,
+        if (quality != null) 'quality': quality!.toJson(),
       };
 }
@@ -1,3 +1,5 @@
+import 'package:flutter/foundation.dart';
+
 import 'models/models.dart';
 import 'wireguard_dart_platform_interface.dart';
 
@@ -18,8 +20,16 @@ class WireguardDart {
     return WireguardDartPlatform.instance.setupTunnel(bundleId: bundleId, tunnelName: tunnelName, win32ServiceName: win32ServiceName);
   }
 
-  Future<void> connect({required String cfg}) {
-    return WireguardDartPlatform.instance.connect(cfg: cfg);
+  /// Brings the tunnel up with the wg-quick style config [cfg], or with the
+  /// config of the profile [profileId] returned by [importProfiles]. Pass
+  /// exactly one of them. Profiles are stored on Linux only; elsewhere
+  /// [profileId] throws an [UnsupportedError].
+  Future<void> connect({String? cfg, int? profileId}) {
+    assert((cfg == null) != (profileId == null), 'Pass either cfg or profileId');
+    if (profileId != null && defaultTargetPlatform != TargetPlatform.linux) {
+      throw UnsupportedError('connect with a profileId is supported on Linux only');
+    }
+    return WireguardDartPlatform.instance.connect(cfg: cfg, profileId: profileId);
   }
 
   Future<void> disconnect() {
@@ -63,4 +73,163 @@ class WireguardDart {
   Future<NotificationPermission> openAppNotificationSettings() {
     return WireguardDartPlatform.instance.openAppNotificationSettings();
   }
+
+  /// Runs [calls] natively in order within a single platform channel round trip.
+  ///
+  /// Returns the result of every call, in order. Execution stops at the first
+  /// failing call, which is rethrown as a `PlatformException` carrying that
+  /// call's error code; its details hold the `index` of the failed call and
+  /// the `results` of the calls that completed before it.
+  Future<List<Object?>> batch(List<BatchCall> calls) {
+    return WireguardDartPlatform.instance.batch(calls);
+  }
+
+  /// Measures the latency of all [probes] concurrently and returns them best
+  /// first: lowest loss, then lowest median RTT, then lowest jitter.
+  /// Unreachable endpoints come last, in their original order.
+  ///
+  /// Every endpoint receives [samples] probes, [interval] apart; replies are
+  /// awaited for [timeout] after the last one. The whole ranking therefore
+  /// takes at most `(samples - 1) * interval + timeout`, however many
+  /// endpoints are probed. Supported on Windows and Linux.
+  Future<List<EndpointRanking>> rankEndpoints(List<EndpointProbe> probes,
+      {int samples = 3,
+      Duration interval = const Duration(milliseconds: 100),
+      Duration timeout = const Duration(seconds: 1)}) {
+    return WireguardDartPlatform.instance
+        .rankEndpoints(probes, samples: samples, interval: interval, timeout: timeout);
+  }
+
+  /// Starts resolving the host names of [endpoints] ("host:port" or bare host
+  /// names) in the background and returns right away.
+  ///
+  /// Call it as soon as the server list is known: a later [connect] to any of
+  /// them then gets its addresses from the cache instead of waiting for DNS.
+  /// Answers are kept for their DNS TTL and refreshed before they expire, for
+  /// as long as the host keeps being used. Supported on Windows and Linux.
+  Future<void> prefetchEndpoints(List<String> endpoints) {
+    return WireguardDartPlatform.instance.prefetchEndpoints(endpoints);
+  }
+
+  /// Adds [peers] to the connected tunnel, or replaces all settings of those
+  /// that exist already, without touching the other peers or rewriting the
+  /// configuration. Returns the number of peers afterwards.
+  ///
+  /// Meant for servers and gateways with many peers coming and going. The
+  /// whole batch is validated first; a malformed key, endpoint or allowed IP
+  /// fails with `INVALID_ARGUMENT` and nothing applied. Changes are not saved
+  /// to the config, so the next [connect] starts over from its own peers.
+  /// Routes are not changed. Supported on Windows and Linux.
+  ///
+  /// Endpoints may be host names. They are resolved off the platform thread,
+  /// through the cache [prefetchEndpoints] fills, and the peer gets the most
+  /// preferred address; it is not raced as with [connect]. A host name that
+  /// does not resolve fails with `INVALID_ARGUMENT` and nothing applied.
+  Future<int> addPeers(List<PeerConfig> peers) {
+    return WireguardDartPlatform.instance.addPeers(peers);
+  }
+
+  /// Changes the endpoint, keepalive or allowed IPs of existing peers, as
+  /// [addPeers] does, host name endpoints included. Fails with
+  /// `INVALID_ARGUMENT` if a peer is not there.
+  Future<int> updatePeers(List<PeerUpdate> updates) {
+    return WireguardDartPlatform.instance.updatePeers(updates);
+  }
+
+  /// Removes the peers with [publicKeys]; keys of peers that are not there are
+  /// skipped. Returns the number of peers afterwards.
+  Future<int> removePeers(List<String> publicKeys) {
+    return WireguardDartPlatform.instance.removePeers(publicKeys);
+  }
+
+  /// Stores [profiles], a map of profile names to wg-quick style configs, and
+  /// returns their profile IDs in the same order, for [connect] to take
+  /// instead of the config text.
+  ///
+  /// Meant for importing whole server lists at once: configs are parsed on
+  /// all cores and kept in a compact file in the user's data directory that
+  /// outlives app restarts. A config that is stored already, under any name,
+  /// keeps its ID, and [findProfiles] finds it under the new name as well.
+  /// Importing a name again with a different config replaces the old
+  /// profile. A config that does not parse fails the whole import with
+  /// `INVALID_CONFIG`. Supported on Linux.
+  Future<List<int>> importProfiles(Map<String, String> profiles) {
+    return WireguardDartPlatform.instance.importProfiles(profiles);
+  }
+
+  /// Returns the IDs of the stored profiles named [name], with a peer at
+  /// [endpoint] as written in the config, or with a peer of [publicKey].
+  /// Pass one of them. Supported on Linux.
+  Future<List<int>> findProfiles({String? name, String? endpoint, String? publicKey}) {
+    return WireguardDartPlatform.instance.findProfiles(name: name, endpoint: endpoint, publicKey: publicKey);
+  }
+
+  /// Removes stored profiles; unknown IDs are skipped. Supported on Linux.
+  Future<void> removeProfiles(List<int> ids) {
+    return WireguardDartPlatform.instance.removeProfiles(ids);
+  }
+
+  /// Returns how many bytes went through the tunnel, or through the peer with
+  /// [publicKey], per bucket of [resolution] between [from] and [to].
+  ///
+  /// Traffic is recorded natively every second while connected, whether or
+  /// not the app is polling, into fixed-size rings: memory stays the same
+  /// however long the tunnel runs. Without [from] and [to] the whole span
+  /// still held at that resolution is returned. Fails with `INVALID_ARGUMENT`
+  /// for a peer that is not configured. Supported on Linux and Windows.
+  Future<TrafficHistory> trafficHistory(
+      {required TrafficResolution resolution, String? publicKey, DateTime? from, DateTime? to}) {
+    return WireguardDartPlatform.instance
+        .trafficHistory(resolution: resolution, publicKey: publicKey, from: from, to: to);
+  }
+
+  /// Returns how many bytes went through the tunnel since [since], or since
+  /// usage was first recorded on this device, across connects and app
+  /// restarts, e.g. for the current billing period of a metered plan.
+  ///
+  /// Usage is kept in a log in the user's data directory that survives
+  /// crashes; at most the last minute of traffic before a crash is lost. For
+  /// times more than a day back the result counts from the start of the
+  /// hour, or of the day beyond 62 days. Supported on Linux only: the
+  /// Windows plugin keeps no usage log and fails with a
+  /// `MissingPluginException`; [trafficHistory] covers the last 30 days there.
+  Future<DataUsage> dataUsage({DateTime? since}) {
+    return WireguardDartPlatform.instance.dataUsage(since: since);
+  }
+
+  /// Sends a small UDP echo probe through the tunnel to [target] every
+  /// [interval] while connected. [target] is an "address:port" of a UDP echo
+  /// service (RFC 862) inside the tunnel, e.g. on the server's tunnel address.
+  /// A probe unanswered after [timeout] counts as lost. Pass `null` to stop
+  /// probing.
+  ///
+  /// The RTT median and tail, jitter and loss of recent probes come with
+  /// [getTunnelStatistics] and the metrics of [setMetricsSocket], at no cost
+  /// beyond the probes themselves. Memory stays the same however long the
+  /// tunnel runs. Supported on Linux and Windows; Windows serves no metrics.
+  Future<void> setQualityProbe(String? target,
+      {Duration interval = const Duration(seconds: 1), Duration timeout = const Duration(seconds: 2)}) {
+    return WireguardDartPlatform.instance.setQualityProbe(target, interval: interval, timeout: timeout);
+  }
+
+  /// Turns leak protection on or off. While [enabled], nothing leaves the
+  /// device except through the tunnel interface, to the tunnel's endpoints,
+  /// and what DHCP and IPv6 neighbor discovery need, so no traffic gets
+  /// around the tunnel while it is down or reconnecting. The protection
+  /// follows endpoint changes and stays in place after [disconnect] and when
+  /// the app exits, until it is turned off. DNS is blocked too: resolve
+  /// endpoint host names beforehand with [prefetchEndpoints]. Requires a
+  /// prior [setupTunnel]. Supported on Linux.
+  Future<void> setKillSwitch(bool enabled) {
+    return WireguardDartPlatform.instance.setKillSwitch(enabled);
+  }
+
+  /// Serves tunnel status, per-peer traffic and handshake age, connect
+  /// latency histograms and reconnect counts in the OpenMetrics text format
+  /// over HTTP on a unix domain socket at [socketPath], for a local agent to
+  /// scrape. Nothing is exposed on the network. Pass `null` to stop serving.
+  /// Supported on Linux.
+  Future<void> setMetricsSocket(String? socketPath) {
+    return WireguardDartPlatform.instance.setMetricsSocket(socketPath);
+  }
 }
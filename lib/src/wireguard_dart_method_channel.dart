@@ -38,8 +38,11 @@ class MethodChannelWireguardDart extends WireguardDartPlatform {
   }
 
   @override
-  Future<void> connect({required String cfg}) async {
-    await methodChannel.invokeMethod<void>('connect', {'cfg': cfg});
+  Future<void> connect({String? cfg, int? profileId}) async {
+    await methodChannel.invokeMethod<void>('connect', {
+      if (cfg != null) 'cfg': cfg,
+      if (profileId != null) 'profileId': profileId,
+    });
   }
 
   @override
@@ -118,4 +121,114 @@ class MethodChannelWireguardDart extends WireguardDartPlatform {
       throw Exception(e);
     }
   }
+
+  @override
+  Future<List<Object?>> batch(List<BatchCall> calls) async {
+    final result = await methodChannel.invokeListMethod<Object?>('batch', {
+      'calls': calls.map((c) => c.toMap()).toList(),
+    });
+    return result ?? <Object?>[];
+  }
+
+  @override
+  Future<List<EndpointRanking>> rankEndpoints(List<EndpointProbe> probes,
+      {int samples = 3,
+      Duration interval = const Duration(milliseconds: 100),
+      Duration timeout = const Duration(seconds: 1)}) async {
+    final result = await methodChannel.invokeListMethod<Map<dynamic, dynamic>>('rankEndpoints', {
+      'targets': probes.map((p) => p.toMap()).toList(),
+      'samples': samples,
+      'intervalMs': interval.inMilliseconds,
+      'timeoutMs': timeout.inMilliseconds,
+    });
+    return (result ?? []).map(EndpointRanking.fromMap).toList();
+  }
+
+  @override
+  Future<void> prefetchEndpoints(List<String> endpoints) async {
+    await methodChannel.invokeMethod<void>('prefetchEndpoints', {'endpoints': endpoints});
+  }
+
+  @override
+  Future<int> addPeers(List<PeerConfig> peers) async {
+    final result = await methodChannel.invokeMethod<int>('addPeers', {
+      'peers': peers.map((p) => p.toMap()).toList(),
+    });
+    return result ?? 0;
+  }
+
+  @override
+  Future<int> updatePeers(List<PeerUpdate> updates) async {
+    final result = await methodChannel.invokeMethod<int>('updatePeers', {
+      'peers': updates.map((u) => u.toMap()).toList(),
+    });
+    return result ?? 0;
+  }
+
+  @override
+  Future<int> removePeers(List<String> publicKeys) async {
+    final result = await methodChannel.invokeMethod<int>('removePeers', {'publicKeys': publicKeys});
+    return result ?? 0;
+  }
+
+  @override
+  Future<TrafficHistory> trafficHistory(
+      {required TrafficResolution resolution, String? publicKey, DateTime? from, DateTime? to}) async {
+    final result = await methodChannel.invokeMapMethod<dynamic, dynamic>('trafficHistory', {
+      'resolution': resolution.name,
+      if (publicKey != null) 'publicKey': publicKey,
+      if (from != null) 'from': from.millisecondsSinceEpoch ~/ 1000,
+      if (to != null) 'to': to.millisecondsSinceEpoch ~/ 1000,
+    });
+    return TrafficHistory.fromMap(result!);
+  }
+
+  @override
+  Future<List<int>> importProfiles(Map<String, String> profiles) async {
+    final result = await methodChannel.invokeListMethod<int>('importProfiles', {'profiles': profiles});
+    return result!;
+  }
+
+  @override
+  Future<List<int>> findProfiles({String? name, String? endpoint, String? publicKey}) async {
+    final result = await methodChannel.invokeListMethod<int>('findProfiles', {
+      if (name != null) 'name': name,
+      if (endpoint != null) 'endpoint': endpoint,
+      if (publicKey != null) 'publicKey': publicKey,
+    });
+    return result!;
+  }
+
+  @override
+  Future<void> removeProfiles(List<int> ids) async {
+    await methodChannel.invokeMethod<void>('removeProfiles', {'ids': ids});
+  }
+
+  @override
+  Future<DataUsage> dataUsage({DateTime? since}) async {
+    final result = await methodChannel.invokeMapMethod<dynamic, dynamic>('dataUsage', {
+      if (since != null) 'since': since.millisecondsSinceEpoch ~/ 1000,
+    });
+    return DataUsage.fromMap(result!);
+  }
+
+  @override
+  Future<void> setQualityProbe(String? target,
+      {Duration interval = const Duration(seconds: 1), Duration timeout = const Duration(seconds: 2)}) async {
+    await methodChannel.invokeMethod<void>('setQualityProbe', {
+      'target': target,
+      'intervalMs': interval.inMilliseconds,
+      'timeoutMs': timeout.inMilliseconds,
+    });
+  }
+
+  @override
+  Future<void> setKillSwitch(bool enabled) async {
+    await methodChannel.invokeMethod<void>('setKillSwitch', {'enabled': enabled});
+  }
+
+  @override
+  Future<void> setMetricsSocket(String? socketPath) async {
+    await methodChannel.invokeMethod<void>('setMetricsSocket', {'socketPath': socketPath});
+  }
 }
@@ -37,7 +37,7 @@ abstract class WireguardDartPlatform extends PlatformInterface {
     throw UnimplementedError('setupTunnel() has not been implemented');
   }
 
-  Future<void> connect({required String cfg}) {
+  Future<void> connect({String? cfg, int? profileId}) {
     throw UnimplementedError('connect() has not been implemented');
   }
 
@@ -79,4 +79,65 @@ abstract class WireguardDartPlatform extends PlatformInterface {
   Future<NotificationPermission> openAppNotificationSettings() {
     throw UnimplementedError('openAppNotificationSettings() has not been implemented');
   }
+
+  Future<List<Object?>> batch(List<BatchCall> calls) {
+    throw UnimplementedError('batch() has not been implemented');
+  }
+
+  Future<List<EndpointRanking>> rankEndpoints(List<EndpointProbe> probes,
+      {int samples = 3,
+      Duration interval = const Duration(milliseconds: 100),
+      Duration timeout = const Duration(seconds: 1)}) {
+    throw UnimplementedError('rankEndpoints() has not been implemented');
+  }
+
+  Future<void> prefetchEndpoints(List<String> endpoints) {
+    throw UnimplementedError('prefetchEndpoints() has not been implemented');
+  }
+
+  Future<int> addPeers(List<PeerConfig> peers) {
+    throw UnimplementedError('addPeers() has not been implemented');
+  }
+
+  Future<int> updatePeers(List<PeerUpdate> updates) {
+    throw UnimplementedError('updatePeers() has not been implemented');
+  }
+
+  Future<int> removePeers(List<String> publicKeys) {
+    throw UnimplementedError('removePeers() has not been implemented');
+  }
+
+  Future<TrafficHistory> trafficHistory(
+      {required TrafficResolution resolution, String? publicKey, DateTime? from, DateTime? to}) {
+    throw UnimplementedError('trafficHistory() has not been implemented');
+  }
+
+  Future<List<int>> importProfiles(Map<String, String> profiles) {
+    throw UnimplementedError('importProfiles() has not been implemented');
+  }
+
+  Future<List<int>> findProfiles({String? name, String? endpoint, String? publicKey}) {
+    throw UnimplementedError('findProfiles() has not been implemented');
+  }
+
+  Future<void> removeProfiles(List<int> ids) {
+    throw UnimplementedError('removeProfiles() has not been implemented');
+  }
+
+  Future<DataUsage> dataUsage({DateTime? since}) {
+    throw UnimplementedError('dataUsage() has not been implemented');
+  }
+
+  Future<void> setQualityProbe(String? target,
+      {Duration interval = const Duration(seconds: 1), Duration timeout = const Duration(seconds: 2)}) {
+    throw UnimplementedError('setQualityProbe() has not been implemented');
+  }
+
+  Future<void> setKillSwitch(bool enabled) {
+    throw UnimplementedError('setKillSwitch() has not been implemented');
+  }
+
+  Future<void> setMetricsSocket(String? socketPath) {
+    throw UnimplementedError('setMetricsSocket() has not been implemented');
+  }
 }
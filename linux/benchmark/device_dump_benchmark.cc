@@ -0,0 +1,127 @@
+// Times parsing of WG_CMD_GET_DEVICE dumps the size of a large multi-peer device, the way status polling reads them.
+// Usage: wireguard_dart_device_dump_benchmark [peer count]
+
+#include <linux/genetlink.h>
+#include <linux/time_types.h>
+#include <linux/wireguard.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "device_dump.h"
+#include "netlink.h"
+
+namespace {
+
+using wireguard_dart::DeviceView;
+using wireguard_dart::NetlinkMessage;
+
+// The kernel fills dump messages up to about a page.
+const size_t kMessageSize = 4096;
+const int kAllowedIpsPerPeer = 4;
+
+NetlinkMessage StartMessage() {
+  NetlinkMessage message(0x15, NLM_F_MULTI);
+  genlmsghdr genl = {};
+  genl.cmd = WG_CMD_GET_DEVICE;
+  genl.version = WG_GENL_VERSION;
+  message.AppendHeader(genl);
+  message.PutU32(WGDEVICE_A_IFINDEX, 7);
+  message.PutString(WGDEVICE_A_IFNAME, "wg0");
+  return message;
+}
+
+void PutPeer(NetlinkMessage& message, uint32_t index) {
+  size_t peer = message.BeginNested(0);
+  uint8_t key[32] = {};
+  std::copy_n(reinterpret_cast<const uint8_t*>(&index), sizeof(index), key);
+  message.PutAttribute(WGPEER_A_PUBLIC_KEY, key, sizeof(key));
+  message.PutAttribute(WGPEER_A_PRESHARED_KEY, key, sizeof(key));
+  __kernel_timespec handshake = {1760000000 + index, 0};
+  message.PutAttribute(WGPEER_A_LAST_HANDSHAKE_TIME, &handshake, sizeof(handshake));
+  message.PutU16(WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL, 25);
+  uint64_t bytes = index * 1000ull;
+  message.PutAttribute(WGPEER_A_TX_BYTES, &bytes, sizeof(bytes));
+  message.PutAttribute(WGPEER_A_RX_BYTES, &bytes, sizeof(bytes));
+  message.PutU32(WGPEER_A_PROTOCOL_VERSION, 1);
+  sockaddr_in endpoint = {};
+  endpoint.sin_family = AF_INET;
+  endpoint.sin_port = htons(51820);
+  endpoint.sin_addr.s_addr = htonl(0xc0000000 | index);
+  message.PutAttribute(WGPEER_A_ENDPOINT, &endpoint, sizeof(endpoint));
+  size_t allowed_ips = message.BeginNested(WGPEER_A_ALLOWEDIPS);
+  for (int i = 0; i < kAllowedIpsPerPeer; i++) {
+    size_t allowed_ip = message.BeginNested(0);
+    message.PutU16(WGALLOWEDIP_A_FAMILY, AF_INET);
+    uint32_t address = htonl(0x0a000000 | index << 8 | static_cast<uint32_t>(i));
+    message.PutAttribute(WGALLOWEDIP_A_IPADDR, &address, sizeof(address));
+    message.PutU8(WGALLOWEDIP_A_CIDR_MASK, 32);
+    message.EndNested(allowed_ip);
+  }
+  message.EndNested(allowed_ips);
+  message.EndNested(peer);
+}
+
+// A dump of `peers` peers, split into page-sized messages.
+std::vector<NetlinkMessage> BuildDump(uint32_t peers) {
+  std::vector<NetlinkMessage> dump;
+  NetlinkMessage message = StartMessage();
+  size_t list = message.BeginNested(WGDEVICE_A_PEERS);
+  for (uint32_t index = 0; index < peers; index++) {
+    if (message.size() > kMessageSize - 256) {
+      message.EndNested(list);
+      dump.push_back(message);
+      message = StartMessage();
+      list = message.BeginNested(WGDEVICE_A_PEERS);
+    }
+    PutPeer(message, index);
+  }
+  message.EndNested(list);
+  dump.push_back(message);
+  return dump;
+}
+
+void Run(const char* name, std::vector<NetlinkMessage>& dump, uint32_t peers,
+         const std::function<void(const DeviceView&)>& parse) {
+  const int kRuns = 5;
+  double best = 0;
+  for (int run = 0; run < kRuns; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto& message : dump) {
+      parse(DeviceView(message.header()));
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = run == 0 ? elapsed : std::min(best, elapsed);
+  }
+  std::cout << name << ": " << peers << " peers in " << dump.size() << " messages, " << best * 1000 << " ms, "
+            << static_cast<uint64_t>(peers / best) << " peers/s (best of " << kRuns << ")" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t peers = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 10000;
+  auto dump = BuildDump(peers);
+
+  wireguard_dart::TunnelStatistics statistics;
+  Run("Statistics", dump, peers,
+      [&statistics](const DeviceView& message) { wireguard_dart::AddStatistics(message, &statistics); });
+  std::vector<wireguard_dart::PeerSample> samples;
+  samples.reserve(peers);
+  Run("Peer samples", dump, peers, [&samples](const DeviceView& message) {
+    samples.clear();
+    wireguard_dart::AddPeerSamples(message, &samples);
+  });
+  // For comparison: copying everything out, allowed IPs included, as GetWireguardDevice does.
+  Run("Full device", dump, peers, [](const DeviceView& message) {
+    wireguard_dart::WireguardDevice device;
+    wireguard_dart::MergeDeviceMessage(message, &device);
+  });
+  return 0;
+}
@@ -0,0 +1,65 @@
+// Times CalculateRoutes on split-tunnel inputs of the size produced by "everything except a country list" configs.
+// Usage: wireguard_dart_route_calculator_benchmark [prefix count]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "route_calculator.h"
+
+namespace {
+
+using wireguard_dart::IpPrefix;
+
+std::vector<IpPrefix> RandomPrefixes(int version, size_t count, int min_length, int max_length, std::mt19937 &random) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::uniform_int_distribution<int> length(min_length, max_length);
+  std::vector<IpPrefix> prefixes(count);
+  for (auto &prefix : prefixes) {
+    prefix.version = version;
+    prefix.length = static_cast<uint8_t>(length(random));
+    for (int i = 0; i < (version == 4 ? 4 : 16); i++) {
+      prefix.address[i] = static_cast<uint8_t>(byte(random));
+    }
+  }
+  return prefixes;
+}
+
+IpPrefix Everything(int version) {
+  IpPrefix prefix;
+  prefix.version = version;
+  return prefix;
+}
+
+void Run(const char *name, const std::vector<IpPrefix> &include, const std::vector<IpPrefix> &exclude) {
+  const int kRuns = 5;
+  double best = 0;
+  size_t routes = 0;
+  for (int run = 0; run < kRuns; run++) {
+    auto start = std::chrono::steady_clock::now();
+    routes = wireguard_dart::CalculateRoutes(include, exclude).size();
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    best = run == 0 ? elapsed : std::min(best, elapsed);
+  }
+  std::cout << name << ": " << include.size() << " included, " << exclude.size() << " excluded -> " << routes
+            << " routes in " << best << " ms (best of " << kRuns << ")" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+  std::mt19937 random(51820);
+
+  // Everything except a country list: the complement of many small networks.
+  Run("IPv4 complement", {Everything(4)}, RandomPrefixes(4, count, 16, 24, random));
+  Run("IPv6 complement", {Everything(6)}, RandomPrefixes(6, count, 29, 48, random));
+  // A country list routed through the tunnel, minus LANs: mostly aggregation.
+  Run("IPv4 aggregate", RandomPrefixes(4, count, 12, 24, random), RandomPrefixes(4, count / 100, 8, 16, random));
+  Run("IPv6 aggregate", RandomPrefixes(6, count, 20, 48, random), RandomPrefixes(6, count / 100, 16, 32, random));
+  return 0;
+}
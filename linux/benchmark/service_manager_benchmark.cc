@@ -0,0 +1,176 @@
+// Times the service half of connect and disconnect against a SimulatedServiceManager, for every wait strategy: how
+// long the calls take, when the status watcher reports the tunnel connected, and how late it reports each transition.
+// The steps are those of the Windows plugin's HandleMethodCall: connect starts the watcher and the service and
+// returns while the service is start pending, disconnect stops the service and waits until it is stopped.
+// Usage: wireguard_dart_service_manager_benchmark [cycles]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "service_manager.h"
+
+namespace {
+
+using wireguard_dart::ServiceState;
+using wireguard_dart::SimulatedServiceBehavior;
+using wireguard_dart::SimulatedServiceManager;
+using wireguard_dart::WaitOptions;
+using wireguard_dart::WaitStrategy;
+using Clock = std::chrono::steady_clock;
+
+const wchar_t kService[] = L"WireGuardTunnel$benchmark";
+
+double MillisBetween(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+double Median(std::vector<double> values) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+// What the status watcher reported and how long after the transition it did so.
+class Observer {
+ public:
+  explicit Observer(SimulatedServiceManager* manager) : manager_(manager) {}
+
+  void OnChange(ServiceState state) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state == ServiceState::running || state == ServiceState::stopped) {
+      lags_.push_back(MillisBetween(manager_->state_since(kService), now));
+    }
+    state_ = state;
+    reported_at_ = now;
+    changed_.notify_all();
+  }
+
+  // Waits until `state` is reported; returns when it was, or Clock::time_point() after `timeout`.
+  Clock::time_point Await(ServiceState state, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!changed_.wait_for(lock, timeout, [this, state] { return state_ == state; })) {
+      return Clock::time_point();
+    }
+    return reported_at_;
+  }
+
+  std::vector<double> lags() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lags_;
+  }
+
+ private:
+  SimulatedServiceManager* manager_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  ServiceState state_ = ServiceState::stopped;
+  Clock::time_point reported_at_;
+  std::vector<double> lags_;
+};
+
+const char* StrategyName(WaitStrategy strategy) {
+  switch (strategy) {
+    case WaitStrategy::poll:
+      return "poll";
+    case WaitStrategy::wait_hint:
+      return "wait_hint";
+    case WaitStrategy::notify:
+      return "notify";
+  }
+  return "";
+}
+
+void Run(const char* name, const SimulatedServiceBehavior& behavior, WaitStrategy strategy, int cycles) {
+  SimulatedServiceManager manager;
+  manager.Install(kService, behavior);
+  WaitOptions options;
+  options.strategy = strategy;
+  // Short enough that a hung stop does not dominate the run.
+  options.timeout = 5000;
+  Observer observer(&manager);
+  wireguard_dart::ServiceWatcher watcher(&manager, kService, options,
+                                         [&observer](ServiceState state) { observer.OnChange(state); });
+
+  std::vector<double> connect_ms;
+  std::vector<double> connected_ms;
+  std::vector<double> disconnect_ms;
+  int failures = 0;
+  for (int cycle = 0; cycle < cycles; cycle++) {
+    auto start = Clock::now();
+    try {
+      manager.Start(kService);
+    } catch (const wireguard_dart::ServiceError&) {
+      failures++;
+      continue;
+    }
+    connect_ms.push_back(MillisBetween(start, Clock::now()));
+    auto connected = observer.Await(ServiceState::running, std::chrono::milliseconds(behavior.start_delay + 15000));
+    if (connected == Clock::time_point()) {
+      failures++;
+    } else {
+      connected_ms.push_back(MillisBetween(start, connected));
+    }
+
+    start = Clock::now();
+    try {
+      wireguard_dart::StopService(&manager, kService, options);
+      disconnect_ms.push_back(MillisBetween(start, Clock::now()));
+    } catch (const wireguard_dart::ServiceError&) {
+      // A hung service stays hung; later cycles could not start it again.
+      failures++;
+      break;
+    }
+    observer.Await(ServiceState::stopped, std::chrono::milliseconds(15000));
+  }
+
+  std::cout << name << " / " << StrategyName(strategy) << ": connect " << Median(connect_ms) << " ms, connected after "
+            << Median(connected_ms) << " ms, disconnect " << Median(disconnect_ms) << " ms, report lag "
+            << Median(observer.lags()) << " ms (medians of " << cycles << " cycles, " << failures << " failed)"
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int cycles = argc > 1 ? std::atoi(argv[1]) : 3;
+
+  SimulatedServiceBehavior fast;
+  fast.start_delay = 100;
+  fast.stop_delay = 100;
+
+  // Slow to stop, with a wait hint close to the truth.
+  SimulatedServiceBehavior slow_stop;
+  slow_stop.start_delay = 200;
+  slow_stop.stop_delay = 1500;
+  slow_stop.wait_hint = 2000;
+
+  // Quick, but asks for two minutes, as some services do.
+  SimulatedServiceBehavior large_hint;
+  large_hint.start_delay = 100;
+  large_hint.stop_delay = 300;
+  large_hint.wait_hint = 120000;
+
+  SimulatedServiceBehavior hung_stop = fast;
+  hung_stop.hang_stop = true;
+
+  SimulatedServiceBehavior failed_start;
+  failed_start.fail_start = true;
+
+  for (WaitStrategy strategy : {WaitStrategy::poll, WaitStrategy::wait_hint, WaitStrategy::notify}) {
+    Run("fast service", fast, strategy, cycles);
+    Run("slow stop", slow_stop, strategy, cycles);
+    Run("large wait hint", large_hint, strategy, cycles);
+    Run("hung stop", hung_stop, strategy, 1);
+    Run("failed start", failed_start, strategy, cycles);
+  }
+  return 0;
+}
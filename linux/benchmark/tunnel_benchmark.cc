@@ -0,0 +1,516 @@
+// Measures what the Linux backend delivers end to end. Two network namespaces are joined by a veth pair, and a tunnel
+// is brought up in each with TunnelControl. A built-in traffic generator then measures TCP goodput, the UDP packet
+// rate and round-trip latency over the bare veth pair as a baseline and through the tunnel, along with the time to
+// bring the tunnel up, complete the first handshake and take it down again. Results are printed as JSON on stdout.
+// Needs no outside network, only user namespaces and WireGuard in the kernel; exits with 77 without them, the code
+// CTest takes for a skipped test.
+// Usage: wireguard_dart_tunnel_benchmark [seconds per measurement]
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "link_control.h"
+#include "netlink.h"
+#include "tunnel_control.h"
+#include "wireguard_config.h"
+#include "wireguard_device.h"
+
+namespace {
+
+using wireguard_dart::IpPrefix;
+using wireguard_dart::WireguardConfig;
+
+const int kSkipped = 77;
+const int kLoopback = 1;
+
+const char kClientVeth[] = "bench0";
+const char kServerVeth[] = "bench1";
+const char kClientTunnel[] = "wgbench0";
+const char kServerTunnel[] = "wgbench1";
+const char kClientUnderlay[] = "192.0.2.1";
+const char kServerUnderlay[] = "192.0.2.2";
+const char kClientInner[] = "10.200.0.1";
+const char kServerInner[] = "10.200.0.2";
+const uint16_t kListenPort = 51820;
+
+const uint16_t kEchoPort = 9000;
+const uint16_t kSinkPort = 9001;
+const uint16_t kStreamPort = 9002;
+
+// Tunnels brought up, waited on for a handshake and taken down for the connect and disconnect times.
+const int kConnectCycles = 5;
+const int kPings = 1000;
+// Payload of the packet rate probes, the size of small interactive packets.
+const size_t kSmallPacket = 64;
+
+double MillisSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+[[noreturn]] void ThrowErrno(const std::string& what) { throw std::system_error(errno, std::generic_category(), what); }
+
+int OpenNamespace() {
+  int fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ThrowErrno("open network namespace");
+  }
+  return fd;
+}
+
+// Moves the calling thread into the network namespace `fd` until the end of the scope. Sockets, including netlink
+// sockets, belong to the namespace they were created in.
+class NamespaceScope {
+ public:
+  explicit NamespaceScope(int fd) : home_(OpenNamespace()) {
+    if (setns(fd, CLONE_NEWNET) != 0) {
+      close(home_);
+      ThrowErrno("setns");
+    }
+  }
+  ~NamespaceScope() {
+    setns(home_, CLONE_NEWNET);
+    close(home_);
+  }
+
+  NamespaceScope(const NamespaceScope&) = delete;
+  NamespaceScope& operator=(const NamespaceScope&) = delete;
+
+ private:
+  int home_;
+};
+
+IpPrefix Prefix(const std::string& text) {
+  IpPrefix prefix;
+  wireguard_dart::ParseIpPrefix(text, &prefix);
+  return prefix;
+}
+
+int LinkIndex(const std::string& name) {
+  auto link = wireguard_dart::FindLink(name);
+  if (!link.has_value()) {
+    throw std::runtime_error("Link " + name + " not found");
+  }
+  return link->ifindex;
+}
+
+// Creates a veth pair in the current namespace whose peer end is moved into `peer_namespace`.
+void CreateVethPair(const std::string& name, const std::string& peer_name, int peer_namespace) {
+  wireguard_dart::NetlinkSocket socket(NETLINK_ROUTE);
+  wireguard_dart::NetlinkMessage message(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, name);
+  size_t link_info = message.BeginNested(IFLA_LINKINFO);
+  message.PutString(IFLA_INFO_KIND, "veth");
+  size_t data = message.BeginNested(IFLA_INFO_DATA);
+  size_t peer = message.BeginNested(VETH_INFO_PEER);
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, peer_name);
+  message.PutU32(IFLA_NET_NS_FD, static_cast<uint32_t>(peer_namespace));
+  message.EndNested(peer);
+  message.EndNested(data);
+  message.EndNested(link_info);
+  socket.Request(message);
+}
+
+// Brings up the loopback and the veth end `name` with `address` in the current namespace.
+void ConfigureUnderlay(const std::string& name, const std::string& address) {
+  int ifindex = LinkIndex(name);
+  wireguard_dart::RouteBatch batch;
+  batch.SetLinkUp(kLoopback);
+  batch.AddAddress(ifindex, Prefix(address + "/24"));
+  batch.SetLinkUp(ifindex);
+  batch.Commit();
+}
+
+std::string RandomPrivateKey() {
+  std::random_device random;
+  wireguard_dart::WireguardKey key;
+  for (auto& byte : key) {
+    byte = static_cast<uint8_t>(random());
+  }
+  return wireguard_dart::EncodeKey(key);
+}
+
+sockaddr_in Address(const char* ip, uint16_t port) {
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  inet_pton(AF_INET, ip, &address.sin_addr);
+  return address;
+}
+
+int OpenSocket(int type, const char* ip, uint16_t port, bool bind_address) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ThrowErrno("socket");
+  }
+  sockaddr_in address = Address(ip, port);
+  int enabled = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+  int result = bind_address ? bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+                            : connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+  if (result != 0) {
+    close(fd);
+    ThrowErrno(bind_address ? "bind" : "connect");
+  }
+  return fd;
+}
+
+// The receiving side of the traffic generator: a UDP echo for latency, a UDP sink counting datagrams for the packet
+// rate and a TCP sink for goodput, each on a thread of its own. Listens on all addresses of the namespace it was
+// created in, so the same server answers over the veth pair and through the tunnel.
+class TrafficServer {
+ public:
+  TrafficServer() {
+    echo_ = OpenSocket(SOCK_DGRAM, "0.0.0.0", kEchoPort, true);
+    sink_ = OpenSocket(SOCK_DGRAM, "0.0.0.0", kSinkPort, true);
+    stream_ = OpenSocket(SOCK_STREAM, "0.0.0.0", kStreamPort, true);
+    if (listen(stream_, 4) != 0) {
+      ThrowErrno("listen");
+    }
+    threads_.emplace_back([this] { Echo(); });
+    threads_.emplace_back([this] { Sink(); });
+    threads_.emplace_back([this] { Stream(); });
+  }
+
+  ~TrafficServer() {
+    stop_ = true;
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    close(echo_);
+    close(sink_);
+    close(stream_);
+  }
+
+  TrafficServer(const TrafficServer&) = delete;
+  TrafficServer& operator=(const TrafficServer&) = delete;
+
+  uint64_t TakeDatagrams() { return datagrams_.exchange(0); }
+
+ private:
+  // Waits until `fd` is readable, giving up now and then to check for the end.
+  bool Wait(int fd) {
+    while (!stop_) {
+      pollfd descriptor = {fd, POLLIN, 0};
+      if (poll(&descriptor, 1, 100) > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Echo() {
+    char buffer[2048];
+    while (Wait(echo_)) {
+      sockaddr_storage from = {};
+      socklen_t from_length = sizeof(from);
+      ssize_t length = recvfrom(echo_, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_length);
+      if (length >= 0) {
+        sendto(echo_, buffer, length, 0, reinterpret_cast<const sockaddr*>(&from), from_length);
+      }
+    }
+  }
+
+  void Sink() {
+    char buffer[2048];
+    while (Wait(sink_)) {
+      while (recv(sink_, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0) {
+        datagrams_++;
+      }
+    }
+  }
+
+  void Stream() {
+    std::vector<char> buffer(1 << 17);
+    while (Wait(stream_)) {
+      int connection = accept4(stream_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection < 0) {
+        continue;
+      }
+      while (Wait(connection) && recv(connection, buffer.data(), buffer.size(), 0) > 0) {
+      }
+      close(connection);
+    }
+  }
+
+  int echo_ = -1;
+  int sink_ = -1;
+  int stream_ = -1;
+  std::atomic_bool stop_{false};
+  std::atomic<uint64_t> datagrams_{0};
+  std::vector<std::thread> threads_;
+};
+
+// Nearest-rank percentile of sorted `values`.
+double Percentile(const std::vector<double>& sorted, double percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(percent / 100 * sorted.size() + 0.5);
+  return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+std::string Distribution(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  std::ostringstream json;
+  json << "{\"min\": " << (values.empty() ? 0 : values.front()) << ", \"p50\": " << Percentile(values, 50)
+       << ", \"p90\": " << Percentile(values, 90) << ", \"p99\": " << Percentile(values, 99)
+       << ", \"max\": " << (values.empty() ? 0 : values.back()) << "}";
+  return json.str();
+}
+
+std::string JsonString(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+  }
+  return quoted + "\"";
+}
+
+// Round trips of small datagrams to the echo server, in microseconds. Lost ones are counted instead.
+std::string MeasureLatency(const char* server) {
+  int fd = OpenSocket(SOCK_DGRAM, server, kEchoPort, false);
+  std::vector<double> rtts;
+  int lost = 0;
+  char buffer[kSmallPacket] = {};
+  for (int i = 0; i < kPings; i++) {
+    auto start = std::chrono::steady_clock::now();
+    send(fd, buffer, sizeof(buffer), 0);
+    pollfd descriptor = {fd, POLLIN, 0};
+    if (poll(&descriptor, 1, 1000) > 0 && recv(fd, buffer, sizeof(buffer), 0) >= 0) {
+      rtts.push_back(MillisSince(start) * 1000);
+    } else {
+      lost++;
+    }
+  }
+  close(fd);
+  return "\"latency_us\": " + Distribution(rtts) + ", \"pings_lost\": " + std::to_string(lost);
+}
+
+// Small datagrams sent as fast as one socket can, and how many of them arrived.
+std::string MeasurePacketRate(const char* server, TrafficServer& traffic, int seconds) {
+  int fd = OpenSocket(SOCK_DGRAM, server, kSinkPort, false);
+  char buffer[kSmallPacket] = {};
+  traffic.TakeDatagrams();
+  uint64_t sent = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (int i = 0; i < 64; i++) {
+      sent += send(fd, buffer, sizeof(buffer), 0) >= 0;
+    }
+  }
+  double elapsed = MillisSince(start) / 1000;
+  // Let the packets in flight arrive.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  uint64_t received = traffic.TakeDatagrams();
+  close(fd);
+  std::ostringstream json;
+  json << "\"udp_sent_pps\": " << sent / elapsed << ", \"udp_received_pps\": " << received / elapsed;
+  return json.str();
+}
+
+// Bytes one TCP connection delivers, counted until the server has read all of them.
+std::string MeasureGoodput(const char* server, int seconds) {
+  int fd = OpenSocket(SOCK_STREAM, server, kStreamPort, false);
+  std::vector<char> buffer(1 << 17);
+  uint64_t sent = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    ssize_t length = send(fd, buffer.data(), buffer.size(), MSG_NOSIGNAL);
+    if (length < 0) {
+      close(fd);
+      ThrowErrno("send");
+    }
+    sent += length;
+  }
+  // The server closes once it has read everything.
+  shutdown(fd, SHUT_WR);
+  while (recv(fd, buffer.data(), buffer.size(), 0) > 0) {
+  }
+  double elapsed = MillisSince(start) / 1000;
+  close(fd);
+  std::ostringstream json;
+  json << "\"tcp_goodput_mbps\": " << sent * 8 / elapsed / 1e6;
+  return json.str();
+}
+
+std::string MeasureTraffic(const char* server, TrafficServer& traffic, int seconds) {
+  return MeasureGoodput(server, seconds) + ", " + MeasurePacketRate(server, traffic, seconds) + ", " +
+         MeasureLatency(server);
+}
+
+// Sends datagrams into the tunnel until its first handshake completed; the driver initiates on the first packet.
+void AwaitHandshake(wireguard_dart::TunnelControl& tunnel) {
+  int fd = OpenSocket(SOCK_DGRAM, kServerInner, kSinkPort, false);
+  char buffer[1] = {};
+  auto start = std::chrono::steady_clock::now();
+  for (;;) {
+    send(fd, buffer, sizeof(buffer), 0);
+    auto samples = tunnel.PeerSamples();
+    if (!samples.empty() && samples[0].last_handshake != 0) {
+      break;
+    }
+    if (MillisSince(start) > 10000) {
+      close(fd);
+      throw std::runtime_error("No handshake within 10 s");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  close(fd);
+}
+
+WireguardConfig ClientConfig(const std::string& private_key, const std::string& server_public_key) {
+  WireguardConfig config;
+  config.interface_config.private_key = private_key;
+  config.interface_config.addresses = {std::string(kClientInner) + "/32"};
+  wireguard_dart::PeerConfig peer;
+  peer.public_key = server_public_key;
+  peer.endpoint = wireguard_dart::JoinEndpoint(kServerUnderlay, kListenPort);
+  peer.allowed_ips = {std::string(kServerInner) + "/32"};
+  config.peers.push_back(peer);
+  return config;
+}
+
+// Brings the server's tunnel up in `server_namespace` and the client's a number of times in the current one, timing
+// each step, and measures the traffic through the last client tunnel.
+std::string MeasureTunnel(int server_namespace, TrafficServer& traffic, int seconds) {
+  wireguard_dart::TunnelControl server(kServerTunnel);
+  wireguard_dart::TunnelControl client(kClientTunnel);
+  std::string client_key = RandomPrivateKey();
+  std::string server_public_key;
+  {
+    NamespaceScope scope(server_namespace);
+    WireguardConfig config;
+    config.interface_config.private_key = RandomPrivateKey();
+    // The prefix route of the address covers the client, whose peer is only added later.
+    config.interface_config.addresses = {std::string(kServerInner) + "/24"};
+    config.interface_config.listen_port = kListenPort;
+    server.Up(config);
+    server_public_key = wireguard_dart::EncodeKey(server.Device().public_key);
+  }
+
+  std::vector<double> up_ms;
+  std::vector<double> connect_ms;
+  std::vector<double> down_ms;
+  std::string traffic_json;
+  for (int cycle = 0; cycle < kConnectCycles; cycle++) {
+    auto start = std::chrono::steady_clock::now();
+    client.Up(ClientConfig(client_key, server_public_key));
+    up_ms.push_back(MillisSince(start));
+    if (cycle == 0) {
+      // The server learns the client's key from the kernel, added the way addPeers does.
+      wireguard_dart::PeerChange change = {wireguard_dart::PeerChange::Kind::add, wireguard_dart::PeerConfig()};
+      change.peer.public_key = wireguard_dart::EncodeKey(client.Device().public_key);
+      change.peer.allowed_ips = {std::string(kClientInner) + "/32"};
+      NamespaceScope scope(server_namespace);
+      server.ApplyPeerChanges({change});
+    }
+    AwaitHandshake(client);
+    connect_ms.push_back(MillisSince(start));
+    if (cycle == kConnectCycles - 1) {
+      traffic_json = MeasureTraffic(kServerInner, traffic, seconds);
+    }
+    start = std::chrono::steady_clock::now();
+    client.Down();
+    down_ms.push_back(MillisSince(start));
+  }
+  {
+    NamespaceScope scope(server_namespace);
+    server.Down();
+  }
+  return traffic_json + ", \"up_ms\": " + Distribution(up_ms) + ", \"connect_ms\": " + Distribution(connect_ms) +
+         ", \"down_ms\": " + Distribution(down_ms);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int seconds = argc > 1 ? std::atoi(argv[1]) : 3;
+  if (seconds <= 0) {
+    std::cerr << "Usage: " << argv[0] << " [seconds per measurement]" << std::endl;
+    return 2;
+  }
+  // The current namespace becomes the client's; the server gets a second one.
+  if (unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0) {
+    std::cerr << "Network namespaces are not available: " << strerror(errno) << std::endl;
+    return kSkipped;
+  }
+
+  int status = 0;
+  std::ostringstream json;
+  json << "{\"seconds_per_measurement\": " << seconds;
+  try {
+    int client_namespace = OpenNamespace();
+    if (unshare(CLONE_NEWNET) != 0) {
+      ThrowErrno("unshare");
+    }
+    int server_namespace = OpenNamespace();
+    if (setns(client_namespace, CLONE_NEWNET) != 0) {
+      ThrowErrno("setns");
+    }
+    CreateVethPair(kClientVeth, kServerVeth, server_namespace);
+    ConfigureUnderlay(kClientVeth, kClientUnderlay);
+    {
+      NamespaceScope scope(server_namespace);
+      ConfigureUnderlay(kServerVeth, kServerUnderlay);
+    }
+    std::unique_ptr<TrafficServer> traffic;
+    {
+      NamespaceScope scope(server_namespace);
+      traffic = std::make_unique<TrafficServer>();
+    }
+
+    json << ", \"underlay\": {" << MeasureTraffic(kServerUnderlay, *traffic, seconds) << "}";
+    try {
+      std::string tunnel = MeasureTunnel(server_namespace, *traffic, seconds);
+      json << ", \"tunnel\": {" << tunnel << "}";
+    } catch (const wireguard_dart::NetlinkError& e) {
+      if (e.error_code() != EOPNOTSUPP) {
+        throw;
+      }
+      json << ", \"tunnel\": {\"error\": " << JsonString(std::string("WireGuard is not available: ") + e.what())
+           << "}";
+      status = kSkipped;
+    }
+  } catch (std::exception& e) {
+    json << ", \"error\": " << JsonString(e.what());
+    status = 1;
+  }
+  json << "}";
+  std::cout << json.str() << std::endl;
+  return status;
+}
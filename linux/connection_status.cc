@@ -0,0 +1,33 @@
+#include "connection_status.h"
+
+#include <net/if.h>
+
+#include <string>
+
+namespace wireguard_dart {
+
+std::string ConnectionStatusToString(const ConnectionStatus status) {
+  switch (status) {
+    case ConnectionStatus::connected:
+      return "connected";
+    case ConnectionStatus::disconnected:
+      return "disconnected";
+    case ConnectionStatus::connecting:
+      return "connecting";
+    case ConnectionStatus::disconnecting:
+      return "disconnecting";
+    case ConnectionStatus::degraded:
+      return "degraded";
+    default:
+      return "unknown";
+  }
+}
+
+ConnectionStatus ConnectionStatusFromLinkFlags(unsigned int flags) {
+  if ((flags & IFF_UP) != 0) {
+    return ConnectionStatus::connected;
+  }
+  return ConnectionStatus::disconnected;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,17 @@
+#ifndef WIREGUARD_DART_CONNECTION_STATUS_H
+#define WIREGUARD_DART_CONNECTION_STATUS_H
+
+#include <string>
+
+namespace wireguard_dart {
+
+enum ConnectionStatus { connected, disconnected, connecting, disconnecting, degraded, unknown };
+
+std::string ConnectionStatusToString(const ConnectionStatus status);
+
+// Maps IFF_* flags of the tunnel link to a status.
+ConnectionStatus ConnectionStatusFromLinkFlags(unsigned int flags);
+
+}  // namespace wireguard_dart
+
+#endif
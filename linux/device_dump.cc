@@ -0,0 +1,116 @@
+#include "device_dump.h"
+
+#include <linux/genetlink.h>
+#include <linux/time_types.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wireguard_dart {
+
+static AttributeRange GenericPayload(const nlmsghdr* message) {
+  size_t header_length = NLMSG_HDRLEN + GENL_HDRLEN;
+  if (message->nlmsg_len < header_length) {
+    return AttributeRange(nullptr, 0);
+  }
+  return AttributeRange(reinterpret_cast<const char*>(message) + header_length, message->nlmsg_len - header_length);
+}
+
+AllowedIp AllowedIpView::ToAllowedIp() const {
+  AllowedIp allowed_ip = {};
+  allowed_ip.family = family();
+  allowed_ip.cidr = cidr();
+  if (const nlattr* address = attributes_[WGALLOWEDIP_A_IPADDR]) {
+    memcpy(&allowed_ip.address, AttributeData(address), std::min(AttributeLength(address), sizeof(allowed_ip.address)));
+  }
+  return allowed_ip;
+}
+
+int64_t PeerView::last_handshake() const {
+  auto time = attributes_.Get<__kernel_timespec>(WGPEER_A_LAST_HANDSHAKE_TIME);
+  return time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+DeviceView::DeviceView(const nlmsghdr* message) : attributes_(GenericPayload(message)) {}
+
+std::string_view DeviceView::name() const {
+  const nlattr* name = attributes_[WGDEVICE_A_IFNAME];
+  if (name == nullptr) {
+    return std::string_view();
+  }
+  auto* data = static_cast<const char*>(AttributeData(name));
+  return std::string_view(data, strnlen(data, AttributeLength(name)));
+}
+
+void DumpWireguardDevice(const std::string& name, const std::function<void(const DeviceView&)>& on_message) {
+  NetlinkSocket socket(NETLINK_GENERIC);
+  uint16_t family = socket.ResolveFamily(WG_GENL_NAME);
+
+  NetlinkMessage message(family, NLM_F_DUMP);
+  genlmsghdr genl = {};
+  genl.cmd = WG_CMD_GET_DEVICE;
+  genl.version = WG_GENL_VERSION;
+  message.AppendHeader(genl);
+  message.PutString(WGDEVICE_A_IFNAME, name);
+
+  socket.Request(message, [&on_message](const nlmsghdr* reply) { on_message(DeviceView(reply)); });
+}
+
+void MergeDeviceMessage(const DeviceView& message, WireguardDevice* device) {
+  // Only the first message carries the device settings, but every one names the device.
+  if (device->name.empty()) {
+    device->name = std::string(message.name());
+  }
+  if (int ifindex = message.ifindex()) {
+    device->ifindex = ifindex;
+  }
+  if (uint16_t listen_port = message.listen_port()) {
+    device->listen_port = listen_port;
+  }
+  WireguardKey public_key = message.public_key();
+  if (public_key != WireguardKey()) {
+    device->public_key = public_key;
+  }
+
+  for (const PeerView peer : message.peers()) {
+    WireguardKey peer_key = peer.public_key();
+    if (!peer.has_state() && !device->peers.empty() && device->peers.back().public_key == peer_key) {
+      for (const AllowedIpView allowed_ip : peer.allowed_ips()) {
+        device->peers.back().allowed_ips.push_back(allowed_ip.ToAllowedIp());
+      }
+      continue;
+    }
+    WireguardPeer parsed;
+    parsed.public_key = peer_key;
+    parsed.endpoint = peer.endpoint();
+    parsed.last_handshake = peer.last_handshake();
+    parsed.rx_bytes = peer.rx_bytes();
+    parsed.tx_bytes = peer.tx_bytes();
+    parsed.persistent_keepalive = peer.persistent_keepalive();
+    for (const AllowedIpView allowed_ip : peer.allowed_ips()) {
+      parsed.allowed_ips.push_back(allowed_ip.ToAllowedIp());
+    }
+    device->peers.push_back(std::move(parsed));
+  }
+}
+
+void AddStatistics(const DeviceView& message, TunnelStatistics* statistics) {
+  for (const PeerView peer : message.peers()) {
+    statistics->total_download += peer.rx_bytes();
+    statistics->total_upload += peer.tx_bytes();
+    statistics->latest_handshake = std::max(statistics->latest_handshake, peer.last_handshake());
+  }
+}
+
+void AddPeerSamples(const DeviceView& message, std::vector<PeerSample>* samples) {
+  for (const PeerView peer : message.peers()) {
+    if (peer.has_state()) {
+      samples->push_back({peer.public_key(), peer.last_handshake(), peer.rx_bytes(), peer.tx_bytes()});
+    }
+  }
+}
+
+}  // namespace wireguard_dart
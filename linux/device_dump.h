@@ -0,0 +1,147 @@
+#ifndef WIREGUARD_DART_DEVICE_DUMP_H
+#define WIREGUARD_DART_DEVICE_DUMP_H
+
+#include <linux/netlink.h>
+#include <linux/wireguard.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "netlink.h"
+#include "wireguard_config.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+// The attributes of one nesting level indexed by type, found in a single pass. Types above kMax are skipped.
+template <uint16_t kMax>
+class AttributeTable {
+ public:
+  explicit AttributeTable(const AttributeRange& attributes) {
+    for (const nlattr* attribute : attributes) {
+      uint16_t type = AttributeType(attribute);
+      if (type <= kMax) {
+        attributes_[type] = attribute;
+      }
+    }
+  }
+
+  const nlattr* operator[](uint16_t type) const { return type <= kMax ? attributes_[type] : nullptr; }
+
+  // Reads a fixed-size attribute; missing or short ones are zero-filled.
+  template <typename T>
+  T Get(uint16_t type) const {
+    T value = {};
+    if (const nlattr* attribute = (*this)[type]) {
+      memcpy(&value, AttributeData(attribute), std::min(sizeof(T), AttributeLength(attribute)));
+    }
+    return value;
+  }
+
+ private:
+  const nlattr* attributes_[kMax + 1] = {};
+};
+
+// The entries of a list attribute such as WGDEVICE_A_PEERS, each seen through a `View`.
+template <typename View>
+class ViewRange {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(AttributeRange::Iterator position) : position_(position) {}
+
+    View operator*() const { return View(*position_); }
+    bool operator!=(const Iterator& other) const { return position_ != other.position_; }
+    Iterator& operator++() {
+      ++position_;
+      return *this;
+    }
+
+   private:
+    AttributeRange::Iterator position_;
+  };
+
+  explicit ViewRange(const nlattr* list) : entries_(list) {}
+
+  Iterator begin() const { return Iterator(entries_.begin()); }
+  Iterator end() const { return Iterator(entries_.end()); }
+
+ private:
+  AttributeRange entries_;
+};
+
+// Typed views of a WG_CMD_GET_DEVICE dump, read in place from the receive buffer while the dump is being received.
+// They copy nothing and allocate nothing, and are only valid as long as the message they were made from.
+
+class AllowedIpView {
+ public:
+  explicit AllowedIpView(const nlattr* entry) : attributes_(AttributeRange(entry)) {}
+
+  uint16_t family() const { return attributes_.Get<uint16_t>(WGALLOWEDIP_A_FAMILY); }
+  uint8_t cidr() const { return attributes_.Get<uint8_t>(WGALLOWEDIP_A_CIDR_MASK); }
+  AllowedIp ToAllowedIp() const;
+
+ private:
+  AttributeTable<WGALLOWEDIP_A_MAX> attributes_;
+};
+
+class PeerView {
+ public:
+  explicit PeerView(const nlattr* peer) : attributes_(AttributeRange(peer)) {}
+
+  WireguardKey public_key() const { return attributes_.Get<WireguardKey>(WGPEER_A_PUBLIC_KEY); }
+  // False for an entry that only continues the allowed IPs of the last peer of the previous message. Those carry the
+  // public key and allowed IPs, and none of the state below.
+  bool has_state() const { return attributes_[WGPEER_A_RX_BYTES] != nullptr; }
+  sockaddr_storage endpoint() const { return attributes_.Get<sockaddr_storage>(WGPEER_A_ENDPOINT); }
+  // Unix epoch milliseconds, 0 if no handshake has completed yet.
+  int64_t last_handshake() const;
+  uint64_t rx_bytes() const { return attributes_.Get<uint64_t>(WGPEER_A_RX_BYTES); }
+  uint64_t tx_bytes() const { return attributes_.Get<uint64_t>(WGPEER_A_TX_BYTES); }
+  uint16_t persistent_keepalive() const { return attributes_.Get<uint16_t>(WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL); }
+  ViewRange<AllowedIpView> allowed_ips() const { return ViewRange<AllowedIpView>(attributes_[WGPEER_A_ALLOWEDIPS]); }
+
+ private:
+  AttributeTable<WGPEER_A_MAX> attributes_;
+};
+
+// One message of the dump. The kernel fills messages up to a page or so: only the first carries the device settings,
+// and a peer cut off at the end of one message continues as the first peer of the next.
+class DeviceView {
+ public:
+  // `message` is a reply to WG_CMD_GET_DEVICE, starting with its genetlink header.
+  explicit DeviceView(const nlmsghdr* message);
+
+  int ifindex() const { return static_cast<int>(attributes_.Get<uint32_t>(WGDEVICE_A_IFINDEX)); }
+  std::string_view name() const;
+  uint16_t listen_port() const { return attributes_.Get<uint16_t>(WGDEVICE_A_LISTEN_PORT); }
+  uint32_t fwmark() const { return attributes_.Get<uint32_t>(WGDEVICE_A_FWMARK); }
+  WireguardKey public_key() const { return attributes_.Get<WireguardKey>(WGDEVICE_A_PUBLIC_KEY); }
+  ViewRange<PeerView> peers() const { return ViewRange<PeerView>(attributes_[WGDEVICE_A_PEERS]); }
+
+ private:
+  AttributeTable<WGDEVICE_A_MAX> attributes_;
+};
+
+// Dumps device `name` with WG_CMD_GET_DEVICE, passing a view of every message to `on_message` as it arrives.
+void DumpWireguardDevice(const std::string& name, const std::function<void(const DeviceView&)>& on_message);
+
+// Copies one message of a dump into `device`, joining a peer continued from the previous message with its first part.
+void MergeDeviceMessage(const DeviceView& message, WireguardDevice* device);
+
+// Adds the traffic and handshakes of the peers in `message` to `statistics`.
+void AddStatistics(const DeviceView& message, TunnelStatistics* statistics);
+
+// Appends a sample for every peer starting in `message`.
+void AddPeerSamples(const DeviceView& message, std::vector<PeerSample>* samples);
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,266 @@
+#include "kill_switch.h"
+
+#include <arpa/inet.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+const char KillSwitch::kTableName[] = "wireguard_dart";
+
+namespace {
+
+const char kChainName[] = "output";
+
+// Offsets of the header fields the rules match.
+const uint32_t kIpv4Destination = 16;
+const uint32_t kIpv6Destination = 24;
+const uint32_t kUdpSourcePort = 0;
+const uint32_t kUdpDestinationPort = 2;
+const uint32_t kIcmpv6Type = 0;
+
+// Packets of DHCP clients and servers.
+const uint16_t kDhcpClientPort = 68;
+const uint16_t kDhcpServerPort = 67;
+const uint16_t kDhcp6ClientPort = 546;
+const uint16_t kDhcp6ServerPort = 547;
+
+// Router solicitation up to neighbor advertisement.
+const uint8_t kFirstNeighborDiscoveryType = 133;
+const uint8_t kLastNeighborDiscoveryType = 136;
+
+uint16_t MessageType(uint16_t message) { return static_cast<uint16_t>((NFNL_SUBSYS_NFTABLES << 8) | message); }
+
+NetlinkMessage TableMessage(uint16_t message, uint16_t flags) {
+  NetlinkMessage table(MessageType(message), flags);
+  nfgenmsg header = {};
+  header.nfgen_family = NFPROTO_INET;
+  header.version = NFNETLINK_V0;
+  table.AppendHeader(header);
+  table.PutString(NFTA_TABLE_NAME, KillSwitch::kTableName);
+  return table;
+}
+
+NetlinkMessage ChainMessage() {
+  NetlinkMessage chain(MessageType(NFT_MSG_NEWCHAIN), NLM_F_CREATE);
+  nfgenmsg header = {};
+  header.nfgen_family = NFPROTO_INET;
+  header.version = NFNETLINK_V0;
+  chain.AppendHeader(header);
+  chain.PutString(NFTA_CHAIN_TABLE, KillSwitch::kTableName);
+  chain.PutString(NFTA_CHAIN_NAME, kChainName);
+  size_t hook = chain.BeginNested(NFTA_CHAIN_HOOK);
+  chain.PutU32(NFTA_HOOK_HOOKNUM, htonl(NF_INET_LOCAL_OUT));
+  chain.PutU32(NFTA_HOOK_PRIORITY, htonl(0));
+  chain.EndNested(hook);
+  chain.PutU32(NFTA_CHAIN_POLICY, htonl(NF_DROP));
+  chain.PutString(NFTA_CHAIN_TYPE, "filter");
+  return chain;
+}
+
+// An accept rule of the output chain, built from expressions that all have to match. Every match loads a packet field
+// into register 1 and compares it.
+class AcceptRule {
+ public:
+  AcceptRule() : message_(MessageType(NFT_MSG_NEWRULE), NLM_F_CREATE | NLM_F_APPEND) {
+    nfgenmsg header = {};
+    header.nfgen_family = NFPROTO_INET;
+    header.version = NFNETLINK_V0;
+    message_.AppendHeader(header);
+    message_.PutString(NFTA_RULE_TABLE, KillSwitch::kTableName);
+    message_.PutString(NFTA_RULE_CHAIN, kChainName);
+    expressions_ = message_.BeginNested(NFTA_RULE_EXPRESSIONS);
+  }
+
+  AcceptRule& Meta(uint32_t key, const void* value, size_t length) {
+    Begin("meta");
+    message_.PutU32(NFTA_META_DREG, htonl(NFT_REG_1));
+    message_.PutU32(NFTA_META_KEY, htonl(key));
+    End();
+    return Compare(NFT_CMP_EQ, value, length);
+  }
+
+  AcceptRule& Meta(uint32_t key, uint8_t value) { return Meta(key, &value, sizeof(value)); }
+
+  // Loads `length` bytes at `offset` of the header at `base` without comparing them.
+  AcceptRule& Load(uint32_t base, uint32_t offset, uint32_t length) {
+    Begin("payload");
+    message_.PutU32(NFTA_PAYLOAD_DREG, htonl(NFT_REG_1));
+    message_.PutU32(NFTA_PAYLOAD_BASE, htonl(base));
+    message_.PutU32(NFTA_PAYLOAD_OFFSET, htonl(offset));
+    message_.PutU32(NFTA_PAYLOAD_LEN, htonl(length));
+    End();
+    return *this;
+  }
+
+  AcceptRule& Payload(uint32_t base, uint32_t offset, const void* value, uint32_t length) {
+    return Load(base, offset, length).Compare(NFT_CMP_EQ, value, length);
+  }
+
+  AcceptRule& Port(uint32_t offset, uint16_t port) {
+    uint16_t value = htons(port);
+    return Payload(NFT_PAYLOAD_TRANSPORT_HEADER, offset, &value, sizeof(value));
+  }
+
+  // Compares register 1 with `value`.
+  AcceptRule& Compare(uint32_t op, const void* value, size_t length) {
+    Begin("cmp");
+    message_.PutU32(NFTA_CMP_SREG, htonl(NFT_REG_1));
+    message_.PutU32(NFTA_CMP_OP, htonl(op));
+    size_t data = message_.BeginNested(NFTA_CMP_DATA);
+    message_.PutAttribute(NFTA_DATA_VALUE, value, length);
+    message_.EndNested(data);
+    End();
+    return *this;
+  }
+
+  // Appends the verdict and returns the finished message.
+  const NetlinkMessage& Accept() {
+    Begin("immediate");
+    message_.PutU32(NFTA_IMMEDIATE_DREG, htonl(NFT_REG_VERDICT));
+    size_t data = message_.BeginNested(NFTA_IMMEDIATE_DATA);
+    size_t verdict = message_.BeginNested(NFTA_DATA_VERDICT);
+    message_.PutU32(NFTA_VERDICT_CODE, htonl(NF_ACCEPT));
+    message_.EndNested(verdict);
+    message_.EndNested(data);
+    End();
+    message_.EndNested(expressions_);
+    return message_;
+  }
+
+ private:
+  void Begin(const char* name) {
+    element_ = message_.BeginNested(NFTA_LIST_ELEM);
+    message_.PutString(NFTA_EXPR_NAME, name);
+    data_ = message_.BeginNested(NFTA_EXPR_DATA);
+  }
+
+  void End() {
+    message_.EndNested(data_);
+    message_.EndNested(element_);
+  }
+
+  NetlinkMessage message_;
+  size_t expressions_ = 0;
+  size_t element_ = 0;
+  size_t data_ = 0;
+};
+
+// Output interface names are compared in full, as the kernel loads them: padded with zeros to IFNAMSIZ.
+AcceptRule& OutputInterface(AcceptRule& rule, const std::string& name) {
+  char padded[IFNAMSIZ] = {};
+  strncpy(padded, name.c_str(), IFNAMSIZ - 1);
+  return rule.Meta(NFT_META_OIFNAME, padded, sizeof(padded));
+}
+
+void AddUdp(NetlinkBatch* batch, uint8_t family, uint16_t source_port, uint16_t destination_port) {
+  AcceptRule rule;
+  rule.Meta(NFT_META_NFPROTO, family).Meta(NFT_META_L4PROTO, IPPROTO_UDP);
+  batch->Add(rule.Port(kUdpSourcePort, source_port).Port(kUdpDestinationPort, destination_port).Accept());
+}
+
+void AddEndpoint(NetlinkBatch* batch, const sockaddr_storage& endpoint) {
+  AcceptRule rule;
+  if (endpoint.ss_family == AF_INET) {
+    auto* address = reinterpret_cast<const sockaddr_in*>(&endpoint);
+    rule.Meta(NFT_META_NFPROTO, NFPROTO_IPV4).Meta(NFT_META_L4PROTO, IPPROTO_UDP);
+    rule.Payload(NFT_PAYLOAD_NETWORK_HEADER, kIpv4Destination, &address->sin_addr, 4);
+    rule.Payload(NFT_PAYLOAD_TRANSPORT_HEADER, kUdpDestinationPort, &address->sin_port, 2);
+  } else if (endpoint.ss_family == AF_INET6) {
+    auto* address = reinterpret_cast<const sockaddr_in6*>(&endpoint);
+    rule.Meta(NFT_META_NFPROTO, NFPROTO_IPV6).Meta(NFT_META_L4PROTO, IPPROTO_UDP);
+    rule.Payload(NFT_PAYLOAD_NETWORK_HEADER, kIpv6Destination, &address->sin6_addr, 16);
+    rule.Payload(NFT_PAYLOAD_TRANSPORT_HEADER, kUdpDestinationPort, &address->sin6_port, 2);
+  } else {
+    return;
+  }
+  batch->Add(rule.Accept());
+}
+
+}  // namespace
+
+void KillSwitch::Enable(const std::string& interface_name, const std::vector<sockaddr_storage>& endpoints) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Commit(true, interface_name, endpoints);
+  enabled_ = true;
+  interface_name_ = interface_name;
+}
+
+void KillSwitch::SetEndpoints(const std::vector<sockaddr_storage>& endpoints) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!enabled_) {
+    return;
+  }
+  Commit(true, interface_name_, endpoints);
+}
+
+void KillSwitch::Disable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Commit(false, "", {});
+  enabled_ = false;
+}
+
+bool KillSwitch::enabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return enabled_;
+}
+
+bool KillSwitch::Installed() {
+  NetlinkSocket socket(NETLINK_NETFILTER);
+  NetlinkMessage message = TableMessage(NFT_MSG_GETTABLE, 0);
+  try {
+    socket.Request(message);
+  } catch (const NetlinkError& e) {
+    if (e.error_code() != ENOENT) {
+      throw;
+    }
+    return false;
+  }
+  return true;
+}
+
+void KillSwitch::Commit(bool enabled, const std::string& interface_name,
+                        const std::vector<sockaddr_storage>& endpoints) {
+  if (socket_ == nullptr) {
+    socket_ = std::make_unique<NetlinkSocket>(NETLINK_NETFILTER);
+  }
+  // Creating the table first makes deleting it succeed whether or not it exists; both happen in the same transaction
+  // as building the new one, so no packet sees the table missing.
+  NetlinkBatch batch;
+  batch.Add(TableMessage(NFT_MSG_NEWTABLE, NLM_F_CREATE));
+  batch.Add(TableMessage(NFT_MSG_DELTABLE, 0));
+  if (enabled) {
+    batch.Add(TableMessage(NFT_MSG_NEWTABLE, NLM_F_CREATE));
+    batch.Add(ChainMessage());
+    {
+      AcceptRule rule;
+      batch.Add(OutputInterface(rule, "lo").Accept());
+    }
+    {
+      AcceptRule rule;
+      batch.Add(OutputInterface(rule, interface_name).Accept());
+    }
+    for (const sockaddr_storage& endpoint : endpoints) {
+      AddEndpoint(&batch, endpoint);
+    }
+    AddUdp(&batch, NFPROTO_IPV4, kDhcpClientPort, kDhcpServerPort);
+    AddUdp(&batch, NFPROTO_IPV6, kDhcp6ClientPort, kDhcp6ServerPort);
+    AcceptRule neighbor_discovery;
+    neighbor_discovery.Meta(NFT_META_NFPROTO, NFPROTO_IPV6).Meta(NFT_META_L4PROTO, IPPROTO_ICMPV6);
+    neighbor_discovery.Load(NFT_PAYLOAD_TRANSPORT_HEADER, kIcmpv6Type, 1);
+    neighbor_discovery.Compare(NFT_CMP_GTE, &kFirstNeighborDiscoveryType, 1);
+    neighbor_discovery.Compare(NFT_CMP_LTE, &kLastNeighborDiscoveryType, 1);
+    batch.Add(neighbor_discovery.Accept());
+  }
+  socket_->Transact(batch, NFNL_SUBSYS_NFTABLES);
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,62 @@
+#ifndef WIREGUARD_DART_KILL_SWITCH_H
+#define WIREGUARD_DART_KILL_SWITCH_H
+
+#include <sys/socket.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "netlink.h"
+
+namespace wireguard_dart {
+
+// Leak protection: an nftables table whose output chain drops every packet that does not leave through loopback or the
+// tunnel interface, except WireGuard's own packets to the peer endpoints and what DHCP and IPv6 neighbor discovery need
+// to keep the network underneath up. Traffic cannot get around the tunnel while it is down or being set up, and the
+// protection outlives the app until it is disabled.
+//
+// Every change goes to the kernel as one nfnetlink transaction, which deletes the table and builds it again: the old
+// ruleset applies until the new one is complete, so there is no moment without protection, and a change that fails
+// leaves the old ruleset in place. Enabling, updating and disabling each take a single sendmsg.
+class KillSwitch {
+ public:
+  // nftables table of family inet that holds the ruleset.
+  static const char kTableName[];
+
+  KillSwitch() = default;
+
+  KillSwitch(const KillSwitch&) = delete;
+  KillSwitch& operator=(const KillSwitch&) = delete;
+
+  // Installs the ruleset allowing `interface_name` and UDP to `endpoints`, or replaces the installed one. The interface
+  // is matched by name, so it need not exist yet. Throws NetlinkError, e.g. with EPERM without CAP_NET_ADMIN.
+  void Enable(const std::string& interface_name, const std::vector<sockaddr_storage>& endpoints);
+
+  // Replaces the endpoints the ruleset allows. Does nothing while disabled.
+  void SetEndpoints(const std::vector<sockaddr_storage>& endpoints);
+
+  // Removes the ruleset, also one left by an earlier run. Throws NetlinkError.
+  void Disable();
+
+  bool enabled();
+
+  // Whether the ruleset is in the kernel, e.g. because an earlier run left it enabled. Throws NetlinkError.
+  static bool Installed();
+
+ private:
+  // Sends the transaction that replaces the ruleset with one for `interface_name` and `endpoints`, or only removes it
+  // unless `enabled`.
+  void Commit(bool enabled, const std::string& interface_name, const std::vector<sockaddr_storage>& endpoints);
+
+  std::mutex mutex_;
+  // NETLINK_NETFILTER, opened on first use.
+  std::unique_ptr<NetlinkSocket> socket_;
+  bool enabled_ = false;
+  std::string interface_name_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
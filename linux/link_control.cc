@@ -0,0 +1,279 @@
+#include "link_control.h"
+
+#include <linux/fib_rules.h>
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <linux/wireguard.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "netlink.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+static uint8_t Family(const IpPrefix& prefix) { return prefix.version == 4 ? AF_INET : AF_INET6; }
+
+static size_t AddressLength(const IpPrefix& prefix) { return prefix.version == 4 ? 4 : 16; }
+
+void CreateWireguardLink(const std::string& name, uint32_t mtu) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, name);
+  if (mtu != 0) {
+    message.PutU32(IFLA_MTU, mtu);
+  }
+  size_t link_info = message.BeginNested(IFLA_LINKINFO);
+  message.PutString(IFLA_INFO_KIND, WG_GENL_NAME);
+  message.EndNested(link_info);
+  socket.Request(message);
+}
+
+void DeleteLink(const std::string& name) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_DELLINK, 0);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, name);
+  try {
+    socket.Request(message);
+  } catch (const NetlinkError& e) {
+    if (e.error_code() != ENODEV) {
+      throw;
+    }
+  }
+}
+
+static NetlinkMessage LinkStateMessage(int ifindex, bool up, uint32_t mtu = 0) {
+  NetlinkMessage message(RTM_NEWLINK, 0);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  info.ifi_index = ifindex;
+  info.ifi_flags = up ? IFF_UP : 0;
+  info.ifi_change = IFF_UP;
+  message.AppendHeader(info);
+  if (up) {
+    message.PutString(IFLA_IFALIAS, kInterfaceAlias);
+  }
+  if (mtu != 0) {
+    message.PutU32(IFLA_MTU, mtu);
+  }
+  return message;
+}
+
+static NetlinkMessage AddressMessage(uint16_t type, uint16_t flags, int ifindex, const IpPrefix& address) {
+  NetlinkMessage message(type, flags);
+  ifaddrmsg info = {};
+  info.ifa_family = Family(address);
+  info.ifa_prefixlen = address.length;
+  info.ifa_index = ifindex;
+  message.AppendHeader(info);
+  message.PutAttribute(IFA_LOCAL, address.address.data(), AddressLength(address));
+  message.PutAttribute(IFA_ADDRESS, address.address.data(), AddressLength(address));
+  return message;
+}
+
+static NetlinkMessage RouteMessage(uint16_t type, uint16_t flags, int ifindex, const IpPrefix& network,
+                                   uint32_t table) {
+  NetlinkMessage message(type, flags);
+  rtmsg route = {};
+  route.rtm_family = Family(network);
+  route.rtm_dst_len = network.length;
+  route.rtm_table = table == 0 ? RT_TABLE_MAIN : RT_TABLE_UNSPEC;
+  route.rtm_protocol = RTPROT_BOOT;
+  route.rtm_scope = RT_SCOPE_LINK;
+  route.rtm_type = RTN_UNICAST;
+  message.AppendHeader(route);
+  if (table != 0) {
+    message.PutU32(RTA_TABLE, table);
+  }
+  message.PutAttribute(RTA_DST, network.address.data(), AddressLength(network));
+  message.PutU32(RTA_OIF, ifindex);
+  return message;
+}
+
+static NetlinkMessage RuleMessage(uint8_t family, bool add, bool suppress_main) {
+  NetlinkMessage message(add ? RTM_NEWRULE : RTM_DELRULE, add ? NLM_F_CREATE : 0);
+  fib_rule_hdr rule = {};
+  rule.family = family;
+  rule.action = FR_ACT_TO_TBL;
+  if (suppress_main) {
+    // "table main suppress_prefixlength 0": use the main table except for its default route.
+    rule.table = RT_TABLE_MAIN;
+    message.AppendHeader(rule);
+    message.PutU32(FRA_SUPPRESS_PREFIXLEN, 0);
+  } else {
+    // "not fwmark 51820 table 51820".
+    rule.flags = FIB_RULE_INVERT;
+    rule.table = RT_TABLE_UNSPEC;
+    message.AppendHeader(rule);
+    message.PutU32(FRA_TABLE, kTunnelRoutingTable);
+    message.PutU32(FRA_FWMARK, kTunnelRoutingTable);
+  }
+  return message;
+}
+
+void RouteBatch::Add(const NetlinkMessage& change, const NetlinkMessage& revert) {
+  changes_.Add(change);
+  reverts_.push_back(revert);
+}
+
+void SetLinkMtu(int ifindex, uint32_t mtu) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_NEWLINK, 0);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  info.ifi_index = ifindex;
+  message.AppendHeader(info);
+  message.PutU32(IFLA_MTU, mtu);
+  socket.Request(message);
+}
+
+void RouteBatch::SetLinkUp(int ifindex, uint32_t mtu) {
+  Add(LinkStateMessage(ifindex, true, mtu), LinkStateMessage(ifindex, false));
+}
+
+void RouteBatch::AddAddress(int ifindex, const IpPrefix& address) {
+  Add(AddressMessage(RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, ifindex, address),
+      AddressMessage(RTM_DELADDR, 0, ifindex, address));
+}
+
+void RouteBatch::AddRoute(int ifindex, const IpPrefix& destination, uint32_t table) {
+  // The kernel rejects destinations with host bits set, which allowed IPs may well have.
+  IpPrefix network = destination;
+  for (size_t bit = network.length; bit < AddressLength(network) * 8; bit++) {
+    network.address[bit / 8] &= static_cast<uint8_t>(~(0x80 >> (bit % 8)));
+  }
+  Add(RouteMessage(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, ifindex, network, table),
+      RouteMessage(RTM_DELROUTE, 0, ifindex, network, table));
+}
+
+void RouteBatch::AddDefaultRouteRules(int version) {
+  uint8_t family = version == 4 ? AF_INET : AF_INET6;
+  for (bool suppress_main : {false, true}) {
+    Add(RuleMessage(family, true, suppress_main), RuleMessage(family, false, suppress_main));
+  }
+  rule_versions_.push_back(version);
+}
+
+void RouteBatch::Commit() {
+  // The kernel numbers rules itself and so accepts duplicates: clear copies left by a previous run before adding.
+  for (int version : rule_versions_) {
+    RemoveDefaultRouteRules(version);
+  }
+
+  NetlinkSocket socket(NETLINK_ROUTE);
+  auto errors = socket.RequestBatch(changes_);
+  auto failed = std::find_if(errors.begin(), errors.end(), [](int error) { return error != 0; });
+  if (failed == errors.end()) {
+    return;
+  }
+
+  // Undo in reverse order, so that e.g. routes go before the link state they depend on.
+  NetlinkBatch reverts;
+  for (size_t i = errors.size(); i-- > 0;) {
+    if (errors[i] == 0) {
+      reverts.Add(reverts_[i]);
+    }
+  }
+  auto revert_errors = socket.RequestBatch(reverts);
+  for (int error : revert_errors) {
+    if (error != 0) {
+      std::cerr << "Failed to revert a network change: " << strerror(error) << std::endl;
+    }
+  }
+  throw NetlinkError("Failed to apply network change " + std::to_string(failed - errors.begin() + 1) + " of " +
+                         std::to_string(errors.size()),
+                     *failed);
+}
+
+// Deletes one rule. Returns false if it does not exist.
+static bool DeleteRule(uint8_t family, bool suppress_main) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message = RuleMessage(family, false, suppress_main);
+  try {
+    socket.Request(message);
+  } catch (const NetlinkError& e) {
+    if (e.error_code() != ENOENT) {
+      throw;
+    }
+    return false;
+  }
+  return true;
+}
+
+void RemoveDefaultRouteRules(int version) {
+  uint8_t family = version == 4 ? AF_INET : AF_INET6;
+  for (bool suppress_main : {false, true}) {
+    while (DeleteRule(family, suppress_main)) {
+    }
+  }
+}
+
+static std::string FormatAddress(const nlattr* attribute, uint8_t family) {
+  char text[INET6_ADDRSTRLEN] = "";
+  if (AttributeLength(attribute) >= (family == AF_INET ? 4u : 16u)) {
+    inet_ntop(family, AttributeData(attribute), text, sizeof(text));
+  }
+  return text;
+}
+
+std::string RouteIdentity(const sockaddr_storage& destination, uint32_t mark) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_GETROUTE, 0);
+  rtmsg route = {};
+  route.rtm_family = static_cast<uint8_t>(destination.ss_family);
+  if (destination.ss_family == AF_INET) {
+    route.rtm_dst_len = 32;
+    message.AppendHeader(route);
+    message.PutAttribute(RTA_DST, &reinterpret_cast<const sockaddr_in&>(destination).sin_addr, 4);
+  } else {
+    route.rtm_dst_len = 128;
+    message.AppendHeader(route);
+    message.PutAttribute(RTA_DST, &reinterpret_cast<const sockaddr_in6&>(destination).sin6_addr, 16);
+  }
+  if (mark != 0) {
+    message.PutU32(RTA_MARK, mark);
+  }
+
+  std::string oif, gateway, source;
+  socket.Request(message, [&](const nlmsghdr* reply) {
+    if (reply->nlmsg_type != RTM_NEWROUTE || reply->nlmsg_len < NLMSG_LENGTH(sizeof(rtmsg))) {
+      return;
+    }
+    auto* found = static_cast<const rtmsg*>(NLMSG_DATA(reply));
+    size_t header_length = NLMSG_LENGTH(NLMSG_ALIGN(sizeof(rtmsg)));
+    for (const nlattr* attribute : AttributeRange(reinterpret_cast<const char*>(reply) + header_length,
+                                                  reply->nlmsg_len - header_length)) {
+      switch (AttributeType(attribute)) {
+        case RTA_OIF:
+          if (AttributeLength(attribute) >= sizeof(uint32_t)) {
+            oif = std::to_string(*static_cast<const uint32_t*>(AttributeData(attribute)));
+          }
+          break;
+        case RTA_GATEWAY:
+          gateway = FormatAddress(attribute, found->rtm_family);
+          break;
+        case RTA_PREFSRC:
+          source = FormatAddress(attribute, found->rtm_family);
+          break;
+      }
+    }
+  });
+  return oif + " " + gateway + " " + source;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,71 @@
+#ifndef WIREGUARD_DART_LINK_CONTROL_H
+#define WIREGUARD_DART_LINK_CONTROL_H
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "netlink.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Routing table and firewall mark used for default routes through the tunnel, as wg-quick does: traffic not marked
+// by WireGuard itself is looked up in this table, while the device's own encrypted packets carry the mark and use
+// the main table.
+const uint32_t kTunnelRoutingTable = 51820;
+
+// Creates a WireGuard link. Throws NetlinkError with EEXIST if the name is taken.
+void CreateWireguardLink(const std::string& name, uint32_t mtu);
+
+// Deletes a link; does nothing if it does not exist.
+void DeleteLink(const std::string& name);
+
+// Changes the MTU of a link, leaving its state alone.
+void SetLinkMtu(int ifindex, uint32_t mtu);
+
+// Address, route, link state and policy rule changes for a tunnel, sent to the kernel in as few sendmsg calls as
+// possible. Nothing is applied before Commit, which applies all of them or none.
+class RouteBatch {
+ public:
+  // Brings the link up and tags it with kInterfaceAlias so a later app instance recognizes it. Also sets the MTU unless
+  // `mtu` is 0, for links created by someone else.
+  void SetLinkUp(int ifindex, uint32_t mtu = 0);
+
+  void AddAddress(int ifindex, const IpPrefix& address);
+
+  // Adds a route to `destination` through the link, in the main table unless `table` says otherwise.
+  void AddRoute(int ifindex, const IpPrefix& destination, uint32_t table = 0);
+
+  // Adds the policy rules sending unmarked traffic of the given IP version to kTunnelRoutingTable, while keeping more
+  // specific routes of the main table. Copies left by a previous run are removed at Commit.
+  void AddDefaultRouteRules(int version);
+
+  size_t size() const { return changes_.size(); }
+
+  // Applies the changes in the order they were added. The kernel handles them one by one, so if any fails the ones
+  // that went through are reverted before the first error is thrown as NetlinkError.
+  void Commit();
+
+ private:
+  void Add(const NetlinkMessage& change, const NetlinkMessage& revert);
+
+  NetlinkBatch changes_;
+  // reverts_[i] undoes the i-th change.
+  std::vector<NetlinkMessage> reverts_;
+  std::vector<int> rule_versions_;
+};
+
+// Removes the policy rules added by RouteBatch::AddDefaultRouteRules for the given IP version, if any.
+void RemoveDefaultRouteRules(int version);
+
+// Identifies the network that packets to `destination` carrying firewall mark `mark` leave through, from the route
+// the kernel picks for them: "<ifindex> <gateway> <source>", with empty parts for what the route does not have.
+// Throws NetlinkError, e.g. with ENETUNREACH when there is no route.
+std::string RouteIdentity(const sockaddr_storage& destination, uint32_t mark);
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,116 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+namespace wireguard_dart {
+
+namespace {
+
+void WriteAll(int fd, const void* data, size_t length, const std::string& path) {
+  const char* bytes = static_cast<const char*>(data);
+  while (length > 0) {
+    ssize_t written = write(fd, bytes, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to write " + path);
+    }
+    bytes += written;
+    length -= written;
+  }
+}
+
+}  // namespace
+
+MappedFile::MappedFile(const std::string& path) : path_(path) {
+  // Left behind by a Replace that did not finish; the file itself is still complete.
+  unlink((path_ + ".tmp").c_str());
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to open " + path_);
+  }
+  try {
+    struct stat info;
+    if (fstat(fd_, &info) < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to open " + path_);
+    }
+    if (info.st_size > 0) {
+      Map(info.st_size);
+    }
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+MappedFile::~MappedFile() {
+  Unmap();
+  close(fd_);
+}
+
+void MappedFile::Resize(size_t size) {
+  if (ftruncate(fd_, size) < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to size " + path_);
+  }
+  Unmap();
+  Map(size);
+}
+
+void MappedFile::Replace(const std::vector<Chunk>& chunks, size_t size) {
+  std::string temporary = path_ + ".tmp";
+  int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to create " + temporary);
+  }
+  try {
+    for (const Chunk& chunk : chunks) {
+      WriteAll(fd, chunk.data, chunk.length, temporary);
+    }
+    if (ftruncate(fd, size) < 0 || fsync(fd) < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to write " + temporary);
+    }
+    if (rename(temporary.c_str(), path_.c_str()) < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to replace " + path_);
+    }
+  } catch (...) {
+    close(fd);
+    unlink(temporary.c_str());
+    throw;
+  }
+  Unmap();
+  close(fd_);
+  fd_ = fd;
+  Map(size);
+}
+
+void MappedFile::Sync(size_t length) {
+  if (length > 0 && msync(mapping_, length, MS_SYNC) < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to write " + path_);
+  }
+}
+
+void MappedFile::Map(size_t size) {
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "Failed to map " + path_);
+  }
+  mapping_ = static_cast<char*>(mapping);
+  size_ = size;
+}
+
+void MappedFile::Unmap() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+    mapping_ = nullptr;
+    size_ = 0;
+  }
+}
+
+}  // namespace wireguard_dart
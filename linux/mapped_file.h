@@ -0,0 +1,54 @@
+#ifndef WIREGUARD_DART_MAPPED_FILE_H
+#define WIREGUARD_DART_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+// A file mapped read-write and shared in full: the storage of the append-only files UsageLog and ProfileStore keep
+// their records in. Writes to the mapping reach the page cache at once, so they survive a crash of the app; Sync puts
+// them on disk. A file is compacted by writing the new contents next to it and renaming them over it, so it is
+// complete at any time. Not thread-safe.
+class MappedFile {
+ public:
+  // Bytes written by Replace.
+  struct Chunk {
+    const void* data;
+    size_t length;
+  };
+
+  // Opens the file at `path`, creating it empty if it does not exist, and maps it unless it is empty. Throws
+  // std::system_error.
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const std::string& path() const { return path_; }
+  char* data() const { return mapping_; }
+  size_t size() const { return size_; }
+
+  // Grows or shrinks the file to `size` bytes, filling what it grows by with zeros, and maps it again.
+  void Resize(size_t size);
+  // Replaces the file with one of `size` bytes that starts with `chunks`, which may point into the mapping, and maps
+  // it. On failure the file and the mapping are left as they were.
+  void Replace(const std::vector<Chunk>& chunks, size_t size);
+  // Writes the first `length` bytes of the mapping to disk.
+  void Sync(size_t length);
+
+ private:
+  void Map(size_t size);
+  void Unmap();
+
+  const std::string path_;
+  int fd_ = -1;
+  char* mapping_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace wireguard_dart
+
+#endif
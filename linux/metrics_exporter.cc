@@ -0,0 +1,411 @@
+#include "metrics_exporter.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+// How long a client gets to send its request and take the answer.
+const int kClientTimeout = 1000;
+const size_t kMaxRequest = 8192;
+
+const char kContentType[] = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+void Append(std::string* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// printf into `out` without a temporary string.
+void Append(std::string* out, const char* format, ...) {
+  char buffer[256];
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+  va_end(arguments);
+  if (length > 0) {
+    out->append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+  }
+}
+
+const char* PhaseName(ConnectPhase phase) {
+  switch (phase) {
+    case ConnectPhase::resolve:
+      return "resolve";
+    case ConnectPhase::up:
+      return "up";
+    case ConnectPhase::mtu:
+      return "mtu";
+    case ConnectPhase::down:
+      return "down";
+  }
+  return "";
+}
+
+const char* ReasonName(ReconnectReason reason) {
+  switch (reason) {
+    case ReconnectReason::connect:
+      return "connect";
+    case ReconnectReason::network_change:
+      return "network_change";
+    case ReconnectReason::endpoint:
+      return "endpoint";
+    case ReconnectReason::stall:
+      return "stall";
+  }
+  return "";
+}
+
+void RenderHistogram(const LatencyHistogram& histogram, const char* phase, std::string* out) {
+  std::array<uint64_t, LatencyHistogram::kBounds.size() + 1> counts = histogram.counts();
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < LatencyHistogram::kBounds.size(); i++) {
+    cumulative += counts[i];
+    Append(out, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"%s\",le=\"%g\"} %" PRIu64 "\n", phase,
+           LatencyHistogram::kBounds[i] / 1e6, cumulative);
+  }
+  // The count is derived from the buckets so that it always equals the +Inf bucket.
+  cumulative += counts.back();
+  Append(out, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", phase,
+         cumulative);
+  Append(out, "wireguard_dart_connect_phase_duration_seconds_count{phase=\"%s\"} %" PRIu64 "\n", phase, cumulative);
+  Append(out, "wireguard_dart_connect_phase_duration_seconds_sum{phase=\"%s\"} %.6f\n", phase,
+         histogram.sum_micros() / 1e6);
+}
+
+// Writes all of `data` unless the client stops reading for kClientTimeout.
+bool SendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    pollfd pfd = {fd, POLLOUT, 0};
+    if (poll(&pfd, 1, kClientTimeout) <= 0) {
+      return false;
+    }
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+int64_t UnixMillisNow() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+constexpr std::array<int64_t, 12> LatencyHistogram::kBounds;
+
+void LatencyHistogram::Observe(std::chrono::steady_clock::duration duration) {
+  int64_t micros = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), 0);
+  size_t bucket = 0;
+  while (bucket < kBounds.size() && micros > kBounds[bucket]) {
+    bucket++;
+  }
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_micros_.fetch_add(micros, std::memory_order_relaxed);
+}
+
+std::array<uint64_t, LatencyHistogram::kBounds.size() + 1> LatencyHistogram::counts() const {
+  std::array<uint64_t, kBounds.size() + 1> counts;
+  for (size_t i = 0; i < counts.size(); i++) {
+    counts[i] = counts_[i].load(std::memory_order_relaxed);
+  }
+  return counts;
+}
+
+void TunnelMetrics::SetQuality(const LinkQuality* quality) {
+  if (quality == nullptr) {
+    probing_.store(false, std::memory_order_relaxed);
+    return;
+  }
+  rtt_median_.store(quality->rtt_median, std::memory_order_relaxed);
+  rtt_p90_.store(quality->rtt_p90, std::memory_order_relaxed);
+  rtt_p99_.store(quality->rtt_p99, std::memory_order_relaxed);
+  jitter_.store(quality->jitter, std::memory_order_relaxed);
+  loss_.store(quality->loss, std::memory_order_relaxed);
+  probes_received_.store(quality->received, std::memory_order_relaxed);
+  probing_.store(true, std::memory_order_relaxed);
+}
+
+bool TunnelMetrics::quality(LinkQuality* quality) const {
+  if (!probing_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  quality->rtt_median = rtt_median_.load(std::memory_order_relaxed);
+  quality->rtt_p90 = rtt_p90_.load(std::memory_order_relaxed);
+  quality->rtt_p99 = rtt_p99_.load(std::memory_order_relaxed);
+  quality->jitter = jitter_.load(std::memory_order_relaxed);
+  quality->loss = loss_.load(std::memory_order_relaxed);
+  quality->received = probes_received_.load(std::memory_order_relaxed);
+  return true;
+}
+
+void RenderOpenMetrics(const TunnelMetrics& metrics, const std::vector<PeerSample>& peers, int64_t now,
+                       std::string* out) {
+  out->clear();
+
+  out->append(
+      "# TYPE wireguard_dart_tunnel_status stateset\n"
+      "# HELP wireguard_dart_tunnel_status Status of the tunnel as the plugin last saw it.\n");
+  ConnectionStatus status = metrics.status();
+  for (ConnectionStatus state : {ConnectionStatus::connected, ConnectionStatus::disconnected,
+                                 ConnectionStatus::connecting, ConnectionStatus::disconnecting,
+                                 ConnectionStatus::degraded, ConnectionStatus::unknown}) {
+    Append(out, "wireguard_dart_tunnel_status{wireguard_dart_tunnel_status=\"%s\"} %d\n",
+           ConnectionStatusToString(state).c_str(), state == status ? 1 : 0);
+  }
+
+  out->append(
+      "# TYPE wireguard_dart_peer_receive_bytes counter\n"
+      "# UNIT wireguard_dart_peer_receive_bytes bytes\n"
+      "# HELP wireguard_dart_peer_receive_bytes Bytes received from the peer.\n");
+  // Public keys are base64, which needs no escaping in label values.
+  for (const PeerSample& peer : peers) {
+    Append(out, "wireguard_dart_peer_receive_bytes_total{public_key=\"%s\"} %" PRIu64 "\n",
+           EncodeKey(peer.public_key).c_str(), peer.rx_bytes);
+  }
+  out->append(
+      "# TYPE wireguard_dart_peer_transmit_bytes counter\n"
+      "# UNIT wireguard_dart_peer_transmit_bytes bytes\n"
+      "# HELP wireguard_dart_peer_transmit_bytes Bytes sent to the peer.\n");
+  for (const PeerSample& peer : peers) {
+    Append(out, "wireguard_dart_peer_transmit_bytes_total{public_key=\"%s\"} %" PRIu64 "\n",
+           EncodeKey(peer.public_key).c_str(), peer.tx_bytes);
+  }
+  out->append(
+      "# TYPE wireguard_dart_peer_handshake_age_seconds gauge\n"
+      "# UNIT wireguard_dart_peer_handshake_age_seconds seconds\n"
+      "# HELP wireguard_dart_peer_handshake_age_seconds Time since the latest handshake; absent before the first.\n");
+  for (const PeerSample& peer : peers) {
+    if (peer.last_handshake != 0) {
+      Append(out, "wireguard_dart_peer_handshake_age_seconds{public_key=\"%s\"} %.3f\n",
+             EncodeKey(peer.public_key).c_str(), std::max<int64_t>(now - peer.last_handshake, 0) / 1e3);
+    }
+  }
+
+  out->append(
+      "# TYPE wireguard_dart_connect_phase_duration_seconds histogram\n"
+      "# UNIT wireguard_dart_connect_phase_duration_seconds seconds\n"
+      "# HELP wireguard_dart_connect_phase_duration_seconds Latency of the steps of connect and disconnect.\n");
+  for (ConnectPhase phase : {ConnectPhase::resolve, ConnectPhase::up, ConnectPhase::mtu, ConnectPhase::down}) {
+    RenderHistogram(metrics.phase(phase), PhaseName(phase), out);
+  }
+
+  out->append(
+      "# TYPE wireguard_dart_reconnects counter\n"
+      "# HELP wireguard_dart_reconnects Times the tunnel was set up or moved again while connected.\n");
+  for (ReconnectReason reason : {ReconnectReason::connect, ReconnectReason::network_change, ReconnectReason::endpoint,
+                                 ReconnectReason::stall}) {
+    Append(out, "wireguard_dart_reconnects_total{reason=\"%s\"} %" PRIu64 "\n", ReasonName(reason),
+           metrics.reconnects(reason));
+  }
+
+  LinkQuality quality;
+  if (metrics.quality(&quality)) {
+    out->append(
+        "# TYPE wireguard_dart_probe_rtt_seconds summary\n"
+        "# UNIT wireguard_dart_probe_rtt_seconds seconds\n"
+        "# HELP wireguard_dart_probe_rtt_seconds Round trip time of recent quality probes through the tunnel.\n");
+    Append(out, "wireguard_dart_probe_rtt_seconds{quantile=\"0.5\"} %.6f\n", quality.rtt_median / 1e3);
+    Append(out, "wireguard_dart_probe_rtt_seconds{quantile=\"0.9\"} %.6f\n", quality.rtt_p90 / 1e3);
+    Append(out, "wireguard_dart_probe_rtt_seconds{quantile=\"0.99\"} %.6f\n", quality.rtt_p99 / 1e3);
+    Append(out, "wireguard_dart_probe_rtt_seconds_count %" PRIu64 "\n", quality.received);
+    out->append(
+        "# TYPE wireguard_dart_probe_jitter_seconds gauge\n"
+        "# UNIT wireguard_dart_probe_jitter_seconds seconds\n"
+        "# HELP wireguard_dart_probe_jitter_seconds Smoothed variation of the probe round trip time.\n");
+    Append(out, "wireguard_dart_probe_jitter_seconds %.6f\n", quality.jitter / 1e3);
+    out->append(
+        "# TYPE wireguard_dart_probe_loss_ratio gauge\n"
+        "# UNIT wireguard_dart_probe_loss_ratio ratio\n"
+        "# HELP wireguard_dart_probe_loss_ratio Fraction of recent quality probes that went unanswered.\n");
+    Append(out, "wireguard_dart_probe_loss_ratio %.4f\n", quality.loss);
+  }
+
+  if (const Reactor* reactor = metrics.reactor()) {
+    out->append(
+        "# TYPE wireguard_dart_reactor_wakeups counter\n"
+        "# HELP wireguard_dart_reactor_wakeups Times the event loop thread woke up; flat while the tunnel is idle.\n");
+    Append(out, "wireguard_dart_reactor_wakeups_total %" PRIu64 "\n", reactor->wakeups());
+  }
+  out->append("# EOF\n");
+}
+
+MetricsExporter::~MetricsExporter() { Stop(); }
+
+void MetricsExporter::Start(const std::string& path) {
+  Stop();
+  // Bound in a directory of its own next to `path`, which only this user can enter, and moved to `path` once its
+  // permissions are narrowed: it is never reachable with the wider ones bind gives it.
+  std::string directory = path.substr(0, path.rfind('/') + 1) + ".XXXXXX";
+  std::string bound = directory + "/s";
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path) || bound.size() >= sizeof(address.sun_path)) {
+    throw std::system_error(ENAMETOOLONG, std::generic_category(), "Invalid metrics socket path");
+  }
+  if (mkdtemp(&directory[0]) == nullptr) {
+    throw std::system_error(errno, std::generic_category(), "Failed to listen on " + path);
+  }
+  bound = directory + "/s";
+  memcpy(address.sun_path, bound.c_str(), bound.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    int error_code = errno;
+    rmdir(directory.c_str());
+    throw std::system_error(error_code, std::generic_category(), "Failed to open metrics socket");
+  }
+  // Only a socket is replaced, never a regular file that happens to be at the path.
+  struct stat existing;
+  int error_code = 0;
+  if (lstat(path.c_str(), &existing) == 0 && !S_ISSOCK(existing.st_mode)) {
+    error_code = EADDRINUSE;
+  } else if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || chmod(bound.c_str(), 0660) < 0 ||
+             listen(fd, 8) < 0 || rename(bound.c_str(), path.c_str()) < 0) {
+    error_code = errno;
+  }
+  if (error_code != 0) {
+    close(fd);
+    unlink(bound.c_str());
+    rmdir(directory.c_str());
+    throw std::system_error(error_code, std::generic_category(), "Failed to listen on " + path);
+  }
+  rmdir(directory.c_str());
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    error_code = errno;
+    close(fd);
+    unlink(path.c_str());
+    throw std::system_error(error_code, std::generic_category(), "Failed to create eventfd");
+  }
+  listen_fd_ = fd;
+  path_ = path;
+  thread_ = std::thread(&MetricsExporter::Run, this);
+}
+
+void MetricsExporter::Stop() {
+  if (thread_.joinable()) {
+    uint64_t one = 1;
+    (void)!write(stop_fd_, &one, sizeof(one));
+    thread_.join();
+  }
+  if (stop_fd_ >= 0) {
+    close(stop_fd_);
+    stop_fd_ = -1;
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    unlink(path_.c_str());
+  }
+  path_.clear();
+}
+
+void MetricsExporter::Run() {
+  pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  for (;;) {
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      std::cerr << "Metrics exporter: poll failed with errno " << errno << std::endl;
+      return;
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+      return;
+    }
+    if ((fds[0].revents & POLLIN) == 0) {
+      continue;
+    }
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+      continue;
+    }
+    try {
+      Serve(fd);
+    } catch (std::exception& e) {
+      std::cerr << "Metrics exporter: " << e.what() << std::endl;
+    }
+    close(fd);
+  }
+}
+
+void MetricsExporter::Serve(int fd) {
+  // Only the request line matters; headers are read up to the blank line and ignored.
+  char request[kMaxRequest];
+  size_t length = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kClientTimeout);
+  while (length < sizeof(request) && memmem(request, length, "\r\n\r\n", 4) == nullptr) {
+    int remaining = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+    pollfd fds[2] = {{fd, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+    if (remaining <= 0 || poll(fds, 2, remaining) <= 0 || (fds[1].revents & POLLIN) != 0) {
+      return;
+    }
+    ssize_t n = recv(fd, request + length, sizeof(request) - length, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    length += n;
+  }
+
+  std::string_view line(request, length);
+  line = line.substr(0, line.find("\r\n"));
+  const char* status_line = "200 OK";
+  if (line.substr(0, 4) != "GET ") {
+    status_line = "405 Method Not Allowed";
+  } else {
+    std::string_view target = line.substr(4, line.find(' ', 4) - 4);
+    if (target != "/metrics" && target != "/") {
+      status_line = "404 Not Found";
+    }
+  }
+
+  body_.clear();
+  if (strcmp(status_line, "200 OK") == 0) {
+    std::vector<PeerSample> peers;
+    int ifindex = metrics_->tunnel();
+    if (ifindex != 0) {
+      try {
+        peers = sample_peers_(ifindex);
+      } catch (std::exception& e) {
+        // The tunnel may be going down; its status and histograms are still worth serving.
+        std::cerr << "Metrics exporter: cannot read peers: " << e.what() << std::endl;
+      }
+    }
+    RenderOpenMetrics(*metrics_, peers, UnixMillisNow(), &body_);
+  }
+  response_.clear();
+  Append(&response_, "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+         status_line, strcmp(status_line, "200 OK") == 0 ? kContentType : "text/plain", body_.size());
+  response_ += body_;
+  SendAll(fd, response_);
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,160 @@
+#ifndef WIREGUARD_DART_METRICS_EXPORTER_H
+#define WIREGUARD_DART_METRICS_EXPORTER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connection_status.h"
+#include "handshake_watchdog.h"
+#include "quality_prober.h"
+#include "reactor.h"
+
+namespace wireguard_dart {
+
+// The steps of connect and disconnect whose latency is recorded.
+enum class ConnectPhase {
+  // Resolving and racing endpoint host names.
+  resolve,
+  // Creating and configuring the interface, addresses, routes and rules.
+  up,
+  // Path MTU discovery after connecting.
+  mtu,
+  // Deleting the interface on disconnect.
+  down,
+};
+
+// Why a running tunnel was set up or moved again.
+enum class ReconnectReason {
+  // connect while a tunnel was connected already.
+  connect,
+  // Rebound after the network underneath changed.
+  network_change,
+  // Switched to another address of an endpoint host name.
+  endpoint,
+  // A recovery step of the handshake watchdog for a peer that stopped answering.
+  stall,
+};
+
+// A latency histogram with fixed buckets that is updated and read without locks.
+class LatencyHistogram {
+ public:
+  // Upper bounds of the buckets in microseconds; observations above the last go to the +Inf bucket.
+  static constexpr std::array<int64_t, 12> kBounds = {1000,   5000,    10000,   25000,   50000,   100000,
+                                                      250000, 500000, 1000000, 2500000, 5000000, 10000000};
+
+  void Observe(std::chrono::steady_clock::duration duration);
+
+  // Non-cumulative counts, the +Inf bucket last. Buckets are read one at a time, so an observation made meanwhile
+  // may be missing from the sum or the counts.
+  std::array<uint64_t, kBounds.size() + 1> counts() const;
+  uint64_t sum_micros() const { return sum_micros_.load(std::memory_order_relaxed); }
+
+ private:
+  std::array<std::atomic<uint64_t>, kBounds.size() + 1> counts_ = {};
+  std::atomic<uint64_t> sum_micros_{0};
+};
+
+// What the exporter serves, updated by the tunnel control path with relaxed atomic stores only, so that a scrape
+// never holds up connect or disconnect.
+class TunnelMetrics {
+ public:
+  void SetStatus(ConnectionStatus status) { status_.store(status, std::memory_order_relaxed); }
+  ConnectionStatus status() const { return status_.load(std::memory_order_relaxed); }
+
+  // The interface index of the running tunnel whose peers are reported, 0 if there is none.
+  void SetTunnel(int ifindex) { ifindex_.store(ifindex, std::memory_order_relaxed); }
+  int tunnel() const { return ifindex_.load(std::memory_order_relaxed); }
+
+  void ObservePhase(ConnectPhase phase, std::chrono::steady_clock::duration duration) {
+    phases_[static_cast<size_t>(phase)].Observe(duration);
+  }
+  const LatencyHistogram& phase(ConnectPhase phase) const { return phases_[static_cast<size_t>(phase)]; }
+
+  void CountReconnect(ReconnectReason reason) {
+    reconnects_[static_cast<size_t>(reason)].fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t reconnects(ReconnectReason reason) const {
+    return reconnects_[static_cast<size_t>(reason)].load(std::memory_order_relaxed);
+  }
+
+  // The latest estimates of the quality prober, or nullptr while it does not run. The fields are stored one at a
+  // time, so a scrape may mix two consecutive estimates.
+  void SetQuality(const LinkQuality* quality);
+  // False while the quality prober does not run.
+  bool quality(LinkQuality* quality) const;
+
+  // The reactor whose wakeups are reported, which must outlive the metrics; nullptr reports none.
+  void SetReactor(const Reactor* reactor) { reactor_.store(reactor, std::memory_order_relaxed); }
+  const Reactor* reactor() const { return reactor_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<ConnectionStatus> status_{ConnectionStatus::disconnected};
+  std::atomic<int> ifindex_{0};
+  std::array<LatencyHistogram, 4> phases_;
+  std::array<std::atomic<uint64_t>, 4> reconnects_ = {};
+  std::atomic<bool> probing_{false};
+  std::atomic<double> rtt_median_{0};
+  std::atomic<double> rtt_p90_{0};
+  std::atomic<double> rtt_p99_{0};
+  std::atomic<double> jitter_{0};
+  std::atomic<double> loss_{0};
+  std::atomic<uint64_t> probes_received_{0};
+  std::atomic<const Reactor*> reactor_{nullptr};
+};
+
+// Renders the metrics and the counters of the tunnel's peers in the OpenMetrics text format, ending with "# EOF".
+// `now` is the current Unix epoch time in milliseconds, to turn handshake times into ages. `out` is cleared first and
+// keeps its capacity, so that rendering into the same string again does not allocate.
+void RenderOpenMetrics(const TunnelMetrics& metrics, const std::vector<PeerSample>& peers, int64_t now,
+                       std::string* out);
+
+// Serves TunnelMetrics over HTTP on a unix domain socket, for a local agent to scrape, e.g. with
+// `curl --unix-socket <path> http://localhost/metrics`. Nothing is exposed on the network. Scrapes are answered one at
+// a time on a thread of their own; peer counters are read from the device at scrape time through `sample_peers`.
+class MetricsExporter {
+ public:
+  // Returns the peers of the tunnel with the given interface index. Called on the exporter thread.
+  using PeerSampler = std::function<std::vector<PeerSample>(int ifindex)>;
+
+  MetricsExporter(const TunnelMetrics* metrics, PeerSampler sample_peers)
+      : metrics_(metrics), sample_peers_(sample_peers) {}
+  ~MetricsExporter();
+
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  // Listens on `path`, stopping a previous listener. A socket file left at `path` by an earlier run is replaced; the
+  // socket is only ever accessible to the owner and group. Throws std::system_error.
+  void Start(const std::string& path);
+  // Stops listening and removes the socket file.
+  void Stop();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  void Run();
+  // Reads one request from `fd` and answers it.
+  void Serve(int fd);
+
+  const TunnelMetrics* metrics_;
+  PeerSampler sample_peers_;
+  std::string path_;
+  int listen_fd_ = -1;
+  // Written to by Stop to wake the thread.
+  int stop_fd_ = -1;
+  std::thread thread_;
+  // Reused across scrapes.
+  std::string body_;
+  std::string response_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,328 @@
+#include "netlink.h"
+
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/genetlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+// Every message of a batch is acknowledged by its own skb, which is charged to our receive buffer at several hundred
+// bytes; this many fit into the default buffer with room to spare, so no acknowledgement is dropped.
+const size_t kMaxBatchMessages = 128;
+const size_t kMaxBatchBytes = 32768;
+
+NetlinkError::NetlinkError(const std::string& message, int error_code)
+    : std::runtime_error(message + ": " + strerror(error_code)), error_code_(error_code) {}
+
+NetlinkMessage::NetlinkMessage(uint16_t type, uint16_t flags) { Reset(type, flags); }
+
+void NetlinkMessage::Reset(uint16_t type, uint16_t flags) {
+  buffer_.clear();
+  nlmsghdr header = {};
+  header.nlmsg_type = type;
+  header.nlmsg_flags = flags;
+  Append(&header, sizeof(header));
+}
+
+void* NetlinkMessage::Append(const void* data, size_t length) {
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + NLMSG_ALIGN(length));
+  memcpy(buffer_.data() + offset, data, length);
+  header()->nlmsg_len = buffer_.size();
+  return buffer_.data() + offset;
+}
+
+void NetlinkMessage::PutAttribute(uint16_t type, const void* data, size_t length) {
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + NLA_ALIGN(NLA_HDRLEN + length));
+  auto* attribute = reinterpret_cast<nlattr*>(buffer_.data() + offset);
+  attribute->nla_type = type;
+  attribute->nla_len = NLA_HDRLEN + length;
+  if (length > 0) {
+    memcpy(buffer_.data() + offset + NLA_HDRLEN, data, length);
+  }
+  header()->nlmsg_len = buffer_.size();
+}
+
+size_t NetlinkMessage::BeginNested(uint16_t type) {
+  size_t offset = buffer_.size();
+  PutAttribute(type | NLA_F_NESTED, nullptr, 0);
+  return offset;
+}
+
+void NetlinkMessage::EndNested(size_t token) {
+  auto* attribute = reinterpret_cast<nlattr*>(buffer_.data() + token);
+  attribute->nla_len = buffer_.size() - token;
+}
+
+void NetlinkBatch::Add(const NetlinkMessage& message) {
+  offsets_.push_back(buffer_.size());
+  auto* data = static_cast<const char*>(message.data());
+  buffer_.insert(buffer_.end(), data, data + message.size());
+}
+
+void ForEachAttribute(const void* data, size_t length, const std::function<void(const nlattr*)>& visit) {
+  for (const nlattr* attribute : AttributeRange(data, length)) {
+    visit(attribute);
+  }
+}
+
+NetlinkSocket::NetlinkSocket(int protocol, uint32_t groups) : sequence_(static_cast<uint32_t>(time(nullptr))) {
+  fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+  if (fd_ < 0) {
+    throw NetlinkError("Failed to open netlink socket", errno);
+  }
+
+  sockaddr_nl address = {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = groups;
+  if (bind(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    int error_code = errno;
+    close(fd_);
+    throw NetlinkError("Failed to bind netlink socket", error_code);
+  }
+
+  // Keep error acknowledgements small: they would otherwise echo the whole failed request.
+  int enabled = 1;
+  setsockopt(fd_, SOL_NETLINK, NETLINK_CAP_ACK, &enabled, sizeof(enabled));
+
+  // Large enough for a full page of dump messages.
+  receive_buffer_.resize(32768);
+}
+
+NetlinkSocket::~NetlinkSocket() { close(fd_); }
+
+void NetlinkSocket::Request(NetlinkMessage& message, const std::function<void(const nlmsghdr*)>& on_message) {
+  nlmsghdr* request = message.header();
+  request->nlmsg_seq = ++sequence_;
+  request->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+  bool dump = (request->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(fd_, message.data(), message.size(), 0, reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    throw NetlinkError("Failed to send netlink request", errno);
+  }
+
+  for (;;) {
+    ssize_t received = recv(fd_, receive_buffer_.data(), receive_buffer_.size(), 0);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw NetlinkError("Failed to receive netlink reply", errno);
+    }
+
+    auto* reply = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+    auto remaining = static_cast<int>(received);
+    for (; NLMSG_OK(reply, remaining); reply = NLMSG_NEXT(reply, remaining)) {
+      if (reply->nlmsg_seq != request->nlmsg_seq) {
+        continue;
+      }
+      if (reply->nlmsg_type == NLMSG_DONE) {
+        return;
+      }
+      if (reply->nlmsg_type == NLMSG_ERROR) {
+        auto* error = static_cast<const nlmsgerr*>(NLMSG_DATA(reply));
+        if (error->error != 0) {
+          throw NetlinkError("Netlink request failed", -error->error);
+        }
+        // ACK. A dump still ends with NLMSG_DONE.
+        if (!dump) {
+          return;
+        }
+        continue;
+      }
+      if (on_message) {
+        on_message(reply);
+      }
+    }
+  }
+}
+
+std::vector<int> NetlinkSocket::RequestBatch(NetlinkBatch& batch) {
+  std::vector<int> errors(batch.size(), 0);
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+
+  size_t next = 0;
+  while (next < batch.size()) {
+    size_t first = next;
+    size_t begin = batch.offsets_[first];
+    size_t end = begin;
+    uint32_t first_sequence = sequence_ + 1;
+    while (next < batch.size() && next - first < kMaxBatchMessages) {
+      size_t message_end = next + 1 < batch.size() ? batch.offsets_[next + 1] : batch.buffer_.size();
+      if (next > first && message_end - begin > kMaxBatchBytes) {
+        break;
+      }
+      auto* header = reinterpret_cast<nlmsghdr*>(batch.buffer_.data() + batch.offsets_[next]);
+      header->nlmsg_seq = ++sequence_;
+      header->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+      end = message_end;
+      next++;
+    }
+
+    iovec chunk = {batch.buffer_.data() + begin, end - begin};
+    msghdr request = {};
+    request.msg_name = &kernel;
+    request.msg_namelen = sizeof(kernel);
+    request.msg_iov = &chunk;
+    request.msg_iovlen = 1;
+    if (sendmsg(fd_, &request, 0) < 0) {
+      std::fill(errors.begin() + static_cast<std::ptrdiff_t>(first), errors.end(), errno);
+      return errors;
+    }
+
+    size_t pending = next - first;
+    while (pending > 0) {
+      ssize_t received = recv(fd_, receive_buffer_.data(), receive_buffer_.size(), 0);
+      if (received < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw NetlinkError("Failed to receive netlink acknowledgements", errno);
+      }
+      auto* reply = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+      auto remaining = static_cast<int>(received);
+      for (; NLMSG_OK(reply, remaining); reply = NLMSG_NEXT(reply, remaining)) {
+        uint32_t index = reply->nlmsg_seq - first_sequence;
+        if (reply->nlmsg_type != NLMSG_ERROR || index >= next - first) {
+          continue;
+        }
+        errors[first + index] = -static_cast<const nlmsgerr*>(NLMSG_DATA(reply))->error;
+        pending--;
+      }
+    }
+  }
+  return errors;
+}
+
+void NetlinkSocket::Transact(NetlinkBatch& batch, uint16_t subsystem) {
+  nfgenmsg batch_header = {};
+  batch_header.nfgen_family = AF_UNSPEC;
+  batch_header.version = NFNETLINK_V0;
+  batch_header.res_id = htons(subsystem);
+  NetlinkMessage begin(NFNL_MSG_BATCH_BEGIN, NLM_F_REQUEST);
+  begin.AppendHeader(batch_header);
+  NetlinkMessage end(NFNL_MSG_BATCH_END, NLM_F_REQUEST);
+  end.AppendHeader(batch_header);
+
+  uint32_t first_sequence = ++sequence_;
+  begin.header()->nlmsg_seq = first_sequence;
+  for (size_t offset : batch.offsets_) {
+    auto* header = reinterpret_cast<nlmsghdr*>(batch.buffer_.data() + offset);
+    header->nlmsg_seq = ++sequence_;
+    header->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+  }
+  end.header()->nlmsg_seq = ++sequence_;
+
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  iovec parts[] = {{const_cast<void*>(begin.data()), begin.size()},
+                   {batch.buffer_.data(), batch.buffer_.size()},
+                   {const_cast<void*>(end.data()), end.size()}};
+  msghdr request = {};
+  request.msg_name = &kernel;
+  request.msg_namelen = sizeof(kernel);
+  request.msg_iov = parts;
+  request.msg_iovlen = 3;
+  if (sendmsg(fd_, &request, 0) < 0) {
+    throw NetlinkError("Failed to send netlink transaction", errno);
+  }
+
+  // The kernel handles the transaction within sendmsg, so all of its acknowledgements are queued by now. A rejected
+  // transaction may be answered by fewer of them, e.g. a single error for the batch as a whole.
+  size_t acknowledged = 0;
+  int first_error = 0;
+  for (;;) {
+    ssize_t received = recv(fd_, receive_buffer_.data(), receive_buffer_.size(), MSG_DONTWAIT);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      throw NetlinkError("Failed to receive netlink acknowledgements", errno);
+    }
+    auto* reply = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+    auto remaining = static_cast<int>(received);
+    for (; NLMSG_OK(reply, remaining); reply = NLMSG_NEXT(reply, remaining)) {
+      if (reply->nlmsg_type != NLMSG_ERROR || reply->nlmsg_seq - first_sequence > sequence_ - first_sequence) {
+        continue;
+      }
+      int error = -static_cast<const nlmsgerr*>(NLMSG_DATA(reply))->error;
+      if (error != 0 && first_error == 0) {
+        first_error = error;
+      }
+      acknowledged++;
+    }
+  }
+  if (first_error != 0) {
+    throw NetlinkError("Netlink transaction failed", first_error);
+  }
+  if (acknowledged < batch.size()) {
+    throw NetlinkError("Netlink transaction was not acknowledged", EIO);
+  }
+}
+
+bool NetlinkSocket::ReceiveNotifications(const std::function<void(const nlmsghdr*)>& on_message) {
+  bool complete = true;
+  for (;;) {
+    ssize_t received = recv(fd_, receive_buffer_.data(), receive_buffer_.size(), MSG_DONTWAIT);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        complete = false;
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return complete;
+      }
+      throw NetlinkError("Failed to receive netlink notifications", errno);
+    }
+    auto* message = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+    auto remaining = static_cast<int>(received);
+    for (; NLMSG_OK(message, remaining); message = NLMSG_NEXT(message, remaining)) {
+      on_message(message);
+    }
+  }
+}
+
+uint16_t NetlinkSocket::ResolveFamily(const char* name) {
+  NetlinkMessage message(GENL_ID_CTRL, 0);
+  genlmsghdr genl = {};
+  genl.cmd = CTRL_CMD_GETFAMILY;
+  genl.version = 1;
+  message.AppendHeader(genl);
+  message.PutAttribute(CTRL_ATTR_FAMILY_NAME, name, strlen(name) + 1);
+
+  uint16_t family = 0;
+  Request(message, [&family](const nlmsghdr* reply) {
+    auto* payload = static_cast<const char*>(NLMSG_DATA(reply)) + GENL_HDRLEN;
+    ForEachAttribute(payload, reply->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN, [&family](const nlattr* attribute) {
+      if (AttributeType(attribute) == CTRL_ATTR_FAMILY_ID) {
+        family = *static_cast<const uint16_t*>(AttributeData(attribute));
+      }
+    });
+  });
+  if (family == 0) {
+    throw NetlinkError(std::string("Generic netlink family not found: ") + name, ENOENT);
+  }
+  return family;
+}
+
+}  // namespace wireguard_dart
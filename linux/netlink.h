@@ -0,0 +1,174 @@
+#ifndef WIREGUARD_DART_NETLINK_H
+#define WIREGUARD_DART_NETLINK_H
+
+#include <linux/netlink.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+class NetlinkError : public std::runtime_error {
+ public:
+  NetlinkError(const std::string& message, int error_code);
+
+  // errno value reported by the kernel or the failing syscall.
+  int error_code() const { return error_code_; }
+
+ private:
+  int error_code_;
+};
+
+// Builds a single netlink message: header, fixed family header and attributes.
+class NetlinkMessage {
+ public:
+  NetlinkMessage(uint16_t type, uint16_t flags);
+
+  // Starts over with an empty message of the given type, keeping the buffer so that no allocation is needed.
+  void Reset(uint16_t type, uint16_t flags);
+
+  // Preallocates room for a message of `size` bytes.
+  void Reserve(size_t size) { buffer_.reserve(size); }
+
+  // Appends a fixed-size family header (ifinfomsg, genlmsghdr, ...) right after nlmsghdr.
+  template <typename T>
+  T* AppendHeader(const T& header) {
+    return static_cast<T*>(Append(&header, sizeof(T)));
+  }
+
+  void PutAttribute(uint16_t type, const void* data, size_t length);
+  void PutU8(uint16_t type, uint8_t value) { PutAttribute(type, &value, sizeof(value)); }
+  void PutU16(uint16_t type, uint16_t value) { PutAttribute(type, &value, sizeof(value)); }
+  void PutU32(uint16_t type, uint32_t value) { PutAttribute(type, &value, sizeof(value)); }
+  void PutString(uint16_t type, const std::string& value) { PutAttribute(type, value.c_str(), value.size() + 1); }
+
+  // Opens a nested attribute; returns a token to pass to EndNested.
+  size_t BeginNested(uint16_t type);
+  void EndNested(size_t token);
+
+  nlmsghdr* header() { return reinterpret_cast<nlmsghdr*>(buffer_.data()); }
+  const void* data() const { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+
+ private:
+  void* Append(const void* data, size_t length);
+
+  std::vector<char> buffer_;
+};
+
+// Requests sent together by NetlinkSocket::RequestBatch. Messages are copied in back to back, as the kernel reads them
+// from a single buffer.
+class NetlinkBatch {
+ public:
+  void Add(const NetlinkMessage& message);
+
+  size_t size() const { return offsets_.size(); }
+  bool empty() const { return offsets_.empty(); }
+
+ private:
+  friend class NetlinkSocket;
+
+  std::vector<char> buffer_;
+  std::vector<size_t> offsets_;
+};
+
+inline const void* AttributeData(const nlattr* attribute) {
+  return reinterpret_cast<const char*>(attribute) + NLA_HDRLEN;
+}
+
+inline size_t AttributeLength(const nlattr* attribute) { return attribute->nla_len - NLA_HDRLEN; }
+
+inline uint16_t AttributeType(const nlattr* attribute) { return attribute->nla_type & NLA_TYPE_MASK; }
+
+// The attributes in [data, data + length) for range-based for loops, read in place without copying or allocating.
+// Iteration stops at the first attribute that does not fit the remaining length.
+class AttributeRange {
+ public:
+  class Iterator {
+   public:
+    Iterator(const nlattr* attribute, size_t remaining) : attribute_(attribute), remaining_(remaining) { Check(); }
+
+    const nlattr* operator*() const { return attribute_; }
+    bool operator!=(const Iterator& other) const { return attribute_ != other.attribute_; }
+    Iterator& operator++() {
+      size_t aligned = NLA_ALIGN(attribute_->nla_len);
+      remaining_ = aligned < remaining_ ? remaining_ - aligned : 0;
+      attribute_ = reinterpret_cast<const nlattr*>(reinterpret_cast<const char*>(attribute_) + aligned);
+      Check();
+      return *this;
+    }
+
+   private:
+    void Check() {
+      if (remaining_ < NLA_HDRLEN || attribute_->nla_len < NLA_HDRLEN || attribute_->nla_len > remaining_) {
+        attribute_ = nullptr;
+      }
+    }
+
+    const nlattr* attribute_;
+    size_t remaining_;
+  };
+
+  AttributeRange(const void* data, size_t length) : data_(data), length_(length) {}
+  // The payload of a nested attribute; empty for nullptr.
+  explicit AttributeRange(const nlattr* nested)
+      : data_(nested != nullptr ? AttributeData(nested) : nullptr),
+        length_(nested != nullptr ? AttributeLength(nested) : 0) {}
+
+  Iterator begin() const { return Iterator(static_cast<const nlattr*>(data_), length_); }
+  Iterator end() const { return Iterator(nullptr, 0); }
+
+ private:
+  const void* data_;
+  size_t length_;
+};
+
+// Calls `visit` for every attribute in [data, data + length).
+void ForEachAttribute(const void* data, size_t length, const std::function<void(const nlattr*)>& visit);
+
+// Blocking netlink socket bound to a kernel protocol (NETLINK_ROUTE, NETLINK_GENERIC, ...).
+class NetlinkSocket {
+ public:
+  explicit NetlinkSocket(int protocol, uint32_t groups = 0);
+  ~NetlinkSocket();
+
+  NetlinkSocket(const NetlinkSocket&) = delete;
+  NetlinkSocket& operator=(const NetlinkSocket&) = delete;
+
+  int fd() const { return fd_; }
+
+  // Sends `message` and reads replies until it is acknowledged or, for dumps, until NLMSG_DONE. Every data message
+  // of the reply is passed to `on_message`. Throws NetlinkError if the kernel reports an error.
+  void Request(NetlinkMessage& message, const std::function<void(const nlmsghdr*)>& on_message = nullptr);
+
+  // Sends all messages of `batch`, packing many of them into each sendmsg, and collects their acknowledgements. The
+  // kernel handles the messages one by one and carries on after a failed one, so instead of throwing this returns the
+  // errno value of every message, 0 for success. Messages that could not be sent at all report the send error.
+  // Throws NetlinkError only if acknowledgements cannot be read, which leaves the outcome unknown.
+  std::vector<int> RequestBatch(NetlinkBatch& batch);
+
+  // Sends all messages of `batch` to the nfnetlink `subsystem` (NFNL_SUBSYS_NFTABLES, ...) as one transaction, framed
+  // by NFNL_MSG_BATCH_BEGIN and NFNL_MSG_BATCH_END in a single sendmsg. The kernel applies every message or, if any
+  // fails, none of them. Throws NetlinkError with the error of the first failed message.
+  void Transact(NetlinkBatch& batch, uint16_t subsystem);
+
+  // Resolves the id of a generic netlink family, e.g. "wireguard".
+  uint16_t ResolveFamily(const char* name);
+
+  // Passes every multicast notification queued on a socket bound to `groups` to `on_message`, without blocking.
+  // Returns false if the kernel dropped notifications because the receive buffer overflowed.
+  bool ReceiveNotifications(const std::function<void(const nlmsghdr*)>& on_message);
+
+ private:
+  int fd_;
+  uint32_t sequence_;
+  std::vector<char> receive_buffer_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,145 @@
+#include "network_monitor.h"
+
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+#include "netlink.h"
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+// The attributes following the family header of a message at least NLMSG_LENGTH(header_size) long.
+static AttributeRange Attributes(const nlmsghdr* message, size_t header_size) {
+  size_t header_length = NLMSG_LENGTH(NLMSG_ALIGN(header_size));
+  if (message->nlmsg_len < header_length) {
+    return AttributeRange(nullptr, 0);
+  }
+  return AttributeRange(reinterpret_cast<const char*>(message) + header_length, message->nlmsg_len - header_length);
+}
+
+static bool HasAttribute(const nlmsghdr* message, size_t header_size, uint16_t type) {
+  for (const nlattr* attribute : Attributes(message, header_size)) {
+    if (AttributeType(attribute) == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsUnderlayChange(const nlmsghdr* message, int tunnel_ifindex) {
+  switch (message->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK: {
+      if (message->nlmsg_len < NLMSG_LENGTH(sizeof(ifinfomsg))) {
+        return false;
+      }
+      auto* link = static_cast<const ifinfomsg*>(NLMSG_DATA(message));
+      // Wireless drivers report scan results and other events as link notifications without any change to the link.
+      return link->ifi_index != tunnel_ifindex && !HasAttribute(message, sizeof(ifinfomsg), IFLA_WIRELESS);
+    }
+    case RTM_NEWADDR:
+    case RTM_DELADDR: {
+      if (message->nlmsg_len < NLMSG_LENGTH(sizeof(ifaddrmsg))) {
+        return false;
+      }
+      auto* address = static_cast<const ifaddrmsg*>(NLMSG_DATA(message));
+      return static_cast<int>(address->ifa_index) != tunnel_ifindex && address->ifa_scope < RT_SCOPE_LINK;
+    }
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE: {
+      if (message->nlmsg_len < NLMSG_LENGTH(sizeof(rtmsg))) {
+        return false;
+      }
+      auto* route = static_cast<const rtmsg*>(NLMSG_DATA(message));
+      uint32_t table = route->rtm_table;
+      int oif = 0;
+      for (const nlattr* attribute : Attributes(message, sizeof(rtmsg))) {
+        if (AttributeType(attribute) == RTA_TABLE && AttributeLength(attribute) >= sizeof(uint32_t)) {
+          table = *static_cast<const uint32_t*>(AttributeData(attribute));
+        } else if (AttributeType(attribute) == RTA_OIF && AttributeLength(attribute) >= sizeof(int)) {
+          oif = *static_cast<const int*>(AttributeData(attribute));
+        }
+      }
+      return table == RT_TABLE_MAIN && (route->rtm_flags & RTM_F_CLONED) == 0 && oif != tunnel_ifindex;
+    }
+    default:
+      return false;
+  }
+}
+
+NetworkMonitor::~NetworkMonitor() { Stop(); }
+
+void NetworkMonitor::Start(int tunnel_ifindex) {
+  Stop();
+  socket_ = std::make_unique<NetlinkSocket>(NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                                                               RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE);
+  reactor_->Invoke([this, tunnel_ifindex] {
+    tunnel_ifindex_ = tunnel_ifindex;
+    debouncer_.Reset();
+    reactor_->Watch(socket_->fd(), EPOLLIN, [this](uint32_t) { OnNotifications(); });
+  });
+}
+
+void NetworkMonitor::Stop() {
+  if (socket_ == nullptr) {
+    return;
+  }
+  reactor_->Invoke([this] {
+    reactor_->Unwatch(socket_->fd());
+    if (settle_timer_ != 0) {
+      reactor_->CancelTimer(settle_timer_);
+      settle_timer_ = 0;
+    }
+  });
+  socket_.reset();
+}
+
+void NetworkMonitor::OnNotifications() {
+  bool changed = false;
+  bool complete = true;
+  try {
+    complete = socket_->ReceiveNotifications(
+        [this, &changed](const nlmsghdr* message) { changed |= IsUnderlayChange(message, tunnel_ifindex_); });
+  } catch (std::exception& e) {
+    std::cerr << "Network monitor: " << e.what() << std::endl;
+    reactor_->Unwatch(socket_->fd());
+    return;
+  }
+  // After an overflow the lost notifications may have been changes too.
+  if (!changed && complete) {
+    return;
+  }
+  debouncer_.Notify(SteadyMillisNow());
+  if (settle_timer_ != 0) {
+    reactor_->CancelTimer(settle_timer_);
+  }
+  int64_t delay = std::max<int64_t>(debouncer_.deadline() - SteadyMillisNow(), 0);
+  settle_timer_ = reactor_->AddTimer(std::chrono::milliseconds(delay), [this] { OnSettled(); });
+}
+
+void NetworkMonitor::OnSettled() {
+  settle_timer_ = 0;
+  int64_t now = SteadyMillisNow();
+  if (!debouncer_.Due(now)) {
+    int64_t deadline = debouncer_.deadline();
+    if (deadline >= 0) {
+      settle_timer_ = reactor_->AddTimer(std::chrono::milliseconds(deadline - now), [this] { OnSettled(); });
+    }
+    return;
+  }
+  try {
+    on_change_();
+  } catch (std::exception& e) {
+    std::cerr << "Network monitor: " << e.what() << std::endl;
+  }
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,55 @@
+#ifndef WIREGUARD_DART_NETWORK_MONITOR_H
+#define WIREGUARD_DART_NETWORK_MONITOR_H
+
+#include <linux/netlink.h>
+
+#include <functional>
+#include <memory>
+
+#include "netlink.h"
+#include "network_change.h"
+#include "reactor.h"
+
+namespace wireguard_dart {
+
+// Whether an rtnetlink notification is about the network underneath the tunnel: a link other than the tunnel
+// appearing, going down or coming up, a global address being added or removed on one, or a main table route that
+// does not go through the tunnel changing. The tunnel's own link, addresses and routes, link-local addresses and the
+// routes of other tables, such as those of our policy rules, are not.
+bool IsUnderlayChange(const nlmsghdr* message, int tunnel_ifindex);
+
+// Watches the rtnetlink link, address and route groups while a tunnel is up and calls `on_change` on the reactor
+// thread once a burst of underlay changes has settled, so that the tunnel can be rebound in place instead of being
+// torn down and set up again. The notification socket and the settle timer live on the reactor; the monitor has no
+// thread of its own.
+class NetworkMonitor {
+ public:
+  NetworkMonitor(Reactor* reactor, std::function<void()> on_change) : reactor_(reactor), on_change_(on_change) {}
+  ~NetworkMonitor();
+
+  NetworkMonitor(const NetworkMonitor&) = delete;
+  NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+  // Starts watching on behalf of the tunnel with the given interface index, stopping a previous watch. Throws
+  // NetlinkError if the notification socket cannot be opened.
+  void Start(int tunnel_ifindex);
+  // Once this returns, `on_change` is neither running nor called again.
+  void Stop();
+
+ private:
+  // Handlers on the reactor thread.
+  void OnNotifications();
+  void OnSettled();
+
+  Reactor* reactor_;
+  std::function<void()> on_change_;
+  int tunnel_ifindex_ = 0;
+  NetworkChangeDebouncer debouncer_;
+  std::unique_ptr<NetlinkSocket> socket_;
+  // Fires when the pending burst is due; 0 while none is pending.
+  Reactor::TimerId settle_timer_ = 0;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,431 @@
+#include "profile_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+namespace wireguard_dart {
+
+namespace {
+
+const char kMagic[8] = {'W', 'G', 'P', 'R', 'O', 'F', 'S', '\0'};
+const uint32_t kVersion = 1;
+// Record flags. A tombstone or an alias holds no config.
+const uint32_t kRemoved = 1;
+const uint32_t kAlias = 2;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved[13];
+};
+static_assert(sizeof(Header) == 64, "records start 8 byte aligned");
+
+// Profiles parsed per thread at least, so that small imports do not pay for threads.
+const size_t kImportChunk = 64;
+
+// FNV-1a. Used both to find identical configs and to detect torn records.
+uint64_t Hash(const void* data, size_t length, uint64_t hash = 14695981039346656037ull) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+size_t Align(size_t length) { return (length + 7) & ~static_cast<size_t>(7); }
+
+// Endpoints and public keys of the peers of a config in the canonical form of WireguardConfig::ToString, read without
+// parsing it again.
+void PeerFields(const char* text, size_t length, std::vector<std::string>* endpoints,
+                std::vector<std::string>* public_keys) {
+  static const char kPeer[] = "\n[Peer]\n";
+  static const char kEndpoint[] = "Endpoint = ";
+  static const char kPublicKey[] = "PublicKey = ";
+  const char* end = text + length;
+  const char* line = std::search(text, end, kPeer, kPeer + sizeof(kPeer) - 1);
+  while (line < end) {
+    const char* line_end = std::find(line, end, '\n');
+    size_t line_length = line_end - line;
+    if (line_length > sizeof(kEndpoint) - 1 && memcmp(line, kEndpoint, sizeof(kEndpoint) - 1) == 0) {
+      endpoints->emplace_back(line + sizeof(kEndpoint) - 1, line_end);
+    } else if (line_length > sizeof(kPublicKey) - 1 && memcmp(line, kPublicKey, sizeof(kPublicKey) - 1) == 0) {
+      public_keys->emplace_back(line + sizeof(kPublicKey) - 1, line_end);
+    }
+    line = line_end + (line_end < end ? 1 : 0);
+  }
+}
+
+void Erase(std::unordered_map<std::string, std::vector<ProfileStore::ProfileId>>* index, const std::string& key,
+           ProfileStore::ProfileId id) {
+  auto found = index->find(key);
+  if (found == index->end()) {
+    return;
+  }
+  std::vector<ProfileStore::ProfileId>& ids = found->second;
+  ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+  if (ids.empty()) {
+    index->erase(found);
+  }
+}
+
+struct ParsedProfile {
+  std::string config;
+  uint64_t hash = 0;
+  std::string error;
+};
+
+}  // namespace
+
+// Followed by the name and the config text, padded to a multiple of 8 bytes.
+struct ProfileStore::Record {
+  // Of the fields below and the name and config text.
+  uint64_t checksum;
+  // Of the whole record, padding included.
+  uint32_t length;
+  uint32_t id;
+  uint32_t flags;
+  uint32_t name_length;
+  uint32_t config_length;
+  uint32_t reserved;
+
+  uint64_t Checksum() const {
+    return Hash(reinterpret_cast<const char*>(this) + sizeof(checksum),
+                sizeof(Record) - sizeof(checksum) + name_length + config_length);
+  }
+
+  const char* name() const { return reinterpret_cast<const char*>(this + 1); }
+  const char* config() const { return name() + name_length; }
+};
+
+ProfileStore::ProfileStore(const std::string& path) : file_(path) {
+  static_assert(sizeof(Record) == 32, "records stay 8 byte aligned");
+  if (file_.size() == 0) {
+    Header header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    file_.Resize(kInitialSize);
+    memcpy(file_.data(), &header, sizeof(header));
+  }
+  const Header* header = reinterpret_cast<const Header*>(file_.data());
+  if (file_.size() < sizeof(Header) || memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion) {
+    throw std::runtime_error(path + " is not a profile store");
+  }
+
+  // The records end at the first one that is missing or torn.
+  end_ = sizeof(Header);
+  while (end_ + sizeof(Record) <= file_.size()) {
+    const Record* record = reinterpret_cast<const Record*>(file_.data() + end_);
+    if (record->length < sizeof(Record) || record->length % 8 != 0 || record->length > file_.size() - end_ ||
+        record->id == 0 ||
+        static_cast<uint64_t>(record->name_length) + record->config_length > record->length - sizeof(Record) ||
+        record->checksum != record->Checksum()) {
+      break;
+    }
+    bool stored = record->id < profiles_.size() && profiles_[record->id].has_value();
+    std::string name(record->name(), record->name_length);
+    if ((record->flags & kRemoved) != 0) {
+      if (stored) {
+        dead_bytes_ += RecordBytes(*profiles_[record->id]);
+        Unindex(record->id);
+      }
+      dead_bytes_ += record->length;
+    } else if ((record->flags & kAlias) != 0) {
+      if (stored) {
+        IndexAlias(record->id, end_, name);
+      } else {
+        dead_bytes_ += record->length;
+      }
+    } else {
+      if (stored) {
+        // Not written by this class, which never reuses IDs; the newer record wins.
+        dead_bytes_ += RecordBytes(*profiles_[record->id]);
+        Unindex(record->id);
+      }
+      Index(record->id, end_, name, record->config(), record->config_length);
+    }
+    next_id_ = std::max<ProfileId>(next_id_, record->id + 1);
+    end_ += record->length;
+  }
+  // Records written after a torn one may have reached the disk before it; they must not come back once the space is
+  // reused.
+  if (std::any_of(file_.data() + end_, file_.data() + file_.size(), [](char c) { return c != 0; })) {
+    memset(file_.data() + end_, 0, file_.size() - end_);
+  }
+}
+
+std::vector<ProfileStore::ProfileId> ProfileStore::Import(
+    const std::vector<std::pair<std::string, std::string>>& profiles) {
+  std::unordered_set<std::string> names;
+  for (const std::pair<std::string, std::string>& profile : profiles) {
+    if (!names.insert(profile.first).second) {
+      throw std::invalid_argument("Profile '" + profile.first + "': The name is given more than once");
+    }
+  }
+
+  // Parsing dominates an import of thousands of profiles, and needs no lock.
+  std::vector<ParsedProfile> parsed(profiles.size());
+  size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t chunk = std::max(kImportChunk, (profiles.size() + threads - 1) / threads);
+  std::vector<std::future<void>> parsers;
+  for (size_t first = 0; first < profiles.size(); first += chunk) {
+    size_t last = std::min(first + chunk, profiles.size());
+    parsers.push_back(std::async(std::launch::async, [&profiles, &parsed, first, last] {
+      for (size_t i = first; i < last; i++) {
+        try {
+          if (profiles[i].first.empty()) {
+            throw std::invalid_argument("The name is empty");
+          }
+          parsed[i].config = WireguardConfig::Parse(profiles[i].second).ToString();
+          parsed[i].hash = Hash(parsed[i].config.data(), parsed[i].config.size());
+        } catch (std::exception& e) {
+          parsed[i].error = e.what();
+        }
+      }
+    }));
+  }
+  for (std::future<void>& parser : parsers) {
+    parser.get();
+  }
+  for (size_t i = 0; i < parsed.size(); i++) {
+    if (!parsed[i].error.empty()) {
+      throw std::invalid_argument("Profile '" + profiles[i].first + "': " + parsed[i].error);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<ProfileId> ids;
+  ids.reserve(profiles.size());
+  for (size_t i = 0; i < profiles.size(); i++) {
+    const std::string& name = profiles[i].first;
+    const ParsedProfile& profile = parsed[i];
+    std::optional<ProfileId> existing;
+    auto candidates = by_config_.find(profile.hash);
+    if (candidates != by_config_.end()) {
+      for (ProfileId candidate : candidates->second) {
+        if (ConfigText(*profiles_[candidate]) == profile.config) {
+          existing = candidate;
+          break;
+        }
+      }
+    }
+    auto named = by_name_.find(name);
+    if (named != by_name_.end() && named->second == existing) {
+      ids.push_back(*existing);
+      continue;
+    }
+    if (named != by_name_.end()) {
+      ProfileId replaced = named->second;
+      Append(replaced, kRemoved, std::string(), std::string());
+    }
+    if (existing.has_value()) {
+      Append(*existing, kAlias, name, std::string());
+      ids.push_back(*existing);
+      continue;
+    }
+    ProfileId id = next_id_;
+    Append(id, 0, name, profile.config);
+    next_id_++;
+    ids.push_back(id);
+  }
+  // Imports are rare and the configs hold keys that are hard to get again, so they are on disk before returning.
+  file_.Sync(end_);
+  return ids;
+}
+
+void ProfileStore::Remove(const std::vector<ProfileId>& ids) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (ProfileId id : ids) {
+    if (id < profiles_.size() && profiles_[id].has_value()) {
+      Append(id, kRemoved, std::string(), std::string());
+    }
+  }
+}
+
+std::optional<WireguardConfig> ProfileStore::Find(ProfileId id) {
+  std::string text;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id >= profiles_.size() || !profiles_[id].has_value()) {
+      return std::nullopt;
+    }
+    text = ConfigText(*profiles_[id]);
+  }
+  // Validated on import, so this cannot throw for the canonical text.
+  return WireguardConfig::Parse(text);
+}
+
+std::optional<ProfileStore::ProfileId> ProfileStore::FindByName(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = by_name_.find(name);
+  if (found == by_name_.end()) {
+    return std::nullopt;
+  }
+  return found->second;
+}
+
+std::vector<ProfileStore::ProfileId> ProfileStore::FindByEndpoint(const std::string& endpoint) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = by_endpoint_.find(endpoint);
+  return found != by_endpoint_.end() ? found->second : std::vector<ProfileId>();
+}
+
+std::vector<ProfileStore::ProfileId> ProfileStore::FindByPublicKey(const std::string& public_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = by_public_key_.find(public_key);
+  return found != by_public_key_.end() ? found->second : std::vector<ProfileId>();
+}
+
+size_t ProfileStore::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return live_;
+}
+
+void ProfileStore::Append(ProfileId id, uint32_t flags, const std::string& name, const std::string& config) {
+  size_t length = Align(sizeof(Record) + name.size() + config.size());
+  if (end_ + length > file_.size() && dead_bytes_ > 0 && dead_bytes_ * 2 >= end_ - sizeof(Header)) {
+    Compact();
+  }
+  if (end_ + length > file_.size()) {
+    file_.Resize(std::max(2 * file_.size(), Align(end_ + length)));
+  }
+
+  Record* record = reinterpret_cast<Record*>(file_.data() + end_);
+  record->length = static_cast<uint32_t>(length);
+  record->id = id;
+  record->flags = flags;
+  record->name_length = static_cast<uint32_t>(name.size());
+  record->config_length = static_cast<uint32_t>(config.size());
+  record->reserved = 0;
+  memcpy(reinterpret_cast<char*>(record + 1), name.data(), name.size());
+  memcpy(reinterpret_cast<char*>(record + 1) + name.size(), config.data(), config.size());
+  record->checksum = record->Checksum();
+
+  if ((flags & kRemoved) != 0) {
+    dead_bytes_ += RecordBytes(*profiles_[id]) + length;
+    Unindex(id);
+  } else if ((flags & kAlias) != 0) {
+    IndexAlias(id, end_, name);
+  } else {
+    Index(id, end_, name, record->config(), config.size());
+  }
+  end_ += length;
+}
+
+void ProfileStore::Compact() {
+  // The live records keep their IDs and order, each profile followed by its aliases.
+  std::vector<MappedFile::Chunk> chunks = {{file_.data(), sizeof(Header)}};
+  std::vector<std::optional<Profile>> moved = profiles_;
+  size_t end = sizeof(Header);
+  auto move = [this, &chunks, &end](size_t* offset) {
+    const Record* record = reinterpret_cast<const Record*>(file_.data() + *offset);
+    chunks.push_back({record, record->length});
+    *offset = end;
+    end += record->length;
+  };
+  for (std::optional<Profile>& profile : moved) {
+    if (profile.has_value()) {
+      move(&profile->offset);
+      for (size_t& alias_offset : profile->alias_offsets) {
+        move(&alias_offset);
+      }
+    }
+  }
+  file_.Replace(chunks, file_.size());
+  profiles_ = std::move(moved);
+  end_ = end;
+  dead_bytes_ = 0;
+}
+
+void ProfileStore::Index(ProfileId id, size_t offset, const std::string& name, const char* config,
+                         size_t config_length) {
+  if (id >= profiles_.size()) {
+    profiles_.resize(id + 1);
+  }
+  Profile profile;
+  profile.offset = offset;
+  profile.name = name;
+  profile.hash = Hash(config, config_length);
+  ReleaseName(name, id);
+  by_name_[name] = id;
+  by_config_[profile.hash].push_back(id);
+  std::vector<std::string> endpoints;
+  std::vector<std::string> public_keys;
+  PeerFields(config, config_length, &endpoints, &public_keys);
+  for (const std::string& endpoint : endpoints) {
+    by_endpoint_[endpoint].push_back(id);
+  }
+  for (const std::string& public_key : public_keys) {
+    by_public_key_[public_key].push_back(id);
+  }
+  profiles_[id] = std::move(profile);
+  live_++;
+}
+
+void ProfileStore::IndexAlias(ProfileId id, size_t offset, const std::string& name) {
+  ReleaseName(name, id);
+  by_name_[name] = id;
+  profiles_[id]->alias_offsets.push_back(offset);
+}
+
+void ProfileStore::ReleaseName(const std::string& name, ProfileId id) {
+  auto named = by_name_.find(name);
+  if (named != by_name_.end() && named->second != id) {
+    Unindex(named->second);
+  }
+}
+
+void ProfileStore::Unindex(ProfileId id) {
+  const Profile& profile = *profiles_[id];
+  std::vector<std::string> names = {profile.name};
+  for (size_t alias_offset : profile.alias_offsets) {
+    const Record* alias = reinterpret_cast<const Record*>(file_.data() + alias_offset);
+    names.emplace_back(alias->name(), alias->name_length);
+  }
+  for (const std::string& name : names) {
+    auto named = by_name_.find(name);
+    if (named != by_name_.end() && named->second == id) {
+      by_name_.erase(named);
+    }
+  }
+  auto hashed = by_config_.find(profile.hash);
+  if (hashed != by_config_.end()) {
+    std::vector<ProfileId>& ids = hashed->second;
+    ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+    if (ids.empty()) {
+      by_config_.erase(hashed);
+    }
+  }
+  const Record* record = reinterpret_cast<const Record*>(file_.data() + profile.offset);
+  std::vector<std::string> endpoints;
+  std::vector<std::string> public_keys;
+  PeerFields(record->config(), record->config_length, &endpoints, &public_keys);
+  for (const std::string& endpoint : endpoints) {
+    Erase(&by_endpoint_, endpoint, id);
+  }
+  for (const std::string& public_key : public_keys) {
+    Erase(&by_public_key_, public_key, id);
+  }
+  profiles_[id].reset();
+  live_--;
+}
+
+size_t ProfileStore::RecordBytes(const Profile& profile) const {
+  size_t bytes = reinterpret_cast<const Record*>(file_.data() + profile.offset)->length;
+  for (size_t alias_offset : profile.alias_offsets) {
+    bytes += reinterpret_cast<const Record*>(file_.data() + alias_offset)->length;
+  }
+  return bytes;
+}
+
+std::string ProfileStore::ConfigText(const Profile& profile) const {
+  const Record* record = reinterpret_cast<const Record*>(file_.data() + profile.offset);
+  return std::string(record->config(), record->config_length);
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,113 @@
+#ifndef WIREGUARD_DART_PROFILE_STORE_H
+#define WIREGUARD_DART_PROFILE_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Imported tunnel configs in a memory-mapped, append-only file, so that connect takes a small profile ID instead of the
+// whole config text. Configs are parsed and validated once on import and stored in the canonical form of
+// WireguardConfig::ToString; importing the same config again, under any name, returns the ID of the stored one, which
+// is then found under that name as well.
+//
+// A profile ID is the position of its offset in a table, so finding a profile at connect is one lookup. Profiles are
+// also indexed by name, by peer endpoint and by peer public key. The indexes live in memory and are rebuilt from the
+// records when the file is opened.
+//
+// Every record carries a checksum, and records are only appended: a removal appends a tombstone, and another name for
+// a stored profile an alias. A record torn by a crash is dropped when the file is opened, and so is everything after
+// it. When the file is full and at least half of it is removed profiles, the live records are written next to the file
+// and renamed over it. Otherwise the file doubles in size.
+class ProfileStore {
+ public:
+  // Profile IDs start at 1.
+  using ProfileId = uint32_t;
+
+  // Bytes the file is created with.
+  static const size_t kInitialSize = 1 << 20;
+
+  // Opens the store at `path`, creating it if it does not exist. Throws std::system_error, or std::runtime_error if the
+  // file is not a profile store.
+  explicit ProfileStore(const std::string& path);
+
+  ProfileStore(const ProfileStore&) = delete;
+  ProfileStore& operator=(const ProfileStore&) = delete;
+
+  // Parses `profiles` (name and config text) on all cores and stores the new ones. Returns their IDs in order. A config
+  // that is stored already keeps its ID and gains the name. A name that is taken by a different config is moved to the
+  // new one and the old profile is removed. Throws std::invalid_argument naming the first profile that does not parse
+  // or whose name is given twice, with nothing stored, or std::system_error.
+  std::vector<ProfileId> Import(const std::vector<std::pair<std::string, std::string>>& profiles);
+
+  // Removes profiles. Unknown IDs are skipped.
+  void Remove(const std::vector<ProfileId>& ids);
+
+  // The config of a profile, or nullopt if there is none with `id`.
+  std::optional<WireguardConfig> Find(ProfileId id);
+
+  std::optional<ProfileId> FindByName(const std::string& name);
+  // Profiles with a peer at `endpoint`, as written in the config.
+  std::vector<ProfileId> FindByEndpoint(const std::string& endpoint);
+  // Profiles with a peer of `public_key`.
+  std::vector<ProfileId> FindByPublicKey(const std::string& public_key);
+
+  // Live profiles.
+  size_t size();
+
+ private:
+  struct Record;
+  struct Profile {
+    // Of the record in the mapping.
+    size_t offset = 0;
+    std::string name;
+    uint64_t hash = 0;
+    // Of the records of its other names.
+    std::vector<size_t> alias_offsets;
+  };
+
+  // Appends a record with `flags`, growing or compacting the file first if it does not fit.
+  void Append(ProfileId id, uint32_t flags, const std::string& name, const std::string& config);
+  // Rewrites the file, which keeps its size, with the records of the live profiles.
+  void Compact();
+  // Adds a stored profile to the indexes.
+  void Index(ProfileId id, size_t offset, const std::string& name, const char* config, size_t config_length);
+  // Adds another name of a stored profile, whose record is at `offset`, to the indexes.
+  void IndexAlias(ProfileId id, size_t offset, const std::string& name);
+  // Gives up `name` if a profile other than `id` holds it. Only when reading a file whose tombstone for the previous
+  // holder of the name was torn.
+  void ReleaseName(const std::string& name, ProfileId id);
+  void Unindex(ProfileId id);
+  // Of all records of a stored profile.
+  size_t RecordBytes(const Profile& profile) const;
+  std::string ConfigText(const Profile& profile) const;
+
+  std::mutex mutex_;
+  MappedFile file_;
+  // End of the last record.
+  size_t end_ = 0;
+  // Bytes of records of removed profiles and of tombstones.
+  size_t dead_bytes_ = 0;
+  ProfileId next_id_ = 1;
+  // Indexed by ID; unset for removed profiles.
+  std::vector<std::optional<Profile>> profiles_;
+  size_t live_ = 0;
+  std::unordered_map<std::string, ProfileId> by_name_;
+  // Hash of the config text to the profiles with that hash.
+  std::unordered_map<uint64_t, std::vector<ProfileId>> by_config_;
+  std::unordered_map<std::string, std::vector<ProfileId>> by_endpoint_;
+  std::unordered_map<std::string, std::vector<ProfileId>> by_public_key_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
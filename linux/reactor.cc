@@ -0,0 +1,322 @@
+#include "reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <exception>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+// Events handled per epoll_wait.
+const int kMaxEvents = 32;
+
+// Watcher number of the wake eventfd; watchers are numbered from 1.
+const uint64_t kWakeEvent = 0;
+
+}  // namespace
+
+void TimerWheel::Add(uint64_t id, int64_t deadline) { Insert(id, std::max(deadline, current_)); }
+
+void TimerWheel::Insert(uint64_t id, int64_t deadline) {
+  if (deadline - current_ < static_cast<int64_t>(kSlots)) {
+    size_t slot = static_cast<size_t>(deadline) % kSlots;
+    timers_[id] = Timer{deadline, static_cast<int64_t>(slots_[slot].size())};
+    slots_[slot].push_back(id);
+    occupied_[slot / 64] |= uint64_t{1} << (slot % 64);
+  } else {
+    timers_[id] = Timer{deadline, -1};
+    overflow_.emplace(deadline, id);
+  }
+}
+
+bool TimerWheel::Cancel(uint64_t id) {
+  auto timer = timers_.find(id);
+  if (timer == timers_.end()) {
+    return false;
+  }
+  if (timer->second.index >= 0) {
+    RemoveFromSlot(static_cast<size_t>(timer->second.deadline) % kSlots, static_cast<size_t>(timer->second.index));
+  } else {
+    auto range = overflow_.equal_range(timer->second.deadline);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+      if (entry->second == id) {
+        overflow_.erase(entry);
+        break;
+      }
+    }
+  }
+  timers_.erase(id);
+  return true;
+}
+
+void TimerWheel::RemoveFromSlot(size_t slot, size_t index) {
+  std::vector<uint64_t>& ids = slots_[slot];
+  ids[index] = ids.back();
+  timers_[ids[index]].index = static_cast<int64_t>(index);
+  ids.pop_back();
+  if (ids.empty()) {
+    occupied_[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+  }
+}
+
+size_t TimerWheel::NextOccupied(size_t from) const {
+  size_t word = from / 64;
+  uint64_t bits = occupied_[word] & (~uint64_t{0} << (from % 64));
+  // One extra word wraps around to the bits before `from`.
+  for (size_t step = 0; step <= occupied_.size(); step++) {
+    if (bits != 0) {
+      return word * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+    }
+    word = (word + 1) % occupied_.size();
+    bits = occupied_[word];
+  }
+  return kSlots;
+}
+
+std::vector<uint64_t> TimerWheel::Advance(int64_t now) {
+  std::vector<uint64_t> expired;
+  if (now < current_) {
+    return expired;
+  }
+  // Slots are visited in deadline order, from the one of current_, skipping empty ones by their bits.
+  const size_t start = static_cast<size_t>(current_) % kSlots;
+  const size_t span = static_cast<size_t>(std::min<int64_t>(now - current_ + 1, kSlots));
+  size_t offset = 0;
+  while (offset < span) {
+    size_t slot = NextOccupied((start + offset) % kSlots);
+    size_t distance = (slot + kSlots - start) % kSlots;
+    if (slot == kSlots || distance < offset || distance >= span) {
+      break;
+    }
+    for (uint64_t id : slots_[slot]) {
+      expired.push_back(id);
+      timers_.erase(id);
+    }
+    slots_[slot].clear();
+    occupied_[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+    offset = distance + 1;
+  }
+  while (!overflow_.empty() && overflow_.begin()->first <= now) {
+    expired.push_back(overflow_.begin()->second);
+    timers_.erase(overflow_.begin()->second);
+    overflow_.erase(overflow_.begin());
+  }
+
+  current_ = now + 1;
+  while (!overflow_.empty() && overflow_.begin()->first - current_ < static_cast<int64_t>(kSlots)) {
+    auto entry = overflow_.begin();
+    Insert(entry->second, entry->first);
+    overflow_.erase(entry);
+  }
+  return expired;
+}
+
+int64_t TimerWheel::next_deadline() const {
+  // Everything in the wheel is due before anything in the overflow.
+  size_t start = static_cast<size_t>(current_) % kSlots;
+  size_t slot = NextOccupied(start);
+  if (slot != kSlots) {
+    return current_ + static_cast<int64_t>((slot + kSlots - start) % kSlots);
+  }
+  return overflow_.empty() ? -1 : overflow_.begin()->first;
+}
+
+Reactor::Reactor() : wheel_(SteadyMillisNow()) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to create epoll instance");
+  }
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeEvent;
+  if (wake_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) < 0) {
+    int error_code = errno;
+    if (wake_fd_ >= 0) {
+      close(wake_fd_);
+    }
+    close(epoll_fd_);
+    throw std::system_error(error_code, std::generic_category(), "Failed to create eventfd");
+  }
+  thread_ = std::thread(&Reactor::Run, this);
+}
+
+Reactor::~Reactor() {
+  Post([this] { stop_ = true; });
+  thread_.join();
+  close(wake_fd_);
+  close(epoll_fd_);
+}
+
+void Reactor::Watch(int fd, uint32_t events, OnReady on_ready) {
+  Invoke([&] {
+    auto existing = watcher_by_fd_.find(fd);
+    uint64_t id = existing != watcher_by_fd_.end() ? existing->second : next_watcher_;
+    epoll_event event = {};
+    event.events = events;
+    event.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, existing != watcher_by_fd_.end() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to watch descriptor");
+    }
+    if (existing == watcher_by_fd_.end()) {
+      next_watcher_++;
+      watcher_by_fd_[fd] = id;
+    }
+    watchers_[id] = Watcher{fd, std::move(on_ready)};
+  });
+}
+
+void Reactor::Unwatch(int fd) {
+  Invoke([&] {
+    auto existing = watcher_by_fd_.find(fd);
+    if (existing == watcher_by_fd_.end()) {
+      return;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    watchers_.erase(existing->second);
+    watcher_by_fd_.erase(existing);
+  });
+}
+
+Reactor::TimerId Reactor::AddTimer(std::chrono::milliseconds delay, Task task, std::chrono::milliseconds period) {
+  TimerId id = next_timer_.fetch_add(1, std::memory_order_relaxed);
+  Invoke([&] {
+    timers_[id] = TimerTask{std::move(task), std::max<int64_t>(period.count(), 0)};
+    wheel_.Add(id, SteadyMillisNow() + delay.count());
+  });
+  return id;
+}
+
+void Reactor::CancelTimer(TimerId id) {
+  Invoke([&] {
+    wheel_.Cancel(id);
+    timers_.erase(id);
+  });
+}
+
+void Reactor::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    posted_.push_back(std::move(task));
+  }
+  uint64_t one = 1;
+  (void)!write(wake_fd_, &one, sizeof(one));
+}
+
+void Reactor::Invoke(const Task& task) {
+  if (InReactorThread()) {
+    task();
+    return;
+  }
+  std::mutex mutex;
+  std::condition_variable done_condition;
+  bool done = false;
+  std::exception_ptr error;
+  Post([&] {
+    try {
+      task();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    done_condition.notify_one();
+  });
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [&done] { return done; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Reactor::Run() {
+  epoll_event events[kMaxEvents];
+  while (!stop_) {
+    int timeout = -1;
+    int64_t deadline = wheel_.next_deadline();
+    if (deadline >= 0) {
+      timeout = static_cast<int>(std::min<int64_t>(std::max<int64_t>(deadline - SteadyMillisNow(), 0), INT_MAX));
+    }
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Reactor: epoll_wait failed with errno " << errno << std::endl;
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.u64 == kWakeEvent) {
+        RunPosted();
+        continue;
+      }
+      // An earlier handler of this round may have removed the watcher.
+      auto watcher = watchers_.find(events[i].data.u64);
+      if (watcher == watchers_.end()) {
+        continue;
+      }
+      OnReady on_ready = watcher->second.on_ready;
+      try {
+        on_ready(events[i].events);
+      } catch (std::exception& e) {
+        std::cerr << "Reactor: " << e.what() << std::endl;
+      }
+    }
+    RunTimers();
+  }
+}
+
+void Reactor::RunPosted() {
+  uint64_t count;
+  (void)!read(wake_fd_, &count, sizeof(count));
+  std::deque<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks.swap(posted_);
+  }
+  for (Task& task : tasks) {
+    try {
+      task();
+    } catch (std::exception& e) {
+      std::cerr << "Reactor: " << e.what() << std::endl;
+    }
+  }
+}
+
+void Reactor::RunTimers() {
+  for (TimerId id : wheel_.Advance(SteadyMillisNow())) {
+    // An earlier handler of this round may have cancelled the timer.
+    auto timer = timers_.find(id);
+    if (timer == timers_.end()) {
+      continue;
+    }
+    Task task;
+    if (timer->second.period > 0) {
+      // Rescheduled first, so that the task may cancel its own timer.
+      task = timer->second.task;
+      wheel_.Add(id, SteadyMillisNow() + timer->second.period);
+    } else {
+      task = std::move(timer->second.task);
+      timers_.erase(timer);
+    }
+    try {
+      task();
+    } catch (std::exception& e) {
+      std::cerr << "Reactor: " << e.what() << std::endl;
+    }
+  }
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,145 @@
+#ifndef WIREGUARD_DART_REACTOR_H
+#define WIREGUARD_DART_REACTOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace wireguard_dart {
+
+// Timers by deadline in milliseconds, in a hashed wheel of kSlots one-millisecond slots: adding, cancelling and
+// expiring a timer take constant time. Timers further out than one turn of the wheel wait in an ordered map and move
+// into the wheel as it turns. A bitmap of occupied slots gives the next deadline without visiting the slots one by
+// one, so a loop driven by the wheel sleeps until then instead of waking every tick. Pure data structure; Reactor
+// drives it.
+class TimerWheel {
+ public:
+  static const size_t kSlots = 1024;
+
+  // `now` is where the wheel starts turning.
+  explicit TimerWheel(int64_t now) : current_(now) {}
+
+  // Schedules timer `id`, which must not be scheduled already. A deadline that has passed expires on the next Advance.
+  void Add(uint64_t id, int64_t deadline);
+  // Returns false if `id` is not scheduled.
+  bool Cancel(uint64_t id);
+
+  // Turns the wheel to `now` and returns the timers that expired, earliest deadline first. They are no longer
+  // scheduled.
+  std::vector<uint64_t> Advance(int64_t now);
+
+  // The earliest deadline, -1 if no timer is scheduled.
+  int64_t next_deadline() const;
+  size_t size() const { return timers_.size(); }
+
+ private:
+  struct Timer {
+    int64_t deadline;
+    // Position in slots_[deadline % kSlots], or -1 while waiting in overflow_.
+    int64_t index;
+  };
+
+  void Insert(uint64_t id, int64_t deadline);
+  void RemoveFromSlot(size_t slot, size_t index);
+  // The first occupied slot at or after slot `from`, wrapping around; kSlots if none is.
+  size_t NextOccupied(size_t from) const;
+
+  // The first millisecond not expired yet. Timers in the wheel have deadlines in [current_, current_ + kSlots).
+  int64_t current_;
+  std::array<std::vector<uint64_t>, kSlots> slots_;
+  std::array<uint64_t, kSlots / 64> occupied_ = {};
+  std::multimap<int64_t, uint64_t> overflow_;
+  std::unordered_map<uint64_t, Timer> timers_;
+};
+
+// One thread that waits on file descriptors and timers with epoll and calls their handlers, for the parts of the
+// backend that would otherwise each run a thread of their own. Handlers run one at a time on the reactor thread and
+// must not block. While nothing is due the thread sleeps in epoll_wait without a timeout, so an idle reactor costs no
+// CPU; every return from epoll_wait is counted as a wakeup.
+//
+// Watches and timers may be changed from any thread. Off the reactor thread, a change is run on it and waited for, so
+// once Unwatch or CancelTimer returns the handler is neither running nor called again.
+class Reactor {
+ public:
+  using Task = std::function<void()>;
+  // Called with the epoll events that occurred.
+  using OnReady = std::function<void(uint32_t events)>;
+  using TimerId = uint64_t;
+
+  // Starts the reactor thread. Throws std::system_error.
+  Reactor();
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  // Calls `on_ready` whenever `fd` has any of `events` (EPOLLIN, ...), level-triggered, replacing an earlier watch of
+  // `fd`. Throws std::system_error if epoll rejects the descriptor.
+  void Watch(int fd, uint32_t events, OnReady on_ready);
+  // Does nothing if `fd` is not watched. Call before closing `fd`.
+  void Unwatch(int fd);
+
+  // Calls `task` once `delay` has passed, and then every `period` unless it is zero, until cancelled.
+  TimerId AddTimer(std::chrono::milliseconds delay, Task task,
+                   std::chrono::milliseconds period = std::chrono::milliseconds(0));
+  // Does nothing if the timer expired or was cancelled already.
+  void CancelTimer(TimerId id);
+
+  // Runs `task` on the reactor thread soon, without waiting for it.
+  void Post(Task task);
+  // Runs `task` on the reactor thread and waits for it. On the reactor thread itself, runs it in place.
+  void Invoke(const Task& task);
+
+  bool InReactorThread() const { return std::this_thread::get_id() == thread_.get_id(); }
+
+  // Returns from epoll_wait since the start.
+  uint64_t wakeups() const { return wakeups_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Watcher {
+    int fd;
+    OnReady on_ready;
+  };
+  struct TimerTask {
+    Task task;
+    int64_t period;
+  };
+
+  void Run();
+  void RunPosted();
+  void RunTimers();
+
+  int epoll_fd_ = -1;
+  // Written to by Post to wake the thread.
+  int wake_fd_ = -1;
+  std::atomic<uint64_t> wakeups_{0};
+
+  // Owned by the reactor thread. Watchers are keyed by a number of their own rather than by descriptor, so that an
+  // event still pending for a descriptor that was unwatched and reused reaches nobody.
+  std::unordered_map<uint64_t, Watcher> watchers_;
+  std::unordered_map<int, uint64_t> watcher_by_fd_;
+  uint64_t next_watcher_ = 1;
+  TimerWheel wheel_;
+  std::unordered_map<TimerId, TimerTask> timers_;
+  std::atomic<TimerId> next_timer_{1};
+  bool stop_ = false;
+
+  std::mutex mutex_;
+  std::deque<Task> posted_;
+
+  std::thread thread_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
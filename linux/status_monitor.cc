@@ -0,0 +1,239 @@
+#include "status_monitor.h"
+
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+// Delays of the handshake check while a link waits for its first handshake, doubling from the first to the last.
+static const int64_t kFirstHandshakeCheck = 10;
+static const int64_t kMaxHandshakeCheck = 1000;
+// How often the watchdog samples the peers of a connected link.
+static const int64_t kWatchdogInterval = 1000;
+
+void TunnelStatusTracker::Reset(const std::optional<LinkInfo>& link, bool handshake) {
+  ifindex_ = link.has_value() ? link->ifindex : 0;
+  up_ = link.has_value() && (link->flags & IFF_UP) != 0;
+  handshake_ = handshake;
+  status_ = up_ ? UpStatus() : ConnectionStatus::disconnected;
+}
+
+void TunnelStatusTracker::Update(const nlmsghdr* message) {
+  switch (message->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK: {
+      if (message->nlmsg_len < NLMSG_LENGTH(sizeof(ifinfomsg))) {
+        return;
+      }
+      auto* link = static_cast<const ifinfomsg*>(NLMSG_DATA(message));
+      bool named = false;
+      size_t header_length = NLMSG_LENGTH(NLMSG_ALIGN(sizeof(ifinfomsg)));
+      for (const nlattr* attribute : AttributeRange(reinterpret_cast<const char*>(message) + header_length,
+                                                    message->nlmsg_len - header_length)) {
+        if (AttributeType(attribute) == IFLA_IFNAME) {
+          auto* name = static_cast<const char*>(AttributeData(attribute));
+          named = interface_name_ == std::string(name, strnlen(name, AttributeLength(attribute)));
+        }
+      }
+      // A link renamed away from the interface name is gone as far as the tunnel is concerned.
+      if (!named && link->ifi_index != ifindex_) {
+        return;
+      }
+      if (message->nlmsg_type == RTM_DELLINK || !named) {
+        ifindex_ = 0;
+        up_ = false;
+        handshake_ = false;
+        status_ = ConnectionStatus::disconnected;
+        return;
+      }
+      bool created = ifindex_ == 0;
+      bool up = (link->ifi_flags & IFF_UP) != 0;
+      ifindex_ = link->ifi_index;
+      if (up) {
+        status_ = UpStatus();
+      } else if (up_) {
+        handshake_ = false;
+        status_ = ConnectionStatus::disconnecting;
+      } else if (created) {
+        status_ = ConnectionStatus::connecting;
+      }
+      up_ = up;
+      return;
+    }
+    case RTM_NEWADDR:
+    case RTM_DELADDR: {
+      if (message->nlmsg_len < NLMSG_LENGTH(sizeof(ifaddrmsg))) {
+        return;
+      }
+      auto* address = static_cast<const ifaddrmsg*>(NLMSG_DATA(message));
+      // Link-local addresses come and go with the link itself.
+      if (ifindex_ == 0 || static_cast<int>(address->ifa_index) != ifindex_ || address->ifa_scope >= RT_SCOPE_LINK) {
+        return;
+      }
+      if (message->nlmsg_type == RTM_NEWADDR) {
+        status_ = up_ ? UpStatus() : ConnectionStatus::connecting;
+      } else if (up_) {
+        handshake_ = false;
+        status_ = ConnectionStatus::disconnecting;
+      }
+      return;
+    }
+    default:
+      return;
+  }
+}
+
+void TunnelStatusTracker::SetHandshake(bool handshake) {
+  handshake_ = handshake;
+  if (awaiting_handshake() && handshake) {
+    status_ = ConnectionStatus::connected;
+  }
+}
+
+StatusMonitor::~StatusMonitor() { Stop(); }
+
+void StatusMonitor::Start(const std::string& interface_name) {
+  Stop();
+  // Opened before the link is looked up, so that no change in between goes unnoticed.
+  socket_ = std::make_unique<NetlinkSocket>(NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR);
+  reactor_->Invoke([this, interface_name] {
+    interface_name_ = interface_name;
+    std::optional<LinkInfo> link = FindLink(interface_name);
+    tracker_.emplace(interface_name);
+    tracker_->Reset(link, link.has_value() && HandshakeDone());
+    reported_.reset();
+    reactor_->Watch(socket_->fd(), EPOLLIN, [this](uint32_t) { OnNotifications(); });
+    Publish();
+  });
+}
+
+void StatusMonitor::Stop() {
+  if (socket_ == nullptr) {
+    return;
+  }
+  reactor_->Invoke([this] {
+    reactor_->Unwatch(socket_->fd());
+    if (handshake_timer_ != 0) {
+      reactor_->CancelTimer(handshake_timer_);
+      handshake_timer_ = 0;
+    }
+    if (watchdog_timer_ != 0) {
+      reactor_->CancelTimer(watchdog_timer_);
+      watchdog_timer_ = 0;
+    }
+  });
+  socket_.reset();
+}
+
+void StatusMonitor::WatchHandshakes(SamplePeers sample_peers, Recover recover) {
+  reactor_->Invoke([&] {
+    sample_peers_ = std::move(sample_peers);
+    recover_ = std::move(recover);
+  });
+}
+
+void StatusMonitor::OnNotifications() {
+  try {
+    bool complete = socket_->ReceiveNotifications([this](const nlmsghdr* message) { tracker_->Update(message); });
+    // After an overflow the lost notifications may have changed the link; it is looked up again instead.
+    if (!complete) {
+      std::optional<LinkInfo> link = FindLink(interface_name_);
+      tracker_->Reset(link, link.has_value() && HandshakeDone());
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Status monitor: " << e.what() << std::endl;
+    reactor_->Unwatch(socket_->fd());
+    return;
+  }
+  Publish();
+}
+
+void StatusMonitor::CheckHandshake() {
+  handshake_timer_ = 0;
+  tracker_->SetHandshake(HandshakeDone());
+  if (tracker_->awaiting_handshake()) {
+    handshake_delay_ = std::min(handshake_delay_ * 2, kMaxHandshakeCheck);
+    handshake_timer_ = reactor_->AddTimer(std::chrono::milliseconds(handshake_delay_), [this] { CheckHandshake(); });
+  }
+  Publish();
+}
+
+void StatusMonitor::CheckPeers() {
+  std::vector<PeerSample> samples;
+  try {
+    samples = sample_peers_(interface_name_);
+  } catch (std::exception& e) {
+    // The link notifications tell whether the tunnel went away.
+    std::cerr << "Status monitor: " << e.what() << std::endl;
+    return;
+  }
+  RecoveryStep step = watchdog_.Observe(samples, SteadyMillisNow());
+  Publish();
+  if (step.action != RecoveryAction::none) {
+    try {
+      recover_(step);
+    } catch (std::exception& e) {
+      std::cerr << "Status monitor: " << e.what() << std::endl;
+    }
+  }
+}
+
+bool StatusMonitor::HandshakeDone() {
+  try {
+    return handshake_done_(interface_name_);
+  } catch (std::exception& e) {
+    // E.g. while the device is being set up; the next check asks again.
+    std::cerr << "Status monitor: " << e.what() << std::endl;
+    return false;
+  }
+}
+
+void StatusMonitor::Publish() {
+  ConnectionStatus status = tracker_->status();
+  // The watchdog starts over with every connection.
+  if (status == ConnectionStatus::connected && sample_peers_ != nullptr) {
+    if (watchdog_timer_ == 0) {
+      watchdog_.Reset();
+      watchdog_timer_ = reactor_->AddTimer(std::chrono::milliseconds(kWatchdogInterval), [this] { CheckPeers(); },
+                                           std::chrono::milliseconds(kWatchdogInterval));
+    }
+    if (watchdog_.degraded()) {
+      status = ConnectionStatus::degraded;
+    }
+  } else if (watchdog_timer_ != 0) {
+    reactor_->CancelTimer(watchdog_timer_);
+    watchdog_timer_ = 0;
+  }
+  if (tracker_->awaiting_handshake()) {
+    if (handshake_timer_ == 0) {
+      handshake_delay_ = kFirstHandshakeCheck;
+      handshake_timer_ = reactor_->AddTimer(std::chrono::milliseconds(handshake_delay_), [this] { CheckHandshake(); });
+    }
+  } else if (handshake_timer_ != 0) {
+    reactor_->CancelTimer(handshake_timer_);
+    handshake_timer_ = 0;
+  }
+  if (reported_ == status) {
+    return;
+  }
+  reported_ = status;
+  try {
+    on_status_(status);
+  } catch (std::exception& e) {
+    std::cerr << "Status monitor: " << e.what() << std::endl;
+  }
+}
+
+}  // namespace wireguard_dart
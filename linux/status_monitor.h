@@ -0,0 +1,112 @@
+#ifndef WIREGUARD_DART_STATUS_MONITOR_H
+#define WIREGUARD_DART_STATUS_MONITOR_H
+
+#include <linux/netlink.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "connection_status.h"
+#include "handshake_watchdog.h"
+#include "netlink.h"
+#include "reactor.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+// The status of a tunnel interface as its rtnetlink link and address notifications tell it, fed one message at a
+// time. A link that is being configured or is up without a completed handshake is connecting; one that goes down or
+// loses its addresses while up is disconnecting until it is deleted. Pure; StatusMonitor drives it.
+class TunnelStatusTracker {
+ public:
+  explicit TunnelStatusTracker(std::string interface_name) : interface_name_(std::move(interface_name)) {}
+
+  // Starts over from the link as it is, nullopt if it does not exist, and whether a peer has completed a handshake.
+  void Reset(const std::optional<LinkInfo>& link, bool handshake);
+  // Applies an RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR or RTM_DELADDR notification; others and those of other
+  // interfaces are ignored.
+  void Update(const nlmsghdr* message);
+  // A handshake only moves a connecting link that is up to connected.
+  void SetHandshake(bool handshake);
+
+  ConnectionStatus status() const { return status_; }
+  // Whether only a handshake is missing to be connected.
+  bool awaiting_handshake() const { return up_ && status_ == ConnectionStatus::connecting; }
+
+ private:
+  ConnectionStatus UpStatus() const { return handshake_ ? ConnectionStatus::connected : ConnectionStatus::connecting; }
+
+  std::string interface_name_;
+  // 0 while the link does not exist.
+  int ifindex_ = 0;
+  bool up_ = false;
+  bool handshake_ = false;
+  ConnectionStatus status_ = ConnectionStatus::disconnected;
+};
+
+// Reports the status of a tunnel interface as it changes, driven by rtnetlink link and address notifications on the
+// reactor rather than by polling: a transition is reported within the time it takes the reactor to wake up. The kernel
+// announces no handshakes, so only while the link is up and waiting for its first one, `handshake_done` is asked again
+// after 10 ms, 20 ms and so on up to every second. Once connected, a HandshakeWatchdog may sample the peers every
+// second: while one of them is stalled the tunnel is degraded rather than connected.
+class StatusMonitor {
+ public:
+  // Whether a peer of the interface has completed a handshake. Called on the reactor thread.
+  using HandshakeCheck = std::function<bool(const std::string& interface_name)>;
+  // The counters of the peers of the interface. Called on the reactor thread.
+  using SamplePeers = std::function<std::vector<PeerSample>(const std::string& interface_name)>;
+  // Performs a recovery step of the watchdog. Called on the reactor thread, so it must hand anything slow elsewhere.
+  using Recover = std::function<void(const RecoveryStep& step)>;
+
+  // `on_status` is called on the reactor thread with every new status.
+  StatusMonitor(Reactor* reactor, HandshakeCheck handshake_done, std::function<void(ConnectionStatus)> on_status)
+      : reactor_(reactor), handshake_done_(handshake_done), on_status_(on_status) {}
+  ~StatusMonitor();
+
+  StatusMonitor(const StatusMonitor&) = delete;
+  StatusMonitor& operator=(const StatusMonitor&) = delete;
+
+  // Starts following the interface named `interface_name`, whether or not it exists, stopping a previous watch, and
+  // reports its current status. Throws NetlinkError if the notification socket cannot be opened.
+  void Start(const std::string& interface_name);
+  // Once this returns, `on_status` is neither running nor called again.
+  void Stop();
+
+  // Has the watchdog follow the peers from the next Start on while the interface is connected, and hand its steps to
+  // `recover`.
+  void WatchHandshakes(SamplePeers sample_peers, Recover recover);
+
+ private:
+  // Handlers on the reactor thread.
+  void OnNotifications();
+  void CheckHandshake();
+  void CheckPeers();
+  // Asks `handshake_done` about the interface, taking a failure for no.
+  bool HandshakeDone();
+  // Reports a new status and schedules or cancels the handshake check and the watchdog.
+  void Publish();
+
+  Reactor* reactor_;
+  HandshakeCheck handshake_done_;
+  std::function<void(ConnectionStatus)> on_status_;
+  std::string interface_name_;
+  std::unique_ptr<NetlinkSocket> socket_;
+  std::optional<TunnelStatusTracker> tracker_;
+  std::optional<ConnectionStatus> reported_;
+  // 0 while no handshake check is scheduled.
+  Reactor::TimerId handshake_timer_ = 0;
+  int64_t handshake_delay_ = 0;
+  SamplePeers sample_peers_;
+  Recover recover_;
+  HandshakeWatchdog watchdog_;
+  // 0 while the watchdog does not run.
+  Reactor::TimerId watchdog_timer_ = 0;
+};
+
+}  // namespace wireguard_dart
+
+#endif
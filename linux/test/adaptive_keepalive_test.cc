@@ -0,0 +1,169 @@
+#include "adaptive_keepalive.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKeys[][45] = {"xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=",
+                                "TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0="};
+const int64_t kSample = 5000;
+const uint64_t kKeepaliveBytes = 32;
+const uint64_t kInitiationBytes = 148;
+
+PeerConfig MakePeer(const std::string &public_key, uint16_t keepalive) {
+  PeerConfig peer;
+  peer.public_key = public_key;
+  peer.persistent_keepalive = keepalive;
+  return peer;
+}
+
+// One peer's counters as the driver would report them, advanced sample by sample.
+class SimulatedPeer {
+ public:
+  explicit SimulatedPeer(const std::string &public_key) {
+    DecodeKey(public_key, &sample_.public_key);
+    sample_.last_handshake = 1;
+    sample_.rx_bytes = 1000;
+    sample_.tx_bytes = 1000;
+  }
+
+  // Advances by one sample period in which `received` and `sent` bytes went through.
+  std::vector<KeepaliveChange> Step(KeepaliveTuner *tuner, uint64_t received, uint64_t sent, bool handshake = false) {
+    now_ += kSample;
+    sample_.rx_bytes += received;
+    sample_.tx_bytes += sent;
+    if (handshake) {
+      sample_.last_handshake = now_;
+    }
+    return tuner->Observe({sample_}, now_);
+  }
+
+  // Idles for `seconds`, sending nothing but keepalives. Returns the changes of the last sample that had any.
+  std::vector<KeepaliveChange> Idle(KeepaliveTuner *tuner, int seconds) {
+    std::vector<KeepaliveChange> last;
+    for (int64_t elapsed = 0; elapsed < seconds * 1000; elapsed += kSample) {
+      auto changes = Step(tuner, 0, kKeepaliveBytes);
+      if (!changes.empty()) {
+        last = changes;
+      }
+    }
+    return last;
+  }
+
+  int64_t now() const { return now_; }
+
+ private:
+  PeerSample sample_ = {};
+  int64_t now_ = 100000;
+};
+
+}  // namespace
+
+TEST(KeepaliveTuner, ProbesLongerIntervalsWhileIdle) {
+  KeepaliveTuner tuner;
+  tuner.Reset({MakePeer(kPublicKeys[0], 20), MakePeer(kPublicKeys[1], 0)});
+  SimulatedPeer peer(kPublicKeys[0]);
+  EXPECT_TRUE(peer.Step(&tuner, 0, 0).empty());
+  EXPECT_EQ(tuner.interval(), 20);
+
+  EXPECT_TRUE(peer.Idle(&tuner, 55).empty());
+  auto changes = peer.Step(&tuner, 0, kKeepaliveBytes);
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(EncodeKey(changes[0].public_key), kPublicKeys[0]);
+  EXPECT_EQ(changes[0].interval, 30);
+
+  peer.Idle(&tuner, 900);
+  EXPECT_EQ(tuner.interval(), kMaxKeepalive);
+  EXPECT_FALSE(tuner.settled());
+
+  std::vector<PeerChange> updates = KeepaliveUpdates(changes);
+  ASSERT_EQ(updates.size(), 1u);
+  EXPECT_EQ(updates[0].kind, PeerChange::Kind::update);
+  EXPECT_EQ(updates[0].peer.public_key, kPublicKeys[0]);
+  EXPECT_EQ(updates[0].peer.persistent_keepalive, 30);
+  EXPECT_TRUE(updates[0].peer.endpoint.empty());
+}
+
+TEST(KeepaliveTuner, TrafficDoesNotCountAsIdle) {
+  KeepaliveTuner tuner;
+  tuner.Reset({MakePeer(kPublicKeys[0], 20)});
+  SimulatedPeer peer(kPublicKeys[0]);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(peer.Step(&tuner, 5000, 1000).empty());
+  }
+  EXPECT_EQ(tuner.interval(), 20);
+}
+
+TEST(KeepaliveTuner, FallsBackWhenHandshakeAfterIdleGoesUnanswered) {
+  KeepaliveTuner tuner;
+  tuner.Reset({MakePeer(kPublicKeys[0], 20)});
+  SimulatedPeer peer(kPublicKeys[0]);
+  peer.Step(&tuner, 0, 0);
+  peer.Idle(&tuner, 60);
+  ASSERT_EQ(tuner.interval(), 30);
+
+  // Nothing was received for more than the interval; then an initiation goes unanswered three times.
+  peer.Idle(&tuner, 25);
+  std::vector<KeepaliveChange> changes;
+  for (int i = 0; i < 4 && changes.empty(); i++) {
+    changes = peer.Step(&tuner, 0, kInitiationBytes);
+  }
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(changes[0].interval, 20);
+  EXPECT_TRUE(tuner.settled());
+
+  // Settled: the handshake completes again and no longer interval is tried.
+  peer.Step(&tuner, 92, kInitiationBytes, true);
+  EXPECT_TRUE(peer.Idle(&tuner, 600).empty());
+  EXPECT_EQ(tuner.interval(), 20);
+}
+
+TEST(KeepaliveTuner, UnansweredHandshakeDuringTrafficIsNotBlamedOnNat) {
+  KeepaliveTuner tuner;
+  tuner.Reset({MakePeer(kPublicKeys[0], 20)});
+  SimulatedPeer peer(kPublicKeys[0]);
+  peer.Step(&tuner, 0, 0);
+  peer.Idle(&tuner, 60);
+  ASSERT_EQ(tuner.interval(), 30);
+
+  peer.Step(&tuner, 5000, 5000);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(peer.Step(&tuner, 0, kInitiationBytes).empty());
+  }
+  EXPECT_FALSE(tuner.settled());
+}
+
+TEST(KeepaliveTuner, RemembersWhatWasLearnedPerNetwork) {
+  KeepaliveTuner tuner;
+  tuner.Reset({MakePeer(kPublicKeys[0], 20)});
+  SimulatedPeer peer(kPublicKeys[0]);
+  EXPECT_TRUE(tuner.SetNetwork("2 192.0.2.1 192.0.2.2", peer.now()).empty());
+  peer.Step(&tuner, 0, 0);
+  peer.Idle(&tuner, 60 + 90);
+  ASSERT_EQ(tuner.interval(), 45);
+  peer.Idle(&tuner, 40);
+  for (int i = 0; i < 4; i++) {
+    peer.Step(&tuner, 0, kInitiationBytes);
+  }
+  ASSERT_EQ(tuner.interval(), 30);
+  ASSERT_TRUE(tuner.settled());
+
+  auto changes = tuner.SetNetwork("3 198.51.100.1 198.51.100.2", peer.now());
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(changes[0].interval, 20);
+  EXPECT_FALSE(tuner.settled());
+
+  changes = tuner.SetNetwork("2 192.0.2.1 192.0.2.2", peer.now());
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(changes[0].interval, 30);
+  EXPECT_TRUE(tuner.settled());
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
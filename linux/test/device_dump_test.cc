@@ -0,0 +1,251 @@
+#include "device_dump.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <linux/netlink.h>
+#include <netinet/in.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// A dump of a device with two peers, laid out the way the kernel's WG_CMD_GET_DEVICE writes it: the first peer's
+// allowed IPs did not fit the first message and continue in the second, under the public key alone.
+alignas(NLMSG_ALIGNTO) const uint8_t kFirstMessage[] = {
+    // nlmsghdr: wireguard family 0x15, NLM_F_MULTI
+    0x34, 0x01, 0x00, 0x00, 0x15, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // genlmsghdr: WG_CMD_GET_DEVICE, version 1
+    0x00, 0x01, 0x00, 0x00,
+    // WGDEVICE_A_LISTEN_PORT 51820
+    0x06, 0x00, 0x06, 0x00, 0x6c, 0xca, 0x00, 0x00,
+    // WGDEVICE_A_FWMARK 0xca6c
+    0x08, 0x00, 0x07, 0x00, 0x6c, 0xca, 0x00, 0x00,
+    // WGDEVICE_A_IFINDEX 7
+    0x08, 0x00, 0x01, 0x00, 0x07, 0x00, 0x00, 0x00,
+    // WGDEVICE_A_IFNAME "wg0"
+    0x08, 0x00, 0x02, 0x00, 0x77, 0x67, 0x30, 0x00,
+    // WGDEVICE_A_PUBLIC_KEY HIgo9xNzJMWLKASShiTqIybxZ0U3wGLiUeJ1PKf8ykw=
+    0x24, 0x00, 0x04, 0x00, 0x1c, 0x88, 0x28, 0xf7, 0x13, 0x73, 0x24, 0xc5, 0x8b, 0x28, 0x04, 0x92,
+    0x86, 0x24, 0xea, 0x23, 0x26, 0xf1, 0x67, 0x45, 0x37, 0xc0, 0x62, 0xe2, 0x51, 0xe2, 0x75, 0x3c,
+    0xa7, 0xfc, 0xca, 0x4c,
+    // WGDEVICE_A_PEERS
+    0xdc, 0x00, 0x08, 0x80,
+      // peer xTIBA5rb
+      0xd8, 0x00, 0x00, 0x80,
+        // WGPEER_A_PUBLIC_KEY xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=
+        0x24, 0x00, 0x01, 0x00, 0xc5, 0x32, 0x01, 0x03, 0x9a, 0xdb, 0xa1, 0x4b, 0xe7, 0x1f, 0x88, 0x6d,
+        0xa1, 0xd8, 0xdb, 0xe9, 0xee, 0xbd, 0xed, 0x08, 0xcb, 0x11, 0x1b, 0x75, 0x34, 0x00, 0x78, 0x99,
+        0x9a, 0xa9, 0xf0, 0x38,
+        // WGPEER_A_PRESHARED_KEY
+        0x24, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_LAST_HANDSHAKE_TIME 1760000000123 ms
+        0x14, 0x00, 0x06, 0x00, 0x00, 0x78, 0xe7, 0x68, 0x00, 0x00, 0x00, 0x00, 0xc0, 0xd4, 0x54, 0x07,
+        0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL 25
+        0x06, 0x00, 0x05, 0x00, 0x19, 0x00, 0x00, 0x00,
+        // WGPEER_A_TX_BYTES 1000
+        0x0c, 0x00, 0x08, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_RX_BYTES 2000
+        0x0c, 0x00, 0x07, 0x00, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_PROTOCOL_VERSION 1
+        0x08, 0x00, 0x0a, 0x00, 0x01, 0x00, 0x00, 0x00,
+        // WGPEER_A_ENDPOINT 192.0.2.1:51820
+        0x14, 0x00, 0x04, 0x00, 0x02, 0x00, 0xca, 0x6c, 0xc0, 0x00, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_ALLOWEDIPS
+        0x3c, 0x00, 0x09, 0x80,
+          // allowed IP 10.0.0.0/8
+          0x1c, 0x00, 0x00, 0x80,
+            // WGALLOWEDIP_A_FAMILY
+            0x06, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_IPADDR
+            0x08, 0x00, 0x02, 0x00, 0x0a, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_CIDR_MASK
+            0x05, 0x00, 0x03, 0x00, 0x08, 0x00, 0x00, 0x00,
+          // allowed IP 192.168.0.0/16
+          0x1c, 0x00, 0x00, 0x80,
+            // WGALLOWEDIP_A_FAMILY
+            0x06, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_IPADDR
+            0x08, 0x00, 0x02, 0x00, 0xc0, 0xa8, 0x00, 0x00,
+            // WGALLOWEDIP_A_CIDR_MASK
+            0x05, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x00,
+};
+
+alignas(NLMSG_ALIGNTO) const uint8_t kSecondMessage[] = {
+    // nlmsghdr: wireguard family 0x15, NLM_F_MULTI
+    0x24, 0x01, 0x00, 0x00, 0x15, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // genlmsghdr: WG_CMD_GET_DEVICE, version 1
+    0x00, 0x01, 0x00, 0x00,
+    // WGDEVICE_A_IFINDEX 7
+    0x08, 0x00, 0x01, 0x00, 0x07, 0x00, 0x00, 0x00,
+    // WGDEVICE_A_IFNAME "wg0"
+    0x08, 0x00, 0x02, 0x00, 0x77, 0x67, 0x30, 0x00,
+    // WGDEVICE_A_PEERS
+    0x00, 0x01, 0x08, 0x80,
+      // peer xTIBA5rb, continued
+      0x54, 0x00, 0x00, 0x80,
+        // WGPEER_A_PUBLIC_KEY xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=
+        0x24, 0x00, 0x01, 0x00, 0xc5, 0x32, 0x01, 0x03, 0x9a, 0xdb, 0xa1, 0x4b, 0xe7, 0x1f, 0x88, 0x6d,
+        0xa1, 0xd8, 0xdb, 0xe9, 0xee, 0xbd, 0xed, 0x08, 0xcb, 0x11, 0x1b, 0x75, 0x34, 0x00, 0x78, 0x99,
+        0x9a, 0xa9, 0xf0, 0x38,
+        // WGPEER_A_ALLOWEDIPS
+        0x2c, 0x00, 0x09, 0x80,
+          // allowed IP fd00::/8
+          0x28, 0x00, 0x00, 0x80,
+            // WGALLOWEDIP_A_FAMILY
+            0x06, 0x00, 0x01, 0x00, 0x0a, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_IPADDR
+            0x14, 0x00, 0x02, 0x00, 0xfd, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_CIDR_MASK
+            0x05, 0x00, 0x03, 0x00, 0x08, 0x00, 0x00, 0x00,
+      // peer TrMvSoP4
+      0xa8, 0x00, 0x00, 0x80,
+        // WGPEER_A_PUBLIC_KEY TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0=
+        0x24, 0x00, 0x01, 0x00, 0x4e, 0xb3, 0x2f, 0x4a, 0x83, 0xf8, 0x8d, 0x84, 0x25, 0x63, 0xa4, 0x48,
+        0xcc, 0x18, 0x1b, 0xb2, 0xc4, 0x2a, 0x63, 0x7b, 0xf1, 0x23, 0x63, 0xe2, 0xfb, 0x2e, 0xf5, 0x94,
+        0xe5, 0x96, 0x5d, 0x7d,
+        // WGPEER_A_PRESHARED_KEY
+        0x24, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_LAST_HANDSHAKE_TIME 0 ms
+        0x14, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL 0
+        0x06, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_TX_BYTES 300
+        0x0c, 0x00, 0x08, 0x00, 0x2c, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_RX_BYTES 400
+        0x0c, 0x00, 0x07, 0x00, 0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // WGPEER_A_PROTOCOL_VERSION 1
+        0x08, 0x00, 0x0a, 0x00, 0x01, 0x00, 0x00, 0x00,
+        // WGPEER_A_ALLOWEDIPS
+        0x20, 0x00, 0x09, 0x80,
+          // allowed IP 172.16.0.1/32
+          0x1c, 0x00, 0x00, 0x80,
+            // WGALLOWEDIP_A_FAMILY
+            0x06, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00,
+            // WGALLOWEDIP_A_IPADDR
+            0x08, 0x00, 0x02, 0x00, 0xac, 0x10, 0x00, 0x01,
+            // WGALLOWEDIP_A_CIDR_MASK
+            0x05, 0x00, 0x03, 0x00, 0x20, 0x00, 0x00, 0x00,
+};
+
+const nlmsghdr* Message(const uint8_t* data) { return reinterpret_cast<const nlmsghdr*>(data); }
+
+WireguardKey Key(const std::string& base64) {
+  WireguardKey key;
+  EXPECT_TRUE(DecodeKey(base64, &key)) << base64;
+  return key;
+}
+
+std::string Format(const AllowedIp& allowed_ip) {
+  IpPrefix prefix;
+  prefix.version = allowed_ip.family == AF_INET ? 4 : 6;
+  prefix.length = allowed_ip.cidr;
+  memcpy(prefix.address.data(), &allowed_ip.address, prefix.address.size());
+  return FormatIpPrefix(prefix);
+}
+
+}  // namespace
+
+TEST(DeviceDump, ReadsAttributesInPlace) {
+  DeviceView device(Message(kFirstMessage));
+  EXPECT_EQ(device.ifindex(), 7);
+  EXPECT_EQ(device.name(), "wg0");
+  EXPECT_EQ(device.listen_port(), 51820);
+  EXPECT_EQ(device.fwmark(), 0xca6cu);
+  EXPECT_EQ(device.public_key(), Key("HIgo9xNzJMWLKASShiTqIybxZ0U3wGLiUeJ1PKf8ykw="));
+
+  std::vector<std::string> allowed_ips;
+  size_t peers = 0;
+  for (const PeerView peer : device.peers()) {
+    peers++;
+    EXPECT_EQ(peer.public_key(), Key("xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg="));
+    EXPECT_TRUE(peer.has_state());
+    EXPECT_EQ(peer.last_handshake(), 1760000000123);
+    EXPECT_EQ(peer.rx_bytes(), 2000u);
+    EXPECT_EQ(peer.tx_bytes(), 1000u);
+    EXPECT_EQ(peer.persistent_keepalive(), 25);
+    sockaddr_storage endpoint = peer.endpoint();
+    ASSERT_EQ(endpoint.ss_family, AF_INET);
+    auto* address = reinterpret_cast<const sockaddr_in*>(&endpoint);
+    EXPECT_EQ(ntohs(address->sin_port), 51820);
+    EXPECT_EQ(ntohl(address->sin_addr.s_addr), 0xc0000201u);
+    for (const AllowedIpView allowed_ip : peer.allowed_ips()) {
+      allowed_ips.push_back(Format(allowed_ip.ToAllowedIp()));
+    }
+  }
+  EXPECT_EQ(peers, 1u);
+  EXPECT_EQ(allowed_ips, (std::vector<std::string>{"10.0.0.0/8", "192.168.0.0/16"}));
+
+  // Later messages of the dump carry no device settings.
+  DeviceView next(Message(kSecondMessage));
+  EXPECT_EQ(next.name(), "wg0");
+  EXPECT_EQ(next.listen_port(), 0);
+  EXPECT_EQ(next.public_key(), WireguardKey());
+}
+
+TEST(DeviceDump, MergesPeersContinuedInNextMessage) {
+  WireguardDevice device;
+  MergeDeviceMessage(DeviceView(Message(kFirstMessage)), &device);
+  MergeDeviceMessage(DeviceView(Message(kSecondMessage)), &device);
+
+  EXPECT_EQ(device.name, "wg0");
+  EXPECT_EQ(device.ifindex, 7);
+  EXPECT_EQ(device.listen_port, 51820);
+  ASSERT_EQ(device.peers.size(), 2u);
+  const auto& first = device.peers[0];
+  EXPECT_EQ(first.public_key, Key("xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg="));
+  EXPECT_EQ(first.rx_bytes, 2000u);
+  ASSERT_EQ(first.allowed_ips.size(), 3u);
+  EXPECT_EQ(Format(first.allowed_ips[0]), "10.0.0.0/8");
+  EXPECT_EQ(Format(first.allowed_ips[2]), "fd00::/8");
+  const auto& second = device.peers[1];
+  EXPECT_EQ(second.public_key, Key("TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0="));
+  EXPECT_EQ(second.last_handshake, 0);
+  EXPECT_EQ(second.endpoint.ss_family, AF_UNSPEC);
+  ASSERT_EQ(second.allowed_ips.size(), 1u);
+  EXPECT_EQ(Format(second.allowed_ips[0]), "172.16.0.1/32");
+}
+
+TEST(DeviceDump, CountsContinuedPeersOnce) {
+  TunnelStatistics statistics;
+  std::vector<PeerSample> samples;
+  for (const uint8_t* message : {kFirstMessage, kSecondMessage}) {
+    AddStatistics(DeviceView(Message(message)), &statistics);
+    AddPeerSamples(DeviceView(Message(message)), &samples);
+  }
+  EXPECT_EQ(statistics.total_download, 2400u);
+  EXPECT_EQ(statistics.total_upload, 1300u);
+  EXPECT_EQ(statistics.latest_handshake, 1760000000123);
+  ASSERT_EQ(samples.size(), 2u);
+  EXPECT_EQ(samples[0].public_key, Key("xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg="));
+  EXPECT_EQ(samples[1].tx_bytes, 300u);
+}
+
+TEST(DeviceDump, StopsAtTruncatedAttributes) {
+  // A message cut off in the middle of the peers attribute yields the attributes before it and no peers.
+  alignas(NLMSG_ALIGNTO) uint8_t truncated[sizeof(kFirstMessage)];
+  memcpy(truncated, kFirstMessage, sizeof(truncated));
+  reinterpret_cast<nlmsghdr*>(truncated)->nlmsg_len = 120;
+  DeviceView device(Message(truncated));
+  EXPECT_EQ(device.ifindex(), 7);
+  EXPECT_FALSE(device.peers().begin() != device.peers().end());
+
+  // Too short for even the genetlink header.
+  reinterpret_cast<nlmsghdr*>(truncated)->nlmsg_len = NLMSG_HDRLEN;
+  EXPECT_EQ(DeviceView(Message(truncated)).ifindex(), 0);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
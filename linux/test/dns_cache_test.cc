@@ -0,0 +1,172 @@
+#include "dns_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// Answers from a table and counts the queries per host and family.
+class FakeResolver {
+ public:
+  void Set(const std::string &host, int version, DnsAnswer answer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    answers_[{host, version}] = answer;
+  }
+
+  int Queries(const std::string &host) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queries_[host];
+  }
+
+  DnsCache::Query query(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) {
+    return [this, delay](const std::string &host, int version) {
+      std::this_thread::sleep_for(delay);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (version == 4) {
+        queries_[host]++;
+      }
+      auto it = answers_.find({host, version});
+      if (it == answers_.end()) {
+        DnsAnswer empty;
+        empty.ok = true;
+        return empty;
+      }
+      return it->second;
+    };
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::pair<std::string, int>, DnsAnswer> answers_;
+  std::map<std::string, int> queries_;
+};
+
+DnsAnswer Answer(std::vector<std::string> addresses, uint32_t ttl) {
+  DnsAnswer answer;
+  answer.ok = true;
+  answer.addresses = addresses;
+  answer.ttl = ttl;
+  return answer;
+}
+
+DnsCache::Options FastOptions() {
+  DnsCache::Options options;
+  options.min_ttl = 50;
+  options.negative_ttl = 50;
+  return options;
+}
+
+// Polls `condition` for up to two seconds.
+template <typename Condition>
+bool Eventually(Condition condition) {
+  for (int i = 0; i < 200; i++) {
+    if (condition()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+}
+
+}  // namespace
+
+TEST(DnsCache, PrefetchesHostsInParallel) {
+  FakeResolver resolver;
+  std::vector<std::string> hosts;
+  for (int i = 0; i < 4; i++) {
+    hosts.push_back("vpn" + std::to_string(i) + ".example.com");
+    resolver.Set(hosts.back(), 4, Answer({"192.0.2." + std::to_string(i)}, 300));
+  }
+  DnsCache cache(resolver.query(std::chrono::milliseconds(200)), DnsCache::Options());
+
+  auto start = std::chrono::steady_clock::now();
+  cache.Prefetch(hosts);
+  EXPECT_FALSE(cache.Lookup(hosts[0]).has_value());
+  ASSERT_TRUE(Eventually([&] { return cache.Lookup(hosts[3]).has_value() && cache.Lookup(hosts[0]).has_value(); }));
+  // Four hosts with two families each took about as long as one query.
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(600));
+
+  auto cached = cache.Lookup(hosts[2]);
+  EXPECT_TRUE(cached->fresh);
+  EXPECT_EQ(cached->ipv4, std::vector<std::string>{"192.0.2.2"});
+  EXPECT_TRUE(cached->ipv6.empty());
+  EXPECT_EQ(resolver.Queries(hosts[2]), 1);
+}
+
+TEST(DnsCache, IgnoresLiterals) {
+  FakeResolver resolver;
+  DnsCache cache(resolver.query(), FastOptions());
+  cache.Prefetch({"192.0.2.1", "2001:db8::1"});
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(resolver.Queries("192.0.2.1"), 0);
+  EXPECT_EQ(resolver.Queries("2001:db8::1"), 0);
+}
+
+TEST(DnsCache, RefreshesInBackgroundBeforeTtlRunsOut) {
+  FakeResolver resolver;
+  resolver.Set("vpn.example.com", 4, Answer({"192.0.2.1"}, 0));
+  resolver.Set("vpn.example.com", 6, Answer({"2001:db8::1"}, 0));
+  DnsCache cache(resolver.query(), FastOptions());
+
+  cache.Prefetch({"vpn.example.com"});
+  ASSERT_TRUE(Eventually([&] { return cache.Lookup("vpn.example.com").has_value(); }));
+  resolver.Set("vpn.example.com", 4, Answer({"192.0.2.2"}, 0));
+
+  // The TTL is raised to the 50ms minimum and refreshed shortly before it runs out, without anyone asking.
+  ASSERT_TRUE(Eventually([&] { return resolver.Queries("vpn.example.com") >= 3; }));
+  auto cached = cache.Lookup("vpn.example.com");
+  EXPECT_EQ(cached->ipv4, std::vector<std::string>{"192.0.2.2"});
+  EXPECT_EQ(cached->ipv6, std::vector<std::string>{"2001:db8::1"});
+}
+
+TEST(DnsCache, ServesStaleAddressesWhenResolverFails) {
+  FakeResolver resolver;
+  resolver.Set("vpn.example.com", 4, Answer({"192.0.2.1"}, 0));
+  DnsCache cache(resolver.query(), FastOptions());
+
+  cache.Prefetch({"vpn.example.com"});
+  ASSERT_TRUE(Eventually([&] { return cache.Lookup("vpn.example.com").has_value(); }));
+  resolver.Set("vpn.example.com", 4, DnsAnswer());
+  resolver.Set("vpn.example.com", 6, DnsAnswer());
+
+  int queries = resolver.Queries("vpn.example.com");
+  ASSERT_TRUE(Eventually([&] { return resolver.Queries("vpn.example.com") > queries + 1; }));
+  auto cached = cache.Lookup("vpn.example.com");
+  ASSERT_TRUE(cached.has_value());
+  EXPECT_EQ(cached->ipv4, std::vector<std::string>{"192.0.2.1"});
+}
+
+TEST(DnsCache, ResolverServesCacheAndFallsBackForUnknownHosts) {
+  FakeResolver resolver;
+  resolver.Set("vpn.example.com", 4, Answer({"192.0.2.1", "192.0.2.2"}, 300));
+  resolver.Set("vpn.example.com", 6, Answer({"2001:db8::1"}, 300));
+  DnsCache cache(resolver.query(), DnsCache::Options());
+  std::atomic<int> fallbacks(0);
+  auto resolve = CachedResolver(&cache, [&](const std::string &, uint16_t port, AddressFamily) {
+    fallbacks++;
+    return std::vector<std::string>{JoinEndpoint("198.51.100.1", port)};
+  });
+
+  // Not cached yet: answered by the fallback, and prefetched for next time.
+  EXPECT_EQ(resolve("vpn.example.com", 51820, AddressFamily::unspecified),
+            std::vector<std::string>{"198.51.100.1:51820"});
+  EXPECT_EQ(fallbacks, 1);
+  ASSERT_TRUE(Eventually([&] { return cache.Lookup("vpn.example.com").has_value(); }));
+
+  EXPECT_EQ(resolve("vpn.example.com", 51820, AddressFamily::ipv4),
+            (std::vector<std::string>{"192.0.2.1:51820", "[2001:db8::1]:51820", "192.0.2.2:51820"}));
+  EXPECT_EQ(fallbacks, 1);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,111 @@
+#include "endpoint_prober.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test/udp_responder.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+ProbeOptions FastOptions() {
+  ProbeOptions options;
+  options.samples = 3;
+  options.interval = 20;
+  options.timeout = 300;
+  return options;
+}
+
+}  // namespace
+
+TEST(EndpointProber, RanksByRoundTripTime) {
+  ResponderBehavior slow_behavior;
+  slow_behavior.delay = std::chrono::milliseconds(40);
+  UdpResponder slow(slow_behavior);
+  UdpResponder fast;
+
+  auto results = RankEndpoints({{slow.endpoint(), {}}, {fast.endpoint(), {}}}, FastOptions());
+
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[0].endpoint, fast.endpoint());
+  EXPECT_EQ(results[1].endpoint, slow.endpoint());
+  EXPECT_EQ(results[0].address, "127.0.0.1");
+  for (const auto& result : results) {
+    EXPECT_EQ(result.sent, 3);
+    EXPECT_EQ(result.received, 3);
+    EXPECT_EQ(result.loss(), 0);
+    EXPECT_EQ(result.samples.size(), 3u);
+  }
+  EXPECT_GE(results[1].rtt, 40);
+  EXPECT_LT(results[0].rtt, results[1].rtt);
+}
+
+TEST(EndpointProber, RanksLossyAndSilentEndpointsLast) {
+  ResponderBehavior lossy_behavior;
+  lossy_behavior.answer_every = 3;
+  UdpResponder lossy(lossy_behavior);
+  ResponderBehavior silent_behavior;
+  silent_behavior.answer_every = 0;
+  UdpResponder silent(silent_behavior);
+  UdpResponder healthy;
+
+  auto results = RankEndpoints(
+      {{silent.endpoint(), {}}, {"not-an-endpoint", {}}, {lossy.endpoint(), {}}, {healthy.endpoint(), {}}},
+      FastOptions());
+
+  ASSERT_EQ(results.size(), 4u);
+  EXPECT_EQ(results[0].endpoint, healthy.endpoint());
+  EXPECT_EQ(results[1].endpoint, lossy.endpoint());
+  EXPECT_EQ(results[1].received, 1);
+  EXPECT_NEAR(results[1].loss(), 2.0 / 3, 1e-9);
+  // Unanswered targets keep their input order.
+  EXPECT_EQ(results[2].endpoint, silent.endpoint());
+  EXPECT_EQ(results[2].received, 0);
+  EXPECT_EQ(results[2].loss(), 1);
+  EXPECT_EQ(results[3].endpoint, "not-an-endpoint");
+  EXPECT_EQ(results[3].sent, 0);
+  EXPECT_TRUE(results[3].address.empty());
+}
+
+TEST(EndpointProber, MatchesOpaqueRepliesBySource) {
+  ResponderBehavior behavior;
+  behavior.reply = std::vector<uint8_t>(92, 2);
+  UdpResponder responder(behavior);
+
+  auto results = RankEndpoints({{responder.endpoint(), std::vector<uint8_t>(148, 1)}}, FastOptions());
+
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].received, 3);
+  EXPECT_EQ(responder.received(), 3);
+}
+
+TEST(EndpointProber, ProbesAllTargetsWithinOneBudget) {
+  std::vector<std::unique_ptr<UdpResponder>> responders;
+  std::vector<ProbeTarget> targets;
+  for (int i = 0; i < 50; i++) {
+    responders.push_back(std::make_unique<UdpResponder>());
+    targets.push_back({responders.back()->endpoint(), {}});
+  }
+  ProbeOptions options = FastOptions();
+  options.timeout = 2000;
+
+  auto start = std::chrono::steady_clock::now();
+  auto results = RankEndpoints(targets, options);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(results.size(), 50u);
+  for (const auto& result : results) {
+    EXPECT_EQ(result.received, 3) << result.endpoint;
+  }
+  // Returns as soon as every probe is answered instead of waiting out the timeout.
+  EXPECT_LT(elapsed, std::chrono::milliseconds(options.timeout));
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,117 @@
+#include "handshake_watchdog.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// Sizes of WireGuard messages on the wire, without the outer headers.
+const uint64_t kInitiation = 148;
+const uint64_t kResponse = 92;
+const uint64_t kKeepalive = 32;
+
+const int64_t kStart = 1704067200000;
+
+PeerSample Sample(uint8_t key, int64_t last_handshake, uint64_t rx_bytes, uint64_t tx_bytes) {
+  PeerSample sample = {};
+  sample.public_key.fill(key);
+  sample.last_handshake = last_handshake;
+  sample.rx_bytes = rx_bytes;
+  sample.tx_bytes = tx_bytes;
+  return sample;
+}
+
+// Feeds one sample a second from `from` to `to` of a peer whose counters `advance` moves, returning the first step
+// other than none, if any.
+template <typename Advance>
+RecoveryStep ObserveEverySecond(HandshakeWatchdog* watchdog, int64_t from, int64_t to, PeerSample* sample,
+                                Advance advance) {
+  for (int64_t now = from; now <= to; now += 1000) {
+    advance(now, sample);
+    RecoveryStep step = watchdog->Observe({*sample}, now);
+    if (step.action != RecoveryAction::none) {
+      return step;
+    }
+  }
+  return RecoveryStep();
+}
+
+}  // namespace
+
+TEST(HandshakeWatchdog, FindsAPeerThatNeverAnswersWhateverTheMessageSizes) {
+  // Four initiations add up to 592 bytes, a multiple of 16 like data messages.
+  HandshakeWatchdog watchdog(1);
+  PeerSample peer = Sample(1, 0, 0, 0);
+  watchdog.Observe({peer}, kStart);
+  auto initiating = [](int64_t now, PeerSample* sample) {
+    if ((now - kStart) % 5000 == 0) {
+      sample->tx_bytes += 4 * kInitiation;
+    }
+  };
+  RecoveryStep step = ObserveEverySecond(&watchdog, kStart + 1000, kStart + 60000, &peer, initiating);
+  EXPECT_EQ(step.action, RecoveryAction::reresolve_endpoint);
+  EXPECT_EQ(step.public_key, peer.public_key);
+  EXPECT_TRUE(watchdog.degraded());
+}
+
+TEST(HandshakeWatchdog, LeavesAPeerThatAnswersAlone) {
+  HandshakeWatchdog watchdog(1);
+  // Responding to the peer's handshakes sends 92 byte responses, and completes them.
+  PeerSample responder = Sample(1, kStart, kInitiation, kResponse);
+  // A session older than two minutes whose data is still answered.
+  PeerSample busy = Sample(2, kStart - 170000, 0, 0);
+  for (int64_t now = kStart; now <= kStart + 300000; now += 1000) {
+    if ((now - kStart) % 120000 == 0) {
+      responder.rx_bytes += kInitiation;
+      responder.tx_bytes += kResponse;
+      responder.last_handshake = now;
+    }
+    busy.tx_bytes += 1000;
+    if ((now - kStart) % 10000 == 0) {
+      busy.rx_bytes += kKeepalive;
+    }
+    EXPECT_EQ(watchdog.Observe({responder, busy}, now).action, RecoveryAction::none);
+  }
+  EXPECT_FALSE(watchdog.degraded());
+}
+
+TEST(HandshakeWatchdog, ClimbsTheRecoveryLadderUntilAnswered) {
+  HandshakeWatchdog watchdog(1);
+  PeerSample peer = Sample(1, kStart - 60000, 1000, 1000);
+  auto unanswered = [](int64_t, PeerSample* sample) { sample->tx_bytes += kKeepalive; };
+  watchdog.Observe({peer}, kStart);
+  // Data goes out unanswered, then so do the initiations WireGuard starts.
+  RecoveryStep step = ObserveEverySecond(&watchdog, kStart + 1000, kStart + 60000, &peer, unanswered);
+  ASSERT_EQ(step.action, RecoveryAction::reresolve_endpoint);
+  step = ObserveEverySecond(&watchdog, kStart + 31000, kStart + 120000, &peer, unanswered);
+  EXPECT_EQ(step.action, RecoveryAction::reapply_peer);
+  step = ObserveEverySecond(&watchdog, kStart + 121000, kStart + 240000, &peer, unanswered);
+  EXPECT_EQ(step.action, RecoveryAction::restart_tunnel);
+
+  // A completed handshake ends it.
+  peer.last_handshake = kStart + 250000;
+  peer.rx_bytes += kResponse;
+  EXPECT_EQ(watchdog.Observe({peer}, kStart + 250000).action, RecoveryAction::none);
+  EXPECT_FALSE(watchdog.degraded());
+}
+
+TEST(HandshakeWatchdog, StartsOverWhenCountersAreReset) {
+  HandshakeWatchdog watchdog(1);
+  PeerSample peer = Sample(1, 0, 0, 0);
+  watchdog.Observe({peer}, kStart);
+  auto initiating = [](int64_t, PeerSample* sample) { sample->tx_bytes += kInitiation; };
+  ObserveEverySecond(&watchdog, kStart + 1000, kStart + 20000, &peer, initiating);
+  // The tunnel was reconfigured; the wait starts over from the new counters.
+  peer = Sample(1, 0, 0, 0);
+  RecoveryStep step = ObserveEverySecond(&watchdog, kStart + 21000, kStart + 40000, &peer, initiating);
+  EXPECT_EQ(step.action, RecoveryAction::none);
+  EXPECT_FALSE(watchdog.degraded());
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,179 @@
+#include "happy_eyeballs.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKey[] = "xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=";
+
+using Action = EndpointRacer::Action;
+
+}  // namespace
+
+TEST(HappyEyeballs, DetectsLiteralFamilies) {
+  EXPECT_EQ(EndpointFamily("192.0.2.1:51820"), AddressFamily::ipv4);
+  EXPECT_EQ(EndpointFamily("[2001:db8::1]:51820"), AddressFamily::ipv6);
+  EXPECT_EQ(EndpointFamily("vpn.example.com:51820"), AddressFamily::unspecified);
+  EXPECT_EQ(EndpointFamily("192.0.2.1"), AddressFamily::unspecified);
+}
+
+TEST(HappyEyeballs, InterleavesFamiliesStartingWithPreferred) {
+  std::vector<std::string> ipv6 = {"[2001:db8::1]:1", "[2001:db8::2]:1"};
+  std::vector<std::string> ipv4 = {"192.0.2.1:1", "192.0.2.2:1", "192.0.2.3:1"};
+
+  EXPECT_EQ(InterleaveAddressFamilies(ipv6, ipv4, AddressFamily::unspecified),
+            (std::vector<std::string>{"[2001:db8::1]:1", "192.0.2.1:1", "[2001:db8::2]:1", "192.0.2.2:1",
+                                      "192.0.2.3:1"}));
+  EXPECT_EQ(InterleaveAddressFamilies(ipv6, ipv4, AddressFamily::ipv4),
+            (std::vector<std::string>{"192.0.2.1:1", "[2001:db8::1]:1", "192.0.2.2:1", "[2001:db8::2]:1",
+                                      "192.0.2.3:1"}));
+  EXPECT_EQ(InterleaveAddressFamilies({}, ipv4, AddressFamily::ipv6), ipv4);
+}
+
+TEST(HappyEyeballs, CachesWinningFamilyUntilExpiry) {
+  AddressFamilyCache cache;
+  EXPECT_EQ(cache.Preferred("vpn.example.com", 0), AddressFamily::unspecified);
+  cache.Record("vpn.example.com", AddressFamily::ipv4, 1000);
+  EXPECT_EQ(cache.Preferred("vpn.example.com", 2000), AddressFamily::ipv4);
+  EXPECT_EQ(cache.Preferred("other.example.com", 2000), AddressFamily::unspecified);
+  EXPECT_EQ(cache.Preferred("vpn.example.com", 1000 + 10 * 60 * 1000), AddressFamily::unspecified);
+}
+
+TEST(HappyEyeballs, StaggersAttemptsUntilHandshake) {
+  EndpointRacer racer({"[2001:db8::1]:1", "192.0.2.1:1"});
+
+  auto step = racer.Start(0);
+  EXPECT_EQ(step.action, Action::attempt);
+  EXPECT_EQ(step.endpoint, "[2001:db8::1]:1");
+  EXPECT_EQ(racer.Observe(0, kConnectionAttemptDelay - 1).action, Action::none);
+
+  step = racer.Observe(0, kConnectionAttemptDelay);
+  EXPECT_EQ(step.action, Action::attempt);
+  EXPECT_EQ(step.endpoint, "192.0.2.1:1");
+
+  step = racer.Observe(1234, kConnectionAttemptDelay + 40);
+  EXPECT_EQ(step.action, Action::committed);
+  EXPECT_EQ(step.endpoint, "192.0.2.1:1");
+  EXPECT_TRUE(racer.finished());
+  EXPECT_EQ(racer.Observe(0, 100000).action, Action::none);
+}
+
+TEST(HappyEyeballs, GrowsAttemptDelayEveryPassAndGivesUp) {
+  EndpointRacer racer({"[2001:db8::1]:1", "192.0.2.1:1"});
+  int64_t now = 0;
+  racer.Start(now);
+
+  std::vector<int64_t> delays;
+  int64_t last_attempt = now;
+  EndpointRacer::Step step;
+  while (step.action != Action::exhausted && now < 60000) {
+    now += 10;
+    step = racer.Observe(0, now);
+    if (step.action == Action::attempt || step.action == Action::exhausted) {
+      delays.push_back(now - last_attempt);
+      last_attempt = now;
+    }
+  }
+
+  EXPECT_EQ(step.action, Action::exhausted);
+  EXPECT_EQ(step.endpoint, "[2001:db8::1]:1");
+  EXPECT_EQ(delays, (std::vector<int64_t>{250, 250, 500, 500, 1000, 1000}));
+}
+
+TEST(HappyEyeballs, RacesResolvedCandidatesAndCachesWinner) {
+  AddressFamilyCache cache;
+  AddressFamily requested_preference = AddressFamily::unspecified;
+  EndpointRace race(&cache, [&](const std::string& host, uint16_t port, AddressFamily preferred) {
+    EXPECT_EQ(host, "vpn.example.com");
+    EXPECT_EQ(port, 51820);
+    requested_preference = preferred;
+    return std::vector<std::string>{"[2001:db8::1]:51820", "192.0.2.1:51820"};
+  });
+
+  WireguardConfig config;
+  PeerConfig literal;
+  literal.public_key = "fE/wdxzl0klVp/IR8UcaoGUMjqaWi3jAd7KzHKFS6Ds=";
+  literal.endpoint = "198.51.100.1:51820";
+  PeerConfig named;
+  named.public_key = kPublicKey;
+  named.endpoint = "vpn.example.com:51820";
+  config.peers = {literal, named};
+
+  auto prepared = race.Prepare(config);
+  EXPECT_EQ(prepared.peers[0].endpoint, "198.51.100.1:51820");
+  EXPECT_EQ(prepared.peers[1].endpoint, "[2001:db8::1]:51820");
+
+  // Only the IPv4 address answers handshakes.
+  std::mutex mutex;
+  std::string endpoint;
+  bool restarted = false;
+  std::vector<std::pair<std::string, bool>> applied;
+  WireguardKey public_key;
+  ASSERT_TRUE(DecodeKey(kPublicKey, &public_key));
+  race.Start(
+      [&](const PeerConfig& peer, bool restart) {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_EQ(peer.public_key, kPublicKey);
+        endpoint = peer.endpoint;
+        restarted = restart;
+        applied.emplace_back(peer.endpoint, restart);
+      },
+      [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        PeerSample sample = {};
+        sample.public_key = public_key;
+        sample.last_handshake = endpoint == "192.0.2.1:51820" && restarted ? 1 : 0;
+        return std::vector<PeerSample>{sample};
+      });
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (cache.Preferred("vpn.example.com", 0) == AddressFamily::unspecified &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  race.Stop();
+
+  EXPECT_EQ(cache.Preferred("vpn.example.com", 0), AddressFamily::ipv4);
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_GE(applied.size(), 3u);
+  EXPECT_EQ(applied[0], std::make_pair(std::string("[2001:db8::1]:51820"), true));
+  EXPECT_EQ(applied[1], std::make_pair(std::string("192.0.2.1:51820"), true));
+  // The peer had no keepalive configured, so the racing one is dropped in place.
+  EXPECT_EQ(applied.back(), std::make_pair(std::string("192.0.2.1:51820"), false));
+
+  // The next connect asks the resolver for IPv4 first.
+  race.Prepare(config);
+  EXPECT_EQ(requested_preference, AddressFamily::ipv4);
+}
+
+TEST(HappyEyeballs, ResolvesHostNameEndpointsToTheirPreferredAddress) {
+  AddressFamilyCache cache;
+  cache.Record("v4.example.com", AddressFamily::ipv4, SteadyMillisNow());
+  auto resolver = [](const std::string& host, uint16_t port, AddressFamily preferred) {
+    EXPECT_EQ(port, 51820);
+    if (host == "missing.example.com") {
+      return std::vector<std::string>();
+    }
+    return InterleaveAddressFamilies({"[2001:db8::1]:51820"}, {"192.0.2.1:51820"}, preferred);
+  };
+  EXPECT_EQ(ResolveEndpoints({"vpn.example.com:51820", "v4.example.com:51820", "198.51.100.1:51820", ""}, &cache,
+                             resolver),
+            (std::vector<std::string>{"[2001:db8::1]:51820", "192.0.2.1:51820", "198.51.100.1:51820", ""}));
+  EXPECT_THROW(ResolveEndpoints({"vpn.example.com:51820", "missing.example.com:51820"}, &cache, resolver),
+               std::invalid_argument);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,124 @@
+#include "kill_switch.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "link_control.h"
+#include "netlink.h"
+#include "test/network_namespace.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// A link other than loopback to send through: one end of a veth pair, with 10.2.0.0/24 behind it.
+int CreateUplink() {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, "uplink");
+  size_t link_info = message.BeginNested(IFLA_LINKINFO);
+  message.PutString(IFLA_INFO_KIND, "veth");
+  message.EndNested(link_info);
+  socket.Request(message);
+
+  int ifindex = static_cast<int>(if_nametoindex("uplink"));
+  IpPrefix address;
+  Check(ParseIpPrefix("10.2.0.1/24", &address), "Invalid prefix");
+  RouteBatch batch;
+  batch.SetLinkUp(kLoopback);
+  batch.SetLinkUp(ifindex);
+  batch.AddAddress(ifindex, address);
+  batch.Commit();
+  return ifindex;
+}
+
+sockaddr_storage Endpoint(const char* address, uint16_t port) {
+  sockaddr_storage endpoint = {};
+  auto* ipv4 = reinterpret_cast<sockaddr_in*>(&endpoint);
+  ipv4->sin_family = AF_INET;
+  ipv4->sin_port = htons(port);
+  inet_pton(AF_INET, address, &ipv4->sin_addr);
+  return endpoint;
+}
+
+// Sends a datagram; returns 0 or the errno of sendto, which is EPERM for packets dropped by the output chain.
+int Send(const char* address, uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  Check(fd >= 0, "Cannot open socket");
+  sockaddr_storage destination = Endpoint(address, port);
+  char payload = 0;
+  int error = sendto(fd, &payload, 1, 0, reinterpret_cast<sockaddr*>(&destination), sizeof(sockaddr_in)) < 0 ? errno
+                                                                                                              : 0;
+  close(fd);
+  return error;
+}
+
+}  // namespace
+
+TEST(KillSwitch, AllowsOnlyTheTunnelAndItsEndpoints) {
+  RunInNetworkNamespace([] {
+    CreateUplink();
+    Check(Send("10.2.0.5", 51820) == 0, "Blocked before enabling");
+
+    KillSwitch kill_switch;
+    kill_switch.Enable("wg-test", {Endpoint("10.2.0.5", 51820)});
+    Check(kill_switch.enabled() && KillSwitch::Installed(), "Not installed");
+    Check(Send("10.2.0.5", 51820) == 0, "Endpoint blocked");
+    Check(Send("10.2.0.5", 51821) == EPERM, "Other port allowed");
+    Check(Send("10.2.0.6", 51820) == EPERM, "Other address allowed");
+    Check(Send("127.0.0.1", 9) == 0, "Loopback blocked");
+
+    // Replaced in place: the old endpoint is gone with the new one in.
+    kill_switch.SetEndpoints({Endpoint("10.2.0.6", 51820)});
+    Check(Send("10.2.0.6", 51820) == 0, "New endpoint blocked");
+    Check(Send("10.2.0.5", 51820) == EPERM, "Old endpoint allowed");
+
+    // Everything through the tunnel interface passes.
+    kill_switch.Enable("uplink", {});
+    Check(Send("10.2.0.7", 443) == 0, "Tunnel interface blocked");
+
+    kill_switch.Disable();
+    Check(!kill_switch.enabled() && !KillSwitch::Installed(), "Not removed");
+    Check(Send("10.2.0.5", 51821) == 0, "Blocked after disabling");
+    // Nothing to update while disabled, and disabling again is fine.
+    kill_switch.SetEndpoints({Endpoint("10.2.0.5", 51820)});
+    Check(!KillSwitch::Installed(), "Installed while disabled");
+    kill_switch.Disable();
+  });
+}
+
+TEST(KillSwitch, TakesOverARulesetLeftByAnEarlierRun) {
+  RunInNetworkNamespace([] {
+    CreateUplink();
+    {
+      KillSwitch earlier;
+      earlier.Enable("wg-test", {});
+    }
+    Check(KillSwitch::Installed(), "Removed with the instance");
+    Check(Send("10.2.0.5", 51820) == EPERM, "Not protected");
+
+    KillSwitch kill_switch;
+    kill_switch.Enable("wg-test", {Endpoint("10.2.0.5", 51820)});
+    Check(Send("10.2.0.5", 51820) == 0, "Endpoint blocked");
+    kill_switch.Disable();
+    Check(!KillSwitch::Installed(), "Not removed");
+  });
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
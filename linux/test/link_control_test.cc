@@ -0,0 +1,129 @@
+#include "link_control.h"
+
+#include <gtest/gtest.h>
+#include <linux/fib_rules.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "netlink.h"
+#include "test/network_namespace.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+IpPrefix Prefix(const std::string &text) {
+  IpPrefix prefix;
+  Check(ParseIpPrefix(text, &prefix), "Invalid prefix " + text);
+  return prefix;
+}
+
+IpPrefix Route(int index) {
+  IpPrefix route = Prefix("10.0.0.0/24");
+  route.address[1] = static_cast<uint8_t>(index >> 8);
+  route.address[2] = static_cast<uint8_t>(index);
+  return route;
+}
+
+size_t CountRoutes(uint32_t table) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_GETROUTE, NLM_F_DUMP);
+  rtmsg route = {};
+  route.rtm_family = AF_INET;
+  message.AppendHeader(route);
+  size_t count = 0;
+  socket.Request(message, [&](const nlmsghdr *reply) {
+    auto *info = static_cast<const rtmsg *>(NLMSG_DATA(reply));
+    uint32_t route_table = info->rtm_table;
+    ForEachAttribute(RTM_RTA(info), RTM_PAYLOAD(reply), [&](const nlattr *attribute) {
+      if (AttributeType(attribute) == RTA_TABLE) {
+        route_table = *static_cast<const uint32_t *>(AttributeData(attribute));
+      }
+    });
+    count += route_table == table ? 1 : 0;
+  });
+  return count;
+}
+
+size_t CountRules(uint32_t table) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_GETRULE, NLM_F_DUMP);
+  fib_rule_hdr rule = {};
+  rule.family = AF_INET;
+  message.AppendHeader(rule);
+  size_t count = 0;
+  socket.Request(message, [&](const nlmsghdr *reply) {
+    auto *info = static_cast<const fib_rule_hdr *>(NLMSG_DATA(reply));
+    ForEachAttribute(info + 1, reply->nlmsg_len - NLMSG_LENGTH(sizeof(fib_rule_hdr)), [&](const nlattr *attribute) {
+      if (AttributeType(attribute) == FRA_TABLE && *static_cast<const uint32_t *>(AttributeData(attribute)) == table) {
+        count++;
+      }
+    });
+  });
+  return count;
+}
+
+}  // namespace
+
+TEST(LinkControl, CommitsLargeBatch) {
+  RunInNetworkNamespace([] {
+    const int kRoutes = 4096;
+    RouteBatch batch;
+    batch.AddAddress(kLoopback, Prefix("10.255.0.1/32"));
+    batch.SetLinkUp(kLoopback);
+    for (int i = 0; i < kRoutes; i++) {
+      batch.AddRoute(kLoopback, Route(i), kTunnelRoutingTable);
+    }
+    batch.AddDefaultRouteRules(4);
+
+    auto start = std::chrono::steady_clock::now();
+    batch.Commit();
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Committed " << batch.size() << " changes in " << elapsed << " ms" << std::endl;
+
+    Check(CountRoutes(kTunnelRoutingTable) == kRoutes, "Routes missing");
+    Check(CountRules(kTunnelRoutingTable) == 1, "Rule missing");
+
+    // Committing the rules again replaces them rather than piling up copies.
+    RouteBatch rules;
+    rules.AddDefaultRouteRules(4);
+    rules.Commit();
+    Check(CountRules(kTunnelRoutingTable) == 1, "Rule duplicated");
+    RemoveDefaultRouteRules(4);
+    Check(CountRules(kTunnelRoutingTable) == 0, "Rule left behind");
+  });
+}
+
+TEST(LinkControl, RevertsBatchOnFailure) {
+  RunInNetworkNamespace([] {
+    RouteBatch setup;
+    setup.SetLinkUp(kLoopback);
+    setup.Commit();
+
+    RouteBatch batch;
+    for (int i = 0; i < 300; i++) {
+      // No such link: the kernel rejects this one and carries on with the rest.
+      batch.AddRoute(i == 200 ? 9999 : kLoopback, Route(i), kTunnelRoutingTable);
+    }
+    batch.AddDefaultRouteRules(4);
+    try {
+      batch.Commit();
+      Check(false, "Commit succeeded");
+    } catch (const NetlinkError &e) {
+      Check(e.error_code() == ENODEV, std::string("Unexpected error: ") + e.what());
+    }
+    Check(CountRoutes(kTunnelRoutingTable) == 0, "Routes left behind");
+    Check(CountRules(kTunnelRoutingTable) == 0, "Rule left behind");
+  });
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
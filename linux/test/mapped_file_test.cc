@@ -0,0 +1,66 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "test/temp_directory.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+std::string Contents(const std::string& path) {
+  std::string contents;
+  int fd = open(path.c_str(), O_RDONLY);
+  char buffer[4096];
+  ssize_t n;
+  while (fd >= 0 && (n = read(fd, buffer, sizeof(buffer))) > 0) {
+    contents.append(buffer, n);
+  }
+  close(fd);
+  return contents;
+}
+
+}  // namespace
+
+TEST(MappedFile, WritesThroughTheMappingAndReplacesTheFile) {
+  TempDirectory directory("mapped_file_test");
+  std::string path = directory.Path("records");
+  {
+    MappedFile file(path);
+    EXPECT_EQ(file.size(), 0u);
+    EXPECT_EQ(file.data(), nullptr);
+    file.Resize(16);
+    memcpy(file.data(), "0123456789", 10);
+    file.Sync(file.size());
+  }
+  EXPECT_EQ(Contents(path), std::string("0123456789\0\0\0\0\0\0", 16));
+
+  MappedFile file(path);
+  ASSERT_EQ(file.size(), 16u);
+  // Chunks may come from the mapping being replaced.
+  file.Replace({{file.data() + 5, 5}, {"ab", 2}}, 8);
+  EXPECT_EQ(file.size(), 8u);
+  EXPECT_EQ(std::string(file.data(), file.size()), std::string("56789ab\0", 8));
+  EXPECT_EQ(Contents(path), std::string("56789ab\0", 8));
+  EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+}
+
+TEST(MappedFile, RemovesWhatAnUnfinishedReplaceLeftBehind) {
+  TempDirectory directory("mapped_file_test");
+  std::string path = directory.Path("records");
+  int fd = open((path + ".tmp").c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  MappedFile file(path);
+  EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+  EXPECT_EQ(access(path.c_str(), F_OK), 0);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,233 @@
+#include "metrics_exporter.h"
+
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test/temp_directory.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKey[] = "xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=";
+
+PeerSample Sample(int64_t last_handshake) {
+  PeerSample sample = {};
+  DecodeKey(kPublicKey, &sample.public_key);
+  sample.last_handshake = last_handshake;
+  sample.rx_bytes = 1234;
+  sample.tx_bytes = 5678;
+  return sample;
+}
+
+bool Contains(const std::string& text, const std::string& line) {
+  return text.find(line + "\n") != std::string::npos;
+}
+
+// Sends `request` to the socket at `path` and returns everything read until the exporter closes the connection.
+std::string Request(const std::string& path, const std::string& request) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    close(fd);
+    return "";
+  }
+  EXPECT_EQ(send(fd, request.data(), request.size(), MSG_NOSIGNAL), static_cast<ssize_t>(request.size()));
+  std::string response;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, n);
+  }
+  close(fd);
+  return response;
+}
+
+class MetricsExporterTest : public ::testing::Test {
+ protected:
+  TempDirectory directory_{"metrics_test"};
+  std::string path_ = directory_.Path("metrics.sock");
+};
+
+}  // namespace
+
+TEST(LatencyHistogram, CountsIntoTheFirstBucketThatHoldsTheValue) {
+  LatencyHistogram histogram;
+  histogram.Observe(std::chrono::microseconds(1000));
+  histogram.Observe(std::chrono::microseconds(1001));
+  histogram.Observe(std::chrono::seconds(60));
+  auto counts = histogram.counts();
+  EXPECT_EQ(counts[0], 1u);
+  EXPECT_EQ(counts[1], 1u);
+  EXPECT_EQ(counts.back(), 1u);
+  EXPECT_EQ(histogram.sum_micros(), 60002001u);
+}
+
+TEST(RenderOpenMetrics, RendersEveryFamily) {
+  TunnelMetrics metrics;
+  metrics.SetStatus(ConnectionStatus::connected);
+  metrics.ObservePhase(ConnectPhase::up, std::chrono::milliseconds(30));
+  metrics.ObservePhase(ConnectPhase::up, std::chrono::milliseconds(7));
+  metrics.CountReconnect(ReconnectReason::network_change);
+  metrics.CountReconnect(ReconnectReason::network_change);
+
+  std::string text;
+  RenderOpenMetrics(metrics, {Sample(1000000), Sample(0)}, 1002500, &text);
+  EXPECT_TRUE(Contains(text, "wireguard_dart_tunnel_status{wireguard_dart_tunnel_status=\"connected\"} 1"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_tunnel_status{wireguard_dart_tunnel_status=\"disconnected\"} 0"));
+  EXPECT_TRUE(Contains(text, std::string("wireguard_dart_peer_receive_bytes_total{public_key=\"") + kPublicKey +
+                                 "\"} 1234"));
+  EXPECT_TRUE(Contains(text, std::string("wireguard_dart_peer_transmit_bytes_total{public_key=\"") + kPublicKey +
+                                 "\"} 5678"));
+  // Only the peer that completed a handshake has an age.
+  EXPECT_TRUE(Contains(text, std::string("wireguard_dart_peer_handshake_age_seconds{public_key=\"") + kPublicKey +
+                                 "\"} 2.500"));
+  EXPECT_EQ(text.find("handshake_age_seconds{"), text.rfind("handshake_age_seconds{"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"up\",le=\"0.005\"} 0"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"up\",le=\"0.01\"} 1"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"up\",le=\"0.05\"} 2"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_bucket{phase=\"up\",le=\"+Inf\"} 2"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_count{phase=\"up\"} 2"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_sum{phase=\"up\"} 0.037000"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_connect_phase_duration_seconds_count{phase=\"down\"} 0"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_reconnects_total{reason=\"network_change\"} 2"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_reconnects_total{reason=\"connect\"} 0"));
+  // Probe estimates only while the quality prober runs.
+  EXPECT_FALSE(Contains(text, "wireguard_dart_probe_"));
+  ASSERT_GE(text.size(), 6u);
+  EXPECT_EQ(text.substr(text.size() - 6), "# EOF\n");
+
+  // Rendering again reuses the buffer.
+  size_t capacity = text.capacity();
+  const char* data = text.data();
+  RenderOpenMetrics(metrics, {Sample(1000000), Sample(0)}, 1002500, &text);
+  EXPECT_EQ(text.capacity(), capacity);
+  EXPECT_EQ(text.data(), data);
+
+  LinkQuality quality;
+  quality.rtt_median = 25;
+  quality.rtt_p99 = 80;
+  quality.jitter = 1.5;
+  quality.loss = 0.02;
+  quality.received = 49;
+  metrics.SetQuality(&quality);
+  RenderOpenMetrics(metrics, {}, 1002500, &text);
+  EXPECT_TRUE(Contains(text, "wireguard_dart_probe_rtt_seconds{quantile=\"0.5\"} 0.025000"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_probe_rtt_seconds{quantile=\"0.99\"} 0.080000"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_probe_rtt_seconds_count 49"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_probe_jitter_seconds 0.001500"));
+  EXPECT_TRUE(Contains(text, "wireguard_dart_probe_loss_ratio 0.0200"));
+  metrics.SetQuality(nullptr);
+  RenderOpenMetrics(metrics, {}, 1002500, &text);
+  EXPECT_FALSE(Contains(text, "wireguard_dart_probe_"));
+  EXPECT_FALSE(Contains(text, "wireguard_dart_reactor_"));
+
+  // The reactor has woken up at least once for the task it ran.
+  Reactor reactor;
+  reactor.Invoke([] {});
+  metrics.SetReactor(&reactor);
+  RenderOpenMetrics(metrics, {}, 1002500, &text);
+  EXPECT_TRUE(Contains(text, "wireguard_dart_reactor_wakeups_total " + std::to_string(reactor.wakeups())));
+  EXPECT_GE(reactor.wakeups(), 1u);
+  metrics.SetReactor(nullptr);
+}
+
+TEST_F(MetricsExporterTest, ServesMetricsOverHttp) {
+  TunnelMetrics metrics;
+  metrics.SetStatus(ConnectionStatus::connected);
+  int sampled_ifindex = 0;
+  MetricsExporter exporter(&metrics, [&sampled_ifindex](int ifindex) {
+    sampled_ifindex = ifindex;
+    return std::vector<PeerSample>{Sample(0)};
+  });
+  exporter.Start(path_);
+  struct stat info;
+  ASSERT_EQ(stat(path_.c_str(), &info), 0);
+  EXPECT_EQ(info.st_mode & 0777, 0660u);
+  // Bound in a private directory that is gone once the socket is in place.
+  DIR* directory = opendir(directory_.path().c_str());
+  ASSERT_NE(directory, nullptr);
+  std::vector<std::string> names;
+  while (dirent* entry = readdir(directory)) {
+    names.push_back(entry->d_name);
+  }
+  closedir(directory);
+  EXPECT_EQ(names.size(), 3u);
+
+  // Without a tunnel there are no peers to sample.
+  std::string response = Request(path_, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+  EXPECT_NE(response.find("Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"),
+            std::string::npos);
+  EXPECT_EQ(response.find("public_key="), std::string::npos);
+  EXPECT_EQ(sampled_ifindex, 0);
+
+  metrics.SetTunnel(7);
+  response = Request(path_, "GET / HTTP/1.0\r\n\r\n");
+  EXPECT_EQ(sampled_ifindex, 7);
+  std::string body = response.substr(response.find("\r\n\r\n") + 4);
+  EXPECT_NE(response.find("Content-Length: " + std::to_string(body.size()) + "\r\n"), std::string::npos);
+  EXPECT_TRUE(Contains(body, std::string("wireguard_dart_peer_receive_bytes_total{public_key=\"") + kPublicKey +
+                                 "\"} 1234"));
+
+  EXPECT_EQ(Request(path_, "GET /other HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 404", 0), 0u);
+  EXPECT_EQ(Request(path_, "POST /metrics HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 405", 0), 0u);
+
+  exporter.Stop();
+  EXPECT_NE(access(path_.c_str(), F_OK), 0);
+}
+
+TEST_F(MetricsExporterTest, ReplacesAStaleSocketButNoOtherFile) {
+  TunnelMetrics metrics;
+  auto no_peers = [](int) { return std::vector<PeerSample>(); };
+  {
+    MetricsExporter stale(&metrics, no_peers);
+    stale.Start(path_);
+    // A crashed process leaves its socket file behind.
+    ASSERT_EQ(link(path_.c_str(), directory_.Path("left").c_str()), 0);
+  }
+  ASSERT_EQ(rename(directory_.Path("left").c_str(), path_.c_str()), 0);
+  MetricsExporter exporter(&metrics, no_peers);
+  exporter.Start(path_);
+  EXPECT_EQ(Request(path_, "GET /metrics HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 200 OK", 0), 0u);
+  exporter.Stop();
+
+  FILE* file = fopen(path_.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fclose(file);
+  EXPECT_THROW(exporter.Start(path_), std::system_error);
+  EXPECT_EQ(access(path_.c_str(), F_OK), 0);
+}
+
+TEST_F(MetricsExporterTest, DropsClientsThatSendNothing) {
+  TunnelMetrics metrics;
+  MetricsExporter exporter(&metrics, [](int) { return std::vector<PeerSample>(); });
+  exporter.Start(path_);
+
+  int idle = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path_.c_str(), sizeof(address.sun_path) - 1);
+  ASSERT_EQ(connect(idle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+  auto start = std::chrono::steady_clock::now();
+  // Served once the idle client has been given up on.
+  EXPECT_EQ(Request(path_, "GET /metrics HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 200 OK", 0), 0u);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(3));
+  close(idle);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,179 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "link_control.h"
+#include "netlink.h"
+#include "network_change.h"
+#include "network_monitor.h"
+#include "reactor.h"
+#include "test/network_namespace.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const int kTunnel = 7;
+const int kEthernet = 2;
+const char kPublicKeys[][45] = {"xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=",
+                                "TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0=",
+                                "gN65BkIKy1eCE9pP1wdc8ROUtkHLF2PfAqYdyYBz6EA="};
+
+NetlinkMessage LinkMessage(int ifindex, bool wireless = false) {
+  NetlinkMessage message(RTM_NEWLINK, 0);
+  ifinfomsg link = {};
+  link.ifi_index = ifindex;
+  message.AppendHeader(link);
+  message.PutString(IFLA_IFNAME, "eth0");
+  if (wireless) {
+    message.PutAttribute(IFLA_WIRELESS, "\0\0\0\0", 4);
+  }
+  return message;
+}
+
+NetlinkMessage AddressMessage(int ifindex, uint8_t scope) {
+  NetlinkMessage message(RTM_NEWADDR, 0);
+  ifaddrmsg address = {};
+  address.ifa_family = AF_INET6;
+  address.ifa_index = ifindex;
+  address.ifa_scope = scope;
+  message.AppendHeader(address);
+  return message;
+}
+
+NetlinkMessage RouteMessage(uint32_t table, int oif) {
+  NetlinkMessage message(RTM_DELROUTE, 0);
+  rtmsg route = {};
+  route.rtm_family = AF_INET;
+  route.rtm_table = RT_TABLE_UNSPEC;
+  message.AppendHeader(route);
+  message.PutU32(RTA_TABLE, table);
+  message.PutU32(RTA_OIF, oif);
+  return message;
+}
+
+WireguardPeer DevicePeer(const std::string &public_key, const std::string &endpoint, uint16_t keepalive) {
+  WireguardPeer peer;
+  DecodeKey(public_key, &peer.public_key);
+  if (!endpoint.empty()) {
+    ResolveEndpoint(endpoint, &peer.endpoint);
+  }
+  peer.persistent_keepalive = keepalive;
+  return peer;
+}
+
+}  // namespace
+
+TEST(NetworkChangeDebouncer, WaitsForBurstToSettle) {
+  NetworkChangeDebouncer debouncer(200, 750);
+  EXPECT_EQ(debouncer.deadline(), -1);
+  EXPECT_FALSE(debouncer.Due(0));
+
+  debouncer.Notify(1000);
+  debouncer.Notify(1100);
+  EXPECT_EQ(debouncer.deadline(), 1300);
+  EXPECT_FALSE(debouncer.Due(1299));
+  EXPECT_TRUE(debouncer.Due(1300));
+  // The burst was consumed.
+  EXPECT_FALSE(debouncer.Due(1301));
+  EXPECT_EQ(debouncer.deadline(), -1);
+}
+
+TEST(NetworkChangeDebouncer, ActsWithinMaxDelayOfContinuousChanges) {
+  NetworkChangeDebouncer debouncer(200, 750);
+  int64_t now = 0;
+  for (; !debouncer.Due(now); now += 100) {
+    debouncer.Notify(now);
+  }
+  EXPECT_EQ(now, 800);
+
+  debouncer.Notify(900);
+  debouncer.Reset();
+  EXPECT_FALSE(debouncer.Due(2000));
+}
+
+TEST(IsUnderlayChange, IgnoresTheTunnelItself) {
+  EXPECT_TRUE(IsUnderlayChange(LinkMessage(kEthernet).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(LinkMessage(kTunnel).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(LinkMessage(kEthernet, true).header(), kTunnel));
+
+  EXPECT_TRUE(IsUnderlayChange(AddressMessage(kEthernet, RT_SCOPE_UNIVERSE).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(AddressMessage(kEthernet, RT_SCOPE_LINK).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(AddressMessage(kTunnel, RT_SCOPE_UNIVERSE).header(), kTunnel));
+
+  EXPECT_TRUE(IsUnderlayChange(RouteMessage(RT_TABLE_MAIN, kEthernet).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(RouteMessage(RT_TABLE_MAIN, kTunnel).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(RouteMessage(RT_TABLE_LOCAL, kEthernet).header(), kTunnel));
+  EXPECT_FALSE(IsUnderlayChange(RouteMessage(51820, kEthernet).header(), kTunnel));
+
+  NetlinkMessage rule(RTM_NEWRULE, 0);
+  EXPECT_FALSE(IsUnderlayChange(rule.header(), kTunnel));
+}
+
+TEST(NetworkMonitor, ReportsASettledChangeOnTheReactor) {
+  RunInNetworkNamespace([] {
+    Reactor reactor;
+    std::atomic<int> changes{0};
+    std::atomic<bool> on_reactor{true};
+    NetworkMonitor monitor(&reactor, [&] {
+      changes++;
+      on_reactor = on_reactor && reactor.InReactorThread();
+    });
+    monitor.Start(kTunnel);
+
+    RouteBatch batch;
+    batch.SetLinkUp(kLoopback);
+    batch.Commit();
+    for (int i = 0; i < 200 && changes == 0; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    Check(changes == 1, "Change not reported once");
+    Check(on_reactor, "Reported off the reactor thread");
+
+    // Nothing is reported once stopped.
+    monitor.Stop();
+    IpPrefix address;
+    Check(ParseIpPrefix("10.3.0.1/24", &address), "Invalid prefix");
+    RouteBatch later;
+    later.AddAddress(kLoopback, address);
+    later.Commit();
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    Check(changes == 1, "Reported after stopping");
+  });
+}
+
+TEST(RebindChanges, PulsesKeepaliveOfPeersWithEndpoints) {
+  WireguardDevice device;
+  device.peers.push_back(DevicePeer(kPublicKeys[0], "192.0.2.1:51820", 25));
+  device.peers.push_back(DevicePeer(kPublicKeys[1], "", 0));
+  device.peers.push_back(DevicePeer(kPublicKeys[2], "[2001:db8::1]:51820", 0));
+
+  std::vector<PeerChange> changes = RebindChanges(device);
+  ASSERT_EQ(changes.size(), 5u);
+  for (const auto &change : changes) {
+    EXPECT_EQ(change.kind, PeerChange::Kind::update);
+    EXPECT_FALSE(change.replace_allowed_ips);
+  }
+  EXPECT_EQ(changes[0].peer.public_key, kPublicKeys[0]);
+  EXPECT_EQ(changes[0].peer.endpoint, "192.0.2.1:51820");
+  EXPECT_EQ(changes[0].peer.persistent_keepalive, 0);
+  EXPECT_EQ(changes[1].peer.endpoint, "");
+  EXPECT_EQ(changes[1].peer.persistent_keepalive, 25);
+
+  EXPECT_EQ(changes[2].peer.public_key, kPublicKeys[2]);
+  EXPECT_EQ(changes[2].peer.endpoint, "[2001:db8::1]:51820");
+  EXPECT_EQ(changes[3].peer.persistent_keepalive, 1);
+  EXPECT_EQ(changes[4].peer.persistent_keepalive, 0);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
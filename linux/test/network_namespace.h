@@ -0,0 +1,69 @@
+#ifndef WIREGUARD_DART_TEST_NETWORK_NAMESPACE_H
+#define WIREGUARD_DART_TEST_NETWORK_NAMESPACE_H
+
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace wireguard_dart {
+namespace test {
+
+const int kLoopback = 1;
+const int kSkipped = 77;
+
+// Runs `body` in a child process with a network namespace of its own, so that it may change links and routes freely.
+// Skips the test where unprivileged user namespaces are not available. `body` reports failures by throwing.
+inline void RunInNetworkNamespace(const std::function<void()> &body) {
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    close(pipe_fds[0]);
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0) {
+      _exit(kSkipped);
+    }
+    std::string failure;
+    try {
+      body();
+    } catch (std::exception &e) {
+      failure = e.what();
+    }
+    if (!failure.empty() && write(pipe_fds[1], failure.data(), failure.size()) < 0) {
+      _exit(2);
+    }
+    _exit(failure.empty() ? 0 : 1);
+  }
+
+  close(pipe_fds[1]);
+  std::string failure;
+  char buffer[256];
+  ssize_t length;
+  while ((length = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+    failure.append(buffer, static_cast<size_t>(length));
+  }
+  close(pipe_fds[0]);
+  int status = 0;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status));
+  if (WEXITSTATUS(status) == kSkipped) {
+    GTEST_SKIP() << "Network namespaces are not available";
+  }
+  EXPECT_EQ(WEXITSTATUS(status), 0) << failure;
+}
+
+inline void Check(bool condition, const std::string &message) {
+  if (!condition) {
+    throw std::runtime_error(message);
+  }
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
+
+#endif
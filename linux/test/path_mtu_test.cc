@@ -0,0 +1,103 @@
+#include "path_mtu.h"
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <string>
+
+#include "link_control.h"
+#include "test/network_namespace.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// Runs a search against a path that passes everything up to `mtu`, returning the result and counting the probes.
+int Search(int low, int high, int mtu, int* probes) {
+  PathMtuSearch search(low, high);
+  *probes = 0;
+  while (!search.done()) {
+    int size = search.Next();
+    if (size <= mtu) {
+      search.Passed(size);
+    } else {
+      search.TooBig(size);
+    }
+    (*probes)++;
+  }
+  return search.result();
+}
+
+// Brings up the namespace's loopback with `mtu`, which stands in for the bottleneck link on the path to the peer.
+void ClampLoopback(uint32_t mtu) {
+  SetLinkMtu(kLoopback, mtu);
+  RouteBatch batch;
+  batch.SetLinkUp(kLoopback);
+  batch.Commit();
+}
+
+}  // namespace
+
+TEST(PathMtuSearch, FindsTheLargestSizeThatPasses) {
+  int probes = 0;
+  for (int mtu : {1280, 1281, 1420, 1492, 1499, 1500}) {
+    EXPECT_EQ(Search(1280, 1500, mtu, &probes), mtu);
+    EXPECT_LE(probes, 8) << "mtu " << mtu;
+  }
+  EXPECT_EQ(Search(1280, 1500, 9000, &probes), 1500);
+  // Below the floor, which is taken to pass without a probe.
+  EXPECT_EQ(Search(1280, 1500, 576, &probes), 1280);
+}
+
+TEST(PathMtuSearch, NarrowsToReportedLimits) {
+  PathMtuSearch search(1280, 1500);
+  search.TooBig(1391);
+  // A limit learned from the stack may be far below the probe that hit it.
+  search.TooBig(1301);
+  EXPECT_EQ(search.Next(), 1290);
+  search.Passed(1300);
+  EXPECT_TRUE(search.done());
+  EXPECT_EQ(search.result(), 1300);
+  // Outcomes outside the range change nothing.
+  search.TooBig(1200);
+  search.Passed(9000);
+  EXPECT_EQ(search.result(), 1300);
+}
+
+TEST(PathMtu, TunnelMtuLeavesRoomForEncapsulation) {
+  EXPECT_EQ(TunnelMtu(1500, AF_INET), 1440u);
+  EXPECT_EQ(TunnelMtu(1500, AF_INET6), 1420u);
+}
+
+TEST(PathMtu, DiscoversAClampedLoopback) {
+  RunInNetworkNamespace([] {
+    ClampLoopback(1360);
+    int mtu = DiscoverPathMtu("127.0.0.1:51820");
+    Check(mtu == 1360, "IPv4 path MTU " + std::to_string(mtu));
+    mtu = DiscoverPathMtu("[::1]:51820");
+    Check(mtu == 1360, "IPv6 path MTU " + std::to_string(mtu));
+
+    // Unclamped, the search stops at the largest size worth trying.
+    SetLinkMtu(kLoopback, 65536);
+    PathMtuOptions options;
+    options.timeout = 20;
+    mtu = DiscoverPathMtu("127.0.0.1:51820", options);
+    Check(mtu == 1500, "Unclamped path MTU " + std::to_string(mtu));
+  });
+}
+
+TEST(PathMtu, FailsWithoutAnEndpoint) {
+  EXPECT_EQ(DiscoverPathMtu("no port"), 0);
+}
+
+TEST(PathMtu, GivesUpOnceCancelled) {
+  std::atomic<bool> cancelled{true};
+  PathMtuOptions options;
+  options.cancelled = &cancelled;
+  EXPECT_EQ(DiscoverPathMtu("127.0.0.1:51820", options), 0);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
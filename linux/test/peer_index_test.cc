@@ -0,0 +1,126 @@
+#include "peer_index.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKeys[][45] = {"xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=",
+                                "TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0=",
+                                "gN65BkIKy1eCE9pP1wdc8ROUtkHLF2PfAqYdyYBz6EA="};
+
+PeerConfig MakePeer(const std::string &public_key, const std::string &allowed_ip) {
+  PeerConfig peer;
+  peer.public_key = public_key;
+  peer.endpoint = "192.0.2.1:51820";
+  peer.allowed_ips = {allowed_ip};
+  peer.persistent_keepalive = 25;
+  return peer;
+}
+
+// Records the batches handed to the device.
+struct Recorder {
+  std::vector<std::vector<PeerChange>> batches;
+
+  PeerIndex::Apply Apply() {
+    return [this](const std::vector<PeerChange> &changes) { batches.push_back(changes); };
+  }
+};
+
+PeerIndex::Apply Failing() {
+  return [](const std::vector<PeerChange> &) { throw std::runtime_error("device gone"); };
+}
+
+}  // namespace
+
+TEST(PeerIndex, TurnsBatchesIntoDeltas) {
+  PeerIndex index;
+  index.Reset({MakePeer(kPublicKeys[0], "10.0.0.2/32")});
+  Recorder recorder;
+
+  index.Add({MakePeer(kPublicKeys[1], "10.0.0.3/32"), MakePeer(kPublicKeys[2], "10.0.0.4/32")}, recorder.Apply());
+  ASSERT_EQ(recorder.batches.size(), 1u);
+  ASSERT_EQ(recorder.batches[0].size(), 2u);
+  EXPECT_EQ(recorder.batches[0][0].kind, PeerChange::Kind::add);
+  EXPECT_EQ(recorder.batches[0][1].peer.public_key, kPublicKeys[2]);
+  EXPECT_EQ(index.size(), 3u);
+
+  PeerUpdate keepalive;
+  keepalive.public_key = kPublicKeys[0];
+  keepalive.persistent_keepalive = 10;
+  PeerUpdate allowed_ips;
+  allowed_ips.public_key = kPublicKeys[1];
+  allowed_ips.allowed_ips = std::vector<std::string>{"10.0.1.0/24", "fd00::3/128"};
+  index.Update({keepalive, allowed_ips}, recorder.Apply());
+  ASSERT_EQ(recorder.batches.size(), 2u);
+  const auto &updates = recorder.batches[1];
+  ASSERT_EQ(updates.size(), 2u);
+  // An update only carries what changes, plus the keepalive, which the device APIs always take.
+  EXPECT_EQ(updates[0].kind, PeerChange::Kind::update);
+  EXPECT_EQ(updates[0].peer.persistent_keepalive, 10);
+  EXPECT_TRUE(updates[0].peer.endpoint.empty());
+  EXPECT_FALSE(updates[0].replace_allowed_ips);
+  EXPECT_EQ(updates[1].peer.persistent_keepalive, 25);
+  EXPECT_TRUE(updates[1].replace_allowed_ips);
+  EXPECT_EQ(updates[1].peer.allowed_ips, *allowed_ips.allowed_ips);
+  EXPECT_EQ(index.Find(kPublicKeys[0])->persistent_keepalive, 10);
+  EXPECT_EQ(index.Find(kPublicKeys[0])->endpoint, "192.0.2.1:51820");
+  EXPECT_EQ(index.Find(kPublicKeys[1])->allowed_ips, *allowed_ips.allowed_ips);
+
+  // Unknown and repeated keys are skipped.
+  index.Remove({kPublicKeys[2], kPublicKeys[2], "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA="}, recorder.Apply());
+  ASSERT_EQ(recorder.batches.size(), 3u);
+  ASSERT_EQ(recorder.batches[2].size(), 1u);
+  EXPECT_EQ(recorder.batches[2][0].kind, PeerChange::Kind::remove);
+  EXPECT_EQ(index.size(), 2u);
+  EXPECT_EQ(index.Find(kPublicKeys[2]), nullptr);
+
+  index.Remove({kPublicKeys[2]}, recorder.Apply());
+  EXPECT_EQ(recorder.batches.size(), 3u);
+}
+
+TEST(PeerIndex, RejectsMalformedBatchesBeforeApplying) {
+  PeerIndex index;
+  index.Reset({MakePeer(kPublicKeys[0], "10.0.0.2/32")});
+  Recorder recorder;
+
+  EXPECT_THROW(index.Add({MakePeer(kPublicKeys[1], "10.0.0.3/32"), MakePeer(kPublicKeys[2], "10.0.0.0/33")},
+                         recorder.Apply()),
+               std::invalid_argument);
+  EXPECT_THROW(index.Add({MakePeer("not a key", "10.0.0.3/32")}, recorder.Apply()), std::invalid_argument);
+  PeerUpdate known;
+  known.public_key = kPublicKeys[0];
+  known.endpoint = "192.0.2.2:51820";
+  PeerUpdate unknown;
+  unknown.public_key = kPublicKeys[1];
+  unknown.persistent_keepalive = 0;
+  EXPECT_THROW(index.Update({known, unknown}, recorder.Apply()), std::invalid_argument);
+
+  EXPECT_TRUE(recorder.batches.empty());
+  EXPECT_EQ(index.size(), 1u);
+  EXPECT_EQ(index.Find(kPublicKeys[0])->endpoint, "192.0.2.1:51820");
+}
+
+TEST(PeerIndex, KeepsStateWhenApplyFails) {
+  PeerIndex index;
+  index.Reset({MakePeer(kPublicKeys[0], "10.0.0.2/32")});
+
+  PeerUpdate update;
+  update.public_key = kPublicKeys[0];
+  update.persistent_keepalive = 0;
+  EXPECT_THROW(index.Add({MakePeer(kPublicKeys[1], "10.0.0.3/32")}, Failing()), std::runtime_error);
+  EXPECT_THROW(index.Update({update}, Failing()), std::runtime_error);
+  EXPECT_THROW(index.Remove({kPublicKeys[0]}, Failing()), std::runtime_error);
+
+  EXPECT_EQ(index.size(), 1u);
+  EXPECT_EQ(index.Find(kPublicKeys[0])->persistent_keepalive, 25);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,184 @@
+#include "profile_store.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "test/temp_directory.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKey[] = "xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=";
+
+std::string Config(int server) {
+  return "[Interface]\nPrivateKey = yAnz5TF+lXXJte14tji3zlMNq+hd2rYUIgJBgB3fBmk=\nAddress = 10.0.0.2/32\n\n"
+         "[Peer]\nPublicKey = " +
+         std::string(kPublicKey) + "\nAllowedIPs = 0.0.0.0/0\nEndpoint = server" + std::to_string(server) +
+         ".example.com:51820\n";
+}
+
+class ProfileStoreTest : public ::testing::Test {
+ protected:
+  TempDirectory directory_{"profile_store_test"};
+  std::string path_ = directory_.Path("profiles");
+};
+
+}  // namespace
+
+TEST_F(ProfileStoreTest, ImportsAndFindsProfiles) {
+  ProfileStore store(path_);
+  std::vector<std::pair<std::string, std::string>> profiles;
+  for (int server = 0; server < 1000; server++) {
+    profiles.emplace_back("server" + std::to_string(server), Config(server));
+  }
+  std::vector<ProfileStore::ProfileId> ids = store.Import(profiles);
+  ASSERT_EQ(ids.size(), 1000u);
+  EXPECT_EQ(store.size(), 1000u);
+
+  std::optional<WireguardConfig> config = store.Find(ids[42]);
+  ASSERT_TRUE(config.has_value());
+  ASSERT_EQ(config->peers.size(), 1u);
+  EXPECT_EQ(config->peers[0].endpoint, "server42.example.com:51820");
+  EXPECT_EQ(config->interface_config.addresses, std::vector<std::string>({"10.0.0.2/32"}));
+  EXPECT_FALSE(store.Find(0).has_value());
+  EXPECT_FALSE(store.Find(100000).has_value());
+
+  EXPECT_EQ(store.FindByName("server7"), ids[7]);
+  EXPECT_FALSE(store.FindByName("server1000").has_value());
+  EXPECT_EQ(store.FindByEndpoint("server9.example.com:51820"), std::vector<ProfileStore::ProfileId>({ids[9]}));
+  EXPECT_EQ(store.FindByPublicKey(kPublicKey).size(), 1000u);
+
+  // The indexes are rebuilt from the file.
+  ProfileStore reopened(path_);
+  EXPECT_EQ(reopened.size(), 1000u);
+  EXPECT_EQ(reopened.FindByName("server7"), ids[7]);
+  EXPECT_EQ(reopened.Find(ids[999])->peers[0].endpoint, "server999.example.com:51820");
+}
+
+TEST_F(ProfileStoreTest, DeduplicatesAndReplacesByName) {
+  ProfileStore store(path_);
+  std::vector<ProfileStore::ProfileId> first = store.Import({{"a", Config(1)}, {"b", Config(2)}});
+  // Written differently, but the same config.
+  std::string reformatted = "# Exported\n[interface]\nAddress=10.0.0.2/32\n"
+                            "PrivateKey=yAnz5TF+lXXJte14tji3zlMNq+hd2rYUIgJBgB3fBmk=\n[peer]\n"
+                            "PublicKey=" +
+                            std::string(kPublicKey) +
+                            "\nEndpoint=server1.example.com:51820\nAllowedIPs=0.0.0.0/0\n";
+  std::vector<ProfileStore::ProfileId> second = store.Import({{"c", reformatted}, {"b", Config(3)}});
+  EXPECT_EQ(second[0], first[0]);
+  EXPECT_NE(second[1], first[1]);
+  EXPECT_EQ(store.size(), 2u);
+  // The stored config is found under its new name too.
+  EXPECT_EQ(store.FindByName("c"), first[0]);
+  EXPECT_EQ(store.FindByName("a"), first[0]);
+  EXPECT_EQ(store.FindByName("b"), second[1]);
+  EXPECT_FALSE(store.Find(first[1]).has_value());
+  EXPECT_TRUE(store.FindByEndpoint("server2.example.com:51820").empty());
+
+  {
+    ProfileStore reopened(path_);
+    EXPECT_EQ(reopened.FindByName("c"), first[0]);
+  }
+
+  // Taking a name away from a profile removes it under all of its names.
+  std::vector<ProfileStore::ProfileId> third = store.Import({{"c", Config(4)}});
+  EXPECT_FALSE(store.Find(first[0]).has_value());
+  EXPECT_FALSE(store.FindByName("a").has_value());
+  EXPECT_EQ(store.FindByName("c"), third[0]);
+  store.Remove({third[0], 12345});
+  EXPECT_FALSE(store.Find(third[0]).has_value());
+  ProfileStore reopened(path_);
+  EXPECT_EQ(reopened.size(), 1u);
+  EXPECT_FALSE(reopened.FindByName("a").has_value());
+  EXPECT_FALSE(reopened.FindByName("c").has_value());
+  EXPECT_EQ(reopened.FindByName("b"), second[1]);
+  // IDs are not reused.
+  EXPECT_GT(reopened.Import({{"a", Config(1)}})[0], second[1]);
+}
+
+TEST_F(ProfileStoreTest, RejectsBatchesWithInvalidConfigs) {
+  ProfileStore store(path_);
+  EXPECT_THROW(store.Import({{"a", Config(1)}, {"b", "[Interface]\nMTU = big\n"}}), std::invalid_argument);
+  EXPECT_THROW(store.Import({{"", Config(1)}}), std::invalid_argument);
+  // A name given twice would leave the ID returned for its first config dangling.
+  EXPECT_THROW(store.Import({{"a", Config(1)}, {"b", Config(2)}, {"a", Config(3)}}), std::invalid_argument);
+  EXPECT_EQ(store.size(), 0u);
+  EXPECT_FALSE(store.FindByName("b").has_value());
+}
+
+TEST_F(ProfileStoreTest, DropsATornRecord) {
+  std::vector<ProfileStore::ProfileId> ids;
+  {
+    ProfileStore store(path_);
+    ids = store.Import({{"a", Config(1)}, {"b", Config(2)}});
+  }
+  // A crash in the middle of writing the second record, whose first byte follows the first record.
+  int fd = open(path_.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  uint32_t length = 0;
+  ASSERT_EQ(pread(fd, &length, sizeof(length), 64 + 8), static_cast<ssize_t>(sizeof(length)));
+  char garbage = '!';
+  ASSERT_EQ(pwrite(fd, &garbage, 1, 64 + length + 40), 1);
+  close(fd);
+
+  ProfileStore store(path_);
+  EXPECT_EQ(store.size(), 1u);
+  EXPECT_TRUE(store.Find(ids[0]).has_value());
+  EXPECT_FALSE(store.FindByName("b").has_value());
+  std::vector<ProfileStore::ProfileId> again = store.Import({{"b", Config(2)}});
+  ProfileStore reopened(path_);
+  EXPECT_EQ(reopened.size(), 2u);
+  EXPECT_EQ(reopened.FindByName("b"), again[0]);
+}
+
+TEST_F(ProfileStoreTest, CompactsOrGrowsWhenFull) {
+  ProfileStore store(path_);
+  off_t initial_size = FileSize(path_);
+  ProfileStore::ProfileId aliased = store.Import({{"z", Config(500)}})[0];
+  store.Import({{"alias", Config(500)}});
+  std::string padding(40000, 'x');
+  // Replacing one profile over and over fills the file with removed ones.
+  ProfileStore::ProfileId last = 0;
+  for (int i = 0; i < 100; i++) {
+    std::string config = Config(i) + "Comment = " + padding + "\n";
+    last = store.Import({{"a", config}})[0];
+  }
+  EXPECT_EQ(FileSize(path_), initial_size);
+  EXPECT_EQ(store.size(), 2u);
+  EXPECT_EQ(store.FindByName("alias"), aliased);
+  EXPECT_EQ(store.Find(last)->peers[0].endpoint, "server99.example.com:51820");
+
+  // Live profiles that do not fit make it grow.
+  std::vector<std::pair<std::string, std::string>> profiles;
+  for (int i = 0; i < 100; i++) {
+    profiles.emplace_back("b" + std::to_string(i), Config(1000 + i) + "Comment = " + padding + "\n");
+  }
+  store.Import(profiles);
+  EXPECT_GT(FileSize(path_), initial_size);
+  ProfileStore reopened(path_);
+  EXPECT_EQ(reopened.size(), 102u);
+  EXPECT_EQ(reopened.FindByName("a"), last);
+  EXPECT_EQ(reopened.FindByName("alias"), aliased);
+}
+
+TEST_F(ProfileStoreTest, RejectsOtherFiles) {
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_GE(fd, 0);
+  std::string text(100, 'x');
+  ASSERT_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+  close(fd);
+  EXPECT_THROW(ProfileStore store(path_), std::runtime_error);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
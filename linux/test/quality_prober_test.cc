@@ -0,0 +1,144 @@
+#include "quality_prober.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "test/udp_responder.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+QualityProbeOptions FastOptions(const std::string& target) {
+  QualityProbeOptions options;
+  options.target = target;
+  options.interval = 10;
+  options.timeout = 200;
+  return options;
+}
+
+// Waits until `done` holds for the prober's estimates, for at most two seconds.
+template <typename Predicate>
+LinkQuality WaitFor(QualityProber* prober, Predicate done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  LinkQuality quality;
+  while (std::chrono::steady_clock::now() < deadline) {
+    quality = prober->quality().value_or(LinkQuality());
+    if (done(quality)) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return quality;
+}
+
+}  // namespace
+
+TEST(QuantileSketch, StaysWithinItsRelativeAccuracy) {
+  QuantileSketch sketch(0.02, 0.01, 60000);
+  for (int i = 1; i <= 1000; i++) {
+    sketch.Add(i);
+  }
+  EXPECT_EQ(sketch.count(), 1000u);
+  EXPECT_NEAR(sketch.Quantile(0.5), 500, 500 * 0.02);
+  EXPECT_NEAR(sketch.Quantile(0.99), 990, 990 * 0.02);
+  EXPECT_NEAR(sketch.Quantile(0), 1, 0.02);
+  EXPECT_NEAR(sketch.Quantile(1), 1000, 1000 * 0.02);
+
+  // Out of range values are clamped.
+  QuantileSketch other(0.02, 0.01, 60000);
+  other.Add(1e9);
+  other.Add(0);
+  sketch.Merge(other);
+  EXPECT_EQ(sketch.count(), 1002u);
+  EXPECT_NEAR(sketch.Quantile(1), 60000, 60000 * 0.02);
+  EXPECT_NEAR(sketch.Quantile(0), 0.01, 0.01 * 0.02);
+
+  sketch.Clear();
+  EXPECT_EQ(sketch.Quantile(0.5), 0);
+}
+
+TEST(QualityEstimator, TracksRecentRoundTripsJitterAndLoss) {
+  QualityEstimator estimator;
+  for (int i = 0; i < QualityEstimator::kRttWindow; i++) {
+    estimator.OnReply(i % 2 == 0 ? 100 : 110);
+  }
+  LinkQuality quality = estimator.quality();
+  EXPECT_NEAR(quality.rtt_median, 105, 6);
+  EXPECT_NEAR(quality.jitter, 10, 0.1);
+  EXPECT_EQ(quality.loss, 0);
+  EXPECT_EQ(quality.sent, static_cast<uint64_t>(QualityEstimator::kRttWindow));
+
+  // The path got slower: after two windows nothing of the old round trips is left.
+  for (int i = 0; i < 2 * QualityEstimator::kRttWindow; i++) {
+    estimator.OnReply(30);
+  }
+  quality = estimator.quality();
+  EXPECT_NEAR(quality.rtt_p99, 30, 30 * 0.02);
+  EXPECT_LT(quality.jitter, 0.1);
+
+  // Loss covers the last kLossWindow probes.
+  for (int i = 0; i < QualityEstimator::kLossWindow / 4; i++) {
+    estimator.OnLoss();
+  }
+  EXPECT_DOUBLE_EQ(estimator.quality().loss, 0.25);
+  for (int i = 0; i < QualityEstimator::kLossWindow; i++) {
+    estimator.OnReply(30);
+  }
+  EXPECT_EQ(estimator.quality().loss, 0);
+}
+
+TEST(QualityProber, MeasuresAnEchoResponder) {
+  ResponderBehavior behavior;
+  behavior.delay = std::chrono::milliseconds(20);
+  UdpResponder responder(behavior);
+  QualityProber prober;
+  EXPECT_FALSE(prober.quality().has_value());
+
+  int updates = 0;
+  prober.Start(FastOptions(responder.endpoint()), [&updates](const LinkQuality&) { updates++; });
+  LinkQuality quality = WaitFor(&prober, [](const LinkQuality& q) { return q.received >= 5; });
+  EXPECT_GE(quality.received, 5u);
+  EXPECT_GE(quality.rtt_median, 19);
+  EXPECT_LT(quality.rtt_median, 100);
+  EXPECT_EQ(quality.loss, 0);
+  prober.Stop();
+  EXPECT_GE(updates, 5);
+  EXPECT_FALSE(prober.quality().has_value());
+}
+
+TEST(QualityProber, CountsUnansweredProbesAsLost) {
+  ResponderBehavior behavior;
+  behavior.answer_every = 2;
+  UdpResponder responder(behavior);
+  QualityProber prober;
+  QualityProbeOptions options = FastOptions(responder.endpoint());
+  // Losses are only counted once the timeout ran out, replies at once.
+  options.timeout = 30;
+  prober.Start(options);
+  LinkQuality quality = WaitFor(&prober, [](const LinkQuality& q) { return q.sent >= 60; });
+  EXPECT_GE(quality.sent, 60u);
+  EXPECT_NEAR(quality.loss, 0.5, 0.1);
+}
+
+TEST(QualityProber, StopsPromptlyAndRejectsHostNames) {
+  UdpResponder responder;
+  QualityProber prober;
+  QualityProbeOptions options = FastOptions(responder.endpoint());
+  options.interval = 60000;
+  prober.Start(options);
+  auto start = std::chrono::steady_clock::now();
+  prober.Stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+  options.target = "localhost:7";
+  EXPECT_THROW(prober.Start(options), std::invalid_argument);
+  EXPECT_FALSE(prober.quality().has_value());
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
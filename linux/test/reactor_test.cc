@@ -0,0 +1,161 @@
+#include "reactor.h"
+
+#include <gtest/gtest.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// Waits until `done` holds, for at most two seconds.
+template <typename Predicate>
+bool WaitFor(Predicate done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(TimerWheel, ExpiresInDeadlineOrder) {
+  TimerWheel wheel(1000);
+  EXPECT_EQ(wheel.next_deadline(), -1);
+  wheel.Add(1, 1050);
+  wheel.Add(2, 1010);
+  wheel.Add(3, 1010);
+  // Beyond one turn of the wheel, and in the past.
+  wheel.Add(4, 1000 + 5 * TimerWheel::kSlots);
+  wheel.Add(5, 900);
+  EXPECT_EQ(wheel.size(), 5u);
+  EXPECT_EQ(wheel.next_deadline(), 1000);
+
+  EXPECT_EQ(wheel.Advance(1000), std::vector<uint64_t>({5}));
+  EXPECT_EQ(wheel.next_deadline(), 1010);
+  EXPECT_TRUE(wheel.Advance(1009).empty());
+  std::vector<uint64_t> expired = wheel.Advance(1060);
+  ASSERT_EQ(expired.size(), 3u);
+  EXPECT_EQ(expired[2], 1u);
+  EXPECT_EQ(wheel.next_deadline(), static_cast<int64_t>(1000 + 5 * TimerWheel::kSlots));
+
+  // The far timer moves into the wheel as it turns, and a jump past it expires it.
+  EXPECT_TRUE(wheel.Advance(1000 + 4 * TimerWheel::kSlots + 100).empty());
+  EXPECT_EQ(wheel.Advance(1000 + 10 * TimerWheel::kSlots), std::vector<uint64_t>({4}));
+  EXPECT_EQ(wheel.size(), 0u);
+  EXPECT_EQ(wheel.next_deadline(), -1);
+}
+
+TEST(TimerWheel, CancelsInConstantTime) {
+  TimerWheel wheel(0);
+  for (uint64_t id = 1; id <= 100; id++) {
+    wheel.Add(id, 10);
+  }
+  wheel.Add(101, 100000);
+  EXPECT_TRUE(wheel.Cancel(50));
+  EXPECT_TRUE(wheel.Cancel(1));
+  EXPECT_TRUE(wheel.Cancel(101));
+  EXPECT_FALSE(wheel.Cancel(101));
+  EXPECT_FALSE(wheel.Cancel(1000));
+  std::vector<uint64_t> expired = wheel.Advance(10);
+  EXPECT_EQ(expired.size(), 98u);
+  EXPECT_EQ(wheel.next_deadline(), -1);
+
+  // A slot emptied by cancelling is not reported as the next deadline.
+  wheel.Add(7, 20);
+  wheel.Add(8, 30);
+  wheel.Cancel(7);
+  EXPECT_EQ(wheel.next_deadline(), 30);
+}
+
+TEST(Reactor, RunsTimersAndWatchesOnOneThread) {
+  Reactor reactor;
+  std::thread::id reactor_thread;
+  reactor.Invoke([&reactor_thread] { reactor_thread = std::this_thread::get_id(); });
+  EXPECT_NE(reactor_thread, std::this_thread::get_id());
+
+  std::atomic<int> once{0};
+  std::atomic<int> periodic{0};
+  std::atomic<bool> other_thread{false};
+  reactor.AddTimer(std::chrono::milliseconds(20), [&] {
+    once++;
+    other_thread = other_thread || std::this_thread::get_id() != reactor_thread;
+  });
+  Reactor::TimerId ticker = reactor.AddTimer(
+      std::chrono::milliseconds(5), [&] { periodic++; }, std::chrono::milliseconds(5));
+  Reactor::TimerId cancelled = reactor.AddTimer(std::chrono::milliseconds(10), [&] { once += 100; });
+  reactor.CancelTimer(cancelled);
+
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  ASSERT_GE(fd, 0);
+  std::atomic<uint64_t> read_total{0};
+  reactor.Watch(fd, EPOLLIN, [&](uint32_t events) {
+    uint64_t value = 0;
+    if ((events & EPOLLIN) != 0 && read(fd, &value, sizeof(value)) == sizeof(value)) {
+      read_total += value;
+    }
+  });
+  uint64_t three = 3;
+  ASSERT_EQ(write(fd, &three, sizeof(three)), static_cast<ssize_t>(sizeof(three)));
+
+  EXPECT_TRUE(WaitFor([&] { return once == 1 && periodic >= 4 && read_total == 3; }));
+  reactor.CancelTimer(ticker);
+  int ticks = periodic;
+  reactor.Unwatch(fd);
+  ASSERT_EQ(write(fd, &three, sizeof(three)), static_cast<ssize_t>(sizeof(three)));
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_EQ(periodic, ticks);
+  EXPECT_EQ(read_total, 3u);
+  EXPECT_EQ(once, 1);
+  EXPECT_FALSE(other_thread);
+  close(fd);
+}
+
+TEST(Reactor, SleepsWhileIdle) {
+  Reactor reactor;
+  // A timer far out does not wake the reactor before it is due.
+  reactor.AddTimer(std::chrono::hours(1), [] {});
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t wakeups = reactor.wakeups();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_EQ(reactor.wakeups(), wakeups);
+
+  std::atomic<int> fired{0};
+  reactor.AddTimer(std::chrono::milliseconds(10), [&fired] { fired++; });
+  EXPECT_TRUE(WaitFor([&fired] { return fired == 1; }));
+  // The Invoke of AddTimer and the timer itself, give or take a wakeup that came a tick early.
+  EXPECT_LE(reactor.wakeups() - wakeups, 4u);
+}
+
+TEST(Reactor, InvokeWaitsAndPassesOnExceptions) {
+  Reactor reactor;
+  int value = 0;
+  reactor.Invoke([&value] { value = 42; });
+  EXPECT_EQ(value, 42);
+  EXPECT_THROW(reactor.Invoke([] { throw std::runtime_error("failed"); }), std::runtime_error);
+
+  // Handlers may change watches and timers in place, and a throwing handler does not stop the reactor.
+  std::atomic<bool> nested{false};
+  reactor.Post([&] {
+    reactor.AddTimer(std::chrono::milliseconds(0), [&nested] { nested = true; });
+    throw std::runtime_error("ignored");
+  });
+  EXPECT_TRUE(WaitFor([&nested] { return nested.load(); }));
+  EXPECT_THROW(reactor.Watch(-1, EPOLLIN, [](uint32_t) {}), std::system_error);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
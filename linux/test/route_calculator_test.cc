@@ -0,0 +1,97 @@
+#include "route_calculator.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+std::vector<IpPrefix> Prefixes(const std::vector<std::string> &texts) {
+  std::vector<IpPrefix> prefixes;
+  for (const auto &text : texts) {
+    IpPrefix prefix;
+    EXPECT_TRUE(ParseIpPrefix(text, &prefix)) << text;
+    prefixes.push_back(prefix);
+  }
+  return prefixes;
+}
+
+std::vector<std::string> Format(const std::vector<IpPrefix> &prefixes) {
+  std::vector<std::string> texts;
+  for (const auto &prefix : prefixes) {
+    texts.push_back(FormatIpPrefix(prefix));
+  }
+  return texts;
+}
+
+std::vector<std::string> Routes(const std::vector<std::string> &include, const std::vector<std::string> &exclude) {
+  return Format(CalculateRoutes(Prefixes(include), Prefixes(exclude)));
+}
+
+}  // namespace
+
+TEST(RouteCalculator, ComplementsExcludedPrefixes) {
+  EXPECT_EQ(Routes({"0.0.0.0/0"}, {"10.0.0.0/8", "192.168.0.0/16"}),
+            (std::vector<std::string>{"0.0.0.0/5", "8.0.0.0/7", "11.0.0.0/8", "12.0.0.0/6", "16.0.0.0/4",
+                                      "32.0.0.0/3", "64.0.0.0/2", "128.0.0.0/2", "192.0.0.0/9", "192.128.0.0/11",
+                                      "192.160.0.0/13", "192.169.0.0/16", "192.170.0.0/15", "192.172.0.0/14",
+                                      "192.176.0.0/12", "192.192.0.0/10", "193.0.0.0/8", "194.0.0.0/7",
+                                      "196.0.0.0/6", "200.0.0.0/5", "208.0.0.0/4", "224.0.0.0/3"}));
+  EXPECT_EQ(Routes({"::/0"}, {"8000::/1"}), std::vector<std::string>{"::/1"});
+}
+
+TEST(RouteCalculator, MergesAdjacentAndOverlappingPrefixes) {
+  EXPECT_EQ(Routes({"10.0.0.0/9", "10.128.0.0/9", "10.1.0.0/16", "192.0.2.0/25", "192.0.2.128/25"}, {}),
+            (std::vector<std::string>{"10.0.0.0/8", "192.0.2.0/24"}));
+  // Host bits are ignored, and prefixes inside an included one add nothing.
+  EXPECT_EQ(Routes({"10.1.2.3/8"}, {}), std::vector<std::string>{"10.0.0.0/8"});
+  EXPECT_EQ(Routes({"10.0.0.0/8", "10.0.0.1/32"}, {}), std::vector<std::string>{"10.0.0.0/8"});
+}
+
+TEST(RouteCalculator, IgnoresExclusionsOutsideIncludedSpace) {
+  EXPECT_EQ(Routes({"10.0.0.0/8"}, {"192.168.0.0/16", "2001:db8::/32"}), std::vector<std::string>{"10.0.0.0/8"});
+  EXPECT_EQ(Routes({"10.0.0.0/8"}, {"0.0.0.0/0"}), std::vector<std::string>{});
+  EXPECT_EQ(Routes({"10.0.0.0/31"}, {"10.0.0.1/32"}), std::vector<std::string>{"10.0.0.0/32"});
+}
+
+TEST(RouteCalculator, HandlesBothFamiliesIndependently) {
+  EXPECT_EQ(Routes({"::/0", "0.0.0.0/0"}, {"128.0.0.0/1", "fe80::/10", "8000::/1"}),
+            (std::vector<std::string>{"0.0.0.0/1", "::/1"}));
+  // Carving a host out of a /32 leaves one prefix per level in between.
+  auto routes = Routes({"2001:db8::/32"}, {"2001:db8::1/128"});
+  ASSERT_EQ(routes.size(), 96u);
+  EXPECT_EQ(routes.front(), "2001:db8::/128");
+  EXPECT_EQ(routes[1], "2001:db8::2/127");
+  EXPECT_EQ(routes.back(), "2001:db8:8000::/33");
+}
+
+TEST(RouteCalculator, AppliesExcludedIpsOfConfig) {
+  auto config = WireguardConfig::Parse(
+      "[Interface]\n"
+      "PrivateKey = yAnz5TF+lXXJte14tji3zlMNq+hd2rYUIgJBgB3fBmk=\n"
+      "[Peer]\n"
+      "PublicKey = xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=\n"
+      "AllowedIPs = 0.0.0.0/0\n"
+      "ExcludedIPs = 0.0.0.0/1, 128.0.0.0/2\n"
+      "[Peer]\n"
+      "PublicKey = TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0=\n"
+      "AllowedIPs = 10.0.0.0/9, 10.128.0.0/9\n");
+  EXPECT_EQ(config.peers[0].excluded_ips, (std::vector<std::string>{"0.0.0.0/1", "128.0.0.0/2"}));
+
+  auto applied = ApplyExcludedIps(config);
+  EXPECT_EQ(applied.peers[0].allowed_ips, std::vector<std::string>{"192.0.0.0/2"});
+  EXPECT_TRUE(applied.peers[0].excluded_ips.empty());
+  // Peers without ExcludedIPs are left as written.
+  EXPECT_EQ(applied.peers[1].allowed_ips, config.peers[1].allowed_ips);
+  EXPECT_EQ(applied.ToString().find("ExcludedIPs"), std::string::npos);
+
+  config.peers[0].excluded_ips.push_back("not-a-prefix");
+  EXPECT_THROW(ApplyExcludedIps(config), std::invalid_argument);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,221 @@
+#include "service_manager.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const wchar_t kService[] = L"WireGuardTunnel$test";
+
+int64_t MillisSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+WaitOptions Options(WaitStrategy strategy) {
+  WaitOptions options;
+  options.strategy = strategy;
+  options.poll_interval = 20;
+  options.timeout = 1000;
+  return options;
+}
+
+// Collects the states a ServiceWatcher reports.
+class Recorder {
+ public:
+  void Add(ServiceState state) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      states_.push_back(state);
+    }
+    changed_.notify_all();
+  }
+
+  // Waits until `state` was reported, for at most a second.
+  bool Await(ServiceState state) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::seconds(1),
+                             [this, state] { return !states_.empty() && states_.back() == state; });
+  }
+
+  std::vector<ServiceState> states() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return states_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<ServiceState> states_;
+};
+
+}  // namespace
+
+TEST(SimulatedServiceManager, GoesThroughPendingStates) {
+  SimulatedServiceManager manager;
+  SimulatedServiceBehavior behavior;
+  behavior.start_delay = 50;
+  behavior.stop_delay = 50;
+  behavior.wait_hint = 3000;
+  manager.Install(kService, behavior);
+  EXPECT_EQ(manager.Query(kService).state, ServiceState::stopped);
+  EXPECT_EQ(manager.Query(L"missing").state, ServiceState::stopped);
+  EXPECT_THROW(manager.Start(L"missing"), ServiceError);
+  EXPECT_THROW(manager.Stop(kService), ServiceError);
+
+  auto start = Clock::now();
+  manager.Start(kService);
+  ServiceStatus status = manager.Query(kService);
+  EXPECT_EQ(status.state, ServiceState::start_pending);
+  EXPECT_EQ(status.wait_hint, 3000);
+  EXPECT_THROW(manager.Stop(kService), ServiceError);
+  status = manager.WaitForChange(kService, ServiceState::start_pending, 1000);
+  EXPECT_EQ(status.state, ServiceState::running);
+  EXPECT_EQ(status.wait_hint, 0);
+  EXPECT_GE(MillisSince(start), 50);
+  EXPECT_LT(MillisSince(start), 500);
+  EXPECT_THROW(manager.Start(kService), ServiceError);
+
+  manager.Stop(kService);
+  EXPECT_EQ(manager.Query(kService).state, ServiceState::stop_pending);
+  // Not stopped yet when the wait times out.
+  EXPECT_EQ(manager.WaitForChange(kService, ServiceState::stop_pending, 10).state, ServiceState::stop_pending);
+  EXPECT_EQ(manager.WaitForChange(kService, ServiceState::stop_pending, 1000).state, ServiceState::stopped);
+}
+
+TEST(SimulatedServiceManager, SimulatesFailures) {
+  SimulatedServiceManager manager;
+  SimulatedServiceBehavior behavior;
+  behavior.fail_start = true;
+  manager.Install(kService, behavior);
+  EXPECT_THROW(manager.Start(kService), ServiceError);
+  EXPECT_EQ(manager.Query(kService).state, ServiceState::stopped);
+
+  behavior.fail_start = false;
+  behavior.exit_on_start = true;
+  behavior.start_delay = 10;
+  manager.Install(kService, behavior);
+  manager.Start(kService);
+  EXPECT_EQ(manager.WaitForChange(kService, ServiceState::start_pending, 1000).state, ServiceState::stopped);
+}
+
+TEST(StopService, WaitsUntilStoppedWithEveryStrategy) {
+  for (WaitStrategy strategy : {WaitStrategy::poll, WaitStrategy::notify}) {
+    SimulatedServiceManager manager;
+    SimulatedServiceBehavior behavior;
+    behavior.stop_delay = 30;
+    manager.Install(kService, behavior);
+    manager.Start(kService);
+    manager.WaitForChange(kService, ServiceState::start_pending, 1000);
+
+    auto start = Clock::now();
+    StopService(&manager, kService, Options(strategy));
+    EXPECT_EQ(manager.Query(kService).state, ServiceState::stopped);
+    EXPECT_GE(MillisSince(start), 30);
+    // Returns at once when there is nothing to stop.
+    StopService(&manager, kService, Options(strategy));
+    StopService(&manager, L"missing", Options(strategy));
+  }
+}
+
+TEST(StopService, WaitsOutAPendingStop) {
+  SimulatedServiceManager manager;
+  SimulatedServiceBehavior behavior;
+  behavior.stop_delay = 30;
+  manager.Install(kService, behavior);
+  manager.Start(kService);
+  manager.WaitForChange(kService, ServiceState::start_pending, 1000);
+  manager.Stop(kService);
+  StopService(&manager, kService, Options(WaitStrategy::notify));
+  EXPECT_EQ(manager.Query(kService).state, ServiceState::stopped);
+}
+
+TEST(StopService, TimesOutOnAHungStop) {
+  SimulatedServiceManager manager;
+  SimulatedServiceBehavior behavior;
+  behavior.hang_stop = true;
+  manager.Install(kService, behavior);
+  manager.Start(kService);
+  manager.WaitForChange(kService, ServiceState::start_pending, 1000);
+
+  WaitOptions options = Options(WaitStrategy::notify);
+  options.timeout = 100;
+  auto start = Clock::now();
+  EXPECT_THROW(StopService(&manager, kService, options), ServiceError);
+  EXPECT_GE(MillisSince(start), 100);
+  EXPECT_LT(MillisSince(start), 500);
+  EXPECT_EQ(manager.Query(kService).state, ServiceState::stop_pending);
+}
+
+TEST(SimulatedServiceManager, ChangeWaitLastsUntilCancelled) {
+  SimulatedServiceManager manager;
+  manager.Install(kService, SimulatedServiceBehavior());
+  std::unique_ptr<ServiceChangeWait> changes = manager.WatchChanges(kService);
+  EXPECT_EQ(changes->Wait(ServiceState::running, ServiceChangeWait::kNoTimeout).state, ServiceState::stopped);
+
+  auto start = Clock::now();
+  std::thread canceller([&changes] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    changes->Cancel();
+  });
+  EXPECT_EQ(changes->Wait(ServiceState::stopped, ServiceChangeWait::kNoTimeout).state, ServiceState::stopped);
+  canceller.join();
+  EXPECT_GE(MillisSince(start), 200);
+  // Later waits return at once.
+  EXPECT_EQ(changes->Wait(ServiceState::stopped, 1000).state, ServiceState::stopped);
+  EXPECT_LT(MillisSince(start), 1000);
+}
+
+TEST(ServiceWatcher, ReportsEveryTransition) {
+  for (WaitStrategy strategy : {WaitStrategy::poll, WaitStrategy::notify}) {
+    SimulatedServiceManager manager;
+    SimulatedServiceBehavior behavior;
+    // Longer than the poll interval, so that polling sees the pending states too.
+    behavior.start_delay = 100;
+    behavior.stop_delay = 100;
+    manager.Install(kService, behavior);
+    Recorder recorder;
+    ServiceWatcher watcher(&manager, kService, Options(strategy), [&recorder](ServiceState state) {
+      recorder.Add(state);
+    });
+    ASSERT_TRUE(recorder.Await(ServiceState::stopped));
+
+    manager.Start(kService);
+    ASSERT_TRUE(recorder.Await(ServiceState::running));
+    if (strategy == WaitStrategy::notify) {
+      // Reported as soon as the transition happened.
+      EXPECT_LT(MillisSince(manager.state_since(kService)), 50);
+    }
+    manager.Stop(kService);
+    ASSERT_TRUE(recorder.Await(ServiceState::stopped));
+    EXPECT_EQ(recorder.states(),
+              std::vector<ServiceState>({ServiceState::stopped, ServiceState::start_pending, ServiceState::running,
+                                         ServiceState::stop_pending, ServiceState::stopped}));
+  }
+}
+
+TEST(ServiceWatcher, StopsWithoutWaitingForAChange) {
+  SimulatedServiceManager manager;
+  manager.Install(kService, SimulatedServiceBehavior());
+  Recorder recorder;
+  auto watcher = std::make_unique<ServiceWatcher>(&manager, kService, Options(WaitStrategy::notify),
+                                                  [&recorder](ServiceState state) { recorder.Add(state); });
+  ASSERT_TRUE(recorder.Await(ServiceState::stopped));
+  auto start = Clock::now();
+  watcher.reset();
+  EXPECT_LT(MillisSince(start), 50);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,203 @@
+#include "status_monitor.h"
+
+#include <gtest/gtest.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connection_status.h"
+#include "link_control.h"
+#include "netlink.h"
+#include "reactor.h"
+#include "test/network_namespace.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const int kTunnel = 7;
+
+NetlinkMessage LinkMessage(uint16_t type, int ifindex, const char* name, unsigned int flags) {
+  NetlinkMessage message(type, 0);
+  ifinfomsg link = {};
+  link.ifi_index = ifindex;
+  link.ifi_flags = flags;
+  message.AppendHeader(link);
+  message.PutString(IFLA_IFNAME, name);
+  return message;
+}
+
+NetlinkMessage AddressMessage(uint16_t type, int ifindex, uint8_t scope) {
+  NetlinkMessage message(type, 0);
+  ifaddrmsg address = {};
+  address.ifa_family = AF_INET;
+  address.ifa_index = ifindex;
+  address.ifa_scope = scope;
+  message.AppendHeader(address);
+  return message;
+}
+
+// Collects the statuses a monitor reports.
+class StatusLog {
+ public:
+  void Add(ConnectionStatus status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statuses_.push_back(status);
+  }
+
+  // Waits for at most two seconds until `count` statuses were reported.
+  std::vector<ConnectionStatus> Wait(size_t count) {
+    for (int i = 0; i < 200; i++) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (statuses_.size() >= count) {
+          return statuses_;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statuses_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<ConnectionStatus> statuses_;
+};
+
+std::string Describe(const std::vector<ConnectionStatus>& statuses) {
+  std::string text;
+  for (ConnectionStatus status : statuses) {
+    text += ConnectionStatusToString(status) + " ";
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(TunnelStatusTracker, FollowsTheLifeOfTheTunnel) {
+  TunnelStatusTracker tracker("wg0");
+  tracker.Reset(std::nullopt, false);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+
+  // Other links do not matter.
+  tracker.Update(LinkMessage(RTM_NEWLINK, 2, "eth0", IFF_UP).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+
+  tracker.Update(LinkMessage(RTM_NEWLINK, kTunnel, "wg0", 0).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connecting);
+  tracker.Update(AddressMessage(RTM_NEWADDR, kTunnel, RT_SCOPE_UNIVERSE).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connecting);
+  EXPECT_FALSE(tracker.awaiting_handshake());
+  tracker.Update(LinkMessage(RTM_NEWLINK, kTunnel, "wg0", IFF_UP).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connecting);
+  EXPECT_TRUE(tracker.awaiting_handshake());
+  tracker.SetHandshake(false);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connecting);
+  tracker.SetHandshake(true);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connected);
+  EXPECT_FALSE(tracker.awaiting_handshake());
+
+  // Changes of other attributes and link-local addresses keep it connected.
+  tracker.Update(LinkMessage(RTM_NEWLINK, kTunnel, "wg0", IFF_UP | IFF_RUNNING).header());
+  tracker.Update(AddressMessage(RTM_DELADDR, kTunnel, RT_SCOPE_LINK).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connected);
+
+  tracker.Update(AddressMessage(RTM_DELADDR, kTunnel, RT_SCOPE_UNIVERSE).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnecting);
+  // A handshake does not bring back a tunnel that is being torn down.
+  tracker.SetHandshake(true);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnecting);
+  tracker.Update(LinkMessage(RTM_DELLINK, kTunnel, "wg0", 0).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+  // Addresses of the old interface index no longer count.
+  tracker.Update(AddressMessage(RTM_NEWADDR, kTunnel, RT_SCOPE_UNIVERSE).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+}
+
+TEST(TunnelStatusTracker, StartsFromTheLinkAsItIs) {
+  TunnelStatusTracker tracker("wg0");
+  LinkInfo link;
+  link.name = "wg0";
+  link.ifindex = kTunnel;
+  link.flags = IFF_UP;
+  tracker.Reset(link, true);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connected);
+  tracker.Reset(link, false);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::connecting);
+  link.flags = 0;
+  tracker.Reset(link, true);
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+
+  // Taken down and renamed away.
+  link.flags = IFF_UP;
+  tracker.Reset(link, true);
+  tracker.Update(LinkMessage(RTM_NEWLINK, kTunnel, "wg0", 0).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnecting);
+  tracker.Update(LinkMessage(RTM_NEWLINK, kTunnel, "old", 0).header());
+  EXPECT_EQ(tracker.status(), ConnectionStatus::disconnected);
+}
+
+TEST(StatusMonitor, ReportsTransitionsAsTheyHappen) {
+  RunInNetworkNamespace([] {
+    Reactor reactor;
+    StatusLog log;
+    std::atomic<bool> handshake{false};
+    StatusMonitor monitor(
+        &reactor, [&handshake](const std::string&) { return handshake.load(); },
+        [&log](ConnectionStatus status) { log.Add(status); });
+    // A veth link stands in for the tunnel, which the namespace may not be able to create.
+    monitor.Start("wg-test");
+    Check(log.Wait(1).size() == 1, "Initial status not reported");
+
+    NetlinkSocket socket(NETLINK_ROUTE);
+    NetlinkMessage message(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+    ifinfomsg info = {};
+    info.ifi_family = AF_UNSPEC;
+    message.AppendHeader(info);
+    message.PutString(IFLA_IFNAME, "wg-test");
+    size_t link_info = message.BeginNested(IFLA_LINKINFO);
+    message.PutString(IFLA_INFO_KIND, "veth");
+    message.EndNested(link_info);
+    socket.Request(message);
+    Check(log.Wait(2).size() == 2, "Creation not reported");
+
+    RouteBatch batch;
+    batch.SetLinkUp(static_cast<int>(if_nametoindex("wg-test")));
+    batch.Commit();
+    handshake = true;
+    Check(log.Wait(3).size() == 3, "Handshake not reported");
+
+    // The kernel takes the link down before deleting it.
+    DeleteLink("wg-test");
+    std::vector<ConnectionStatus> statuses = log.Wait(5);
+    std::vector<ConnectionStatus> expected = {ConnectionStatus::disconnected, ConnectionStatus::connecting,
+                                              ConnectionStatus::connected, ConnectionStatus::disconnecting,
+                                              ConnectionStatus::disconnected};
+    Check(statuses == expected, "Reported " + Describe(statuses));
+
+    // Nothing is reported once stopped.
+    monitor.Stop();
+    NetlinkMessage again(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+    again.AppendHeader(info);
+    again.PutString(IFLA_IFNAME, "wg-test");
+    link_info = again.BeginNested(IFLA_LINKINFO);
+    again.PutString(IFLA_INFO_KIND, "veth");
+    again.EndNested(link_info);
+    socket.Request(again);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Check(log.Wait(0).size() == 5, "Reported after stopping");
+  });
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,63 @@
+#ifndef WIREGUARD_DART_TEST_TEMP_DIRECTORY_H
+#define WIREGUARD_DART_TEST_TEMP_DIRECTORY_H
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+// A fresh directory under /tmp for the files of one test, removed together with the files left in it.
+class TempDirectory {
+ public:
+  explicit TempDirectory(const std::string& prefix) {
+    std::string pattern = "/tmp/" + prefix + "_XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    if (mkdtemp(name.data()) == nullptr) {
+      throw std::system_error(errno, std::generic_category(), "mkdtemp");
+    }
+    path_ = name.data();
+  }
+
+  ~TempDirectory() {
+    if (DIR* directory = opendir(path_.c_str())) {
+      while (dirent* entry = readdir(directory)) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+          unlink(Path(entry->d_name).c_str());
+        }
+      }
+      closedir(directory);
+    }
+    rmdir(path_.c_str());
+  }
+
+  TempDirectory(const TempDirectory&) = delete;
+  TempDirectory& operator=(const TempDirectory&) = delete;
+
+  const std::string& path() const { return path_; }
+  // The path of `name` in the directory.
+  std::string Path(const std::string& name) const { return path_ + "/" + name; }
+
+ private:
+  std::string path_;
+};
+
+// The size of the file at `path`, -1 if there is none.
+inline off_t FileSize(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
+
+#endif
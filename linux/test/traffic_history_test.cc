@@ -0,0 +1,125 @@
+#include "traffic_history.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// 2024-01-01T00:00:00Z, on the hour.
+const int64_t kHour = 1704067200;
+
+WireguardKey Key(uint8_t n) {
+  WireguardKey key = {};
+  key[0] = n;
+  return key;
+}
+
+PeerSample Sample(uint8_t n, uint64_t rx_bytes, uint64_t tx_bytes) {
+  PeerSample sample = {};
+  sample.public_key = Key(n);
+  sample.rx_bytes = rx_bytes;
+  sample.tx_bytes = tx_bytes;
+  return sample;
+}
+
+}  // namespace
+
+TEST(TrafficRing, AlignsBucketsAndClearsSkippedOnes) {
+  TrafficRing ring(60, 4);
+  ring.Add(kHour + 10, 1, 2);
+  ring.Add(kHour + 59, 1, 0);
+  ring.Add(kHour + 60, 5, 5);
+
+  TrafficWindow window = ring.Window(kHour, kHour + 120, kHour + 60);
+  EXPECT_EQ(window.start, kHour);
+  EXPECT_EQ(window.step, 60);
+  EXPECT_EQ(window.samples, std::vector<int64_t>({2, 2, 5, 5}));
+
+  // Three minutes later only the buckets of the last four minutes are held; the skipped ones read as 0.
+  ring.Add(kHour + 240, 7, 0);
+  window = ring.Window(0, kHour + 1000, kHour + 240);
+  EXPECT_EQ(window.start, kHour + 60);
+  EXPECT_EQ(window.samples, std::vector<int64_t>({5, 5, 0, 0, 0, 0, 7, 0}));
+
+  // Queried later than the newest sample, the buckets since then are 0 and older ones fall out.
+  window = ring.Window(0, kHour + 1000, kHour + 300);
+  EXPECT_EQ(window.start, kHour + 120);
+  EXPECT_EQ(window.samples, std::vector<int64_t>({0, 0, 0, 0, 7, 0, 0, 0}));
+
+  // A clock stepping back counts into the newest bucket.
+  ring.Add(kHour, 1, 1);
+  EXPECT_EQ(ring.Window(kHour + 240, kHour + 300, kHour + 240).samples, std::vector<int64_t>({8, 1}));
+  EXPECT_TRUE(ring.Window(kHour + 300, kHour + 300, kHour + 300).samples.empty());
+}
+
+TEST(TrafficRing, SkippingMoreThanTheRingClearsEverything) {
+  TrafficRing ring(1, 3);
+  ring.Add(kHour, 1, 1);
+  ring.Add(kHour + 1, 1, 1);
+  ring.Add(kHour + 1000, 4, 4);
+  EXPECT_EQ(ring.Window(0, kHour + 1001, kHour + 1000).samples, std::vector<int64_t>({0, 0, 0, 0, 4, 4}));
+}
+
+TEST(TrafficHistory, RecordsTunnelAndPeersAtEveryResolution) {
+  TrafficHistory history;
+  history.Observe({Sample(1, 1000, 2000), Sample(2, 0, 0)}, kHour);
+  TrafficDelta traffic = history.Observe({Sample(1, 1100, 2300), Sample(2, 10, 20)}, kHour + 1);
+  EXPECT_EQ(traffic.rx_bytes, 110u);
+  EXPECT_EQ(traffic.tx_bytes, 320u);
+  history.Observe({Sample(1, 1200, 2300), Sample(2, 10, 20)}, kHour + 61);
+
+  auto seconds = history.Query(nullptr, TrafficResolution::second, kHour, kHour + 2, kHour + 61);
+  ASSERT_TRUE(seconds.has_value());
+  // The first samples only set the baseline.
+  EXPECT_EQ(seconds->samples, std::vector<int64_t>({0, 0, 110, 320}));
+
+  auto minutes = history.Query(nullptr, TrafficResolution::minute, kHour, kHour + 120, kHour + 61);
+  EXPECT_EQ(minutes->samples, std::vector<int64_t>({110, 320, 100, 0}));
+  auto hours = history.Query(nullptr, TrafficResolution::hour, kHour, kHour + 3600, kHour + 61);
+  EXPECT_EQ(hours->samples, std::vector<int64_t>({210, 320}));
+
+  WireguardKey peer = Key(2);
+  auto peer_minutes = history.Query(&peer, TrafficResolution::minute, kHour, kHour + 120, kHour + 61);
+  ASSERT_TRUE(peer_minutes.has_value());
+  EXPECT_EQ(peer_minutes->samples, std::vector<int64_t>({10, 20, 0, 0}));
+  WireguardKey unknown = Key(3);
+  EXPECT_FALSE(history.Query(&unknown, TrafficResolution::minute, kHour, kHour + 120, kHour + 61).has_value());
+
+  // A removed peer's history goes with it.
+  history.Observe({Sample(1, 1200, 2300)}, kHour + 62);
+  EXPECT_FALSE(history.Query(&peer, TrafficResolution::minute, kHour, kHour + 120, kHour + 62).has_value());
+}
+
+TEST(TrafficHistory, RestartAndCounterResetsDoNotCountOldTraffic) {
+  TrafficHistory history;
+  history.Observe({Sample(1, 100, 100)}, kHour);
+  history.Observe({Sample(1, 150, 100)}, kHour + 1);
+  // Sampling paused for a while.
+  history.Restart();
+  history.Observe({Sample(1, 5000, 5000)}, kHour + 100);
+  // The device was recreated and counts from 0 again.
+  history.Observe({Sample(1, 30, 40)}, kHour + 101);
+
+  auto window = history.Query(nullptr, TrafficResolution::second, kHour, kHour + 102, kHour + 101);
+  ASSERT_TRUE(window.has_value());
+  int64_t rx = 0;
+  int64_t tx = 0;
+  for (size_t i = 0; i < window->samples.size(); i += 2) {
+    rx += window->samples[i];
+    tx += window->samples[i + 1];
+  }
+  EXPECT_EQ(rx, 50 + 30);
+  EXPECT_EQ(tx, 40);
+
+  history.Clear();
+  window = history.Query(nullptr, TrafficResolution::hour, kHour, kHour + 3600, kHour + 101);
+  EXPECT_EQ(window->samples, std::vector<int64_t>({0, 0}));
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
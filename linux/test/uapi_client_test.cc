@@ -0,0 +1,237 @@
+#include "uapi_client.h"
+
+#include <gtest/gtest.h>
+#include <linux/wireguard.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "test/temp_directory.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const char kPublicKeys[][45] = {"xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=",
+                                "TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0="};
+const char kHexPublicKeys[][65] = {"c53201039adba14be71f886da1d8dbe9eebded08cb111b75340078999aa9f038",
+                                   "4eb32f4a83f88d842563a448cc181bb2c42a637bf12363e2fb2ef594e5965d7d"};
+
+// A stand-in for a userspace implementation: answers every request on a unix socket in a temporary directory with
+// the next canned reply, optionally closing the connection afterwards as an implementation restart would.
+class FakeImplementation {
+ public:
+  explicit FakeImplementation(std::vector<std::string> replies, bool close_after_reply = false)
+      : replies_(std::move(replies)), close_after_reply_(close_after_reply) {
+    listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path_.c_str(), sizeof(address.sun_path) - 1);
+    EXPECT_EQ(bind(listener_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+    EXPECT_EQ(listen(listener_, 4), 0);
+    thread_ = std::thread([this] { Serve(); });
+  }
+
+  ~FakeImplementation() {
+    shutdown(listener_, SHUT_RDWR);
+    thread_.join();
+    close(listener_);
+  }
+
+  const std::string& path() const { return path_; }
+
+  std::vector<std::string> requests() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+  }
+
+ private:
+  void Serve() {
+    size_t next = 0;
+    while (next < replies_.size()) {
+      int connection = accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection < 0) {
+        return;
+      }
+      std::string received;
+      char buffer[4096];
+      while (next < replies_.size()) {
+        size_t end = received.find("\n\n");
+        if (end == std::string::npos) {
+          ssize_t length = recv(connection, buffer, sizeof(buffer), 0);
+          if (length <= 0) {
+            break;
+          }
+          received.append(buffer, length);
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          requests_.push_back(received.substr(0, end + 2));
+        }
+        received.erase(0, end + 2);
+        // Reply in small pieces so that lines are cut between reads.
+        const std::string& reply = replies_[next++];
+        for (size_t offset = 0; offset < reply.size(); offset += 7) {
+          send(connection, reply.data() + offset, std::min<size_t>(7, reply.size() - offset), MSG_NOSIGNAL);
+        }
+        if (close_after_reply_) {
+          break;
+        }
+      }
+      close(connection);
+    }
+  }
+
+  std::vector<std::string> replies_;
+  bool close_after_reply_;
+  TempDirectory directory_{"uapi_test"};
+  std::string path_ = directory_.Path("wg0.sock");
+  int listener_ = -1;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<std::string> requests_;
+};
+
+std::string DeviceReply() {
+  return std::string("private_key=e84b5a6d2717c1003a13b431570353dbaca9146cf150c5f8575680feba52027a\n") +
+         "listen_port=51820\n"
+         "public_key=" + kHexPublicKeys[0] + "\n"
+         "endpoint=192.0.2.1:51820\n"
+         "last_handshake_time_sec=1700000000\n"
+         "last_handshake_time_nsec=500000000\n"
+         "tx_bytes=100\n"
+         "rx_bytes=200\n"
+         "persistent_keepalive_interval=25\n"
+         "allowed_ip=10.0.0.2/32\n"
+         "allowed_ip=fd00::2/128\n"
+         "public_key=" + kHexPublicKeys[1] + "\n"
+         "endpoint=[2001:db8::1]:51820\n"
+         "last_handshake_time_sec=0\n"
+         "last_handshake_time_nsec=0\n"
+         "tx_bytes=1\n"
+         "rx_bytes=2\n"
+         "persistent_keepalive_interval=0\n"
+         "protocol_version=1\n"
+         "errno=0\n\n";
+}
+
+}  // namespace
+
+TEST(UapiReplyParser, JoinsLinesCutAtAnyByte) {
+  std::string reply = DeviceReply();
+  std::vector<std::pair<std::string, std::string>> expected;
+  UapiReplyParser parser;
+  ASSERT_TRUE(parser.Feed(reply.data(), reply.size(), [&expected](std::string_view key, std::string_view value) {
+    expected.emplace_back(key, value);
+  }));
+  ASSERT_EQ(expected.size(), 19u);
+
+  for (size_t cut = 1; cut < reply.size(); cut++) {
+    std::vector<std::pair<std::string, std::string>> pairs;
+    auto handler = [&pairs](std::string_view key, std::string_view value) { pairs.emplace_back(key, value); };
+    parser.Reset();
+    EXPECT_FALSE(parser.Feed(reply.data(), cut, handler));
+    EXPECT_TRUE(parser.Feed(reply.data() + cut, reply.size() - cut, handler));
+    EXPECT_EQ(pairs, expected) << "cut at " << cut;
+    EXPECT_EQ(parser.error_code(), 0);
+  }
+}
+
+TEST(UapiSetWriter, SerializesTheFlagsOfSetDeviceWriter) {
+  PeerConfig peer;
+  peer.public_key = kPublicKeys[0];
+  peer.endpoint = "[2001:db8::1]:51820";
+  peer.allowed_ips = {"10.0.0.2/32"};
+  peer.persistent_keepalive = 25;
+  WireguardKey private_key = {};
+
+  UapiSetWriter writer;
+  writer.SetInterface(private_key, 51820, 0, WGDEVICE_F_REPLACE_PEERS);
+  writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+  writer.AddPeer(peer, WGPEER_F_UPDATE_ONLY);
+  writer.AddPeer(peer, WGPEER_F_REMOVE_ME);
+  std::string zero_key(64, '0');
+  std::string public_key = std::string("public_key=") + kHexPublicKeys[0] + "\n";
+  EXPECT_EQ(writer.Finish(), "set=1\n"
+                             "private_key=" + zero_key + "\n"
+                             "listen_port=51820\n"
+                             "fwmark=0\n"
+                             "replace_peers=true\n" +
+                                 public_key +
+                                 "preshared_key=" + zero_key + "\n"
+                                 "endpoint=[2001:db8::1]:51820\n"
+                                 "persistent_keepalive_interval=25\n"
+                                 "replace_allowed_ips=true\n"
+                                 "allowed_ip=10.0.0.2/32\n" +
+                                 public_key +
+                                 "update_only=true\n"
+                                 "endpoint=[2001:db8::1]:51820\n"
+                                 "persistent_keepalive_interval=25\n" +
+                                 public_key + "remove=true\n\n");
+
+  writer.Reset();
+  peer.allowed_ips = {"10.0.0.0/33"};
+  EXPECT_THROW(writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS), std::invalid_argument);
+}
+
+TEST(UapiConnection, PollsOverOneConnection) {
+  FakeImplementation implementation({DeviceReply(), DeviceReply(), DeviceReply()});
+  UapiConnection connection(implementation.path());
+
+  TunnelStatistics statistics = UapiStatistics(connection);
+  EXPECT_EQ(statistics.total_download, 202u);
+  EXPECT_EQ(statistics.total_upload, 101u);
+  EXPECT_EQ(statistics.latest_handshake, 1700000000500);
+
+  std::vector<PeerSample> samples = UapiPeerSamples(connection);
+  ASSERT_EQ(samples.size(), 2u);
+  EXPECT_EQ(EncodeKey(samples[1].public_key), kPublicKeys[1]);
+  EXPECT_EQ(samples[0].last_handshake, 1700000000500);
+  EXPECT_EQ(samples[1].rx_bytes, 2u);
+
+  WireguardDevice device = GetUapiDevice(connection);
+  EXPECT_EQ(device.listen_port, 51820);
+  ASSERT_EQ(device.peers.size(), 2u);
+  EXPECT_EQ(EncodeKey(device.peers[0].public_key), kPublicKeys[0]);
+  EXPECT_EQ(device.peers[0].persistent_keepalive, 25);
+  ASSERT_EQ(device.peers[0].allowed_ips.size(), 2u);
+  EXPECT_EQ(device.peers[0].allowed_ips[1].family, AF_INET6);
+  EXPECT_EQ(device.peers[0].allowed_ips[1].cidr, 128);
+  EXPECT_EQ(device.peers[1].endpoint.ss_family, AF_INET6);
+
+  EXPECT_EQ(connection.connects(), 1u);
+  EXPECT_EQ(implementation.requests(), std::vector<std::string>(3, "get=1\n\n"));
+}
+
+TEST(UapiConnection, ReconnectsAndReportsErrno) {
+  FakeImplementation implementation({DeviceReply(), "errno=22\n\n"}, true);
+  UapiConnection connection(implementation.path());
+
+  EXPECT_EQ(UapiStatistics(connection).total_upload, 101u);
+  // The implementation closed the connection after replying; the next request goes out on a new one.
+  UapiSetWriter writer;
+  writer.SetInterface(WireguardKey(), 0, 0, 0);
+  const std::string request = writer.Finish();
+  try {
+    connection.Set(request);
+    FAIL() << "Set succeeded";
+  } catch (const UapiError& e) {
+    EXPECT_EQ(e.error_code(), 22);
+  }
+  EXPECT_EQ(connection.connects(), 2u);
+  ASSERT_EQ(implementation.requests().size(), 2u);
+  EXPECT_EQ(implementation.requests()[1], request);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
@@ -0,0 +1,93 @@
+#ifndef WIREGUARD_DART_TEST_UDP_RESPONDER_H
+#define WIREGUARD_DART_TEST_UDP_RESPONDER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wireguard_dart {
+namespace test {
+
+struct ResponderBehavior {
+  std::chrono::milliseconds delay{0};
+  // Answer only every n-th datagram, 0 never answers.
+  int answer_every = 1;
+  // Reply with this instead of echoing the datagram.
+  std::vector<uint8_t> reply;
+};
+
+// Loopback UDP server answering probes on its own thread; a stand-in for an echo service at a tunnel endpoint or
+// inside the tunnel.
+class UdpResponder {
+ public:
+  explicit UdpResponder(ResponderBehavior behavior = ResponderBehavior()) : behavior_(behavior) {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(fd_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~UdpResponder() {
+    stopped_ = true;
+    thread_.join();
+    close(fd_);
+  }
+
+  std::string endpoint() const { return "127.0.0.1:" + std::to_string(port_); }
+
+  int received() const { return received_; }
+
+ private:
+  void Run() {
+    while (!stopped_) {
+      pollfd fds = {fd_, POLLIN, 0};
+      if (poll(&fds, 1, 10) <= 0) {
+        continue;
+      }
+      uint8_t buffer[2048];
+      sockaddr_storage from = {};
+      socklen_t from_length = sizeof(from);
+      ssize_t length = recvfrom(fd_, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_length);
+      if (length < 0) {
+        continue;
+      }
+      int count = ++received_;
+      if (behavior_.answer_every == 0 || count % behavior_.answer_every != 0) {
+        continue;
+      }
+      std::this_thread::sleep_for(behavior_.delay);
+      if (behavior_.reply.empty()) {
+        sendto(fd_, buffer, length, 0, reinterpret_cast<sockaddr*>(&from), from_length);
+      } else {
+        sendto(fd_, behavior_.reply.data(), behavior_.reply.size(), 0, reinterpret_cast<sockaddr*>(&from),
+               from_length);
+      }
+    }
+  }
+
+  ResponderBehavior behavior_;
+  int fd_;
+  uint16_t port_;
+  std::atomic<bool> stopped_{false};
+  std::atomic<int> received_{0};
+  std::thread thread_;
+};
+
+}  // namespace test
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,136 @@
+#include "usage_log.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "test/temp_directory.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+// 2024-01-01T00:00:00Z.
+const int64_t kStart = 1704067200;
+
+class UsageLogTest : public ::testing::Test {
+ protected:
+  TempDirectory directory_{"usage_log_test"};
+  std::string path_ = directory_.Path("wg0.usage");
+};
+
+}  // namespace
+
+TEST_F(UsageLogTest, BatchesTrafficIntoRecords) {
+  auto log = std::make_unique<UsageLog>(path_);
+  for (int64_t second = 0; second < UsageLog::kBatchInterval; second++) {
+    log->Add(kStart + second, 100, 10);
+  }
+  // Counted, but not written yet.
+  EXPECT_EQ(log->size(), 0u);
+  EXPECT_EQ(log->Total().rx_bytes, 6000u);
+  log->Add(kStart + UsageLog::kBatchInterval, 100, 10);
+  EXPECT_EQ(log->size(), 1u);
+  // Idle time adds nothing.
+  log->Add(kStart + 1000, 0, 0);
+  log->Flush(kStart + 1000);
+  EXPECT_EQ(log->size(), 1u);
+  log->Add(kStart + 1000, 5, 5);
+  EXPECT_EQ(log->size(), 1u);
+
+  // The pending batch is appended on close and the totals survive it.
+  log.reset();
+  UsageLog reopened(path_);
+  EXPECT_EQ(reopened.size(), 2u);
+  DataUsage total = reopened.Total();
+  EXPECT_EQ(total.rx_bytes, 6105u);
+  EXPECT_EQ(total.tx_bytes, 615u);
+}
+
+TEST_F(UsageLogTest, AnswersSinceQueries) {
+  UsageLog log(path_);
+  for (int64_t minute = 1; minute <= 10; minute++) {
+    log.Add(kStart + 60 * minute, 1000, 1);
+    log.Flush(kStart + 60 * minute);
+  }
+  log.Add(kStart + 700, 7, 0);
+  EXPECT_EQ(log.Since(0).rx_bytes, 10007u);
+  EXPECT_EQ(log.Since(kStart + 60).rx_bytes, 9007u);
+  EXPECT_EQ(log.Since(kStart + 119).rx_bytes, 9007u);
+  EXPECT_EQ(log.Since(kStart + 120).rx_bytes, 8007u);
+  EXPECT_EQ(log.Since(kStart + 600).rx_bytes, 7u);
+  EXPECT_EQ(log.Since(kStart + 600).tx_bytes, 0u);
+
+  // A clock stepping back does not break the order.
+  log.Flush(kStart);
+  log.Add(kStart, 3, 0);
+  log.Flush(kStart);
+  EXPECT_EQ(log.Since(kStart + 599).rx_bytes, 1010u);
+}
+
+TEST_F(UsageLogTest, DropsATornRecord) {
+  {
+    UsageLog log(path_);
+    for (int64_t minute = 1; minute <= 3; minute++) {
+      log.Add(kStart + 60 * minute, 1000, 1000);
+      log.Flush(kStart + 60 * minute);
+    }
+  }
+  // A crash in the middle of writing the third record.
+  int fd = open(path_.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  uint64_t garbage = 0xdeadbeef;
+  ASSERT_EQ(pwrite(fd, &garbage, sizeof(garbage), 64 + 2 * 32 + 8), static_cast<ssize_t>(sizeof(garbage)));
+  close(fd);
+
+  UsageLog log(path_);
+  EXPECT_EQ(log.size(), 2u);
+  EXPECT_EQ(log.Total().rx_bytes, 2000u);
+  log.Add(kStart + 240, 1, 1);
+  log.Flush(kStart + 240);
+  EXPECT_EQ(log.size(), 3u);
+  EXPECT_EQ(log.Since(kStart + 120).rx_bytes, 1u);
+}
+
+TEST_F(UsageLogTest, CompactsOldRecordsWhenFull) {
+  UsageLog log(path_);
+  off_t initial_size = FileSize(path_);
+  // A record every minute for longer than the log holds.
+  int64_t minutes = UsageLog::kInitialCapacity + 1;
+  for (int64_t minute = 1; minute <= minutes; minute++) {
+    log.Add(kStart + 60 * minute, 10, 1);
+    log.Flush(kStart + 60 * minute);
+  }
+  int64_t now = kStart + 60 * minutes;
+  // The last day stays per minute, the time before it per hour.
+  EXPECT_LE(log.size(), 1440u + (minutes - 1440) / 60 + 2);
+  EXPECT_GE(log.size(), 1440u);
+  EXPECT_EQ(FileSize(path_), initial_size);
+  EXPECT_EQ(log.Total().rx_bytes, 10u * minutes);
+  // Exact on the hour and within the last day, rounded down to the hour before that.
+  EXPECT_EQ(log.Since(kStart + 3600).rx_bytes, 10u * (minutes - 60));
+  EXPECT_EQ(log.Since(kStart + 3600 + 1800).rx_bytes, 10u * (minutes - 60));
+  EXPECT_EQ(log.Since(now - 600).rx_bytes, 100u);
+
+  UsageLog reopened(path_);
+  EXPECT_EQ(reopened.size(), log.size());
+  EXPECT_EQ(reopened.Total().rx_bytes, 10u * minutes);
+}
+
+TEST_F(UsageLogTest, RejectsOtherFiles) {
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_GE(fd, 0);
+  std::string text(100, 'x');
+  ASSERT_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+  close(fd);
+  EXPECT_THROW(UsageLog log(path_), std::runtime_error);
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
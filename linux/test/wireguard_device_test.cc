@@ -0,0 +1,265 @@
+#include "wireguard_device.h"
+
+#include <gtest/gtest.h>
+#include <linux/genetlink.h>
+#include <linux/wireguard.h>
+#include <sys/socket.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "netlink.h"
+
+namespace wireguard_dart {
+namespace test {
+
+namespace {
+
+const uint16_t kFamily = 0x20;
+const char kPrivateKey[] = "yAnz5TF+lXXJte14tji3zlMNq+hd2rYUIgJBgB3fBmk=";
+const char kPublicKeys[][45] = {"xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=",
+                                "TrMvSoP4jYQlY6RIzBgbssQqY3vxI2Pi+y71lOWWXX0="};
+
+// What one message says about one peer.
+struct PeerEntry {
+  std::string public_key;
+  uint32_t flags = 0;
+  bool has_preshared_key = false;
+  bool has_endpoint = false;
+  std::vector<std::string> allowed_ips;
+};
+
+struct SetDeviceRequest {
+  size_t size = 0;
+  uint32_t device_flags = 0;
+  bool has_private_key = false;
+  std::vector<PeerEntry> peers;
+};
+
+std::string FormatAllowedIp(const nlattr* entry) {
+  IpPrefix prefix;
+  ForEachAttribute(AttributeData(entry), AttributeLength(entry), [&prefix](const nlattr* attribute) {
+    switch (AttributeType(attribute)) {
+      case WGALLOWEDIP_A_FAMILY:
+        prefix.version = *static_cast<const uint16_t*>(AttributeData(attribute)) == AF_INET ? 4 : 6;
+        break;
+      case WGALLOWEDIP_A_IPADDR:
+        memcpy(prefix.address.data(), AttributeData(attribute), AttributeLength(attribute));
+        break;
+      case WGALLOWEDIP_A_CIDR_MASK:
+        prefix.length = *static_cast<const uint8_t*>(AttributeData(attribute));
+        break;
+    }
+  });
+  return FormatIpPrefix(prefix);
+}
+
+PeerEntry ParsePeerEntry(const nlattr* peer) {
+  PeerEntry entry;
+  ForEachAttribute(AttributeData(peer), AttributeLength(peer), [&entry](const nlattr* attribute) {
+    switch (AttributeType(attribute)) {
+      case WGPEER_A_PUBLIC_KEY: {
+        WireguardKey key;
+        memcpy(key.data(), AttributeData(attribute), key.size());
+        entry.public_key = EncodeKey(key);
+        break;
+      }
+      case WGPEER_A_FLAGS:
+        entry.flags = *static_cast<const uint32_t*>(AttributeData(attribute));
+        break;
+      case WGPEER_A_PRESHARED_KEY:
+        entry.has_preshared_key = true;
+        break;
+      case WGPEER_A_ENDPOINT:
+        entry.has_endpoint = true;
+        break;
+      case WGPEER_A_ALLOWEDIPS:
+        ForEachAttribute(AttributeData(attribute), AttributeLength(attribute), [&entry](const nlattr* allowed_ip) {
+          entry.allowed_ips.push_back(FormatAllowedIp(allowed_ip));
+        });
+        break;
+    }
+  });
+  return entry;
+}
+
+SetDeviceRequest ParseRequest(NetlinkMessage& message) {
+  SetDeviceRequest request;
+  request.size = message.size();
+  EXPECT_EQ(message.header()->nlmsg_len, message.size());
+  EXPECT_EQ(message.header()->nlmsg_type, kFamily);
+  auto* payload = static_cast<const char*>(NLMSG_DATA(message.header())) + GENL_HDRLEN;
+  ForEachAttribute(payload, message.size() - NLMSG_HDRLEN - GENL_HDRLEN, [&request](const nlattr* attribute) {
+    switch (AttributeType(attribute)) {
+      case WGDEVICE_A_FLAGS:
+        request.device_flags = *static_cast<const uint32_t*>(AttributeData(attribute));
+        break;
+      case WGDEVICE_A_PRIVATE_KEY:
+        request.has_private_key = true;
+        break;
+      case WGDEVICE_A_PEERS:
+        ForEachAttribute(AttributeData(attribute), AttributeLength(attribute), [&request](const nlattr* peer) {
+          request.peers.push_back(ParsePeerEntry(peer));
+        });
+        break;
+    }
+  });
+  return request;
+}
+
+// Collects the messages a SetDeviceWriter sends, and the buffers they were built in.
+struct Recorder {
+  std::vector<SetDeviceRequest> requests;
+  std::vector<const void*> buffers;
+
+  SetDeviceWriter::Send Send() {
+    return [this](NetlinkMessage& message) {
+      requests.push_back(ParseRequest(message));
+      buffers.push_back(message.data());
+    };
+  }
+
+  // The allowed IPs of `public_key` over all messages, in order.
+  std::vector<std::string> AllowedIps(const std::string& public_key) const {
+    std::vector<std::string> allowed_ips;
+    for (const auto& request : requests) {
+      for (const auto& peer : request.peers) {
+        if (peer.public_key == public_key) {
+          allowed_ips.insert(allowed_ips.end(), peer.allowed_ips.begin(), peer.allowed_ips.end());
+        }
+      }
+    }
+    return allowed_ips;
+  }
+};
+
+std::vector<std::string> ManyPrefixes(size_t count) {
+  std::vector<std::string> prefixes;
+  for (size_t i = 0; i < count; i++) {
+    if (i % 4 == 3) {
+      prefixes.push_back("2001:db8:" + std::to_string(i % 10000) + "::/48");
+    } else {
+      prefixes.push_back("10." + std::to_string(i >> 16 & 255) + "." + std::to_string(i >> 8 & 255) + "." +
+                         std::to_string(i & 255) + "/32");
+    }
+  }
+  return prefixes;
+}
+
+}  // namespace
+
+TEST(SetDeviceWriter, SplitsLargeConfigAcrossMessages) {
+  PeerConfig first;
+  first.public_key = kPublicKeys[0];
+  first.endpoint = "192.0.2.1:51820";
+  first.allowed_ips = ManyPrefixes(50000);
+  PeerConfig second;
+  second.public_key = kPublicKeys[1];
+  second.allowed_ips = {"192.168.0.0/16"};
+
+  Recorder recorder;
+  SetDeviceWriter writer(kFamily, "wg0", recorder.Send());
+  WireguardKey private_key;
+  ASSERT_TRUE(DecodeKey(kPrivateKey, &private_key));
+  writer.SetInterface(private_key, 51820, 0, WGDEVICE_F_REPLACE_PEERS);
+  writer.AddPeer(first, WGPEER_F_REPLACE_ALLOWEDIPS);
+  writer.AddPeer(second, WGPEER_F_REPLACE_ALLOWEDIPS);
+  writer.Finish();
+
+  // 50k prefixes take about 1.5 MB of attributes; every message but the last is packed to nearly the limit.
+  const auto& requests = recorder.requests;
+  ASSERT_EQ(requests.size(), writer.messages());
+  EXPECT_LE(requests.size(), 25u);
+  for (size_t i = 0; i < requests.size(); i++) {
+    EXPECT_LE(requests[i].size, kMaxSetDeviceMessage);
+    if (i + 1 < requests.size()) {
+      EXPECT_GT(requests[i].size, kMaxSetDeviceMessage - 64);
+    }
+    // All messages are built in the buffer reserved up front.
+    EXPECT_EQ(recorder.buffers[i], recorder.buffers[0]);
+  }
+
+  // Only the first message replaces the device's peers and the first entry of a peer its allowed IPs.
+  EXPECT_EQ(requests[0].device_flags, static_cast<uint32_t>(WGDEVICE_F_REPLACE_PEERS));
+  EXPECT_TRUE(requests[0].has_private_key);
+  EXPECT_EQ(requests[0].peers[0].flags, static_cast<uint32_t>(WGPEER_F_REPLACE_ALLOWEDIPS));
+  EXPECT_TRUE(requests[0].peers[0].has_preshared_key);
+  EXPECT_TRUE(requests[0].peers[0].has_endpoint);
+  for (size_t i = 1; i < requests.size(); i++) {
+    EXPECT_EQ(requests[i].device_flags, 0u);
+    EXPECT_FALSE(requests[i].has_private_key);
+    const auto& continued = requests[i].peers[0];
+    EXPECT_EQ(continued.public_key, kPublicKeys[0]);
+    EXPECT_EQ(continued.flags, static_cast<uint32_t>(WGPEER_F_UPDATE_ONLY));
+    EXPECT_FALSE(continued.has_preshared_key);
+    EXPECT_FALSE(continued.has_endpoint);
+  }
+  const auto& last = requests.back().peers.back();
+  EXPECT_EQ(last.public_key, kPublicKeys[1]);
+  EXPECT_EQ(last.flags, static_cast<uint32_t>(WGPEER_F_REPLACE_ALLOWEDIPS));
+
+  EXPECT_EQ(recorder.AllowedIps(kPublicKeys[0]), first.allowed_ips);
+  EXPECT_EQ(recorder.AllowedIps(kPublicKeys[1]), second.allowed_ips);
+}
+
+TEST(SetDeviceWriter, StartsPeersInNewMessageWhenFull) {
+  std::vector<PeerConfig> peers(2);
+  for (size_t i = 0; i < peers.size(); i++) {
+    peers[i].public_key = kPublicKeys[i];
+    peers[i].allowed_ips = ManyPrefixes(9);
+  }
+
+  Recorder recorder;
+  SetDeviceWriter writer(kFamily, "wg0", recorder.Send(), 512);
+  writer.AddPeer(peers[0], WGPEER_F_REMOVE_ME);
+  for (const auto& peer : peers) {
+    writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+  }
+  writer.Finish();
+
+  ASSERT_GE(recorder.requests.size(), 2u);
+  for (const auto& request : recorder.requests) {
+    EXPECT_LE(request.size, 512u);
+    EXPECT_EQ(request.device_flags, 0u);
+    for (const auto& peer : request.peers) {
+      // A peer header is never written without room for at least one of its allowed IPs.
+      EXPECT_TRUE(peer.flags == WGPEER_F_REMOVE_ME || !peer.allowed_ips.empty());
+    }
+  }
+  EXPECT_EQ(recorder.requests[0].peers[0].flags, static_cast<uint32_t>(WGPEER_F_REMOVE_ME));
+  EXPECT_EQ(recorder.AllowedIps(kPublicKeys[0]), peers[0].allowed_ips);
+  EXPECT_EQ(recorder.AllowedIps(kPublicKeys[1]), peers[1].allowed_ips);
+}
+
+TEST(SetDeviceWriter, WritesAllowedIpsOfUpdatesOnlyWhenReplacing) {
+  PeerConfig peer;
+  peer.public_key = kPublicKeys[0];
+  peer.allowed_ips = {"10.0.0.2/32"};
+  Recorder recorder;
+  SetDeviceWriter writer(kFamily, "wg0", recorder.Send());
+  writer.AddPeer(peer, WGPEER_F_UPDATE_ONLY);
+  writer.AddPeer(peer, WGPEER_F_UPDATE_ONLY | WGPEER_F_REPLACE_ALLOWEDIPS);
+  writer.Finish();
+
+  ASSERT_EQ(recorder.requests.size(), 1u);
+  const auto& peers = recorder.requests[0].peers;
+  ASSERT_EQ(peers.size(), 2u);
+  EXPECT_TRUE(peers[0].allowed_ips.empty());
+  EXPECT_EQ(peers[1].allowed_ips, peer.allowed_ips);
+  // Updates keep the preshared key.
+  EXPECT_FALSE(peers[1].has_preshared_key);
+}
+
+TEST(SetDeviceWriter, RejectsMalformedAllowedIps) {
+  PeerConfig peer;
+  peer.public_key = kPublicKeys[0];
+  peer.allowed_ips = {"10.0.0.0/8", "10.0.0.0/33"};
+  Recorder recorder;
+  SetDeviceWriter writer(kFamily, "wg0", recorder.Send());
+  EXPECT_THROW(writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS), std::invalid_argument);
+  EXPECT_TRUE(recorder.requests.empty());
+}
+
+}  // namespace test
+}  // namespace wireguard_dart
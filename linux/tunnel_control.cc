@@ -0,0 +1,285 @@
+#include "tunnel_control.h"
+
+#include <dirent.h>
+#include <linux/wireguard.h>
+#include <sys/socket.h>
+
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "device_dump.h"
+#include "link_control.h"
+#include "path_mtu.h"
+#include "uapi_client.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+// wg-quick's default: 1500 minus the IPv6 and WireGuard overhead.
+const uint32_t kDefaultMtu = 1420;
+
+void TunnelControl::Up(const WireguardConfig& config) {
+  // A userspace implementation is started with its tun device, which it owns; only a kernel device is created here.
+  bool userspace = HasUapiSocket(interface_name_);
+  auto existing = FindLink(interface_name_);
+  if (userspace) {
+    if (!existing.has_value()) {
+      throw std::runtime_error("Interface " + interface_name_ + " of the userspace implementation does not exist");
+    }
+    if (existing->alias == kInterfaceAlias) {
+      // Down would make the implementation exit along with its device.
+      throw std::runtime_error("Interface " + interface_name_ + " is already configured; disconnect first");
+    }
+  } else if (existing.has_value()) {
+    if (existing->alias != kInterfaceAlias) {
+      throw std::runtime_error("Interface " + interface_name_ + " exists and is not managed by this app");
+    }
+    Down();
+  }
+
+  std::vector<IpPrefix> addresses;
+  for (const auto& text : config.interface_config.addresses) {
+    IpPrefix address;
+    if (!ParseIpPrefix(text, &address)) {
+      throw std::invalid_argument("Invalid address: " + text);
+    }
+    addresses.push_back(address);
+  }
+  std::vector<IpPrefix> routes;
+  bool default_route[2] = {false, false};
+  for (const auto& peer : config.peers) {
+    for (const auto& text : peer.allowed_ips) {
+      IpPrefix route;
+      if (!ParseIpPrefix(text, &route)) {
+        throw std::invalid_argument("Invalid allowed IP: " + text);
+      }
+      default_route[route.version == 4 ? 0 : 1] |= route.length == 0;
+      routes.push_back(route);
+    }
+  }
+  bool any_default_route = default_route[0] || default_route[1];
+  uint32_t mtu = config.interface_config.mtu != 0 ? config.interface_config.mtu : kDefaultMtu;
+  uint32_t fwmark = any_default_route ? kTunnelRoutingTable : 0;
+
+  if (!userspace) {
+    CreateWireguardLink(interface_name_, mtu);
+  }
+  try {
+    auto link = FindLink(interface_name_);
+    if (!link.has_value()) {
+      throw std::runtime_error("Interface " + interface_name_ + " disappeared while being configured");
+    }
+    if (userspace) {
+      WireguardKey private_key;
+      if (!DecodeKey(config.interface_config.private_key, &private_key)) {
+        throw std::invalid_argument("Invalid key: " + config.interface_config.private_key);
+      }
+      UapiSetWriter writer;
+      writer.SetInterface(private_key, config.interface_config.listen_port, fwmark, WGDEVICE_F_REPLACE_PEERS);
+      for (const auto& peer : config.peers) {
+        writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+      }
+      Uapi()->Set(writer.Finish());
+    } else {
+      SetWireguardDevice(interface_name_, config, fwmark);
+    }
+    // Everything else goes out in one batch, in order: the link is up before routes through it are added.
+    RouteBatch batch;
+    for (const auto& address : addresses) {
+      batch.AddAddress(link->ifindex, address);
+    }
+    batch.SetLinkUp(link->ifindex, userspace ? mtu : 0);
+    for (const auto& route : routes) {
+      batch.AddRoute(link->ifindex, route, route.length == 0 ? kTunnelRoutingTable : 0);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (default_route[i]) {
+        batch.AddDefaultRouteRules(i == 0 ? 4 : 6);
+      }
+    }
+    batch.Commit();
+  } catch (...) {
+    try {
+      Down();
+    } catch (std::exception& e) {
+      std::cerr << "Failed to clean up " << interface_name_ << ": " << e.what() << std::endl;
+    }
+    throw;
+  }
+}
+
+void TunnelControl::Down() {
+  uapi_.reset();
+  DeleteLink(interface_name_);
+  // A tunnel adopted from a previous run does not tell which families it routed by default, so remove both.
+  RemoveDefaultRouteRules(4);
+  RemoveDefaultRouteRules(6);
+}
+
+ConnectionStatus TunnelControl::Status() {
+  auto link = FindLink(interface_name_);
+  if (!link.has_value()) {
+    return ConnectionStatus::disconnected;
+  }
+  return ConnectionStatusFromLinkFlags(link->flags);
+}
+
+TunnelStatistics TunnelControl::Statistics() {
+  if (UapiConnection* uapi = Uapi()) {
+    return UapiStatistics(*uapi);
+  }
+  TunnelStatistics statistics;
+  if (!FindLink(interface_name_).has_value()) {
+    return statistics;
+  }
+  DumpWireguardDevice(interface_name_, [&statistics](const DeviceView& message) { AddStatistics(message, &statistics); });
+  return statistics;
+}
+
+std::vector<PeerSample> TunnelControl::PeerSamples() {
+  if (UapiConnection* uapi = Uapi()) {
+    return UapiPeerSamples(*uapi);
+  }
+  std::vector<PeerSample> samples;
+  DumpWireguardDevice(interface_name_, [&samples](const DeviceView& message) { AddPeerSamples(message, &samples); });
+  return samples;
+}
+
+WireguardDevice TunnelControl::Device() {
+  if (UapiConnection* uapi = Uapi()) {
+    WireguardDevice device = GetUapiDevice(*uapi);
+    device.name = interface_name_;
+    return device;
+  }
+  return GetWireguardDevice(interface_name_);
+}
+
+void TunnelControl::SetPeer(const PeerConfig& peer, bool restart) {
+  UapiConnection* uapi = Uapi();
+  if (uapi == nullptr) {
+    SetWireguardPeer(interface_name_, peer, restart);
+    return;
+  }
+  UapiSetWriter writer;
+  if (restart) {
+    writer.AddPeer(peer, WGPEER_F_REMOVE_ME);
+    writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+  } else {
+    writer.AddPeer(peer, WGPEER_F_UPDATE_ONLY);
+  }
+  uapi->Set(writer.Finish());
+}
+
+void TunnelControl::ApplyPeerChanges(const std::vector<PeerChange>& changes) {
+  UapiConnection* uapi = Uapi();
+  if (uapi == nullptr) {
+    wireguard_dart::ApplyPeerChanges(interface_name_, changes);
+    return;
+  }
+  UapiSetWriter writer;
+  AddPeerChanges(changes, &writer);
+  uapi->Set(writer.Finish());
+}
+
+void TunnelControl::Rebind() {
+  WireguardDevice device = Device();
+  std::vector<PeerChange> changes = RebindChanges(device);
+  if (changes.empty()) {
+    return;
+  }
+  UapiConnection* uapi = Uapi();
+  if (uapi == nullptr) {
+    wireguard_dart::ApplyPeerChanges(interface_name_, changes);
+    return;
+  }
+  UapiSetWriter writer;
+  writer.SetListenPort(device.listen_port);
+  AddPeerChanges(changes, &writer);
+  uapi->Set(writer.Finish());
+}
+
+uint32_t TunnelControl::DiscoverMtu(const PathMtuOptions& options) {
+  PathMtuOptions around_tunnel = options;
+  around_tunnel.prepare_socket = [&options](int fd, int family) {
+    // Marked like the device's own packets, probes skip the policy rules sending everything else into the tunnel.
+    uint32_t mark = kTunnelRoutingTable;
+    setsockopt(fd, SOL_SOCKET, SO_MARK, &mark, sizeof(mark));
+    if (options.prepare_socket) {
+      options.prepare_socket(fd, family);
+    }
+  };
+  uint32_t mtu = 0;
+  for (const auto& peer : Device().peers) {
+    int family = peer.endpoint.ss_family;
+    if (family != AF_INET && family != AF_INET6) {
+      continue;
+    }
+    if (options.cancelled != nullptr && *options.cancelled) {
+      return 0;
+    }
+    int path_mtu = DiscoverPathMtu(FormatEndpoint(peer.endpoint), around_tunnel);
+    if (path_mtu != 0 && (mtu == 0 || TunnelMtu(path_mtu, family) < mtu)) {
+      mtu = TunnelMtu(path_mtu, family);
+    }
+  }
+  auto link = FindLink(interface_name_);
+  if (mtu == 0 || !link.has_value() || (options.cancelled != nullptr && *options.cancelled)) {
+    return 0;
+  }
+  SetLinkMtu(link->ifindex, mtu);
+  return mtu;
+}
+
+UapiConnection* TunnelControl::Uapi() {
+  if (!HasUapiSocket(interface_name_)) {
+    uapi_.reset();
+    return nullptr;
+  }
+  if (uapi_ == nullptr) {
+    uapi_ = std::make_unique<UapiConnection>(UapiSocketPath(interface_name_));
+  }
+  return uapi_.get();
+}
+
+// Names of the devices served by userspace implementations.
+static std::vector<std::string> ListUapiDevices() {
+  std::vector<std::string> names;
+  DIR* directory = opendir(kUapiSocketDirectory);
+  if (directory == nullptr) {
+    return names;
+  }
+  const char suffix[] = ".sock";
+  while (dirent* entry = readdir(directory)) {
+    size_t length = strlen(entry->d_name);
+    if (length > sizeof(suffix) - 1 && strcmp(entry->d_name + length - (sizeof(suffix) - 1), suffix) == 0) {
+      names.emplace_back(entry->d_name, length - (sizeof(suffix) - 1));
+    }
+  }
+  closedir(directory);
+  return names;
+}
+
+std::optional<std::string> FindAttachableTunnel() {
+  try {
+    for (const auto& link : ListWireguardLinks()) {
+      if (link.alias == kInterfaceAlias) {
+        return link.name;
+      }
+    }
+    for (const auto& name : ListUapiDevices()) {
+      auto link = FindLink(name);
+      if (link.has_value() && link->alias == kInterfaceAlias) {
+        return name;
+      }
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Failed to discover running tunnels: " << e.what() << std::endl;
+  }
+  return std::nullopt;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,72 @@
+#ifndef WIREGUARD_DART_TUNNEL_CONTROL_H
+#define WIREGUARD_DART_TUNNEL_CONTROL_H
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "connection_status.h"
+#include "handshake_watchdog.h"
+#include "path_mtu.h"
+#include "peer_index.h"
+#include "uapi_client.h"
+#include "wireguard_config.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+// Controls the WireGuard interface backing a tunnel. That is a kernel device, unless a userspace implementation serves
+// the interface name on a UAPI socket under kUapiSocketDirectory: then the implementation owns a tun device of that
+// name, and WireGuard settings go through the socket while addresses and routes are still set with netlink.
+class TunnelControl {
+ public:
+  const std::string interface_name_;
+
+  TunnelControl(const std::string interface_name) : interface_name_(interface_name) {}
+
+  // Creates and configures the interface the way wg-quick does: addresses, routes for all allowed IPs and, for
+  // default routes, fwmark based policy rules. Replaces an interface of the same name left by the plugin. On failure
+  // everything created so far is removed again. Throws NetlinkError, UapiError, std::invalid_argument or
+  // std::runtime_error.
+  void Up(const WireguardConfig& config);
+
+  // Deletes the interface, which takes its addresses and routes along, and removes the policy rules. A userspace
+  // implementation exits when its tun device goes away.
+  void Down();
+
+  ConnectionStatus Status();
+  TunnelStatistics Statistics();
+  std::vector<PeerSample> PeerSamples();
+
+  // The full device state, including the allowed IPs of every peer.
+  WireguardDevice Device();
+
+  // See SetWireguardPeer and ApplyPeerChanges.
+  void SetPeer(const PeerConfig& peer, bool restart);
+  void ApplyPeerChanges(const std::vector<PeerChange>& changes);
+
+  // Moves the running tunnel onto the current network after a link, address or route change, keeping its sessions:
+  // applies RebindChanges and, for a userspace implementation, sets the listen port again, which makes it reopen its
+  // sockets. Does nothing if the device has no peers with an endpoint.
+  void Rebind();
+
+  // Probes the path MTU to every peer endpoint with packets routed around the tunnel, and sets the interface MTU to
+  // what the narrowest path leaves after the WireGuard overhead. Returns the MTU set, or 0 if no endpoint could be
+  // probed or `options.cancelled` was set, in which case the MTU stays as it was.
+  uint32_t DiscoverMtu(const PathMtuOptions& options = PathMtuOptions());
+
+ private:
+  // The connection to the userspace implementation serving the interface, or nullptr for a kernel device. Kept open
+  // for as long as the socket exists.
+  UapiConnection* Uapi();
+
+  std::unique_ptr<UapiConnection> uapi_;
+};
+
+// Returns the name of a tunnel interface left up by a previous instance of the app, if any.
+std::optional<std::string> FindAttachableTunnel();
+
+}  // namespace wireguard_dart
+
+#endif
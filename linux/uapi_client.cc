@@ -0,0 +1,362 @@
+#include "uapi_client.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/wireguard.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+const char kUapiSocketDirectory[] = "/var/run/wireguard";
+
+// Large enough for a few hundred peers per read; a reply of any size streams through it.
+const size_t kUapiReadBufferSize = 65536;
+
+static const std::string kGetRequest = "get=1\n\n";
+
+std::string UapiSocketPath(const std::string& name) { return std::string(kUapiSocketDirectory) + "/" + name + ".sock"; }
+
+bool HasUapiSocket(const std::string& name) {
+  struct stat info;
+  return stat(UapiSocketPath(name).c_str(), &info) == 0 && S_ISSOCK(info.st_mode);
+}
+
+UapiError::UapiError(const std::string& message, int error_code)
+    : std::runtime_error(message + ": " + strerror(error_code)), error_code_(error_code) {}
+
+template <typename T>
+static T ParseNumber(std::string_view text) {
+  T value = 0;
+  std::from_chars(text.data(), text.data() + text.size(), value);
+  return value;
+}
+
+void UapiReplyParser::Reset() {
+  partial_.clear();
+  done_ = false;
+  error_code_ = 0;
+}
+
+bool UapiReplyParser::Feed(const char* data, size_t size, const Handler& handler) {
+  const char* end = data + size;
+  while (!done_ && data < end) {
+    auto* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+    if (newline == nullptr) {
+      partial_.append(data, end);
+      break;
+    }
+    if (partial_.empty()) {
+      Line(std::string_view(data, newline - data), handler);
+    } else {
+      partial_.append(data, newline);
+      Line(partial_, handler);
+      partial_.clear();
+    }
+    data = newline + 1;
+  }
+  return done_;
+}
+
+void UapiReplyParser::Line(std::string_view line, const Handler& handler) {
+  if (line.empty()) {
+    done_ = true;
+    return;
+  }
+  size_t separator = line.find('=');
+  std::string_view key = line.substr(0, separator);
+  std::string_view value = separator != std::string_view::npos ? line.substr(separator + 1) : std::string_view();
+  if (key == "errno") {
+    error_code_ = ParseNumber<int>(value);
+    return;
+  }
+  handler(key, value);
+}
+
+static WireguardKey RequireKey(const std::string& base64) {
+  WireguardKey key;
+  if (!DecodeKey(base64, &key)) {
+    throw std::invalid_argument("Invalid key: " + base64);
+  }
+  return key;
+}
+
+static bool DecodeHexKey(std::string_view hex, WireguardKey* key) {
+  if (hex.size() != key->size() * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < key->size(); i++) {
+    if (std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, (*key)[i], 16).ptr != hex.data() + 2 * i + 2) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static sockaddr_storage ParseEndpoint(std::string_view text) {
+  sockaddr_storage address = {};
+  std::string host;
+  uint16_t port;
+  if (!SplitEndpoint(std::string(text), &host, &port)) {
+    return address;
+  }
+  auto& ipv4 = reinterpret_cast<sockaddr_in&>(address);
+  auto& ipv6 = reinterpret_cast<sockaddr_in6&>(address);
+  if (inet_pton(AF_INET, host.c_str(), &ipv4.sin_addr) == 1) {
+    ipv4.sin_family = AF_INET;
+    ipv4.sin_port = htons(port);
+  } else if (inet_pton(AF_INET6, host.c_str(), &ipv6.sin6_addr) == 1) {
+    ipv6.sin6_family = AF_INET6;
+    ipv6.sin6_port = htons(port);
+  }
+  return address;
+}
+
+void UapiSetWriter::Reset() {
+  request_.clear();
+  request_ += "set=1\n";
+}
+
+void UapiSetWriter::Put(std::string_view key, std::string_view value) {
+  request_.append(key).append(1, '=').append(value).append(1, '\n');
+}
+
+void UapiSetWriter::PutKey(std::string_view key, const WireguardKey& value) {
+  static const char kDigits[] = "0123456789abcdef";
+  request_.append(key).append(1, '=');
+  for (uint8_t byte : value) {
+    request_.append(1, kDigits[byte >> 4]).append(1, kDigits[byte & 15]);
+  }
+  request_.append(1, '\n');
+}
+
+void UapiSetWriter::SetInterface(const WireguardKey& private_key, uint16_t listen_port, uint32_t fwmark,
+                                 uint32_t flags) {
+  PutKey("private_key", private_key);
+  Put("listen_port", std::to_string(listen_port));
+  Put("fwmark", std::to_string(fwmark));
+  if ((flags & WGDEVICE_F_REPLACE_PEERS) != 0) {
+    Put("replace_peers", "true");
+  }
+}
+
+void UapiSetWriter::SetListenPort(uint16_t listen_port) { Put("listen_port", std::to_string(listen_port)); }
+
+void UapiSetWriter::AddPeer(const PeerConfig& peer, uint32_t flags) {
+  PutKey("public_key", RequireKey(peer.public_key));
+  if ((flags & WGPEER_F_REMOVE_ME) != 0) {
+    Put("remove", "true");
+    return;
+  }
+  if ((flags & WGPEER_F_UPDATE_ONLY) != 0) {
+    Put("update_only", "true");
+  } else {
+    WireguardKey preshared_key = {};
+    if (!peer.preshared_key.empty()) {
+      preshared_key = RequireKey(peer.preshared_key);
+    }
+    PutKey("preshared_key", preshared_key);
+  }
+  if (!peer.endpoint.empty()) {
+    sockaddr_storage address;
+    ResolveEndpoint(peer.endpoint, &address);
+    Put("endpoint", FormatEndpoint(address));
+  }
+  Put("persistent_keepalive_interval", std::to_string(peer.persistent_keepalive));
+  if ((flags & WGPEER_F_REPLACE_ALLOWEDIPS) != 0) {
+    Put("replace_allowed_ips", "true");
+  } else if ((flags & WGPEER_F_UPDATE_ONLY) != 0) {
+    return;
+  }
+  for (const auto& text : peer.allowed_ips) {
+    IpPrefix prefix;
+    if (!ParseIpPrefix(text, &prefix)) {
+      throw std::invalid_argument("Invalid allowed IP: " + text);
+    }
+    Put("allowed_ip", FormatIpPrefix(prefix));
+  }
+}
+
+const std::string& UapiSetWriter::Finish() {
+  request_.append(1, '\n');
+  return request_;
+}
+
+UapiConnection::UapiConnection(const std::string& path) : path_(path), buffer_(kUapiReadBufferSize) {}
+
+UapiConnection::~UapiConnection() { Close(); }
+
+void UapiConnection::Connect() {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(address.sun_path)) {
+    throw UapiError("Socket path too long: " + path_, ENAMETOOLONG);
+  }
+  memcpy(address.sun_path, path_.c_str(), path_.size() + 1);
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    throw UapiError("Failed to open UAPI socket", errno);
+  }
+  if (connect(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    int error_code = errno;
+    Close();
+    throw UapiError("Failed to connect to " + path_, error_code);
+  }
+  connects_++;
+}
+
+void UapiConnection::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+void UapiConnection::Transact(const std::string& request, const UapiReplyParser::Handler& handler) {
+  for (;;) {
+    // A connection kept from an earlier request may have been closed by the other end since; a fresh one may not.
+    bool reused = fd_ >= 0;
+    if (!reused) {
+      Connect();
+    }
+    parser_.Reset();
+
+    int error_code = 0;
+    bool received = false;
+    for (size_t sent = 0; error_code == 0 && sent < request.size();) {
+      ssize_t length = send(fd_, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+      if (length < 0 && errno != EINTR) {
+        error_code = errno;
+      } else if (length > 0) {
+        sent += length;
+      }
+    }
+    while (error_code == 0) {
+      ssize_t length = recv(fd_, buffer_.data(), buffer_.size(), 0);
+      if (length < 0) {
+        if (errno != EINTR) {
+          error_code = errno;
+        }
+        continue;
+      }
+      if (length == 0) {
+        error_code = ECONNRESET;
+        break;
+      }
+      received = true;
+      if (parser_.Feed(buffer_.data(), length, handler)) {
+        break;
+      }
+    }
+
+    if (error_code != 0) {
+      Close();
+      if (reused && !received) {
+        continue;
+      }
+      throw UapiError("UAPI request to " + path_ + " failed", error_code);
+    }
+    if (parser_.error_code() != 0) {
+      throw UapiError("UAPI request to " + path_ + " was rejected", parser_.error_code());
+    }
+    return;
+  }
+}
+
+void UapiConnection::Get(const UapiReplyParser::Handler& handler) { Transact(kGetRequest, handler); }
+
+void UapiConnection::Set(const std::string& request) {
+  static const UapiReplyParser::Handler ignore = [](std::string_view, std::string_view) {};
+  Transact(request, ignore);
+}
+
+WireguardDevice GetUapiDevice(UapiConnection& connection) {
+  WireguardDevice device;
+  connection.Get([&device](std::string_view key, std::string_view value) {
+    if (key == "public_key") {
+      device.peers.emplace_back();
+      DecodeHexKey(value, &device.peers.back().public_key);
+      return;
+    }
+    if (device.peers.empty()) {
+      if (key == "listen_port") {
+        device.listen_port = ParseNumber<uint16_t>(value);
+      }
+      return;
+    }
+    WireguardPeer& peer = device.peers.back();
+    if (key == "endpoint") {
+      peer.endpoint = ParseEndpoint(value);
+    } else if (key == "last_handshake_time_sec") {
+      peer.last_handshake += ParseNumber<int64_t>(value) * 1000;
+    } else if (key == "last_handshake_time_nsec") {
+      peer.last_handshake += ParseNumber<int64_t>(value) / 1000000;
+    } else if (key == "rx_bytes") {
+      peer.rx_bytes = ParseNumber<uint64_t>(value);
+    } else if (key == "tx_bytes") {
+      peer.tx_bytes = ParseNumber<uint64_t>(value);
+    } else if (key == "persistent_keepalive_interval") {
+      peer.persistent_keepalive = ParseNumber<uint16_t>(value);
+    } else if (key == "allowed_ip") {
+      IpPrefix prefix;
+      if (ParseIpPrefix(std::string(value), &prefix)) {
+        AllowedIp allowed_ip = {};
+        allowed_ip.family = prefix.version == 4 ? AF_INET : AF_INET6;
+        memcpy(&allowed_ip.address, prefix.address.data(), sizeof(allowed_ip.address));
+        allowed_ip.cidr = prefix.length;
+        peer.allowed_ips.push_back(allowed_ip);
+      }
+    }
+  });
+  return device;
+}
+
+TunnelStatistics UapiStatistics(UapiConnection& connection) {
+  TunnelStatistics statistics;
+  int64_t last_handshake = 0;
+  connection.Get([&statistics, &last_handshake](std::string_view key, std::string_view value) {
+    if (key == "public_key") {
+      last_handshake = 0;
+    } else if (key == "rx_bytes") {
+      statistics.total_download += ParseNumber<uint64_t>(value);
+    } else if (key == "tx_bytes") {
+      statistics.total_upload += ParseNumber<uint64_t>(value);
+    } else if (key == "last_handshake_time_sec" || key == "last_handshake_time_nsec") {
+      last_handshake += key == "last_handshake_time_sec" ? ParseNumber<int64_t>(value) * 1000
+                                                         : ParseNumber<int64_t>(value) / 1000000;
+      statistics.latest_handshake = std::max(statistics.latest_handshake, last_handshake);
+    }
+  });
+  return statistics;
+}
+
+std::vector<PeerSample> UapiPeerSamples(UapiConnection& connection) {
+  std::vector<PeerSample> samples;
+  connection.Get([&samples](std::string_view key, std::string_view value) {
+    if (key == "public_key") {
+      samples.push_back({});
+      DecodeHexKey(value, &samples.back().public_key);
+    } else if (samples.empty()) {
+      return;
+    } else if (key == "rx_bytes") {
+      samples.back().rx_bytes = ParseNumber<uint64_t>(value);
+    } else if (key == "tx_bytes") {
+      samples.back().tx_bytes = ParseNumber<uint64_t>(value);
+    } else if (key == "last_handshake_time_sec") {
+      samples.back().last_handshake += ParseNumber<int64_t>(value) * 1000;
+    } else if (key == "last_handshake_time_nsec") {
+      samples.back().last_handshake += ParseNumber<int64_t>(value) / 1000000;
+    }
+  });
+  return samples;
+}
+
+}  // namespace wireguard_dart
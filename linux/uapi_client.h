@@ -0,0 +1,133 @@
+#ifndef WIREGUARD_DART_UAPI_CLIENT_H
+#define WIREGUARD_DART_UAPI_CLIENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "wireguard_config.h"
+#include "wireguard_device.h"
+
+namespace wireguard_dart {
+
+// Where userspace implementations such as wireguard-go and boringtun create their control sockets, one
+// `<interface>.sock` per device.
+extern const char kUapiSocketDirectory[];
+
+std::string UapiSocketPath(const std::string& name);
+
+// Whether a userspace implementation serves device `name`, i.e. its control socket exists.
+bool HasUapiSocket(const std::string& name);
+
+class UapiError : public std::runtime_error {
+ public:
+  UapiError(const std::string& message, int error_code);
+
+  // errno value answered by the implementation or set by the failing syscall.
+  int error_code() const { return error_code_; }
+
+ private:
+  int error_code_;
+};
+
+// Splits the reply to a UAPI request into its key=value lines as the bytes arrive. Lines may be cut anywhere between
+// two Feed calls; only such a partial line is copied, into a buffer that is kept across replies.
+class UapiReplyParser {
+ public:
+  using Handler = std::function<void(std::string_view key, std::string_view value)>;
+
+  // Starts over for the next reply.
+  void Reset();
+
+  // Consumes `data`, passing every complete pair but the closing errno=N to `handler`. Returns true once the empty
+  // line ending the reply has been seen; anything after it is ignored.
+  bool Feed(const char* data, size_t size, const Handler& handler);
+
+  // The errno=N of a finished reply, 0 on success.
+  int error_code() const { return error_code_; }
+
+ private:
+  void Line(std::string_view line, const Handler& handler);
+
+  std::string partial_;
+  bool done_ = false;
+  int error_code_ = 0;
+};
+
+// Serializes a set=1 request, the UAPI counterpart of SetDeviceWriter: it takes the same WGDEVICE_F_* and WGPEER_F_*
+// flags and turns them into replace_peers, remove, update_only and replace_allowed_ips. The request is built in a
+// single string whose capacity is kept across Reset calls.
+class UapiSetWriter {
+ public:
+  UapiSetWriter() { Reset(); }
+
+  // Starts a new request.
+  void Reset();
+
+  // Sets the device keys; must come before the first peer.
+  void SetInterface(const WireguardKey& private_key, uint16_t listen_port, uint32_t fwmark, uint32_t flags);
+
+  // Sets only the listen port. Implementations rebind their sockets on it even if the port stays the same.
+  void SetListenPort(uint16_t listen_port);
+
+  // Adds `peer` with WGPEER_F_* `flags`, leaving out the same fields as SetDeviceWriter::AddPeer. Endpoint host names
+  // are resolved here. Throws std::invalid_argument on malformed keys, endpoints or allowed IPs.
+  void AddPeer(const PeerConfig& peer, uint32_t flags);
+
+  // The request, terminated by the empty line.
+  const std::string& Finish();
+
+ private:
+  void Put(std::string_view key, std::string_view value);
+  void PutKey(std::string_view key, const WireguardKey& value);
+
+  std::string request_;
+};
+
+// A connection to the control socket of a userspace implementation. It is opened on first use and kept open, so a
+// request costs one write and the reads of its reply; it is reopened once if the implementation closed it meanwhile.
+class UapiConnection {
+ public:
+  explicit UapiConnection(const std::string& path);
+  ~UapiConnection();
+
+  UapiConnection(const UapiConnection&) = delete;
+  UapiConnection& operator=(const UapiConnection&) = delete;
+
+  // Sends get=1 and passes the pairs of the reply to `handler` while they are being received.
+  void Get(const UapiReplyParser::Handler& handler);
+
+  // Sends a request built by UapiSetWriter. Throws UapiError with the errno the implementation answered.
+  void Set(const std::string& request);
+
+  // Number of times the socket was connected, for tests.
+  size_t connects() const { return connects_; }
+
+ private:
+  void Connect();
+  void Close();
+  void Transact(const std::string& request, const UapiReplyParser::Handler& handler);
+
+  std::string path_;
+  int fd_ = -1;
+  size_t connects_ = 0;
+  std::vector<char> buffer_;
+  UapiReplyParser parser_;
+};
+
+// Reads the full device state with get=1. The private key is not turned into the public key, which stays zero.
+WireguardDevice GetUapiDevice(UapiConnection& connection);
+
+// Adds up the traffic and handshakes of all peers, streaming over the reply without storing the peers.
+TunnelStatistics UapiStatistics(UapiConnection& connection);
+
+std::vector<PeerSample> UapiPeerSamples(UapiConnection& connection);
+
+}  // namespace wireguard_dart
+
+#endif
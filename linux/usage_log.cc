@@ -0,0 +1,210 @@
+#include "usage_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace wireguard_dart {
+
+namespace {
+
+const char kMagic[8] = {'W', 'G', 'U', 'S', 'A', 'G', 'E', '\0'};
+const uint32_t kVersion = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  // Unix epoch seconds.
+  int64_t created;
+  char reserved[40];
+};
+static_assert(sizeof(Header) == 64, "records must stay aligned to their size within pages");
+
+const int64_t kDay = 86400;
+
+// CRC-32 as in zlib. Records are appended once a minute at most, so a bitwise loop is fast enough.
+uint32_t Crc32(const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+int64_t UnixSecondsNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+struct UsageLog::Record {
+  // Unix epoch seconds.
+  int64_t time;
+  // Totals up to `time`.
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+  // CRC-32 of the fields above.
+  uint32_t checksum;
+  uint32_t reserved;
+
+  uint32_t Checksum() const { return Crc32(this, offsetof(Record, checksum)); }
+
+  // Whether the record was written completely and follows `previous`, if any.
+  bool Follows(const Record* previous) const {
+    if (time == 0 || checksum != Checksum()) {
+      return false;
+    }
+    return previous == nullptr ||
+           (time >= previous->time && rx_bytes >= previous->rx_bytes && tx_bytes >= previous->tx_bytes);
+  }
+};
+
+UsageLog::UsageLog(const std::string& path) : file_(path) {
+  static_assert(sizeof(Record) == 32, "records must not straddle pages");
+  if (file_.size() == 0) {
+    Header header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.record_size = sizeof(Record);
+    header.created = UnixSecondsNow();
+    file_.Resize(sizeof(Header) + kInitialCapacity * sizeof(Record));
+    memcpy(file_.data(), &header, sizeof(header));
+  }
+  const Header* header = reinterpret_cast<const Header*>(file_.data());
+  if (file_.size() < sizeof(Header) || memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->record_size != sizeof(Record)) {
+    throw std::runtime_error(path + " is not a usage log");
+  }
+  capacity_ = (file_.size() - sizeof(Header)) / sizeof(Record);
+
+  // The records end at the first one that is missing, torn or out of order.
+  Record* records = reinterpret_cast<Record*>(file_.data() + sizeof(Header));
+  while (size_ < capacity_ && records[size_].Follows(size_ > 0 ? &records[size_ - 1] : nullptr)) {
+    size_++;
+  }
+  if (size_ < capacity_) {
+    memset(&records[size_], 0, sizeof(Record));
+  }
+  if (size_ > 0) {
+    appended_.rx_bytes = records[size_ - 1].rx_bytes;
+    appended_.tx_bytes = records[size_ - 1].tx_bytes;
+  }
+}
+
+UsageLog::~UsageLog() {
+  try {
+    Flush(UnixSecondsNow());
+  } catch (std::exception&) {
+    // Nothing to report to at this point; the batch is lost as in a crash.
+  }
+}
+
+void UsageLog::Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes) {
+  if (rx_bytes == 0 && tx_bytes == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.rx_bytes == 0 && pending_.tx_bytes == 0) {
+    pending_since_ = now;
+  }
+  pending_.rx_bytes += rx_bytes;
+  pending_.tx_bytes += tx_bytes;
+  if (now - pending_since_ >= kBatchInterval) {
+    Append(now, DataUsage{appended_.rx_bytes + pending_.rx_bytes, appended_.tx_bytes + pending_.tx_bytes});
+    pending_ = DataUsage();
+  }
+}
+
+void UsageLog::Flush(int64_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.rx_bytes == 0 && pending_.tx_bytes == 0) {
+    return;
+  }
+  Append(now, DataUsage{appended_.rx_bytes + pending_.rx_bytes, appended_.tx_bytes + pending_.tx_bytes});
+  pending_ = DataUsage();
+}
+
+DataUsage UsageLog::Total() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return DataUsage{appended_.rx_bytes + pending_.rx_bytes, appended_.tx_bytes + pending_.tx_bytes};
+}
+
+DataUsage UsageLog::Since(int64_t time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Record* begin = records();
+  const Record* end = begin + size_;
+  const Record* after = std::upper_bound(begin, end, time, [](int64_t t, const Record& r) { return t < r.time; });
+  DataUsage usage{appended_.rx_bytes + pending_.rx_bytes, appended_.tx_bytes + pending_.tx_bytes};
+  if (after != begin) {
+    usage.rx_bytes -= (after - 1)->rx_bytes;
+    usage.tx_bytes -= (after - 1)->tx_bytes;
+  }
+  return usage;
+}
+
+size_t UsageLog::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+const UsageLog::Record* UsageLog::records() const {
+  return reinterpret_cast<const Record*>(file_.data() + sizeof(Header));
+}
+
+void UsageLog::Append(int64_t time, const DataUsage& totals) {
+  if (size_ > 0) {
+    // Keeps the records in time order when the clock steps back.
+    time = std::max(time, records()[size_ - 1].time);
+  }
+  if (size_ == capacity_) {
+    Compact(time, capacity_);
+  }
+  Record* record = reinterpret_cast<Record*>(file_.data() + sizeof(Header)) + size_;
+  record->time = time;
+  record->rx_bytes = totals.rx_bytes;
+  record->tx_bytes = totals.tx_bytes;
+  record->reserved = 0;
+  record->checksum = record->Checksum();
+  size_++;
+  appended_ = totals;
+  // The page cache keeps the record through a crash of the app; the kernel writes it back in its own time.
+}
+
+void UsageLog::Compact(int64_t now, size_t capacity) {
+  std::vector<Record> kept;
+  const Record* all = records();
+  for (size_t i = 0; i < size_; i++) {
+    const Record& record = all[i];
+    if (record.time >= now - kDay || i + 1 == size_) {
+      kept.push_back(record);
+      continue;
+    }
+    // Of the records in the same hour, or day for older ones, only the last is kept. A record on the hour closes the
+    // hour before, so that queries from the full hour are exact.
+    const Record& next = all[i + 1];
+    int64_t length = record.time >= now - kHourlyDays * kDay ? 3600 : kDay;
+    if (next.time >= now - kDay || (next.time - 1) / length != (record.time - 1) / length ||
+        (next.time >= now - kHourlyDays * kDay) != (record.time >= now - kHourlyDays * kDay)) {
+      kept.push_back(record);
+    }
+  }
+  // Room for another day of records at least.
+  while (kept.size() > capacity * 3 / 4) {
+    capacity *= 2;
+  }
+
+  file_.Replace({{file_.data(), sizeof(Header)}, {kept.data(), kept.size() * sizeof(Record)}},
+                sizeof(Header) + capacity * sizeof(Record));
+  capacity_ = capacity;
+  size_ = kept.size();
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,84 @@
+#ifndef WIREGUARD_DART_USAGE_LOG_H
+#define WIREGUARD_DART_USAGE_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "mapped_file.h"
+
+namespace wireguard_dart {
+
+struct DataUsage {
+  uint64_t rx_bytes = 0;
+  uint64_t tx_bytes = 0;
+};
+
+// Lifetime data usage of a tunnel in a memory-mapped, append-only file that outlives connects, app restarts and
+// crashes. Traffic is added in memory and appended as one 32 byte record per kBatchInterval with traffic; a record
+// holds the running totals at its time, so records are in time and total order and "usage since T" is the total minus
+// the totals of the last record at or before T, found by binary search over the mapping. Every record carries a
+// checksum: a record torn by a crash is dropped when the file is opened, as is the traffic of the batch that was not
+// appended yet.
+//
+// When the file is full, records older than a day are thinned to the last one of each hour and records older than
+// kHourlyDays to the last one of each day. Totals at the kept records stay exact, so "since" queries for older times
+// are answered at hour or day granularity. The thinned log is written next to the file and renamed over it.
+class UsageLog {
+ public:
+  // Seconds of traffic folded into one record.
+  static const int64_t kBatchInterval = 60;
+  // Days for which hourly records are kept by compaction.
+  static const int64_t kHourlyDays = 62;
+  // Records the file is created with room for.
+  static const size_t kInitialCapacity = 4096;
+
+  // Opens the log at `path`, creating it if it does not exist. Throws std::system_error, or std::runtime_error if the
+  // file is not a usage log.
+  explicit UsageLog(const std::string& path);
+  // Appends the pending batch.
+  ~UsageLog();
+
+  UsageLog(const UsageLog&) = delete;
+  UsageLog& operator=(const UsageLog&) = delete;
+
+  // Counts traffic at `now` (Unix epoch seconds), appending the batch once it is kBatchInterval old.
+  void Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes);
+
+  // Appends the pending batch, if it holds any traffic, as of `now`.
+  void Flush(int64_t now);
+
+  // Everything counted since the log was created, including the pending batch.
+  DataUsage Total();
+
+  // Traffic counted after `time` (Unix epoch seconds), including the pending batch. Exact for times of the last day;
+  // older times are rounded down to the records compaction kept.
+  DataUsage Since(int64_t time);
+
+  // Records in the file.
+  size_t size();
+
+ private:
+  struct Record;
+
+  const Record* records() const;
+  // Appends a record of the totals at `time`, compacting or growing the file if it is full.
+  void Append(int64_t time, const DataUsage& totals);
+  // Rewrites the file with the records that compaction keeps at `now`, with room for at least `capacity` records.
+  void Compact(int64_t now, size_t capacity);
+
+  std::mutex mutex_;
+  MappedFile file_;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+  // Totals of the last record.
+  DataUsage appended_;
+  // Traffic not appended yet, counted since `pending_since_`.
+  DataUsage pending_;
+  int64_t pending_since_ = 0;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -1,43 +1,1884 @@
 #include "include/wireguard_dart/wireguard_dart_plugin.h"
 
+#include <arpa/inet.h>
 #include <flutter_linux/flutter_linux.h>
 #include <gtk/gtk.h>
+#include <net/if.h>
 #include <sys/utsname.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "adaptive_keepalive.h"
+#include "connection_status.h"
+#include "dns_cache.h"
+#include "endpoint_prober.h"
+#include "handshake_watchdog.h"
+#include "happy_eyeballs.h"
+#include "kill_switch.h"
+#include "link_control.h"
+#include "metrics_exporter.h"
+#include "network_monitor.h"
+#include "path_mtu.h"
+#include "peer_index.h"
+#include "profile_store.h"
+#include "quality_prober.h"
+#include "reactor.h"
+#include "route_calculator.h"
+#include "status_monitor.h"
+#include "traffic_history.h"
+#include "tunnel_control.h"
+#include "usage_log.h"
+#include "wireguard_config.h"
+#include "wireguard_device.h"
 
 #define WIREGUARD_DART_PLUGIN(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), wireguard_dart_plugin_get_type(), \
                               WireguardDartPlugin))
 
+namespace {
+
+struct PluginState {
+  // The event loop thread of the backend. Declared first so that it outlives
+  // everything that watches descriptors or sets timers on it.
+  wireguard_dart::Reactor reactor;
+  // Served by the exporter and updated from the platform thread and from the
+  // race, MTU discovery, monitors and probers below. Declared before all of
+  // them so that it outlives their threads.
+  wireguard_dart::TunnelMetrics metrics;
+  std::unique_ptr<wireguard_dart::TunnelControl> tunnel;
+  // Set while discovery of a tunnel left up by a previous instance of the app
+  // runs off the platform thread, from registration on. Method calls that come
+  // meanwhile wait for it, in order, so that they see the adopted tunnel.
+  bool attaching = false;
+  std::vector<std::shared_ptr<FlMethodCall>> calls_awaiting_attach;
+  wireguard_dart::AddressFamilyCache family_cache;
+  // Endpoint host names resolved ahead of connect. Declared before the race,
+  // which resolves through it.
+  wireguard_dart::DnsCache dns_cache;
+  // Leak protection while enabled. Declared before the race, which moves it to
+  // the endpoints it tries.
+  wireguard_dart::KillSwitch kill_switch;
+  // Races the addresses of endpoint host names after connect.
+  std::shared_ptr<wireguard_dart::EndpointRace> endpoint_race;
+  // Changes with every connect, disconnect and new tunnel, so that a call that
+  // finishes in the background finds out whether one of them came first.
+  uint64_t tunnel_generation = 0;
+  // Peers of the running tunnel for addPeers, updatePeers and removePeers.
+  // Seeded by connect, or from the device on first use after attaching.
+  std::optional<wireguard_dart::PeerIndex> peers;
+  // The config the running tunnel was connected with, which the handshake
+  // watchdog connects with again as a last resort. Unset for an attached one.
+  std::optional<wireguard_dart::WireguardConfig> tunnel_config;
+  // Endpoints of its peers that were given as host names, which the watchdog
+  // looks up again when a peer stops answering.
+  std::map<wireguard_dart::WireguardKey, std::string> peer_hosts;
+  // Tunes the keepalive of the running tunnel to the NAT of the network.
+  wireguard_dart::AdaptiveKeepalive keepalive;
+  // Path MTU discovery after connecting with a config that sets no MTU. The
+  // platform thread never waits for it: a new discovery runs after the one
+  // before, and stopping one only sets its flag.
+  std::future<void> mtu_discovery;
+  std::shared_ptr<std::atomic<bool>> mtu_discovery_cancelled;
+  // Rebinds the running tunnel when the network underneath it changes.
+  std::unique_ptr<wireguard_dart::NetworkMonitor> network_monitor;
+  // Follows the status of the tunnel interface for the status event channel
+  // once a tunnel is set up.
+  std::unique_ptr<wireguard_dart::StatusMonitor> status_monitor;
+  // Owned by the plugin, which detaches its handlers when disposed.
+  FlEventChannel* status_channel = nullptr;
+  bool status_listening = false;
+  // The latest status the monitor reported, which new listeners receive first.
+  wireguard_dart::ConnectionStatus status =
+      wireguard_dart::ConnectionStatus::unknown;
+  // Traffic of the tunnel and its peers over time, recorded while connected.
+  wireguard_dart::TrafficHistory traffic;
+  // Lifetime data usage of the tunnel, fed by the traffic recorder. Null if
+  // the log cannot be opened.
+  std::unique_ptr<wireguard_dart::UsageLog> usage;
+  wireguard_dart::TrafficRecorder traffic_recorder{&traffic};
+  // Where to send quality probes while connected, if anywhere.
+  std::optional<wireguard_dart::QualityProbeOptions> quality_probe;
+  wireguard_dart::QualityProber quality_prober;
+  std::unique_ptr<wireguard_dart::MetricsExporter> metrics_exporter;
+  // Imported configs that connect takes by ID. Opened on first use.
+  std::unique_ptr<wireguard_dart::ProfileStore> profiles;
+  // Method calls running off the main loop. Declared last so that disposing
+  // waits for them before anything they use goes away.
+  std::list<std::future<void>> background;
+};
+
+}  // namespace
+
 struct _WireguardDartPlugin {
   GObject parent_instance;
+  // GObject does not run C++ constructors, so C++ state lives behind a pointer.
+  PluginState* state;
 };
 
 G_DEFINE_TYPE(WireguardDartPlugin, wireguard_dart_plugin, g_object_get_type())
 
-// Called when a method call is received from Flutter.
-static void wireguard_dart_plugin_handle_method_call(
+// Hands the response of a method call, which it takes over, to the caller:
+// Flutter, or the batch the call is part of. Called on the main loop, either
+// before the handler returns or once the call finished in the background.
+using Respond = std::function<void(FlMethodResponse* response)>;
+
+static void wireguard_dart_plugin_invoke(WireguardDartPlugin* self,
+                                         const gchar* method, FlValue* args,
+                                         Respond respond);
+static void wireguard_dart_plugin_recover(
+    WireguardDartPlugin* self, const wireguard_dart::RecoveryStep& step);
+
+static FlMethodResponse* error_response(const gchar* code,
+                                        const gchar* message = nullptr) {
+  return FL_METHOD_RESPONSE(
+      fl_method_error_response_new(code, message, nullptr));
+}
+
+static const gchar* lookup_string(FlValue* args, const gchar* key) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  return fl_value_get_string(value);
+}
+
+static bool lookup_int(FlValue* args, const gchar* key, int64_t* value) {
+  FlValue* entry = fl_value_lookup_string(args, key);
+  if (entry == nullptr || fl_value_get_type(entry) != FL_VALUE_TYPE_INT) {
+    return false;
+  }
+  *value = fl_value_get_int(entry);
+  return true;
+}
+
+// The network the tunnel's own packets leave through, told apart by the route to
+// the first peer endpoint. Empty if no peer has one.
+static std::string underlay_network(const std::string& interface_name) {
+  wireguard_dart::WireguardDevice device =
+      wireguard_dart::TunnelControl(interface_name).Device();
+  for (const auto& peer : device.peers) {
+    if (peer.endpoint.ss_family == AF_INET ||
+        peer.endpoint.ss_family == AF_INET6) {
+      return wireguard_dart::RouteIdentity(peer.endpoint,
+                                           wireguard_dart::kTunnelRoutingTable);
+    }
+  }
+  return "";
+}
+
+// The endpoint addresses of the tunnel's peers as set on the device, none while
+// the interface does not exist.
+static std::vector<sockaddr_storage> tunnel_endpoints(
+    const std::string& interface_name) {
+  std::vector<sockaddr_storage> endpoints;
+  if (!wireguard_dart::FindLink(interface_name).has_value()) {
+    return endpoints;
+  }
+  for (const auto& peer :
+       wireguard_dart::TunnelControl(interface_name).Device().peers) {
+    if (peer.endpoint.ss_family == AF_INET ||
+        peer.endpoint.ss_family == AF_INET6) {
+      endpoints.push_back(peer.endpoint);
+    }
+  }
+  return endpoints;
+}
+
+// The addresses of the endpoints of `peers`, skipping those without one. Host
+// names are not looked up, as DNS is blocked while the kill switch is on; the
+// endpoint race has replaced them with addresses by the time this is needed.
+static std::vector<sockaddr_storage> peer_endpoints(
+    const std::vector<wireguard_dart::PeerConfig>& peers) {
+  std::vector<sockaddr_storage> endpoints;
+  for (const auto& peer : peers) {
+    std::string host;
+    uint16_t port = 0;
+    if (!wireguard_dart::SplitEndpoint(peer.endpoint, &host, &port)) {
+      continue;
+    }
+    sockaddr_storage address = {};
+    auto* ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+    auto* ipv6 = reinterpret_cast<sockaddr_in6*>(&address);
+    if (inet_pton(AF_INET, host.c_str(), &ipv4->sin_addr) == 1) {
+      ipv4->sin_family = AF_INET;
+      ipv4->sin_port = htons(port);
+    } else if (inet_pton(AF_INET6, host.c_str(), &ipv6->sin6_addr) == 1) {
+      ipv6->sin6_family = AF_INET6;
+      ipv6->sin6_port = htons(port);
+    } else {
+      continue;
+    }
+    endpoints.push_back(address);
+  }
+  return endpoints;
+}
+
+// Lets the kill switch, if enabled, through to the current endpoints of the
+// tunnel and to those of `next`, the peers about to be applied.
+static void allow_endpoints(
+    wireguard_dart::KillSwitch* kill_switch, const std::string& interface_name,
+    const std::vector<wireguard_dart::PeerConfig>& next = {}) {
+  if (!kill_switch->enabled()) {
+    return;
+  }
+  std::vector<sockaddr_storage> endpoints = tunnel_endpoints(interface_name);
+  std::vector<sockaddr_storage> added = peer_endpoints(next);
+  endpoints.insert(endpoints.end(), added.begin(), added.end());
+  kill_switch->SetEndpoints(endpoints);
+}
+
+// Points the kill switch at the tunnel interface. A ruleset left by an earlier
+// run of the app is taken over rather than left to block the endpoints of this
+// one.
+static void retarget_kill_switch(PluginState* state) {
+  try {
+    if (state->kill_switch.enabled() ||
+        wireguard_dart::KillSwitch::Installed()) {
+      std::string interface_name = state->tunnel->interface_name_;
+      state->kill_switch.Enable(interface_name,
+                                tunnel_endpoints(interface_name));
+    }
+  } catch (std::exception& e) {
+    g_warning("Cannot update the kill switch: %s", e.what());
+  }
+}
+
+// Sets the tunnel MTU from the path MTU to its endpoints, unless cancelled.
+static void discover_mtu(const std::string& interface_name,
+                         wireguard_dart::TunnelMetrics* metrics,
+                         const std::atomic<bool>* cancelled) {
+  auto start = std::chrono::steady_clock::now();
+  wireguard_dart::PathMtuOptions options;
+  options.cancelled = cancelled;
+  uint32_t mtu =
+      wireguard_dart::TunnelControl(interface_name).DiscoverMtu(options);
+  if (*cancelled) {
+    return;
+  }
+  metrics->ObservePhase(wireguard_dart::ConnectPhase::mtu,
+                        std::chrono::steady_clock::now() - start);
+  if (mtu != 0) {
+    g_debug("Tunnel MTU set to %u from the path MTU", mtu);
+  }
+}
+
+// Makes a running path MTU discovery give up after its current probe without
+// waiting for it, which a reset of its future would.
+static void cancel_mtu_discovery(PluginState* state) {
+  if (state->mtu_discovery_cancelled != nullptr) {
+    *state->mtu_discovery_cancelled = true;
+  }
+}
+
+// Discovers the path MTU of the tunnel in the background, after a discovery
+// that is still running, so that the platform thread never waits for one.
+static void start_mtu_discovery(PluginState* state,
+                                const std::string& interface_name) {
+  cancel_mtu_discovery(state);
+  auto cancelled = std::make_shared<std::atomic<bool>>(false);
+  state->mtu_discovery_cancelled = cancelled;
+  wireguard_dart::TunnelMetrics* metrics = &state->metrics;
+  state->mtu_discovery = std::async(
+      std::launch::async,
+      [interface_name, metrics, cancelled,
+       previous = std::move(state->mtu_discovery)]() mutable {
+        if (previous.valid()) {
+          previous.wait();
+        }
+        try {
+          discover_mtu(interface_name, metrics, cancelled.get());
+        } catch (std::exception& e) {
+          g_warning("Path MTU discovery failed: %s", e.what());
+        }
+      });
+}
+
+// Runs `task` on the GLib main loop, where plugin state may be touched, e.g.
+// with results from the reactor thread. Keeps the plugin alive until then.
+static void run_on_main_loop(WireguardDartPlugin* self,
+                             std::function<void()> task) {
+  struct MainLoopTask {
+    WireguardDartPlugin* self;
+    std::function<void()> task;
+  };
+  g_main_context_invoke_full(
+      nullptr, G_PRIORITY_DEFAULT,
+      [](gpointer data) -> gboolean {
+        static_cast<MainLoopTask*>(data)->task();
+        return G_SOURCE_REMOVE;
+      },
+      new MainLoopTask{WIREGUARD_DART_PLUGIN(g_object_ref(self)),
+                       std::move(task)},
+      [](gpointer data) {
+        auto* main_loop_task = static_cast<MainLoopTask*>(data);
+        g_object_unref(main_loop_task->self);
+        delete main_loop_task;
+      });
+}
+
+// Runs `work` on a thread of its own, then `then` on the main loop unless the
+// plugin was disposed in between. Disposing waits for running work, which may
+// therefore use the plugin state but must not throw.
+static void run_in_background(WireguardDartPlugin* self,
+                              std::function<void()> work,
+                              std::function<void()> then) {
+  std::list<std::future<void>>& background = self->state->background;
+  background.remove_if([](const std::future<void>& task) {
+    return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  });
+  background.push_back(std::async(
+      std::launch::async,
+      [self, work = std::move(work), then = std::move(then)]() mutable {
+        work();
+        run_on_main_loop(self, [self, then = std::move(then)] {
+          if (self->state != nullptr) {
+            then();
+          }
+        });
+      }));
+}
+
+// Sends the latest status to the status event channel.
+static void send_status(PluginState* state) {
+  g_autoptr(FlValue) event = fl_value_new_string(
+      wireguard_dart::ConnectionStatusToString(state->status).c_str());
+  g_autoptr(GError) error = nullptr;
+  if (!fl_event_channel_send(state->status_channel, event, nullptr, &error)) {
+    g_warning("Cannot send the tunnel status: %s", error->message);
+  }
+}
+
+// Records a status reported by the status monitor and sends it on if Dart
+// listens. The only writer of the status, so that status(), statusStream()
+// and the metrics never disagree.
+static void publish_status(PluginState* state,
+                           wireguard_dart::ConnectionStatus status) {
+  if (status == state->status) {
+    return;
+  }
+  state->status = status;
+  state->metrics.SetStatus(status);
+  if (state->status_listening) {
+    send_status(state);
+  }
+}
+
+// Follows the status of the tunnel interface on the reactor, which hands every
+// change back to the main loop for the status event channel. Links and
+// addresses are notified by the kernel; handshakes are read from the device,
+// and so are the counters the handshake watchdog finds stalled peers by. Its
+// recovery steps are taken on the main loop.
+static void follow_tunnel_status(WireguardDartPlugin* self) {
+  PluginState* state = self->state;
+  if (state->status_monitor == nullptr) {
+    state->status_monitor = std::make_unique<wireguard_dart::StatusMonitor>(
+        &state->reactor,
+        [](const std::string& interface_name) {
+          for (const wireguard_dart::PeerSample& peer :
+               wireguard_dart::TunnelControl(interface_name).PeerSamples()) {
+            if (peer.last_handshake != 0) {
+              return true;
+            }
+          }
+          return false;
+        },
+        [self](wireguard_dart::ConnectionStatus status) {
+          run_on_main_loop(self, [self, status] {
+            if (self->state != nullptr) {
+              publish_status(self->state, status);
+            }
+          });
+        });
+    state->status_monitor->WatchHandshakes(
+        [](const std::string& interface_name) {
+          return wireguard_dart::TunnelControl(interface_name).PeerSamples();
+        },
+        [self](const wireguard_dart::RecoveryStep& step) {
+          run_on_main_loop(self, [self, step] {
+            if (self->state != nullptr) {
+              wireguard_dart_plugin_recover(self, step);
+            }
+          });
+        });
+  }
+  try {
+    state->status_monitor->Start(state->tunnel->interface_name_);
+  } catch (std::exception& e) {
+    g_warning("Cannot follow the tunnel status: %s", e.what());
+  }
+}
+
+// Starts probing the quality of the running tunnel, if a probe target is set.
+static void start_quality_probe(PluginState* state) {
+  state->quality_prober.Stop();
+  state->metrics.SetQuality(nullptr);
+  if (!state->quality_probe.has_value()) {
+    return;
+  }
+  wireguard_dart::TunnelMetrics* metrics = &state->metrics;
+  try {
+    state->quality_prober.Start(
+        *state->quality_probe,
+        [metrics](const wireguard_dart::LinkQuality& quality) {
+          metrics->SetQuality(&quality);
+        });
+  } catch (std::exception& e) {
+    g_warning("Cannot probe the tunnel quality: %s", e.what());
+  }
+}
+
+// Watches the network and tunes keepalives on behalf of the running tunnel,
+// whose configured peers are `peers`. With `adapt_mtu` the MTU follows the
+// path MTU of every new network. A failure only costs the fast recovery after
+// network changes, so it is logged rather than reported.
+static void wireguard_dart_plugin_watch_network(
     WireguardDartPlugin* self,
-    FlMethodCall* method_call) {
-  g_autoptr(FlMethodResponse) response = nullptr;
+    const std::vector<wireguard_dart::PeerConfig>& peers, bool adapt_mtu) {
+  PluginState* state = self->state;
+  std::string interface_name = state->tunnel->interface_name_;
+  state->keepalive.Start(
+      peers,
+      [interface_name] {
+        return wireguard_dart::TunnelControl(interface_name).PeerSamples();
+      },
+      [interface_name](const std::vector<wireguard_dart::PeerChange>& changes) {
+        wireguard_dart::TunnelControl(interface_name).ApplyPeerChanges(changes);
+      },
+      [interface_name] { return underlay_network(interface_name); });
+  wireguard_dart::UsageLog* usage = state->usage.get();
+  state->traffic_recorder.Start(
+      [interface_name] {
+        return wireguard_dart::TunnelControl(interface_name).PeerSamples();
+      },
+      [usage](int64_t now, const wireguard_dart::TrafficDelta& traffic) {
+        if (usage != nullptr) {
+          usage->Add(now, traffic.rx_bytes, traffic.tx_bytes);
+        }
+      });
+  start_quality_probe(state);
+
+  wireguard_dart::AdaptiveKeepalive* keepalive = &state->keepalive;
+  wireguard_dart::TunnelMetrics* metrics = &state->metrics;
+  // Rebinding is quick and done on the reactor; discovering the path MTU takes
+  // seconds of probing, so it is started from the main loop instead.
+  state->network_monitor = std::make_unique<wireguard_dart::NetworkMonitor>(
+      &state->reactor,
+      [self, interface_name, keepalive, metrics, adapt_mtu] {
+        wireguard_dart::TunnelControl(interface_name).Rebind();
+        metrics->CountReconnect(
+            wireguard_dart::ReconnectReason::network_change);
+        keepalive->NetworkChanged();
+        if (adapt_mtu) {
+          run_on_main_loop(self, [self, interface_name] {
+            // Unless the tunnel went down or the plugin was disposed since.
+            if (self->state != nullptr &&
+                self->state->network_monitor != nullptr) {
+              start_mtu_discovery(self->state, interface_name);
+            }
+          });
+        }
+      });
+  try {
+    std::optional<wireguard_dart::LinkInfo> link =
+        wireguard_dart::FindLink(interface_name);
+    if (link.has_value()) {
+      state->metrics.SetTunnel(link->ifindex);
+      state->network_monitor->Start(link->ifindex);
+    }
+  } catch (std::exception& e) {
+    g_warning("Cannot watch network changes: %s", e.what());
+  }
+}
+
+// Opens the usage log of the tunnel in the user's data directory, which keeps
+// the totals of earlier runs of the app.
+static void open_usage_log(PluginState* state,
+                           const std::string& interface_name) {
+  state->usage.reset();
+  g_autofree gchar* directory =
+      g_build_filename(g_get_user_data_dir(), "wireguard_dart", nullptr);
+  g_autofree gchar* file_name =
+      g_strdup_printf("%s.usage", interface_name.c_str());
+  g_autofree gchar* path = g_build_filename(directory, file_name, nullptr);
+  if (g_mkdir_with_parents(directory, 0700) != 0) {
+    g_warning("Cannot create %s; data usage is not recorded", directory);
+    return;
+  }
+  try {
+    state->usage = std::make_unique<wireguard_dart::UsageLog>(path);
+  } catch (std::exception& e) {
+    g_warning("Data usage is not recorded: %s", e.what());
+  }
+}
+
+// The profile store in the user's data directory, opened on first use. Null,
+// with the reason in `error`, if it cannot be opened.
+static wireguard_dart::ProfileStore* wireguard_dart_plugin_profile_store(
+    WireguardDartPlugin* self, std::string* error) {
+  PluginState* state = self->state;
+  if (state->profiles != nullptr) {
+    return state->profiles.get();
+  }
+  g_autofree gchar* directory =
+      g_build_filename(g_get_user_data_dir(), "wireguard_dart", nullptr);
+  g_autofree gchar* path = g_build_filename(directory, "profiles", nullptr);
+  if (g_mkdir_with_parents(directory, 0700) != 0) {
+    *error = std::string("Cannot create ") + directory;
+    return nullptr;
+  }
+  try {
+    state->profiles = std::make_unique<wireguard_dart::ProfileStore>(path);
+  } catch (std::exception& e) {
+    *error = e.what();
+  }
+  return state->profiles.get();
+}
+
+// Adopts the tunnel found by discovery, unless one was set up already.
+static void wireguard_dart_plugin_adopt(WireguardDartPlugin* self,
+                                        const std::string& interface_name) {
+  PluginState* state = self->state;
+  if (state->tunnel != nullptr) {
+    return;
+  }
+  state->tunnel =
+      std::make_unique<wireguard_dart::TunnelControl>(interface_name);
+  open_usage_log(state, interface_name);
+  std::vector<wireguard_dart::PeerConfig> peers;
+  try {
+    peers = wireguard_dart::ConfiguredPeers(state->tunnel->Device());
+  } catch (std::exception& e) {
+    g_warning("Cannot read the attached tunnel: %s", e.what());
+  }
+  retarget_kill_switch(state);
+  follow_tunnel_status(self);
+  // The MTU of an adopted tunnel was chosen by whoever brought it up.
+  wireguard_dart_plugin_watch_network(self, peers, false);
+}
+
+static FlMethodResponse* wireguard_dart_plugin_setup_tunnel(
+    WireguardDartPlugin* self, FlValue* args) {
+  const gchar* tunnel_name = lookup_string(args, "tunnelName");
+  if (tunnel_name == nullptr) {
+    return error_response("Argument 'tunnelName' is required");
+  }
+  // The tunnel name doubles as the kernel interface name.
+  size_t length = strlen(tunnel_name);
+  if (length == 0 || length >= IFNAMSIZ ||
+      strpbrk(tunnel_name, "/ \t\n") != nullptr) {
+    return error_response(
+        "INVALID_TUNNEL_NAME",
+        "Argument 'tunnelName' must be a valid interface name of at most 15 "
+        "characters");
+  }
+
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr ||
+      (state->tunnel->interface_name_ != tunnel_name &&
+       state->tunnel->Status() == wireguard_dart::ConnectionStatus::disconnected)) {
+    state->network_monitor.reset();
+    state->keepalive.Stop();
+    state->traffic_recorder.Stop();
+    state->quality_prober.Stop();
+    state->metrics.SetQuality(nullptr);
+    cancel_mtu_discovery(state);
+    if (state->tunnel == nullptr ||
+        state->tunnel->interface_name_ != tunnel_name) {
+      state->traffic.Clear();
+      open_usage_log(state, tunnel_name);
+    }
+    state->tunnel = std::make_unique<wireguard_dart::TunnelControl>(tunnel_name);
+    state->tunnel_generation++;
+    state->peers.reset();
+    state->tunnel_config.reset();
+    state->peer_hosts.clear();
+    retarget_kill_switch(state);
+    follow_tunnel_status(self);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Remembers the endpoint a peer was given if it is a host name, for the
+// handshake watchdog to look up again, and forgets an earlier one otherwise.
+static void remember_peer_host(PluginState* state,
+                               const std::string& public_key,
+                               const std::string& endpoint) {
+  wireguard_dart::WireguardKey key;
+  if (!wireguard_dart::DecodeKey(public_key, &key)) {
+    return;
+  }
+  if (!endpoint.empty() && wireguard_dart::EndpointFamily(endpoint) ==
+                               wireguard_dart::AddressFamily::unspecified) {
+    state->peer_hosts[key] = endpoint;
+  } else {
+    state->peer_hosts.erase(key);
+  }
+}
+
+// Configures the tunnel with the config that connect prepared in the
+// background, unless a later connect, disconnect or tunnel came first.
+static FlMethodResponse* wireguard_dart_plugin_finish_connect(
+    WireguardDartPlugin* self, uint64_t generation,
+    std::shared_ptr<wireguard_dart::EndpointRace> race,
+    const wireguard_dart::WireguardConfig& config,
+    const wireguard_dart::WireguardConfig& prepared, const std::string& error) {
+  PluginState* state = self->state;
+  if (generation != state->tunnel_generation) {
+    return error_response("CANCELLED",
+                          "A later connect or disconnect came first");
+  }
+  wireguard_dart::TunnelMetrics* metrics = &state->metrics;
+  try {
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+    auto start = std::chrono::steady_clock::now();
+    // The new endpoints are let through before the tunnel sends to them.
+    state->kill_switch.SetEndpoints(peer_endpoints(prepared.peers));
+    state->tunnel->Up(prepared);
+    metrics->ObservePhase(wireguard_dart::ConnectPhase::up,
+                          std::chrono::steady_clock::now() - start);
+    state->peers.emplace();
+    state->peers->Reset(prepared.peers);
+  } catch (std::exception& e) {
+    metrics->SetTunnel(0);
+    return error_response(e.what());
+  }
+  state->tunnel_config = config;
+  for (const wireguard_dart::PeerConfig& peer : config.peers) {
+    remember_peer_host(state, peer.public_key, peer.endpoint);
+  }
+
+  std::string interface_name = state->tunnel->interface_name_;
+  wireguard_dart::KillSwitch* kill_switch = &state->kill_switch;
+  state->endpoint_race = race;
+  state->endpoint_race->Start(
+      [interface_name, metrics, kill_switch](
+          const wireguard_dart::PeerConfig& peer, bool restart) {
+        allow_endpoints(kill_switch, interface_name, {peer});
+        wireguard_dart::TunnelControl(interface_name).SetPeer(peer, restart);
+        allow_endpoints(kill_switch, interface_name);
+        metrics->CountReconnect(wireguard_dart::ReconnectReason::endpoint);
+      },
+      [interface_name] {
+        return wireguard_dart::TunnelControl(interface_name).PeerSamples();
+      });
+  bool adapt_mtu = config.interface_config.mtu == 0;
+  wireguard_dart_plugin_watch_network(self, config.peers, adapt_mtu);
+  if (adapt_mtu) {
+    start_mtu_discovery(state, interface_name);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Tears down the running tunnel and brings it up with `config`. Endpoint host
+// names are resolved first, in the background and both families at once, so
+// the kernel is handed addresses and neither DNS nor a broken family holds up
+// the main loop.
+static void wireguard_dart_plugin_start_connect(
+    WireguardDartPlugin* self, wireguard_dart::WireguardConfig config,
+    Respond respond) {
+  PluginState* state = self->state;
+  if (state->endpoint_race != nullptr) {
+    state->endpoint_race->Stop();
+  }
+  state->network_monitor.reset();
+  state->keepalive.Stop();
+  state->traffic_recorder.Stop();
+  state->quality_prober.Stop();
+  state->metrics.SetQuality(nullptr);
+  cancel_mtu_discovery(state);
+  state->peers.reset();
+  state->tunnel_config.reset();
+  state->peer_hosts.clear();
+  uint64_t generation = ++state->tunnel_generation;
+  wireguard_dart::TunnelMetrics* metrics = &state->metrics;
+  if (state->status == wireguard_dart::ConnectionStatus::connected) {
+    metrics->CountReconnect(wireguard_dart::ReconnectReason::connect);
+  }
+
+  // Every connect resolves with a race of its own, which it hands to the
+  // tunnel once up, so that two connects in flight never share one.
+  auto race = std::make_shared<wireguard_dart::EndpointRace>(
+      &state->family_cache, wireguard_dart::CachedResolver(&state->dns_cache));
+  struct Prepared {
+    wireguard_dart::WireguardConfig config;
+    std::string error;
+  };
+  auto prepared = std::make_shared<Prepared>();
+  run_in_background(
+      self,
+      [race, config, prepared, metrics] {
+        try {
+          auto start = std::chrono::steady_clock::now();
+          prepared->config = race->Prepare(config);
+          metrics->ObservePhase(wireguard_dart::ConnectPhase::resolve,
+                                std::chrono::steady_clock::now() - start);
+        } catch (std::exception& e) {
+          prepared->error = e.what();
+        }
+      },
+      [self, generation, race, config, prepared, respond] {
+        respond(wireguard_dart_plugin_finish_connect(
+            self, generation, race, config, prepared->config,
+            prepared->error));
+      });
+}
+
+// Brings the tunnel up with 'cfg' or with the stored profile 'profileId'.
+static void wireguard_dart_plugin_connect(WireguardDartPlugin* self,
+                                          FlValue* args, Respond respond) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return respond(error_response("Invalid state: call 'setupTunnel' first"));
+  }
+  const gchar* cfg = lookup_string(args, "cfg");
+  int64_t profile_id = 0;
+  if (cfg == nullptr &&
+      !(args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP &&
+        lookup_int(args, "profileId", &profile_id))) {
+    return respond(
+        error_response("Argument 'cfg' or 'profileId' is required"));
+  }
+
+  wireguard_dart::WireguardConfig config;
+  try {
+    if (cfg != nullptr) {
+      config = wireguard_dart::WireguardConfig::Parse(cfg);
+    } else {
+      // Stored parsed and validated; only this profile is read back.
+      std::string error;
+      wireguard_dart::ProfileStore* profiles =
+          wireguard_dart_plugin_profile_store(self, &error);
+      if (profiles == nullptr) {
+        return respond(error_response(error.c_str()));
+      }
+      std::optional<wireguard_dart::WireguardConfig> profile;
+      if (profile_id > 0 && profile_id <= UINT32_MAX) {
+        profile = profiles->Find(static_cast<uint32_t>(profile_id));
+      }
+      if (!profile.has_value()) {
+        return respond(
+            error_response("UNKNOWN_PROFILE", "No profile with this ID"));
+      }
+      config = std::move(*profile);
+    }
+    config = wireguard_dart::ApplyExcludedIps(config);
+  } catch (std::exception& e) {
+    return respond(error_response("INVALID_CONFIG", e.what()));
+  }
+  wireguard_dart_plugin_start_connect(self, std::move(config), respond);
+}
+
+// Starts resolving the host names of a server list in the background, so that a
+// later connect to any of them does not wait for DNS. Returns at once.
+static FlMethodResponse* wireguard_dart_plugin_prefetch_endpoints(
+    WireguardDartPlugin* self, FlValue* args) {
+  FlValue* entries = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                         ? fl_value_lookup_string(args, "endpoints")
+                         : nullptr;
+  if (entries == nullptr || fl_value_get_type(entries) != FL_VALUE_TYPE_LIST) {
+    return error_response("Argument 'endpoints' is required");
+  }
+  std::vector<std::string> endpoints;
+  for (size_t i = 0; i < fl_value_get_length(entries); i++) {
+    FlValue* entry = fl_value_get_list_value(entries, i);
+    if (fl_value_get_type(entry) == FL_VALUE_TYPE_STRING) {
+      endpoints.push_back(fl_value_get_string(entry));
+    }
+  }
+  self->state->dns_cache.Prefetch(wireguard_dart::EndpointHosts(endpoints));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+static FlMethodResponse* wireguard_dart_plugin_disconnect(
+    WireguardDartPlugin* self) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return error_response("Invalid state: call 'setupTunnel' first");
+  }
+  if (state->endpoint_race != nullptr) {
+    state->endpoint_race->Stop();
+  }
+  state->network_monitor.reset();
+  state->keepalive.Stop();
+  state->traffic_recorder.Stop();
+  state->quality_prober.Stop();
+  state->metrics.SetQuality(nullptr);
+  cancel_mtu_discovery(state);
+  state->peers.reset();
+  state->tunnel_config.reset();
+  state->peer_hosts.clear();
+  state->tunnel_generation++;
+  if (state->usage != nullptr) {
+    state->usage->Flush(g_get_real_time() / G_USEC_PER_SEC);
+  }
+  state->metrics.SetTunnel(0);
+  try {
+    auto start = std::chrono::steady_clock::now();
+    state->tunnel->Down();
+    state->metrics.ObservePhase(wireguard_dart::ConnectPhase::down,
+                                std::chrono::steady_clock::now() - start);
+  } catch (std::exception& e) {
+    return error_response(e.what());
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Answers with the status the monitor reported last, the one statusStream()
+// sends. Until its first report the link is asked.
+static FlMethodResponse* wireguard_dart_plugin_status(WireguardDartPlugin* self) {
+  PluginState* state = self->state;
+  wireguard_dart::ConnectionStatus status = state->status;
+  if (state->tunnel == nullptr) {
+    status = wireguard_dart::ConnectionStatus::disconnected;
+  } else if (status == wireguard_dart::ConnectionStatus::unknown) {
+    try {
+      status = state->tunnel->Status();
+    } catch (std::exception& e) {
+      return error_response(e.what());
+    }
+  }
+  g_autoptr(FlValue) result = fl_value_new_string(
+      wireguard_dart::ConnectionStatusToString(status).c_str());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* wireguard_dart_plugin_tunnel_statistics(
+    WireguardDartPlugin* self) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return error_response("Invalid state: call 'setupTunnel' first");
+  }
+
+  wireguard_dart::TunnelStatistics statistics;
+  try {
+    statistics = state->tunnel->Statistics();
+  } catch (std::exception& e) {
+    return error_response(e.what());
+  }
+  // Quality estimates are added while the quality prober runs.
+  std::optional<wireguard_dart::LinkQuality> quality =
+      state->quality_prober.quality();
+  g_autofree gchar* quality_json =
+      quality.has_value()
+          ? g_strdup_printf(
+                ",\"quality\":{\"rttMedian\":%.3f,\"rttP90\":%.3f,"
+                "\"rttP99\":%.3f,\"jitter\":%.3f,\"loss\":%.4f,"
+                "\"probesSent\":%llu,\"probesReceived\":%llu}",
+                quality->rtt_median, quality->rtt_p90, quality->rtt_p99,
+                quality->jitter, quality->loss,
+                static_cast<unsigned long long>(quality->sent),
+                static_cast<unsigned long long>(quality->received))
+          : g_strdup("");
+  g_autofree gchar* json = g_strdup_printf(
+      "{\"totalDownload\":%llu,\"totalUpload\":%llu,"
+      "\"latestHandshake\":%lld%s}",
+      static_cast<unsigned long long>(statistics.total_download),
+      static_cast<unsigned long long>(statistics.total_upload),
+      static_cast<long long>(statistics.latest_handshake), quality_json);
+  g_autoptr(FlValue) result = fl_value_new_string(json);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Serves OpenMetrics on a unix domain socket at 'socketPath', or stops serving
+// them without one.
+static FlMethodResponse* wireguard_dart_plugin_set_metrics_socket(
+    WireguardDartPlugin* self, FlValue* args) {
+  PluginState* state = self->state;
+  const gchar* path = lookup_string(args, "socketPath");
+  if (path == nullptr) {
+    state->metrics_exporter.reset();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  if (state->metrics_exporter == nullptr) {
+    // Peers are read on the exporter thread with a netlink socket or UAPI
+    // connection of its own, never through the plugin state.
+    state->metrics_exporter = std::make_unique<wireguard_dart::MetricsExporter>(
+        &state->metrics, [](int ifindex) {
+          char name[IF_NAMESIZE];
+          if (if_indextoname(ifindex, name) == nullptr) {
+            return std::vector<wireguard_dart::PeerSample>();
+          }
+          return wireguard_dart::TunnelControl(name).PeerSamples();
+        });
+  }
+  if (state->metrics_exporter->path() != path) {
+    try {
+      state->metrics_exporter->Start(path);
+    } catch (std::exception& e) {
+      state->metrics_exporter.reset();
+      return error_response(e.what());
+    }
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Sends UDP echo probes to 'target', a literal "address:port" inside the
+// tunnel, every 'intervalMs' while connected, counting those unanswered after
+// 'timeoutMs' as lost. Stops probing without a target.
+static FlMethodResponse* wireguard_dart_plugin_set_quality_probe(
+    WireguardDartPlugin* self, FlValue* args) {
+  PluginState* state = self->state;
+  const gchar* target = lookup_string(args, "target");
+  if (target == nullptr) {
+    state->quality_probe.reset();
+    start_quality_probe(state);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  wireguard_dart::QualityProbeOptions options;
+  options.target = target;
+  lookup_int(args, "intervalMs", &options.interval);
+  lookup_int(args, "timeoutMs", &options.timeout);
+  if (options.interval <= 0 || options.timeout <= 0) {
+    return error_response("INVALID_ARGUMENT",
+                          "'intervalMs' and 'timeoutMs' must be positive");
+  }
+  std::string host;
+  uint16_t port = 0;
+  if (!wireguard_dart::SplitEndpoint(options.target, &host, &port)) {
+    return error_response("INVALID_ARGUMENT",
+                          "'target' must be an address and port");
+  }
+  state->quality_probe = options;
+  // Running tunnels are watched; others start probing when they connect.
+  if (state->network_monitor != nullptr) {
+    start_quality_probe(state);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Turns leak protection on or off as 'enabled' says. While on, only the tunnel
+// interface and its peer endpoints are reachable, whether or not the tunnel is
+// up, until it is turned off again; the protection outlives the app.
+static FlMethodResponse* wireguard_dart_plugin_set_kill_switch(
+    WireguardDartPlugin* self, FlValue* args) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return error_response("Invalid state: call 'setupTunnel' first");
+  }
+  FlValue* enabled = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                         ? fl_value_lookup_string(args, "enabled")
+                         : nullptr;
+  if (enabled == nullptr || fl_value_get_type(enabled) != FL_VALUE_TYPE_BOOL) {
+    return error_response("Argument 'enabled' is required");
+  }
+  try {
+    if (fl_value_get_bool(enabled)) {
+      std::string interface_name = state->tunnel->interface_name_;
+      state->kill_switch.Enable(interface_name,
+                                tunnel_endpoints(interface_name));
+    } else {
+      state->kill_switch.Disable();
+    }
+  } catch (std::exception& e) {
+    return error_response(e.what());
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Returns the bytes received and sent through the tunnel since the Unix time
+// 'since', or since its usage was first recorded, across connects and app
+// restarts.
+static FlMethodResponse* wireguard_dart_plugin_data_usage(
+    WireguardDartPlugin* self, FlValue* args) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return error_response("Invalid state: call 'setupTunnel' first");
+  }
+  if (state->usage == nullptr) {
+    return error_response("Data usage is not recorded");
+  }
+  int64_t since = INT64_MIN;
+  if (args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP) {
+    lookup_int(args, "since", &since);
+  }
+  wireguard_dart::DataUsage usage = since == INT64_MIN
+                                        ? state->usage->Total()
+                                        : state->usage->Since(since);
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "received",
+                           fl_value_new_int(static_cast<int64_t>(
+                               usage.rx_bytes)));
+  fl_value_set_string_take(result, "sent",
+                           fl_value_new_int(static_cast<int64_t>(
+                               usage.tx_bytes)));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the recorded traffic of the tunnel, or of the peer 'publicKey', at
+// 'resolution' ("second", "minute" or "hour") between the Unix times 'from' and
+// 'to', by default everything still held. Samples are packed as rx and tx
+// bytes of each bucket in turn.
+static FlMethodResponse* wireguard_dart_plugin_traffic_history(
+    WireguardDartPlugin* self, FlValue* args) {
+  const gchar* resolution_name = lookup_string(args, "resolution");
+  wireguard_dart::TrafficResolution resolution;
+  if (resolution_name != nullptr && strcmp(resolution_name, "second") == 0) {
+    resolution = wireguard_dart::TrafficResolution::second;
+  } else if (resolution_name != nullptr &&
+             strcmp(resolution_name, "minute") == 0) {
+    resolution = wireguard_dart::TrafficResolution::minute;
+  } else if (resolution_name != nullptr &&
+             strcmp(resolution_name, "hour") == 0) {
+    resolution = wireguard_dart::TrafficResolution::hour;
+  } else {
+    return error_response(
+        "INVALID_ARGUMENT",
+        "'resolution' must be one of 'second', 'minute' and 'hour'");
+  }
+
+  int64_t now = g_get_real_time() / G_USEC_PER_SEC;
+  int64_t from = 0;
+  int64_t to = now + 1;
+  lookup_int(args, "from", &from);
+  lookup_int(args, "to", &to);
+  const gchar* public_key = lookup_string(args, "publicKey");
+  wireguard_dart::WireguardKey key;
+  if (public_key != nullptr && !wireguard_dart::DecodeKey(public_key, &key)) {
+    return error_response("INVALID_ARGUMENT", "Invalid 'publicKey'");
+  }
+
+  std::optional<wireguard_dart::TrafficWindow> window =
+      self->state->traffic.Query(public_key != nullptr ? &key : nullptr,
+                                 resolution, from, to, now);
+  if (!window.has_value()) {
+    return error_response("INVALID_ARGUMENT",
+                          "No traffic recorded for 'publicKey'");
+  }
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "start", fl_value_new_int(window->start));
+  fl_value_set_string_take(result, "step", fl_value_new_int(window->step));
+  fl_value_set_string_take(
+      result, "samples",
+      fl_value_new_int64_list(window->samples.data(), window->samples.size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// The success response of rankEndpoints.
+static FlMethodResponse* probe_result_list(
+    const std::vector<wireguard_dart::ProbeResult>& ranking) {
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const auto& probe : ranking) {
+    FlValue* samples_ms = fl_value_new_list();
+    for (double rtt : probe.samples) {
+      fl_value_append_take(samples_ms, fl_value_new_float(rtt));
+    }
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "endpoint",
+                             fl_value_new_string(probe.endpoint.c_str()));
+    fl_value_set_string_take(value, "address",
+                             fl_value_new_string(probe.address.c_str()));
+    fl_value_set_string_take(value, "sent", fl_value_new_int(probe.sent));
+    fl_value_set_string_take(value, "received",
+                             fl_value_new_int(probe.received));
+    fl_value_set_string_take(value, "rttMs", fl_value_new_float(probe.rtt));
+    fl_value_set_string_take(value, "jitterMs",
+                             fl_value_new_float(probe.jitter));
+    fl_value_set_string_take(value, "loss", fl_value_new_float(probe.loss()));
+    fl_value_set_string_take(value, "samplesMs", samples_ms);
+    fl_value_append_take(result, value);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Probes candidate endpoints concurrently in the background and responds with
+// them ranked best first, after at most one probing budget: (samples - 1) *
+// intervalMs + timeoutMs.
+static void wireguard_dart_plugin_rank_endpoints(WireguardDartPlugin* self,
+                                                 FlValue* args,
+                                                 Respond respond) {
+  FlValue* entries = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                         ? fl_value_lookup_string(args, "targets")
+                         : nullptr;
+  if (entries == nullptr || fl_value_get_type(entries) != FL_VALUE_TYPE_LIST) {
+    return respond(error_response("Argument 'targets' is required"));
+  }
+
+  std::vector<wireguard_dart::ProbeTarget> targets;
+  for (size_t i = 0; i < fl_value_get_length(entries); i++) {
+    FlValue* entry = fl_value_get_list_value(entries, i);
+    const gchar* endpoint = lookup_string(entry, "endpoint");
+    if (endpoint == nullptr) {
+      return respond(error_response("Every target needs an 'endpoint'"));
+    }
+    wireguard_dart::ProbeTarget target;
+    target.endpoint = endpoint;
+    FlValue* payload = fl_value_lookup_string(entry, "payload");
+    if (payload != nullptr &&
+        fl_value_get_type(payload) == FL_VALUE_TYPE_UINT8_LIST) {
+      const uint8_t* data = fl_value_get_uint8_list(payload);
+      target.payload.assign(data, data + fl_value_get_length(payload));
+    }
+    targets.push_back(std::move(target));
+  }
+
+  wireguard_dart::ProbeOptions options;
+  int64_t samples = options.samples;
+  lookup_int(args, "samples", &samples);
+  lookup_int(args, "intervalMs", &options.interval);
+  lookup_int(args, "timeoutMs", &options.timeout);
+  if (samples < 1 || samples > INT32_MAX || options.interval < 0 ||
+      options.timeout < 0) {
+    return respond(error_response(
+        "INVALID_ARGUMENT",
+        "'samples' must be positive, 'intervalMs' and 'timeoutMs' not "
+        "negative"));
+  }
+  options.samples = static_cast<int>(samples);
+
+  struct Ranking {
+    std::vector<wireguard_dart::ProbeResult> probes;
+    std::string error;
+  };
+  auto ranking = std::make_shared<Ranking>();
+  run_in_background(
+      self,
+      [ranking, targets = std::move(targets), options] {
+        try {
+          ranking->probes = wireguard_dart::RankEndpoints(targets, options);
+        } catch (std::exception& e) {
+          ranking->error = e.what();
+        }
+      },
+      [ranking, respond] {
+        respond(ranking->error.empty()
+                    ? probe_result_list(ranking->probes)
+                    : error_response(ranking->error.c_str()));
+      });
+}
+
+static FlValue* lookup_list(FlValue* args, const gchar* key) {
+  FlValue* value = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                       ? fl_value_lookup_string(args, key)
+                       : nullptr;
+  return value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_LIST
+             ? value
+             : nullptr;
+}
+
+// The strings of a list; entries of other types are skipped.
+static std::vector<std::string> string_list(FlValue* list) {
+  std::vector<std::string> strings;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* entry = fl_value_get_list_value(list, i);
+    if (fl_value_get_type(entry) == FL_VALUE_TYPE_STRING) {
+      strings.push_back(fl_value_get_string(entry));
+    }
+  }
+  return strings;
+}
+
+// The peer index of the running tunnel, read from the device the first time
+// after attaching to a tunnel that was not connected by this instance.
+static wireguard_dart::PeerIndex& wireguard_dart_plugin_peer_index(
+    WireguardDartPlugin* self) {
+  PluginState* state = self->state;
+  if (!state->peers.has_value()) {
+    wireguard_dart::PeerIndex index;
+    index.Reset(wireguard_dart::ConfiguredPeers(state->tunnel->Device()));
+    state->peers = std::move(index);
+  }
+  return *state->peers;
+}
+
+// Applies parsed peer changes to the running tunnel, unless it changed since
+// `generation`, and returns the number of its peers. `endpoints` are those of
+// the added and updated peers as given, in that order, before resolution.
+static FlMethodResponse* wireguard_dart_plugin_apply_peers(
+    WireguardDartPlugin* self, uint64_t generation, const std::string& method,
+    const std::vector<std::string>& removed,
+    const std::vector<wireguard_dart::PeerConfig>& added,
+    const std::vector<wireguard_dart::PeerUpdate>& updates,
+    const std::vector<std::string>& endpoints) {
+  PluginState* state = self->state;
+  if (generation != state->tunnel_generation) {
+    return error_response("CANCELLED",
+                          "A later connect or disconnect came first");
+  }
+  auto apply = [state](const std::vector<wireguard_dart::PeerChange>& changes) {
+    state->tunnel->ApplyPeerChanges(changes);
+  };
+  std::vector<wireguard_dart::PeerConfig> next = added;
+  for (const auto& update : updates) {
+    if (update.endpoint.has_value()) {
+      wireguard_dart::PeerConfig peer;
+      peer.endpoint = *update.endpoint;
+      next.push_back(std::move(peer));
+    }
+  }
+  try {
+    wireguard_dart::PeerIndex& index = wireguard_dart_plugin_peer_index(self);
+    const std::string& interface_name = state->tunnel->interface_name_;
+    allow_endpoints(&state->kill_switch, interface_name, next);
+    if (method == "removePeers") {
+      index.Remove(removed, apply);
+    } else if (method == "addPeers") {
+      index.Add(added, apply);
+    } else {
+      index.Update(updates, apply);
+    }
+    allow_endpoints(&state->kill_switch, interface_name);
+  } catch (std::invalid_argument& e) {
+    return error_response("INVALID_ARGUMENT", e.what());
+  } catch (std::exception& e) {
+    return error_response(e.what());
+  }
+  for (const std::string& public_key : removed) {
+    remember_peer_host(state, public_key, "");
+  }
+  for (size_t i = 0; i < added.size(); i++) {
+    remember_peer_host(state, added[i].public_key, endpoints[i]);
+  }
+  for (size_t i = 0; i < updates.size(); i++) {
+    if (updates[i].endpoint.has_value()) {
+      remember_peer_host(state, updates[i].public_key,
+                         endpoints[added.size() + i]);
+    }
+  }
+  g_autoptr(FlValue) result =
+      fl_value_new_int(static_cast<int64_t>(state->peers->size()));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Adds, updates or removes a batch of peers of the running tunnel with a few
+// incremental WG_CMD_SET_DEVICE messages, or one UAPI set request for a
+// userspace implementation; the other peers are not touched. Endpoint host
+// names are resolved in the background first, as connect does, and the changes
+// applied with their addresses.
+// Changes are not written back to a config, so connect starts over.
+static void wireguard_dart_plugin_change_peers(WireguardDartPlugin* self,
+                                               const gchar* method,
+                                               FlValue* args,
+                                               Respond respond) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr) {
+    return respond(error_response("Invalid state: call 'setupTunnel' first"));
+  }
+  bool remove = strcmp(method, "removePeers") == 0;
+  FlValue* entries = lookup_list(args, remove ? "publicKeys" : "peers");
+  if (entries == nullptr) {
+    return respond(error_response(remove ? "Argument 'publicKeys' is required"
+                                         : "Argument 'peers' is required"));
+  }
+
+  std::vector<std::string> removed;
+  if (remove) {
+    removed = string_list(entries);
+  }
+  std::vector<wireguard_dart::PeerConfig> added;
+  std::vector<wireguard_dart::PeerUpdate> updates;
+  for (size_t i = 0; !remove && i < fl_value_get_length(entries); i++) {
+    FlValue* entry = fl_value_get_list_value(entries, i);
+    const gchar* public_key = lookup_string(entry, "publicKey");
+    if (public_key == nullptr) {
+      g_autofree gchar* message =
+          g_strdup_printf("Peer %zu has no 'publicKey'", i);
+      return respond(error_response("INVALID_ARGUMENT", message));
+    }
+    const gchar* preshared_key = lookup_string(entry, "presharedKey");
+    const gchar* endpoint = lookup_string(entry, "endpoint");
+    FlValue* allowed_ips = lookup_list(entry, "allowedIps");
+    int64_t keepalive = 0;
+    bool has_keepalive = lookup_int(entry, "persistentKeepalive", &keepalive);
+    if (keepalive < 0 || keepalive > UINT16_MAX) {
+      return respond(error_response(
+          "INVALID_ARGUMENT", "'persistentKeepalive' must be within 0-65535"));
+    }
+
+    if (strcmp(method, "addPeers") == 0) {
+      wireguard_dart::PeerConfig peer;
+      peer.public_key = public_key;
+      peer.preshared_key = preshared_key != nullptr ? preshared_key : "";
+      peer.endpoint = endpoint != nullptr ? endpoint : "";
+      if (allowed_ips != nullptr) {
+        peer.allowed_ips = string_list(allowed_ips);
+      }
+      peer.persistent_keepalive = static_cast<uint16_t>(keepalive);
+      added.push_back(std::move(peer));
+    } else {
+      wireguard_dart::PeerUpdate update;
+      update.public_key = public_key;
+      if (endpoint != nullptr) {
+        update.endpoint = endpoint;
+      }
+      if (allowed_ips != nullptr) {
+        update.allowed_ips = string_list(allowed_ips);
+      }
+      if (has_keepalive) {
+        update.persistent_keepalive = static_cast<uint16_t>(keepalive);
+      }
+      updates.push_back(std::move(update));
+    }
+  }
+
+  // The endpoints of the added and updated peers, in that order.
+  std::vector<std::string> endpoints;
+  for (const auto& peer : added) {
+    endpoints.push_back(peer.endpoint);
+  }
+  for (const auto& update : updates) {
+    endpoints.push_back(update.endpoint.value_or(""));
+  }
+  uint64_t generation = state->tunnel_generation;
+  std::string name = method;
+  bool has_host_names = std::any_of(
+      endpoints.begin(), endpoints.end(), [](const std::string& endpoint) {
+        return !endpoint.empty() &&
+               wireguard_dart::EndpointFamily(endpoint) ==
+                   wireguard_dart::AddressFamily::unspecified;
+      });
+  if (!has_host_names) {
+    return respond(wireguard_dart_plugin_apply_peers(
+        self, generation, name, removed, added, updates, endpoints));
+  }
+
+  struct Resolved {
+    std::vector<std::string> endpoints;
+    std::string error;
+  };
+  auto resolved = std::make_shared<Resolved>();
+  wireguard_dart::AddressFamilyCache* family_cache = &state->family_cache;
+  wireguard_dart::DnsCache* dns_cache = &state->dns_cache;
+  run_in_background(
+      self,
+      [resolved, endpoints, family_cache, dns_cache] {
+        try {
+          resolved->endpoints = wireguard_dart::ResolveEndpoints(
+              endpoints, family_cache,
+              wireguard_dart::CachedResolver(dns_cache));
+        } catch (std::exception& e) {
+          resolved->error = e.what();
+        }
+      },
+      [self, generation, name, removed, added, updates, endpoints, resolved,
+       respond]() mutable {
+        if (!resolved->error.empty()) {
+          return respond(
+              error_response("INVALID_ARGUMENT", resolved->error.c_str()));
+        }
+        size_t i = 0;
+        for (auto& peer : added) {
+          peer.endpoint = resolved->endpoints[i++];
+        }
+        for (auto& update : updates) {
+          if (update.endpoint.has_value()) {
+            update.endpoint = resolved->endpoints[i];
+          }
+          i++;
+        }
+        respond(wireguard_dart_plugin_apply_peers(
+            self, generation, name, removed, added, updates, endpoints));
+      });
+}
+
+// Removes and adds a peer of the running tunnel again, at `endpoint` if set,
+// so that it starts a fresh handshake.
+static void wireguard_dart_plugin_reapply_peer(
+    WireguardDartPlugin* self, const std::string& public_key,
+    const std::optional<std::string>& endpoint) {
+  PluginState* state = self->state;
+  try {
+    wireguard_dart::PeerIndex& index = wireguard_dart_plugin_peer_index(self);
+    const std::string& interface_name = state->tunnel->interface_name_;
+    if (endpoint.has_value()) {
+      wireguard_dart::PeerUpdate update;
+      update.public_key = public_key;
+      update.endpoint = endpoint;
+      wireguard_dart::PeerConfig next;
+      next.endpoint = *endpoint;
+      allow_endpoints(&state->kill_switch, interface_name, {next});
+      index.Update(
+          {update},
+          [state](const std::vector<wireguard_dart::PeerChange>& changes) {
+            state->tunnel->ApplyPeerChanges(changes);
+          });
+    }
+    const wireguard_dart::PeerConfig* peer = index.Find(public_key);
+    if (peer == nullptr) {
+      return;
+    }
+    allow_endpoints(&state->kill_switch, interface_name, {*peer});
+    state->tunnel->SetPeer(*peer, true);
+    allow_endpoints(&state->kill_switch, interface_name);
+    state->metrics.CountReconnect(wireguard_dart::ReconnectReason::stall);
+  } catch (std::exception& e) {
+    g_warning("Cannot reapply a stalled peer: %s", e.what());
+  }
+}
+
+// Takes a recovery step of the handshake watchdog: looks the endpoint of the
+// stalled peer up again if it has a host name, reapplies the peer, or
+// connects again with the config of the tunnel. A step that would need what
+// the tunnel does not have, such as a host name or the config of an attached
+// tunnel, falls back to reapplying the peer. Steps that come after the tunnel
+// recovered or changed are dropped.
+static void wireguard_dart_plugin_recover(
+    WireguardDartPlugin* self, const wireguard_dart::RecoveryStep& step) {
+  PluginState* state = self->state;
+  if (state->tunnel == nullptr ||
+      state->status != wireguard_dart::ConnectionStatus::degraded) {
+    return;
+  }
+  std::string public_key = wireguard_dart::EncodeKey(step.public_key);
+  auto host = state->peer_hosts.find(step.public_key);
+  if (step.action == wireguard_dart::RecoveryAction::reresolve_endpoint &&
+      host != state->peer_hosts.end()) {
+    // Looked up afresh rather than from the cache, whose address is the one
+    // that stopped answering.
+    struct Resolved {
+      std::string endpoint;
+      std::string error;
+    };
+    auto resolved = std::make_shared<Resolved>();
+    std::string endpoint = host->second;
+    wireguard_dart::AddressFamilyCache* family_cache = &state->family_cache;
+    uint64_t generation = state->tunnel_generation;
+    run_in_background(
+        self,
+        [resolved, endpoint, family_cache] {
+          try {
+            resolved->endpoint =
+                wireguard_dart::ResolveEndpoints({endpoint}, family_cache)[0];
+          } catch (std::exception& e) {
+            resolved->error = e.what();
+          }
+        },
+        [self, generation, public_key, resolved] {
+          if (generation != self->state->tunnel_generation ||
+              self->state->status !=
+                  wireguard_dart::ConnectionStatus::degraded) {
+            return;
+          }
+          if (!resolved->error.empty()) {
+            g_warning("Cannot look up a stalled peer: %s",
+                      resolved->error.c_str());
+          }
+          wireguard_dart_plugin_reapply_peer(
+              self, public_key,
+              resolved->error.empty()
+                  ? std::optional<std::string>(resolved->endpoint)
+                  : std::nullopt);
+        });
+    return;
+  }
+  if (step.action == wireguard_dart::RecoveryAction::restart_tunnel &&
+      state->tunnel_config.has_value()) {
+    state->metrics.CountReconnect(wireguard_dart::ReconnectReason::stall);
+    wireguard_dart_plugin_start_connect(
+        self, *state->tunnel_config, [](FlMethodResponse* response) {
+          if (FL_IS_METHOD_ERROR_RESPONSE(response)) {
+            g_warning("Cannot restart a stalled tunnel: %s",
+                      fl_method_error_response_get_message(
+                          FL_METHOD_ERROR_RESPONSE(response)));
+          }
+          g_object_unref(response);
+        });
+    return;
+  }
+  wireguard_dart_plugin_reapply_peer(self, public_key, std::nullopt);
+}
+
+static FlValue* profile_id_list(
+    const std::vector<wireguard_dart::ProfileStore::ProfileId>& ids) {
+  FlValue* list = fl_value_new_list();
+  for (wireguard_dart::ProfileStore::ProfileId id : ids) {
+    fl_value_append_take(list, fl_value_new_int(id));
+  }
+  return list;
+}
+
+// Stores the configs of 'profiles', a map of profile names to config text, and
+// responds with their profile IDs in the same order. Configs are parsed on all
+// cores in the background; one that does not parse fails the whole import.
+static void wireguard_dart_plugin_import_profiles(WireguardDartPlugin* self,
+                                                  FlValue* args,
+                                                  Respond respond) {
+  FlValue* entries = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                         ? fl_value_lookup_string(args, "profiles")
+                         : nullptr;
+  if (entries == nullptr || fl_value_get_type(entries) != FL_VALUE_TYPE_MAP) {
+    return respond(error_response("Argument 'profiles' is required"));
+  }
+  std::vector<std::pair<std::string, std::string>> profiles;
+  for (size_t i = 0; i < fl_value_get_length(entries); i++) {
+    FlValue* name = fl_value_get_map_key(entries, i);
+    FlValue* cfg = fl_value_get_map_value(entries, i);
+    if (fl_value_get_type(name) != FL_VALUE_TYPE_STRING ||
+        fl_value_get_type(cfg) != FL_VALUE_TYPE_STRING) {
+      return respond(error_response(
+          "INVALID_ARGUMENT", "Profile names and configs must be strings"));
+    }
+    profiles.emplace_back(fl_value_get_string(name), fl_value_get_string(cfg));
+  }
+
+  std::string error;
+  wireguard_dart::ProfileStore* store =
+      wireguard_dart_plugin_profile_store(self, &error);
+  if (store == nullptr) {
+    return respond(error_response(error.c_str()));
+  }
+  struct Imported {
+    std::vector<wireguard_dart::ProfileStore::ProfileId> ids;
+    std::string code;
+    std::string error;
+  };
+  auto imported = std::make_shared<Imported>();
+  // The store locks itself, so finding and removing profiles goes on meanwhile.
+  run_in_background(
+      self,
+      [imported, store, profiles = std::move(profiles)] {
+        try {
+          imported->ids = store->Import(profiles);
+        } catch (std::invalid_argument& e) {
+          imported->code = "INVALID_CONFIG";
+          imported->error = e.what();
+        } catch (std::exception& e) {
+          imported->code = e.what();
+        }
+      },
+      [imported, respond] {
+        if (!imported->code.empty()) {
+          return respond(error_response(
+              imported->code.c_str(),
+              imported->error.empty() ? nullptr : imported->error.c_str()));
+        }
+        g_autoptr(FlValue) result = profile_id_list(imported->ids);
+        respond(FL_METHOD_RESPONSE(fl_method_success_response_new(result)));
+      });
+}
+
+// Returns the IDs of the profiles named 'name', with a peer at 'endpoint' or
+// with a peer of 'publicKey', whichever is given first.
+static FlMethodResponse* wireguard_dart_plugin_find_profiles(
+    WireguardDartPlugin* self, FlValue* args) {
+  const gchar* name = lookup_string(args, "name");
+  const gchar* endpoint = lookup_string(args, "endpoint");
+  const gchar* public_key = lookup_string(args, "publicKey");
+  if (name == nullptr && endpoint == nullptr && public_key == nullptr) {
+    return error_response(
+        "Argument 'name', 'endpoint' or 'publicKey' is required");
+  }
+  std::string error;
+  wireguard_dart::ProfileStore* store =
+      wireguard_dart_plugin_profile_store(self, &error);
+  if (store == nullptr) {
+    return error_response(error.c_str());
+  }
+  std::vector<wireguard_dart::ProfileStore::ProfileId> ids;
+  if (name != nullptr) {
+    std::optional<wireguard_dart::ProfileStore::ProfileId> id =
+        store->FindByName(name);
+    if (id.has_value()) {
+      ids.push_back(*id);
+    }
+  } else if (endpoint != nullptr) {
+    ids = store->FindByEndpoint(endpoint);
+  } else {
+    ids = store->FindByPublicKey(public_key);
+  }
+  g_autoptr(FlValue) result = profile_id_list(ids);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* wireguard_dart_plugin_remove_profiles(
+    WireguardDartPlugin* self, FlValue* args) {
+  FlValue* entries = lookup_list(args, "ids");
+  if (entries == nullptr) {
+    return error_response("Argument 'ids' is required");
+  }
+  std::vector<wireguard_dart::ProfileStore::ProfileId> ids;
+  for (size_t i = 0; i < fl_value_get_length(entries); i++) {
+    FlValue* entry = fl_value_get_list_value(entries, i);
+    if (fl_value_get_type(entry) == FL_VALUE_TYPE_INT &&
+        fl_value_get_int(entry) > 0 && fl_value_get_int(entry) <= UINT32_MAX) {
+      ids.push_back(static_cast<uint32_t>(fl_value_get_int(entry)));
+    }
+  }
+  std::string error;
+  wireguard_dart::ProfileStore* store =
+      wireguard_dart_plugin_profile_store(self, &error);
+  if (store == nullptr) {
+    return error_response(error.c_str());
+  }
+  try {
+    store->Remove(ids);
+  } catch (std::exception& e) {
+    return error_response(e.what());
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// A batch between its calls, some of which respond from the main loop later.
+struct BatchRun {
+  WireguardDartPlugin* self;
+  FlValue* calls;
+  FlValue* results = fl_value_new_list();
+  Respond respond;
+
+  BatchRun(WireguardDartPlugin* self, FlValue* calls, Respond respond)
+      : self(self), calls(fl_value_ref(calls)), respond(std::move(respond)) {}
+  ~BatchRun() {
+    fl_value_unref(calls);
+    fl_value_unref(results);
+  }
+};
+
+// Runs the calls of a batch from the one at `index` on, each once the one
+// before responded.
+static void wireguard_dart_plugin_batch_from(std::shared_ptr<BatchRun> run,
+                                             size_t index) {
+  if (index == fl_value_get_length(run->calls)) {
+    return run->respond(
+        FL_METHOD_RESPONSE(fl_method_success_response_new(run->results)));
+  }
+  FlValue* entry = fl_value_get_list_value(run->calls, index);
+  FlValue* method = fl_value_get_type(entry) == FL_VALUE_TYPE_MAP
+                        ? fl_value_lookup_string(entry, "method")
+                        : nullptr;
+  if (method == nullptr || fl_value_get_type(method) != FL_VALUE_TYPE_STRING ||
+      strcmp(fl_value_get_string(method), "batch") == 0) {
+    g_autoptr(FlValue) details = fl_value_new_map();
+    fl_value_set_string_take(details, "index", fl_value_new_int(index));
+    fl_value_set_string(details, "results", run->results);
+    g_autofree gchar* message =
+        g_strdup_printf("Batch entry %zu has no valid 'method'", index);
+    return run->respond(FL_METHOD_RESPONSE(
+        fl_method_error_response_new("INVALID_BATCH_CALL", message, details)));
+  }
+
+  const gchar* name = fl_value_get_string(method);
+  wireguard_dart_plugin_invoke(
+      run->self, name, fl_value_lookup_string(entry, "arguments"),
+      [run, index, name](FlMethodResponse* taken) {
+        g_autoptr(FlMethodResponse) response = taken;
+        if (FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+          fl_value_append(run->results,
+                          fl_method_success_response_get_result(
+                              FL_METHOD_SUCCESS_RESPONSE(response)));
+          return wireguard_dart_plugin_batch_from(run, index + 1);
+        }
+
+        // Surface the failing call's own error code so callers can handle it
+        // like a direct invocation.
+        const gchar* code = "NOT_IMPLEMENTED";
+        const gchar* error_message = "Method is not implemented";
+        FlValue* error_details = nullptr;
+        if (FL_IS_METHOD_ERROR_RESPONSE(response)) {
+          FlMethodErrorResponse* error = FL_METHOD_ERROR_RESPONSE(response);
+          code = fl_method_error_response_get_code(error);
+          error_message = fl_method_error_response_get_message(error);
+          error_details = fl_method_error_response_get_details(error);
+        }
+        g_autoptr(FlValue) details = fl_value_new_map();
+        fl_value_set_string_take(details, "index", fl_value_new_int(index));
+        fl_value_set_string_take(details, "method", fl_value_new_string(name));
+        fl_value_set_string(details, "results", run->results);
+        fl_value_set_string_take(details, "details",
+                                 error_details != nullptr
+                                     ? fl_value_ref(error_details)
+                                     : fl_value_new_null());
+        g_autofree gchar* message = g_strdup_printf(
+            "%s: %s", name, error_message != nullptr ? error_message : "");
+        run->respond(FL_METHOD_RESPONSE(
+            fl_method_error_response_new(code, message, details)));
+      });
+}
+
+// Runs an ordered list of method calls in a single platform channel round
+// trip. Execution stops at the first failing call, whose error code is
+// returned together with the results collected so far.
+static void wireguard_dart_plugin_batch(WireguardDartPlugin* self,
+                                        FlValue* args, Respond respond) {
+  FlValue* calls = args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                       ? fl_value_lookup_string(args, "calls")
+                       : nullptr;
+  if (calls == nullptr || fl_value_get_type(calls) != FL_VALUE_TYPE_LIST) {
+    return respond(FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Argument 'calls' is required", nullptr, nullptr)));
+  }
+  wireguard_dart_plugin_batch_from(
+      std::make_shared<BatchRun>(self, calls, std::move(respond)), 0);
+}
+
+// Dispatches a single method by name. Shared by channel calls and batches.
+static void wireguard_dart_plugin_invoke(WireguardDartPlugin* self,
+                                         const gchar* method, FlValue* args,
+                                         Respond respond) {
+  if (strcmp(method, "batch") == 0) {
+    return wireguard_dart_plugin_batch(self, args, std::move(respond));
+  }
+
+  // Nothing to prepare on Linux; handled so that the startup sequence shared
+  // with the other platforms, which begins with it, succeeds.
+  if (strcmp(method, "nativeInit") == 0) {
+    return respond(FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr)));
+  }
+
+  if (strcmp(method, "setupTunnel") == 0) {
+    return respond(wireguard_dart_plugin_setup_tunnel(self, args));
+  }
+
+  if (strcmp(method, "checkTunnelConfiguration") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_bool(self->state->tunnel != nullptr);
+    return respond(FL_METHOD_RESPONSE(fl_method_success_response_new(result)));
+  }
+
+  if (strcmp(method, "connect") == 0) {
+    return wireguard_dart_plugin_connect(self, args, std::move(respond));
+  }
+
+  if (strcmp(method, "prefetchEndpoints") == 0) {
+    return respond(wireguard_dart_plugin_prefetch_endpoints(self, args));
+  }
+
+  if (strcmp(method, "disconnect") == 0) {
+    return respond(wireguard_dart_plugin_disconnect(self));
+  }
+
+  if (strcmp(method, "status") == 0) {
+    return respond(wireguard_dart_plugin_status(self));
+  }
+
+  if (strcmp(method, "tunnelStatistics") == 0) {
+    return respond(wireguard_dart_plugin_tunnel_statistics(self));
+  }
+
+  if (strcmp(method, "addPeers") == 0 || strcmp(method, "updatePeers") == 0 ||
+      strcmp(method, "removePeers") == 0) {
+    return wireguard_dart_plugin_change_peers(self, method, args,
+                                              std::move(respond));
+  }
+
+  if (strcmp(method, "rankEndpoints") == 0) {
+    return wireguard_dart_plugin_rank_endpoints(self, args, std::move(respond));
+  }
 
-  const gchar* method = fl_method_call_get_name(method_call);
+  if (strcmp(method, "trafficHistory") == 0) {
+    return respond(wireguard_dart_plugin_traffic_history(self, args));
+  }
+
+  if (strcmp(method, "dataUsage") == 0) {
+    return respond(wireguard_dart_plugin_data_usage(self, args));
+  }
+
+  if (strcmp(method, "importProfiles") == 0) {
+    return wireguard_dart_plugin_import_profiles(self, args,
+                                                 std::move(respond));
+  }
+
+  if (strcmp(method, "findProfiles") == 0) {
+    return respond(wireguard_dart_plugin_find_profiles(self, args));
+  }
+
+  if (strcmp(method, "removeProfiles") == 0) {
+    return respond(wireguard_dart_plugin_remove_profiles(self, args));
+  }
+
+  if (strcmp(method, "setQualityProbe") == 0) {
+    return respond(wireguard_dart_plugin_set_quality_probe(self, args));
+  }
+
+  if (strcmp(method, "setKillSwitch") == 0) {
+    return respond(wireguard_dart_plugin_set_kill_switch(self, args));
+  }
+
+  if (strcmp(method, "setMetricsSocket") == 0) {
+    return respond(wireguard_dart_plugin_set_metrics_socket(self, args));
+  }
 
   if (strcmp(method, "getPlatformVersion") == 0) {
     struct utsname uname_data = {};
     uname(&uname_data);
     g_autofree gchar *version = g_strdup_printf("Linux %s", uname_data.version);
     g_autoptr(FlValue) result = fl_value_new_string(version);
-    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
-  } else {
-    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+    return respond(FL_METHOD_RESPONSE(fl_method_success_response_new(result)));
   }
 
-  fl_method_call_respond(method_call, response, nullptr);
+  respond(FL_METHOD_RESPONSE(fl_method_not_implemented_response_new()));
+}
+
+// Called when a method call is received from Flutter.
+static void wireguard_dart_plugin_dispatch(
+    WireguardDartPlugin* self, std::shared_ptr<FlMethodCall> call) {
+  wireguard_dart_plugin_invoke(
+      self, fl_method_call_get_name(call.get()),
+      fl_method_call_get_args(call.get()),
+      [call](FlMethodResponse* response) {
+        g_autoptr(FlMethodResponse) owned = response;
+        fl_method_call_respond(call.get(), owned, nullptr);
+      });
+}
+
+static void wireguard_dart_plugin_handle_method_call(
+    WireguardDartPlugin* self,
+    FlMethodCall* method_call) {
+  // Kept until the call responds, which slow calls do from the main loop later.
+  std::shared_ptr<FlMethodCall> call(
+      FL_METHOD_CALL(g_object_ref(method_call)), g_object_unref);
+  if (self->state->attaching) {
+    self->state->calls_awaiting_attach.push_back(std::move(call));
+    return;
+  }
+  wireguard_dart_plugin_dispatch(self, std::move(call));
+}
+
+// Looks for a tunnel left up by a previous instance of the app without
+// blocking the platform thread, adopts it, then runs the method calls that
+// came meanwhile.
+static void wireguard_dart_plugin_attach(WireguardDartPlugin* self) {
+  auto interface_name = std::make_shared<std::optional<std::string>>();
+  self->state->attaching = true;
+  run_in_background(
+      self,
+      [interface_name] {
+        *interface_name = wireguard_dart::FindAttachableTunnel();
+      },
+      [self, interface_name] {
+        PluginState* state = self->state;
+        if (interface_name->has_value()) {
+          wireguard_dart_plugin_adopt(self, **interface_name);
+        }
+        state->attaching = false;
+        std::vector<std::shared_ptr<FlMethodCall>> calls;
+        calls.swap(state->calls_awaiting_attach);
+        for (auto& call : calls) {
+          wireguard_dart_plugin_dispatch(self, std::move(call));
+        }
+      });
 }
 
 static void wireguard_dart_plugin_dispose(GObject* object) {
+  WireguardDartPlugin* self = WIREGUARD_DART_PLUGIN(object);
+  if (self->state != nullptr) {
+    // Bounds the wait of the discovery's future to one probe.
+    cancel_mtu_discovery(self->state);
+  }
+  if (self->state != nullptr && self->state->status_channel != nullptr) {
+    fl_event_channel_set_stream_handlers(self->state->status_channel, nullptr,
+                                         nullptr, nullptr, nullptr);
+    g_object_unref(self->state->status_channel);
+  }
+  delete self->state;
+  self->state = nullptr;
+
   G_OBJECT_CLASS(wireguard_dart_plugin_parent_class)->dispose(object);
 }
 
@@ -45,7 +1886,33 @@ static void wireguard_dart_plugin_class_init(WireguardDartPluginClass* klass) {
   G_OBJECT_CLASS(klass)->dispose = wireguard_dart_plugin_dispose;
 }
 
-static void wireguard_dart_plugin_init(WireguardDartPlugin* self) {}
+static void wireguard_dart_plugin_init(WireguardDartPlugin* self) {
+  self->state = new PluginState();
+  self->state->metrics.SetReactor(&self->state->reactor);
+}
+
+// Sends the latest status to a new listener of the status event channel right
+// away, like the Windows plugin does.
+static FlMethodErrorResponse* status_listen_cb(FlEventChannel* channel,
+                                               FlValue* args,
+                                               gpointer user_data) {
+  WireguardDartPlugin* self = WIREGUARD_DART_PLUGIN(user_data);
+  PluginState* state = self->state;
+  // Until discovery finished the status is unknown; adopting a tunnel sends
+  // it then.
+  state->status_listening = true;
+  if (state->status != wireguard_dart::ConnectionStatus::unknown) {
+    send_status(state);
+  }
+  return nullptr;
+}
+
+static FlMethodErrorResponse* status_cancel_cb(FlEventChannel* channel,
+                                               FlValue* args,
+                                               gpointer user_data) {
+  WIREGUARD_DART_PLUGIN(user_data)->state->status_listening = false;
+  return nullptr;
+}
 
 static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
                            gpointer user_data) {
@@ -56,6 +1923,7 @@ static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
 void wireguard_dart_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
   WireguardDartPlugin* plugin = WIREGUARD_DART_PLUGIN(
       g_object_new(wireguard_dart_plugin_get_type(), nullptr));
+  wireguard_dart_plugin_attach(plugin);
 
   g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
   g_autoptr(FlMethodChannel) channel =
@@ -66,5 +1934,12 @@ void wireguard_dart_plugin_register_with_registrar(FlPluginRegistrar* registrar)
                                             g_object_ref(plugin),
                                             g_object_unref);
 
+  plugin->state->status_channel =
+      fl_event_channel_new(fl_plugin_registrar_get_messenger(registrar),
+                           "wireguard_dart/status", FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->state->status_channel,
+                                       status_listen_cb, status_cancel_cb,
+                                       plugin, nullptr);
+
   g_object_unref(plugin);
 }
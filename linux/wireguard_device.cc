@@ -0,0 +1,340 @@
+#include "wireguard_device.h"
+
+#include <arpa/inet.h>
+#include <linux/genetlink.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <linux/wireguard.h>
+#include <net/if.h>
+#include <netdb.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "device_dump.h"
+#include "netlink.h"
+
+namespace wireguard_dart {
+
+const char kInterfaceAlias[] = "wireguard_dart";
+
+static std::string AttributeString(const nlattr* attribute) {
+  auto* data = static_cast<const char*>(AttributeData(attribute));
+  return std::string(data, strnlen(data, AttributeLength(attribute)));
+}
+
+static LinkInfo ParseLink(const nlmsghdr* message) {
+  auto* info = static_cast<const ifinfomsg*>(NLMSG_DATA(message));
+  LinkInfo link;
+  link.ifindex = info->ifi_index;
+  link.flags = info->ifi_flags;
+  ForEachAttribute(IFLA_RTA(info), IFLA_PAYLOAD(message), [&link](const nlattr* attribute) {
+    switch (AttributeType(attribute)) {
+      case IFLA_IFNAME:
+        link.name = AttributeString(attribute);
+        break;
+      case IFLA_IFALIAS:
+        link.alias = AttributeString(attribute);
+        break;
+      case IFLA_LINKINFO:
+        ForEachAttribute(AttributeData(attribute), AttributeLength(attribute), [&link](const nlattr* nested) {
+          if (AttributeType(nested) == IFLA_INFO_KIND) {
+            link.kind = AttributeString(nested);
+          }
+        });
+        break;
+    }
+  });
+  return link;
+}
+
+std::vector<LinkInfo> ListWireguardLinks() {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_GETLINK, NLM_F_DUMP);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+
+  std::vector<LinkInfo> links;
+  socket.Request(message, [&links](const nlmsghdr* reply) {
+    if (reply->nlmsg_type != RTM_NEWLINK) {
+      return;
+    }
+    LinkInfo link = ParseLink(reply);
+    if (link.kind == WG_GENL_NAME) {
+      links.push_back(link);
+    }
+  });
+  return links;
+}
+
+std::optional<LinkInfo> FindLink(const std::string& name) {
+  NetlinkSocket socket(NETLINK_ROUTE);
+  NetlinkMessage message(RTM_GETLINK, 0);
+  ifinfomsg info = {};
+  info.ifi_family = AF_UNSPEC;
+  message.AppendHeader(info);
+  message.PutString(IFLA_IFNAME, name);
+
+  std::optional<LinkInfo> link;
+  try {
+    socket.Request(message, [&link](const nlmsghdr* reply) {
+      if (reply->nlmsg_type == RTM_NEWLINK) {
+        link = ParseLink(reply);
+      }
+    });
+  } catch (const NetlinkError& e) {
+    if (e.error_code() != ENODEV) {
+      throw;
+    }
+  }
+  return link;
+}
+
+WireguardDevice GetWireguardDevice(const std::string& name) {
+  WireguardDevice device;
+  DumpWireguardDevice(name, [&device](const DeviceView& message) { MergeDeviceMessage(message, &device); });
+  return device;
+}
+
+static WireguardKey RequireKey(const std::string& base64) {
+  WireguardKey key;
+  if (!DecodeKey(base64, &key)) {
+    throw std::invalid_argument("Invalid key: " + base64);
+  }
+  return key;
+}
+
+socklen_t ResolveEndpoint(const std::string& endpoint, sockaddr_storage* address) {
+  std::string host;
+  uint16_t port;
+  if (!SplitEndpoint(endpoint, &host, &port)) {
+    throw std::invalid_argument("Invalid endpoint: " + endpoint);
+  }
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  addrinfo* addresses = nullptr;
+  int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+  if (error != 0 || addresses == nullptr) {
+    throw std::invalid_argument("Failed to resolve endpoint " + endpoint + ": " + gai_strerror(error));
+  }
+  socklen_t length = addresses->ai_addrlen;
+  memcpy(address, addresses->ai_addr, length);
+  freeaddrinfo(addresses);
+  return length;
+}
+
+std::string FormatEndpoint(const sockaddr_storage& address) {
+  char host[INET6_ADDRSTRLEN];
+  if (address.ss_family == AF_INET) {
+    auto& ipv4 = reinterpret_cast<const sockaddr_in&>(address);
+    inet_ntop(AF_INET, &ipv4.sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(ntohs(ipv4.sin_port));
+  }
+  auto& ipv6 = reinterpret_cast<const sockaddr_in6&>(address);
+  inet_ntop(AF_INET6, &ipv6.sin6_addr, host, sizeof(host));
+  return "[" + std::string(host) + "]:" + std::to_string(ntohs(ipv6.sin6_port));
+}
+
+static void PutEndpoint(NetlinkMessage& message, const std::string& endpoint) {
+  sockaddr_storage address;
+  socklen_t length = ResolveEndpoint(endpoint, &address);
+  message.PutAttribute(WGPEER_A_ENDPOINT, &address, length);
+}
+
+static size_t AttributeSize(size_t payload) { return NLA_HDRLEN + NLA_ALIGN(payload); }
+
+// The most a peer adds to a message before its allowed IPs: public key, flags, preshared key, endpoint, keepalive and
+// the allowed IPs attribute, each nested in the peer's entry.
+static const size_t kMaxPeerHeaderSize = NLA_HDRLEN + AttributeSize(sizeof(WireguardKey)) * 2 + AttributeSize(4) +
+                                         AttributeSize(sizeof(sockaddr_in6)) + AttributeSize(2) + NLA_HDRLEN;
+
+static size_t AllowedIpSize(int version) {
+  return NLA_HDRLEN + AttributeSize(2) + AttributeSize(version == 4 ? 4 : 16) + AttributeSize(1);
+}
+
+const size_t kMaxSetDeviceMessage = UINT16_MAX & ~(NLMSG_ALIGNTO - 1);
+
+SetDeviceWriter::SetDeviceWriter(uint16_t family, const std::string& name, Send send, size_t max_size)
+    : family_(family), name_(name), send_(std::move(send)), max_size_(max_size), message_(family, 0) {
+  message_.Reserve(max_size_);
+  Start();
+}
+
+void SetDeviceWriter::Start() {
+  message_.Reset(family_, 0);
+  genlmsghdr genl = {};
+  genl.cmd = WG_CMD_SET_DEVICE;
+  genl.version = WG_GENL_VERSION;
+  message_.AppendHeader(genl);
+  message_.PutString(WGDEVICE_A_IFNAME, name_);
+}
+
+void SetDeviceWriter::Flush() {
+  EndPeer();
+  if (peers_ != 0) {
+    message_.EndNested(peers_);
+    peers_ = 0;
+  }
+  send_(message_);
+  messages_++;
+  Start();
+}
+
+void SetDeviceWriter::SetInterface(const WireguardKey& private_key, uint16_t listen_port, uint32_t fwmark,
+                                   uint32_t flags) {
+  message_.PutAttribute(WGDEVICE_A_PRIVATE_KEY, private_key.data(), private_key.size());
+  message_.PutU16(WGDEVICE_A_LISTEN_PORT, listen_port);
+  message_.PutU32(WGDEVICE_A_FWMARK, fwmark);
+  message_.PutU32(WGDEVICE_A_FLAGS, flags);
+}
+
+void SetDeviceWriter::BeginPeer(const WireguardKey& public_key, uint32_t flags) {
+  if (peers_ == 0) {
+    peers_ = message_.BeginNested(WGDEVICE_A_PEERS);
+  }
+  peer_ = message_.BeginNested(0);
+  message_.PutAttribute(WGPEER_A_PUBLIC_KEY, public_key.data(), public_key.size());
+  message_.PutU32(WGPEER_A_FLAGS, flags);
+}
+
+void SetDeviceWriter::EndPeer() {
+  if (allowed_ips_ != 0) {
+    message_.EndNested(allowed_ips_);
+    allowed_ips_ = 0;
+  }
+  if (peer_ != 0) {
+    message_.EndNested(peer_);
+    peer_ = 0;
+  }
+}
+
+void SetDeviceWriter::AddPeer(const PeerConfig& peer, uint32_t flags) {
+  WireguardKey public_key = RequireKey(peer.public_key);
+  if (message_.size() + kMaxPeerHeaderSize + AllowedIpSize(6) > max_size_) {
+    Flush();
+  }
+  BeginPeer(public_key, flags);
+  if ((flags & WGPEER_F_REMOVE_ME) != 0) {
+    EndPeer();
+    return;
+  }
+  if ((flags & WGPEER_F_UPDATE_ONLY) == 0) {
+    WireguardKey preshared_key = {};
+    if (!peer.preshared_key.empty()) {
+      preshared_key = RequireKey(peer.preshared_key);
+    }
+    message_.PutAttribute(WGPEER_A_PRESHARED_KEY, preshared_key.data(), preshared_key.size());
+  }
+  if (!peer.endpoint.empty()) {
+    PutEndpoint(message_, peer.endpoint);
+  }
+  message_.PutU16(WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL, peer.persistent_keepalive);
+  if ((flags & WGPEER_F_UPDATE_ONLY) != 0 && (flags & WGPEER_F_REPLACE_ALLOWEDIPS) == 0) {
+    EndPeer();
+    return;
+  }
+
+  allowed_ips_ = message_.BeginNested(WGPEER_A_ALLOWEDIPS);
+  for (const auto& text : peer.allowed_ips) {
+    IpPrefix prefix;
+    if (!ParseIpPrefix(text, &prefix)) {
+      throw std::invalid_argument("Invalid allowed IP: " + text);
+    }
+    if (message_.size() + AllowedIpSize(prefix.version) > max_size_) {
+      // Continue in a new message. The peer exists by then, and without WGPEER_F_REPLACE_ALLOWEDIPS the rest is
+      // appended to it.
+      Flush();
+      BeginPeer(public_key, WGPEER_F_UPDATE_ONLY);
+      allowed_ips_ = message_.BeginNested(WGPEER_A_ALLOWEDIPS);
+    }
+    size_t allowed_ip = message_.BeginNested(0);
+    message_.PutU16(WGALLOWEDIP_A_FAMILY, prefix.version == 4 ? AF_INET : AF_INET6);
+    message_.PutAttribute(WGALLOWEDIP_A_IPADDR, prefix.address.data(), prefix.version == 4 ? 4 : 16);
+    message_.PutU8(WGALLOWEDIP_A_CIDR_MASK, prefix.length);
+    message_.EndNested(allowed_ip);
+  }
+  EndPeer();
+}
+
+void SetDeviceWriter::Finish() { Flush(); }
+
+void SetWireguardDevice(const std::string& name, const WireguardConfig& config, uint32_t fwmark) {
+  NetlinkSocket socket(NETLINK_GENERIC);
+  SetDeviceWriter writer(socket.ResolveFamily(WG_GENL_NAME), name,
+                         [&socket](NetlinkMessage& message) { socket.Request(message); });
+  writer.SetInterface(RequireKey(config.interface_config.private_key), config.interface_config.listen_port, fwmark,
+                      WGDEVICE_F_REPLACE_PEERS);
+  for (const auto& peer : config.peers) {
+    writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+  }
+  writer.Finish();
+}
+
+void SetWireguardPeer(const std::string& name, const PeerConfig& peer, bool restart) {
+  NetlinkSocket socket(NETLINK_GENERIC);
+  SetDeviceWriter writer(socket.ResolveFamily(WG_GENL_NAME), name,
+                         [&socket](NetlinkMessage& message) { socket.Request(message); });
+  if (restart) {
+    writer.AddPeer(peer, WGPEER_F_REMOVE_ME);
+    writer.AddPeer(peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+  } else {
+    writer.AddPeer(peer, WGPEER_F_UPDATE_ONLY);
+  }
+  writer.Finish();
+}
+
+void ApplyPeerChanges(const std::string& name, const std::vector<PeerChange>& changes) {
+  NetlinkSocket socket(NETLINK_GENERIC);
+  SetDeviceWriter writer(socket.ResolveFamily(WG_GENL_NAME), name,
+                         [&socket](NetlinkMessage& message) { socket.Request(message); });
+  AddPeerChanges(changes, &writer);
+  writer.Finish();
+}
+
+std::vector<PeerConfig> ConfiguredPeers(const WireguardDevice& device) {
+  std::vector<PeerConfig> peers;
+  peers.reserve(device.peers.size());
+  for (const auto& peer : device.peers) {
+    PeerConfig config;
+    config.public_key = EncodeKey(peer.public_key);
+    config.persistent_keepalive = peer.persistent_keepalive;
+    for (const auto& allowed_ip : peer.allowed_ips) {
+      IpPrefix prefix;
+      prefix.version = allowed_ip.family == AF_INET ? 4 : 6;
+      prefix.length = allowed_ip.cidr;
+      memcpy(prefix.address.data(), &allowed_ip.address, prefix.address.size());
+      config.allowed_ips.push_back(FormatIpPrefix(prefix));
+    }
+    peers.push_back(std::move(config));
+  }
+  return peers;
+}
+
+std::vector<PeerChange> RebindChanges(const WireguardDevice& device) {
+  std::vector<PeerChange> changes;
+  for (const auto& peer : device.peers) {
+    if (peer.endpoint.ss_family != AF_INET && peer.endpoint.ss_family != AF_INET6) {
+      continue;
+    }
+    PeerChange change = {PeerChange::Kind::update, PeerConfig()};
+    change.peer.public_key = EncodeKey(peer.public_key);
+    change.peer.endpoint = FormatEndpoint(peer.endpoint);
+    changes.push_back(change);
+
+    change.peer.endpoint.clear();
+    change.peer.persistent_keepalive = peer.persistent_keepalive != 0 ? peer.persistent_keepalive : 1;
+    changes.push_back(change);
+    if (peer.persistent_keepalive == 0) {
+      change.peer.persistent_keepalive = 0;
+      changes.push_back(change);
+    }
+  }
+  return changes;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,169 @@
+#ifndef WIREGUARD_DART_WIREGUARD_DEVICE_H
+#define WIREGUARD_DART_WIREGUARD_DEVICE_H
+
+#include <linux/wireguard.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "netlink.h"
+#include "peer_index.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Interface alias set on links created by the plugin. Used to recognize our tunnels after an app restart.
+extern const char kInterfaceAlias[];
+
+struct AllowedIp {
+  uint16_t family;
+  in6_addr address;  // in_addr in the first 4 bytes for AF_INET
+  uint8_t cidr;
+};
+
+struct WireguardPeer {
+  WireguardKey public_key = {};
+  sockaddr_storage endpoint = {};
+  // Unix epoch milliseconds, 0 if no handshake has completed yet.
+  int64_t last_handshake = 0;
+  uint64_t rx_bytes = 0;
+  uint64_t tx_bytes = 0;
+  uint16_t persistent_keepalive = 0;
+  std::vector<AllowedIp> allowed_ips;
+};
+
+struct WireguardDevice {
+  std::string name;
+  int ifindex = 0;
+  uint16_t listen_port = 0;
+  WireguardKey public_key = {};
+  std::vector<WireguardPeer> peers;
+};
+
+struct LinkInfo {
+  std::string name;
+  int ifindex = 0;
+  unsigned int flags = 0;  // IFF_* flags
+  std::string kind;        // IFLA_INFO_KIND, e.g. "wireguard"
+  std::string alias;
+};
+
+struct TunnelStatistics {
+  uint64_t total_download = 0;
+  uint64_t total_upload = 0;
+  // Unix epoch milliseconds of the most recent handshake of any peer, 0 if none.
+  int64_t latest_handshake = 0;
+};
+
+// Dumps all links and returns those of kind "wireguard".
+std::vector<LinkInfo> ListWireguardLinks();
+
+// Returns the link with the given name, or nullopt if it does not exist.
+std::optional<LinkInfo> FindLink(const std::string& name);
+
+// Reads the full device state with WG_CMD_GET_DEVICE, coalescing multi-part dumps.
+WireguardDevice GetWireguardDevice(const std::string& name);
+
+// Resolves "host:port" to a socket address, taking the first answer for host names. Returns its length. Throws
+// std::invalid_argument if the endpoint is malformed or does not resolve.
+socklen_t ResolveEndpoint(const std::string& endpoint, sockaddr_storage* address);
+
+// Formats an AF_INET or AF_INET6 address as "ip:port" or "[ip]:port", the form UAPI endpoints take.
+std::string FormatEndpoint(const sockaddr_storage& address);
+
+// Configures the device with WG_CMD_SET_DEVICE, replacing all of its peers. Endpoint host names are resolved here;
+// `fwmark` marks the device's own packets, 0 for none. Throws std::invalid_argument on malformed keys or addresses.
+void SetWireguardDevice(const std::string& name, const WireguardConfig& config, uint32_t fwmark);
+
+// Largest WG_CMD_SET_DEVICE message SetDeviceWriter builds by default. All peers of a message are nested in one
+// attribute, whose length field is 16 bits wide.
+extern const size_t kMaxSetDeviceMessage;
+
+// Splits a device configuration of any size into WG_CMD_SET_DEVICE messages, each packed up to `max_size` bytes and
+// built in the same preallocated buffer. The first message carries the interface settings. A peer whose allowed IPs
+// do not fit continues in the next message with WGPEER_F_UPDATE_ONLY, which appends to what was set before.
+class SetDeviceWriter {
+ public:
+  // Called with every finished message, e.g. to pass it to NetlinkSocket::Request.
+  using Send = std::function<void(NetlinkMessage&)>;
+
+  SetDeviceWriter(uint16_t family, const std::string& name, Send send, size_t max_size = kMaxSetDeviceMessage);
+
+  // Sets the device attributes; must come before the first peer. `flags` are WGDEVICE_F_* flags.
+  void SetInterface(const WireguardKey& private_key, uint16_t listen_port, uint32_t fwmark, uint32_t flags);
+
+  // Adds `peer` with WGPEER_F_* `flags`. Allowed IPs are left out for WGPEER_F_REMOVE_ME, and for WGPEER_F_UPDATE_ONLY
+  // unless WGPEER_F_REPLACE_ALLOWEDIPS is set as well.
+  // Throws std::invalid_argument on malformed keys, endpoints or allowed IPs; messages sent before stay applied.
+  void AddPeer(const PeerConfig& peer, uint32_t flags);
+
+  // Sends the last message.
+  void Finish();
+
+  // Number of messages sent so far.
+  size_t messages() const { return messages_; }
+
+ private:
+  void Start();
+  void Flush();
+  void BeginPeer(const WireguardKey& public_key, uint32_t flags);
+  void EndPeer();
+
+  uint16_t family_;
+  std::string name_;
+  Send send_;
+  size_t max_size_;
+  NetlinkMessage message_;
+  size_t messages_ = 0;
+  // Tokens of the nested attributes open in message_, 0 when closed.
+  size_t peers_ = 0;
+  size_t peer_ = 0;
+  size_t allowed_ips_ = 0;
+};
+
+// Applies a single peer. With `restart` the peer is removed and added again within the same request, which resets its
+// handshake state so that it initiates right away; otherwise only its endpoint and keepalive are updated.
+void SetWireguardPeer(const std::string& name, const PeerConfig& peer, bool restart);
+
+// Adds the peers of `changes` to a SetDeviceWriter or UapiSetWriter, with the WGPEER_F_* flags for their kind.
+template <typename Writer>
+void AddPeerChanges(const std::vector<PeerChange>& changes, Writer* writer) {
+  for (const auto& change : changes) {
+    switch (change.kind) {
+      case PeerChange::Kind::add:
+        writer->AddPeer(change.peer, WGPEER_F_REPLACE_ALLOWEDIPS);
+        break;
+      case PeerChange::Kind::update:
+        writer->AddPeer(change.peer,
+                        WGPEER_F_UPDATE_ONLY | (change.replace_allowed_ips ? WGPEER_F_REPLACE_ALLOWEDIPS : 0));
+        break;
+      case PeerChange::Kind::remove:
+        writer->AddPeer(change.peer, WGPEER_F_REMOVE_ME);
+        break;
+    }
+  }
+}
+
+// Applies peer deltas computed by PeerIndex, as few WG_CMD_SET_DEVICE messages as they fit in. Other peers are left
+// alone. Throws std::invalid_argument on malformed keys or addresses and NetlinkError if the kernel rejects a message.
+void ApplyPeerChanges(const std::string& name, const std::vector<PeerChange>& changes);
+
+// The peers of a device as configs with key, keepalive and allowed IPs, e.g. to index a tunnel adopted after restart.
+std::vector<PeerConfig> ConfiguredPeers(const WireguardDevice& device);
+
+// Updates that move the peers of a device onto the current network after it changed. Every peer with an endpoint gets
+// that endpoint set again, which drops the route and source address cached for it, and its keepalive is raised from
+// 0, which sends a keepalive at once and with it a handshake initiation if the session has gone stale. The last update
+// of each peer restores its keepalive.
+std::vector<PeerChange> RebindChanges(const WireguardDevice& device);
+
+}  // namespace wireguard_dart
+
+#endif
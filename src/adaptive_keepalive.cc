@@ -0,0 +1,235 @@
+#include "adaptive_keepalive.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+// Keepalives are 32 bytes and handshake messages at most 148, so a sample period that moved more than this in either
+// direction carried traffic.
+const uint64_t kIdleBytes = 256;
+// Data and keepalive messages are a multiple of 16 bytes on the wire, a handshake initiation is 148 bytes.
+const uint64_t kMessagePadding = 16;
+// An initiation is unanswered once it was retransmitted three times, as for HandshakeWatchdog.
+const int64_t kUnansweredTimeout = 3 * kRekeyTimeout;
+
+const auto kSampleInterval = std::chrono::seconds(5);
+
+std::vector<PeerChange> KeepaliveUpdates(const std::vector<KeepaliveChange> &changes) {
+  std::vector<PeerChange> updates;
+  updates.reserve(changes.size());
+  for (const auto &change : changes) {
+    PeerChange update = {PeerChange::Kind::update, PeerConfig()};
+    update.peer.public_key = EncodeKey(change.public_key);
+    update.peer.persistent_keepalive = change.interval;
+    updates.push_back(std::move(update));
+  }
+  return updates;
+}
+
+void KeepaliveTuner::Reset(const std::vector<PeerConfig> &peers) {
+  peers_.clear();
+  initial_interval_ = 0;
+  for (const auto &peer : peers) {
+    WireguardKey key;
+    if (peer.persistent_keepalive == 0 || !DecodeKey(peer.public_key, &key)) {
+      continue;
+    }
+    peers_[key].applied = peer.persistent_keepalive;
+    // Start from the most frequent keepalive asked for.
+    if (initial_interval_ == 0 || peer.persistent_keepalive < initial_interval_) {
+      initial_interval_ = peer.persistent_keepalive;
+    }
+  }
+  network_id_.clear();
+  learned_.clear();
+  network_ = NetworkState();
+  network_.interval = initial_interval_;
+}
+
+std::vector<KeepaliveChange> KeepaliveTuner::SetNetwork(const std::string &network, int64_t now) {
+  if (network == network_id_) {
+    return {};
+  }
+  learned_[network_id_] = network_;
+  network_id_ = network;
+  auto found = learned_.find(network);
+  if (found != learned_.end()) {
+    network_ = found->second;
+  } else {
+    network_ = NetworkState();
+    network_.interval = initial_interval_;
+  }
+  network_.idle_since = now;
+  // Whatever was outstanding happened on the previous network.
+  for (auto &entry : peers_) {
+    entry.second.sampled = false;
+  }
+  return Apply();
+}
+
+std::vector<KeepaliveChange> KeepaliveTuner::Observe(const std::vector<PeerSample> &samples, int64_t now) {
+  if (peers_.empty()) {
+    return {};
+  }
+  if (network_.idle_since < 0) {
+    network_.idle_since = now;
+  }
+
+  bool busy = false;
+  bool expired = false;
+  for (const auto &sample : samples) {
+    auto found = peers_.find(sample.public_key);
+    if (found == peers_.end()) {
+      continue;
+    }
+    PeerState &state = found->second;
+    if (!state.sampled || sample.rx_bytes < state.rx_bytes || sample.tx_bytes < state.tx_bytes) {
+      // A new peer, or its counters were reset by a reconfiguration: start tracking from here.
+      state.sampled = true;
+      state.last_handshake = sample.last_handshake;
+      state.rx_bytes = sample.rx_bytes;
+      state.tx_bytes = sample.tx_bytes;
+      state.last_rx_at = now;
+      state.initiating_since = 0;
+      busy = true;
+      continue;
+    }
+
+    uint64_t received = sample.rx_bytes - state.rx_bytes;
+    uint64_t sent = sample.tx_bytes - state.tx_bytes;
+    if (received > 0) {
+      state.last_rx_at = now;
+    }
+    if (sample.last_handshake != state.last_handshake) {
+      state.initiating_since = 0;
+    } else if (state.initiating_since == 0 && sent % kMessagePadding != 0) {
+      state.initiating_since = now;
+      state.silence_before = now - state.last_rx_at;
+      state.stall_judged = false;
+    }
+    if (received > kIdleBytes || sent > kIdleBytes) {
+      busy = true;
+    }
+    if (state.initiating_since != 0) {
+      busy = true;
+      // Only an initiation after an idle gap of about the current interval points at the NAT; anything else is a
+      // broken path, which is for HandshakeWatchdog and the network monitor to deal with.
+      if (!state.stall_judged && now - state.initiating_since >= kUnansweredTimeout) {
+        state.stall_judged = true;
+        expired |= state.silence_before * 5 >= int64_t(network_.interval) * 1000 * 4;
+      }
+    }
+    state.last_handshake = sample.last_handshake;
+    state.rx_bytes = sample.rx_bytes;
+    state.tx_bytes = sample.tx_bytes;
+  }
+
+  if (expired) {
+    uint16_t fallback = network_.proven != 0 && network_.proven < network_.interval
+                            ? network_.proven
+                            : std::max<uint16_t>(kMinKeepalive, network_.interval * 2 / 3);
+    network_.interval = std::min(network_.interval, fallback);
+    network_.settled = true;
+    network_.idle_since = now;
+  } else if (busy) {
+    network_.idle_since = now;
+  } else if (!network_.settled && network_.interval < kMaxKeepalive &&
+             now - network_.idle_since >= int64_t(kProbePeriods) * network_.interval * 1000) {
+    network_.proven = network_.interval;
+    network_.interval = std::min<uint16_t>(kMaxKeepalive, network_.interval * 3 / 2);
+    network_.idle_since = now;
+  }
+  return Apply();
+}
+
+std::vector<KeepaliveChange> KeepaliveTuner::Apply() {
+  std::vector<KeepaliveChange> changes;
+  for (auto &entry : peers_) {
+    if (entry.second.applied != network_.interval) {
+      entry.second.applied = network_.interval;
+      changes.push_back({entry.first, network_.interval});
+    }
+  }
+  return changes;
+}
+
+AdaptiveKeepalive::~AdaptiveKeepalive() { Stop(); }
+
+void AdaptiveKeepalive::Start(const std::vector<PeerConfig> &peers, SamplePeers sample_peers,
+                              ApplyChanges apply_changes, NetworkId network_id) {
+  Stop();
+  tuner_.Reset(peers);
+  if (tuner_.interval() == 0) {
+    return;
+  }
+  sample_peers_ = sample_peers;
+  apply_changes_ = apply_changes;
+  network_id_ = network_id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    network_changed_ = false;
+  }
+  thread_ = std::thread(&AdaptiveKeepalive::Run, this);
+}
+
+void AdaptiveKeepalive::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AdaptiveKeepalive::NetworkChanged() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    network_changed_ = true;
+  }
+  stop_condition_.notify_all();
+}
+
+void AdaptiveKeepalive::Run() {
+  bool look_up_network = true;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    lock.unlock();
+    try {
+      int64_t now = SteadyMillisNow();
+      std::vector<KeepaliveChange> changes;
+      if (look_up_network) {
+        changes = tuner_.SetNetwork(network_id_(), now);
+        look_up_network = false;
+      }
+      for (const auto &change : tuner_.Observe(sample_peers_(), now)) {
+        changes.push_back(change);
+      }
+      if (!changes.empty()) {
+        apply_changes_(KeepaliveUpdates(changes));
+      }
+    } catch (std::exception &e) {
+      // The tunnel may be going down or reconfigured; try again on the next sample.
+      std::cerr << "Adaptive keepalive: " << e.what() << std::endl;
+    }
+    lock.lock();
+    stop_condition_.wait_for(lock, kSampleInterval, [this] { return stop_ || network_changed_; });
+    if (stop_) {
+      return;
+    }
+    look_up_network |= network_changed_;
+    network_changed_ = false;
+  }
+}
+
+}  // namespace wireguard_dart
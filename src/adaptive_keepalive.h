@@ -0,0 +1,138 @@
+#ifndef WIREGUARD_DART_ADAPTIVE_KEEPALIVE_H
+#define WIREGUARD_DART_ADAPTIVE_KEEPALIVE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "peer_index.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Bounds of learned keepalive intervals in seconds. RFC 4787 REQ-5 asks NATs to keep idle UDP mappings for at least
+// two minutes; the ceiling stays just below that.
+const uint16_t kMinKeepalive = 10;
+const uint16_t kMaxKeepalive = 115;
+
+struct KeepaliveChange {
+  WireguardKey public_key;
+  // Seconds.
+  uint16_t interval;
+};
+
+// Keepalive updates as peer updates for ApplyPeerChanges, which leave endpoints and allowed IPs alone.
+std::vector<PeerChange> KeepaliveUpdates(const std::vector<KeepaliveChange> &changes);
+
+// Learns how long the NAT of the current network keeps an idle UDP binding and sets the persistent keepalive of the
+// tunnel's peers just below that. WireGuard keepalives are not acknowledged, so the timeout is found by probing:
+// starting from the configured interval, the interval grows in steps once the tunnel has stayed idle and healthy for
+// kProbePeriods of it. A handshake that goes unanswered after an idle gap of about the current interval means the
+// binding expired first; the tuner then falls back to the last interval that held and stops probing on that network.
+// Periods with traffic do not count either way, as the driver sends no keepalives while packets flow.
+//
+// What was learned is kept per network, identified by an opaque string such as the interface and gateway the tunnel
+// traffic leaves through. Peers configured without keepalive are left alone. Pure state machine: callers feed
+// periodic samples and apply the returned changes.
+class KeepaliveTuner {
+ public:
+  // Idle and healthy periods of the current interval after which the next one is tried.
+  static const int kProbePeriods = 3;
+
+  // Starts over with the configured keepalive of every peer, on an unknown network.
+  void Reset(const std::vector<PeerConfig> &peers);
+
+  // Switches to `network`, resuming from what was learned there before. Returns the changes to apply.
+  std::vector<KeepaliveChange> SetNetwork(const std::string &network, int64_t now);
+
+  // Feeds the counters of all peers at `now` (milliseconds of a monotonic clock). Returns the changes to apply.
+  std::vector<KeepaliveChange> Observe(const std::vector<PeerSample> &samples, int64_t now);
+
+  // The interval in seconds the tuned peers currently run with on the current network, 0 if none are tuned.
+  uint16_t interval() const { return network_.interval; }
+
+  // True once a binding timeout was found on the current network.
+  bool settled() const { return network_.settled; }
+
+ private:
+  struct PeerState {
+    uint16_t applied = 0;
+    bool sampled = false;
+    int64_t last_handshake = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    // When the peer last received anything.
+    int64_t last_rx_at = 0;
+    // When an unanswered handshake initiation was first seen, 0 if none is outstanding.
+    int64_t initiating_since = 0;
+    // How long nothing had been received when that initiation was seen.
+    int64_t silence_before = 0;
+    // Whether the outstanding initiation was already judged.
+    bool stall_judged = false;
+  };
+
+  struct NetworkState {
+    uint16_t interval = 0;
+    // The largest interval seen to hold, 0 if none yet.
+    uint16_t proven = 0;
+    bool settled = false;
+    // Start of the current run of idle, healthy time, -1 before the first sample.
+    int64_t idle_since = -1;
+  };
+
+  std::vector<KeepaliveChange> Apply();
+
+  std::map<WireguardKey, PeerState> peers_;
+  uint16_t initial_interval_ = 0;
+  std::string network_id_;
+  NetworkState network_;
+  std::map<std::string, NetworkState> learned_;
+};
+
+// Runs a KeepaliveTuner on a background thread for platforms without a polling loop of their own.
+class AdaptiveKeepalive {
+ public:
+  using SamplePeers = std::function<std::vector<PeerSample>()>;
+  // Applies keepalive updates to the tunnel.
+  using ApplyChanges = std::function<void(const std::vector<PeerChange> &changes)>;
+  // Identifies the network the tunnel traffic currently leaves through.
+  using NetworkId = std::function<std::string()>;
+
+  AdaptiveKeepalive() = default;
+  ~AdaptiveKeepalive();
+
+  AdaptiveKeepalive(const AdaptiveKeepalive &) = delete;
+  AdaptiveKeepalive &operator=(const AdaptiveKeepalive &) = delete;
+
+  // Starts tuning the keepalive of `peers`, stopping a previous run. Does nothing if none of them has one.
+  void Start(const std::vector<PeerConfig> &peers, SamplePeers sample_peers, ApplyChanges apply_changes,
+             NetworkId network_id);
+  void Stop();
+
+  // Makes the thread look up the network again; called when the network changed. Thread safe.
+  void NetworkChanged();
+
+ private:
+  void Run();
+
+  KeepaliveTuner tuner_;
+  SamplePeers sample_peers_;
+  ApplyChanges apply_changes_;
+  NetworkId network_id_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_ = false;
+  bool network_changed_ = false;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,299 @@
+#include "dns_cache.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windns.h>
+#else
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+void AddAddress(std::vector<std::string> *addresses, int family, const void *address) {
+  char text[INET6_ADDRSTRLEN] = {};
+  if (inet_ntop(family, address, text, sizeof(text)) == nullptr) {
+    return;
+  }
+  if (std::find(addresses->begin(), addresses->end(), text) == addresses->end()) {
+    addresses->push_back(text);
+  }
+}
+
+}  // namespace
+
+#ifdef _WIN32
+DnsAnswer QueryAddresses(const std::string &host, int version) {
+  DnsAnswer answer;
+  WORD type = version == 4 ? DNS_TYPE_A : DNS_TYPE_AAAA;
+  PDNS_RECORD records = nullptr;
+  DNS_STATUS status = DnsQuery_A(host.c_str(), type, DNS_QUERY_STANDARD, nullptr, &records, nullptr);
+  if (status == DNS_ERROR_RCODE_NAME_ERROR || status == DNS_INFO_NO_RECORDS) {
+    answer.ok = true;
+    return answer;
+  }
+  if (status != 0) {
+    return answer;
+  }
+  answer.ok = true;
+  bool first = true;
+  for (PDNS_RECORD record = records; record != nullptr; record = record->pNext) {
+    if (record->Flags.S.Section != DnsSectionAnswer) {
+      continue;
+    }
+    // The chain is only as fresh as its shortest lived link, CNAMEs included.
+    answer.ttl = first ? record->dwTtl : std::min<uint32_t>(answer.ttl, record->dwTtl);
+    first = false;
+    if (record->wType == DNS_TYPE_A && type == DNS_TYPE_A) {
+      AddAddress(&answer.addresses, AF_INET, &record->Data.A.IpAddress);
+    } else if (record->wType == DNS_TYPE_AAAA && type == DNS_TYPE_AAAA) {
+      AddAddress(&answer.addresses, AF_INET6, &record->Data.AAAA.Ip6Address);
+    }
+  }
+  DnsRecordListFree(records, DnsFreeRecordList);
+  return answer;
+}
+#else
+DnsAnswer QueryAddresses(const std::string &host, int version) {
+  DnsAnswer answer;
+  // A resolver state of our own, as queries run on several threads at once.
+  struct __res_state state = {};
+  if (res_ninit(&state) != 0) {
+    return answer;
+  }
+  int type = version == 4 ? ns_t_a : ns_t_aaaa;
+  unsigned char message[4096];
+  int length = res_nquery(&state, host.c_str(), ns_c_in, type, message, sizeof(message));
+  if (length < 0) {
+    answer.ok = state.res_h_errno == HOST_NOT_FOUND || state.res_h_errno == NO_DATA;
+    res_nclose(&state);
+    return answer;
+  }
+  res_nclose(&state);
+
+  ns_msg parsed;
+  if (ns_initparse(message, length, &parsed) != 0) {
+    return answer;
+  }
+  answer.ok = true;
+  int count = ns_msg_count(parsed, ns_s_an);
+  for (int i = 0; i < count; i++) {
+    ns_rr record;
+    if (ns_parserr(&parsed, ns_s_an, i, &record) != 0) {
+      continue;
+    }
+    // The chain is only as fresh as its shortest lived link, CNAMEs included.
+    answer.ttl = i == 0 ? ns_rr_ttl(record) : std::min<uint32_t>(answer.ttl, ns_rr_ttl(record));
+    if (ns_rr_type(record) == ns_t_a && type == ns_t_a && ns_rr_rdlen(record) == 4) {
+      AddAddress(&answer.addresses, AF_INET, ns_rr_rdata(record));
+    } else if (ns_rr_type(record) == ns_t_aaaa && type == ns_t_aaaa && ns_rr_rdlen(record) == 16) {
+      AddAddress(&answer.addresses, AF_INET6, ns_rr_rdata(record));
+    }
+  }
+  return answer;
+}
+#endif
+
+DnsCache::DnsCache(Query query, Options options) : query_(query), options_(options) {
+  for (int i = 0; i < std::max(1, options_.workers); i++) {
+    workers_.emplace_back(&DnsCache::Work, this);
+  }
+  scheduler_ = std::thread(&DnsCache::Schedule, this);
+}
+
+DnsCache::~DnsCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_condition_.notify_all();
+  schedule_condition_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  scheduler_.join();
+}
+
+void DnsCache::Prefetch(const std::vector<std::string> &hosts) {
+  int64_t now = SteadyMillisNow();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &host : hosts) {
+    IpPrefix literal;
+    if (host.empty() || ParseIpPrefix(host, &literal)) {
+      continue;
+    }
+    Entry &entry = entries_[host];
+    entry.last_used = now;
+    if (!entry.resolved || entry.expires_at <= now) {
+      Enqueue(host, entry);
+    }
+  }
+}
+
+std::optional<CachedAddresses> DnsCache::Lookup(const std::string &host) {
+  int64_t now = SteadyMillisNow();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(host);
+  if (it == entries_.end() || !it->second.resolved) {
+    return std::nullopt;
+  }
+  Entry &entry = it->second;
+  entry.last_used = now;
+  CachedAddresses cached;
+  cached.ipv6 = entry.addresses[0];
+  cached.ipv4 = entry.addresses[1];
+  cached.fresh = now < entry.expires_at;
+  if (!cached.fresh) {
+    Enqueue(host, entry);
+  }
+  return cached;
+}
+
+void DnsCache::Enqueue(const std::string &host, Entry &entry) {
+  if (entry.in_flight) {
+    return;
+  }
+  entry.in_flight = true;
+  queue_.push_back(host);
+  work_condition_.notify_one();
+}
+
+void DnsCache::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_condition_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    std::string host = queue_.front();
+    queue_.pop_front();
+    lock.unlock();
+
+    // Both families at once, so that a slow AAAA lookup does not hold up A.
+    auto ipv6 = std::async(std::launch::async, query_, host, 6);
+    DnsAnswer answers[2];
+    answers[1] = query_(host, 4);
+    answers[0] = ipv6.get();
+    int64_t now = SteadyMillisNow();
+
+    lock.lock();
+    auto it = entries_.find(host);
+    if (it == entries_.end()) {
+      continue;
+    }
+    Entry &entry = it->second;
+    entry.in_flight = false;
+    bool any_ok = false;
+    bool any_address = false;
+    int64_t ttl = options_.max_ttl;
+    for (int i = 0; i < 2; i++) {
+      if (!answers[i].ok) {
+        continue;
+      }
+      any_ok = true;
+      if (!answers[i].addresses.empty()) {
+        any_address = true;
+        ttl = std::min<int64_t>(ttl, static_cast<int64_t>(answers[i].ttl) * 1000);
+      }
+    }
+    if (!any_ok) {
+      // Keep serving what we had, if anything; the resolver may just be unreachable for a moment.
+      entry.resolved = entry.resolved || !entry.addresses[0].empty() || !entry.addresses[1].empty();
+      ttl = options_.negative_ttl;
+    } else {
+      for (int i = 0; i < 2; i++) {
+        // A family whose query failed keeps its previous addresses.
+        if (answers[i].ok) {
+          entry.addresses[i] = std::move(answers[i].addresses);
+        }
+      }
+      entry.resolved = true;
+      ttl = any_address ? std::max(options_.min_ttl, std::min(ttl, options_.max_ttl)) : options_.negative_ttl;
+    }
+    if (!entry.resolved) {
+      // Nothing to serve: forget the host and let the next Prefetch try again.
+      entries_.erase(it);
+      continue;
+    }
+    entry.expires_at = now + ttl;
+    // Refresh a little ahead of expiry so that lookups keep getting fresh answers.
+    entry.refresh_at = now + ttl - ttl / 10;
+    schedule_condition_.notify_all();
+  }
+}
+
+void DnsCache::Schedule() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    int64_t now = SteadyMillisNow();
+    int64_t next = INT64_MAX;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      Entry &entry = it->second;
+      if (entry.in_flight || !entry.resolved) {
+        ++it;
+        continue;
+      }
+      if (entry.refresh_at <= now) {
+        if (now - entry.last_used > options_.idle_lifetime) {
+          it = entries_.erase(it);
+          continue;
+        }
+        Enqueue(it->first, entry);
+      } else {
+        next = std::min(next, entry.refresh_at);
+      }
+      ++it;
+    }
+    if (next == INT64_MAX) {
+      schedule_condition_.wait(lock);
+    } else {
+      schedule_condition_.wait_for(lock, std::chrono::milliseconds(next - now));
+    }
+  }
+}
+
+std::vector<std::string> EndpointHosts(const std::vector<std::string> &endpoints) {
+  std::vector<std::string> hosts;
+  for (const auto &endpoint : endpoints) {
+    std::string host;
+    uint16_t port;
+    hosts.push_back(SplitEndpoint(endpoint, &host, &port) ? host : endpoint);
+  }
+  return hosts;
+}
+
+EndpointRace::Resolver CachedResolver(DnsCache *cache, EndpointRace::Resolver fallback) {
+  return [cache, fallback](const std::string &host, uint16_t port, AddressFamily preferred) {
+    auto cached = cache->Lookup(host);
+    if (!cached || (cached->ipv6.empty() && cached->ipv4.empty())) {
+      // Not known yet, or only to the hosts file and other sources DNS does not see.
+      cache->Prefetch({host});
+      return fallback(host, port, preferred);
+    }
+    std::vector<std::string> endpoints[2];
+    for (const auto &address : cached->ipv6) {
+      endpoints[0].push_back(JoinEndpoint(address, port));
+    }
+    for (const auto &address : cached->ipv4) {
+      endpoints[1].push_back(JoinEndpoint(address, port));
+    }
+    return InterleaveAddressFamilies(endpoints[0], endpoints[1], preferred);
+  };
+}
+
+}  // namespace wireguard_dart
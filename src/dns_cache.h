@@ -0,0 +1,108 @@
+#ifndef WIREGUARD_DART_DNS_CACHE_H
+#define WIREGUARD_DART_DNS_CACHE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "happy_eyeballs.h"
+
+namespace wireguard_dart {
+
+struct DnsAnswer {
+  // False if the resolver could not be reached or failed; a name without records is a successful empty answer.
+  bool ok = false;
+  // Numeric addresses.
+  std::vector<std::string> addresses;
+  // Seconds, the lowest TTL of the answer.
+  uint32_t ttl = 0;
+};
+
+// Queries the system's DNS servers for the A (version 4) or AAAA (version 6) records of `host`, with their TTL.
+// Blocking. Uses res_nquery on Linux and DnsQuery on Windows.
+DnsAnswer QueryAddresses(const std::string &host, int version);
+
+struct CachedAddresses {
+  std::vector<std::string> ipv6;
+  std::vector<std::string> ipv4;
+  // False once the TTL ran out; the addresses are still the best known while a refresh is under way.
+  bool fresh = false;
+};
+
+// Resolves endpoint host names ahead of connect and keeps them fresh in the background, honoring record TTLs.
+class DnsCache {
+ public:
+  using Query = std::function<DnsAnswer(const std::string &host, int version)>;
+
+  struct Options {
+    // Bounds applied to record TTLs, in milliseconds.
+    int64_t min_ttl = 30 * 1000;
+    int64_t max_ttl = 60 * 60 * 1000;
+    // How long failures and names without records are remembered.
+    int64_t negative_ttl = 10 * 1000;
+    // Hosts not looked up or prefetched for this long are dropped instead of refreshed.
+    int64_t idle_lifetime = 60 * 60 * 1000;
+    int workers = 4;
+  };
+
+  explicit DnsCache(Query query = QueryAddresses) : DnsCache(query, Options()) {}
+  DnsCache(Query query, Options options);
+  ~DnsCache();
+
+  DnsCache(const DnsCache &) = delete;
+  DnsCache &operator=(const DnsCache &) = delete;
+
+  // Starts resolving `hosts` in parallel and keeps refreshing them from then on. Returns at once; IP literals are
+  // ignored.
+  void Prefetch(const std::vector<std::string> &hosts);
+
+  // Returns the addresses known for `host`, or nullopt if it was never resolved. Expired entries are still returned
+  // and refreshed in the background.
+  std::optional<CachedAddresses> Lookup(const std::string &host);
+
+ private:
+  struct Entry {
+    std::vector<std::string> addresses[2];  // IPv6, IPv4
+    bool resolved = false;
+    bool in_flight = false;
+    int64_t refresh_at = 0;
+    int64_t expires_at = 0;
+    int64_t last_used = 0;
+  };
+
+  // Requires mutex_ to be held.
+  void Enqueue(const std::string &host, Entry &entry);
+  void Work();
+  void Schedule();
+
+  Query query_;
+  Options options_;
+  std::map<std::string, Entry> entries_;
+  std::deque<std::string> queue_;
+
+  std::mutex mutex_;
+  std::condition_variable work_condition_;
+  std::condition_variable schedule_condition_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+  std::thread scheduler_;
+};
+
+// Host names of "host:port" endpoints; entries without a port are taken as host names themselves.
+std::vector<std::string> EndpointHosts(const std::vector<std::string> &endpoints);
+
+// Resolver for EndpointRace that serves cached addresses and falls back to `fallback` for hosts not cached yet,
+// which are then prefetched for next time.
+EndpointRace::Resolver CachedResolver(DnsCache *cache,
+                                      EndpointRace::Resolver fallback = ResolveEndpointCandidates);
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,325 @@
+#include "endpoint_prober.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <map>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "socket_util.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Default probe: magic, target index, sample index and a per-run nonce, echoed back verbatim by responders.
+const uint32_t kProbeMagic = 0x77676470;  // "wgdp"
+const size_t kProbeSize = 16;
+
+const double kNotSent = -2;
+const double kUnanswered = -1;
+
+struct ResolvedTarget {
+  sockaddr_storage address = {};
+  socklen_t address_length = 0;
+  std::string numeric_address;
+};
+
+struct TargetState {
+  bool resolved = false;
+  ResolvedTarget resolved_target;
+  std::vector<uint8_t> payload;
+  std::vector<Clock::time_point> sent_at;
+  // Round trip per sample in milliseconds, or one of the states below.
+  std::vector<double> rtts;
+};
+
+// Key matching a reply's source to a target: family, address and port bytes.
+std::string AddressKey(const sockaddr *address) {
+  if (address->sa_family == AF_INET) {
+    auto in = reinterpret_cast<const sockaddr_in *>(address);
+    std::string key(1, '4');
+    key.append(reinterpret_cast<const char *>(&in->sin_addr), sizeof(in->sin_addr));
+    key.append(reinterpret_cast<const char *>(&in->sin_port), sizeof(in->sin_port));
+    return key;
+  }
+  if (address->sa_family == AF_INET6) {
+    auto in6 = reinterpret_cast<const sockaddr_in6 *>(address);
+    std::string key(1, '6');
+    key.append(reinterpret_cast<const char *>(&in6->sin6_addr), sizeof(in6->sin6_addr));
+    key.append(reinterpret_cast<const char *>(&in6->sin6_port), sizeof(in6->sin6_port));
+    return key;
+  }
+  return std::string();
+}
+
+bool Resolve(const std::string &endpoint, bool numeric_only, ResolvedTarget *target) {
+  std::string host;
+  uint16_t port = 0;
+  if (!SplitEndpoint(endpoint, &host, &port)) {
+    return false;
+  }
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV | (numeric_only ? AI_NUMERICHOST : 0);
+  addrinfo *results = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0 || results == nullptr) {
+    return false;
+  }
+  std::memcpy(&target->address, results->ai_addr, results->ai_addrlen);
+  target->address_length = static_cast<socklen_t>(results->ai_addrlen);
+  freeaddrinfo(results);
+
+  char numeric[NI_MAXHOST] = {};
+  if (getnameinfo(reinterpret_cast<const sockaddr *>(&target->address), target->address_length, numeric,
+                  sizeof(numeric), nullptr, 0, NI_NUMERICHOST) == 0) {
+    target->numeric_address = numeric;
+  }
+  return true;
+}
+
+void PutU32(uint8_t *out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+  }
+}
+
+uint32_t GetU32(const uint8_t *in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t middle = values.size() / 2;
+  return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+}  // namespace
+
+std::vector<ProbeResult> RankEndpoints(const std::vector<ProbeTarget> &targets, const ProbeOptions &options) {
+  SocketRuntime runtime;
+  int samples = std::max(1, options.samples);
+  std::vector<TargetState> states(targets.size());
+
+  // Literal addresses resolve inline; host names are looked up concurrently so that a slow resolver costs one lookup
+  // rather than one per target.
+  std::vector<std::future<bool>> lookups(targets.size());
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (Resolve(targets[i].endpoint, true, &states[i].resolved_target)) {
+      states[i].resolved = true;
+    } else {
+      lookups[i] = std::async(std::launch::async, Resolve, targets[i].endpoint, false, &states[i].resolved_target);
+    }
+  }
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (lookups[i].valid()) {
+      states[i].resolved = lookups[i].get();
+    }
+  }
+
+  Socket sockets[2] = {kInvalidSocket, kInvalidSocket};
+  const int families[2] = {AF_INET, AF_INET6};
+  int last_error = 0;
+  for (int i = 0; i < 2; i++) {
+    sockets[i] = socket(families[i], SOCK_DGRAM, IPPROTO_UDP);
+    if (sockets[i] != kInvalidSocket && !SetNonBlocking(sockets[i])) {
+      CloseSocket(sockets[i]);
+      sockets[i] = kInvalidSocket;
+    }
+    if (sockets[i] == kInvalidSocket) {
+      last_error = LastSocketError();
+    }
+  }
+  if (sockets[0] == kInvalidSocket && sockets[1] == kInvalidSocket) {
+    throw std::system_error(last_error, std::system_category(), "Failed to open probe socket");
+  }
+
+  uint32_t nonce = std::random_device()();
+  std::multimap<std::string, size_t> targets_by_address;
+  for (size_t i = 0; i < targets.size(); i++) {
+    TargetState &state = states[i];
+    state.sent_at.resize(samples);
+    state.rtts.assign(samples, kNotSent);
+    if (!state.resolved) {
+      continue;
+    }
+    targets_by_address.emplace(AddressKey(reinterpret_cast<const sockaddr *>(&state.resolved_target.address)), i);
+    state.payload = targets[i].payload;
+    if (state.payload.empty()) {
+      state.payload.resize(kProbeSize);
+      PutU32(&state.payload[0], kProbeMagic);
+      PutU32(&state.payload[4], static_cast<uint32_t>(i));
+      PutU32(&state.payload[12], nonce);
+    }
+  }
+
+  std::vector<int> sent(targets.size(), 0);
+  size_t outstanding = 0;
+  auto send_round = [&](int sample) {
+    for (size_t i = 0; i < targets.size(); i++) {
+      TargetState &state = states[i];
+      if (!state.resolved) {
+        continue;
+      }
+      Socket fd = sockets[state.resolved_target.address.ss_family == AF_INET ? 0 : 1];
+      if (fd == kInvalidSocket) {
+        continue;
+      }
+      if (targets[i].payload.empty()) {
+        PutU32(&state.payload[8], static_cast<uint32_t>(sample));
+      }
+      state.sent_at[sample] = Clock::now();
+      if (sendto(fd, reinterpret_cast<const char *>(state.payload.data()), static_cast<int>(state.payload.size()), 0,
+                 reinterpret_cast<const sockaddr *>(&state.resolved_target.address),
+                 state.resolved_target.address_length) >= 0) {
+        state.rtts[sample] = kUnanswered;
+        sent[i]++;
+        outstanding++;
+      }
+    }
+  };
+
+  auto on_reply = [&](const uint8_t *data, size_t length, const sockaddr *from, Clock::time_point received_at) {
+    auto range = targets_by_address.equal_range(AddressKey(from));
+    for (auto it = range.first; it != range.second; ++it) {
+      size_t index = it->second;
+      TargetState &state = states[index];
+      int sample = -1;
+      if (targets[index].payload.empty()) {
+        // Our own probe: the echo names the target and sample it answers.
+        if (length < kProbeSize || GetU32(data) != kProbeMagic || GetU32(data + 12) != nonce ||
+            GetU32(data + 4) != index) {
+          continue;
+        }
+        uint32_t echoed = GetU32(data + 8);
+        if (echoed >= state.rtts.size() || state.rtts[echoed] != kUnanswered) {
+          continue;
+        }
+        sample = static_cast<int>(echoed);
+      } else {
+        // Opaque payload: attribute the reply to the oldest unanswered probe.
+        for (int s = 0; s < static_cast<int>(state.rtts.size()); s++) {
+          if (state.rtts[s] == kUnanswered) {
+            sample = s;
+            break;
+          }
+        }
+        if (sample < 0) {
+          continue;
+        }
+      }
+      state.rtts[sample] = std::chrono::duration<double, std::milli>(received_at - state.sent_at[sample]).count();
+      outstanding--;
+      return;
+    }
+  };
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline =
+      start + std::chrono::milliseconds(options.interval * (samples - 1) + std::max<int64_t>(0, options.timeout));
+  int rounds = 0;
+  Clock::time_point next_round = start;
+  uint8_t buffer[2048];
+  while (true) {
+    Clock::time_point now = Clock::now();
+    if (rounds < samples && now >= next_round) {
+      send_round(rounds++);
+      next_round += std::chrono::milliseconds(options.interval);
+      continue;
+    }
+    if (now >= deadline || (rounds == samples && outstanding == 0)) {
+      break;
+    }
+
+    Clock::time_point wake = rounds < samples ? std::min(next_round, deadline) : deadline;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+    pollfd fds[2];
+    size_t count = 0;
+    for (Socket fd : sockets) {
+      if (fd != kInvalidSocket) {
+        fds[count].fd = fd;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        count++;
+      }
+    }
+    if (Poll(fds, count, static_cast<int>(wait)) <= 0) {
+      continue;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if ((fds[i].revents & POLLIN) == 0) {
+        continue;
+      }
+      while (true) {
+        sockaddr_storage from = {};
+        socklen_t from_length = sizeof(from);
+        auto received = recvfrom(fds[i].fd, reinterpret_cast<char *>(buffer), sizeof(buffer), 0,
+                                 reinterpret_cast<sockaddr *>(&from), &from_length);
+        if (received < 0) {
+          break;
+        }
+        on_reply(buffer, static_cast<size_t>(received), reinterpret_cast<const sockaddr *>(&from), Clock::now());
+      }
+    }
+  }
+
+  for (Socket fd : sockets) {
+    if (fd != kInvalidSocket) {
+      CloseSocket(fd);
+    }
+  }
+
+  std::vector<ProbeResult> results(targets.size());
+  for (size_t i = 0; i < targets.size(); i++) {
+    ProbeResult &result = results[i];
+    result.endpoint = targets[i].endpoint;
+    result.address = states[i].resolved_target.numeric_address;
+    result.sent = sent[i];
+    for (double rtt : states[i].rtts) {
+      if (rtt >= 0) {
+        result.samples.push_back(rtt);
+      }
+    }
+    result.received = static_cast<int>(result.samples.size());
+    if (result.received == 0) {
+      continue;
+    }
+    result.rtt = Median(result.samples);
+    for (size_t s = 1; s < result.samples.size(); s++) {
+      result.jitter += std::abs(result.samples[s] - result.samples[s - 1]);
+    }
+    if (result.samples.size() > 1) {
+      result.jitter /= static_cast<double>(result.samples.size() - 1);
+    }
+  }
+
+  std::stable_sort(results.begin(), results.end(), [](const ProbeResult &a, const ProbeResult &b) {
+    if ((a.received == 0) != (b.received == 0)) {
+      return a.received != 0;
+    }
+    if (a.received == 0) {
+      return false;
+    }
+    if (a.loss() != b.loss()) {
+      return a.loss() < b.loss();
+    }
+    if (a.rtt != b.rtt) {
+      return a.rtt < b.rtt;
+    }
+    return a.jitter < b.jitter;
+  });
+  return results;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,52 @@
+#ifndef WIREGUARD_DART_ENDPOINT_PROBER_H
+#define WIREGUARD_DART_ENDPOINT_PROBER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+struct ProbeTarget {
+  // "host:port" or "[v6]:port", as in a peer's Endpoint.
+  std::string endpoint;
+  // Datagram to send, e.g. a handshake initiation built by the caller. When empty a small echo probe is sent, which
+  // only gets an answer from responders that reflect it.
+  std::vector<uint8_t> payload;
+};
+
+struct ProbeOptions {
+  // Probes sent to every target.
+  int samples = 3;
+  // Milliseconds between two probe rounds.
+  int64_t interval = 100;
+  // Milliseconds to wait for replies after the last round went out.
+  int64_t timeout = 1000;
+};
+
+struct ProbeResult {
+  std::string endpoint;
+  // Numeric address the probes were sent to, empty if the endpoint did not resolve.
+  std::string address;
+  int sent = 0;
+  int received = 0;
+  // Median round trip time in milliseconds, over the replies received.
+  double rtt = 0;
+  // Mean difference between consecutive round trip times in milliseconds.
+  double jitter = 0;
+  // Round trip times in milliseconds, in the order the probes were sent.
+  std::vector<double> samples;
+
+  // Fraction of probes that went unanswered, 1 when nothing was sent.
+  double loss() const { return sent == 0 ? 1.0 : 1.0 - static_cast<double>(received) / sent; }
+};
+
+// Probes all targets concurrently from a single socket per address family and returns one result per target, best
+// first: lowest loss, then lowest median RTT, then lowest jitter. Targets that never answered keep their input order
+// at the end. Returns once every probe was answered or the budget of (samples - 1) * interval + timeout ran out,
+// whichever comes first. Throws std::system_error if no socket can be opened.
+std::vector<ProbeResult> RankEndpoints(const std::vector<ProbeTarget> &targets, const ProbeOptions &options);
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,91 @@
+#include "handshake_watchdog.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace wireguard_dart {
+
+// WireGuard's KEEPALIVE_TIMEOUT, within which a peer that received data answers (whitepaper, section 6.5).
+const int64_t kKeepaliveTimeout = 10000;
+// The peer is stalled once sent bytes went unanswered for as long as it takes WireGuard to give up waiting for an
+// answer and then to send three initiations in a row that go unanswered too.
+const int64_t kUnansweredTimeout = kKeepaliveTimeout + kRekeyTimeout + 3 * kRekeyTimeout;
+
+const int64_t kInitialBackoff = 2000;
+const int64_t kMaxBackoff = 60000;
+
+HandshakeWatchdog::HandshakeWatchdog(uint32_t seed) : random_(seed) {}
+
+void HandshakeWatchdog::Reset() {
+  peers_.clear();
+  degraded_ = false;
+  attempt_ = 0;
+  next_attempt_at_ = 0;
+}
+
+int64_t HandshakeWatchdog::NextBackoff() {
+  int64_t backoff = std::min(kMaxBackoff, kInitialBackoff << std::min(attempt_, 5));
+  std::uniform_int_distribution<int64_t> jitter(-backoff / 5, backoff / 5);
+  return backoff + jitter(random_);
+}
+
+RecoveryStep HandshakeWatchdog::Observe(const std::vector<PeerSample> &peers, int64_t now) {
+  RecoveryStep step;
+  bool any_stalled = false;
+  std::map<WireguardKey, PeerState> next_peers;
+  for (const auto &sample : peers) {
+    auto it = peers_.find(sample.public_key);
+    PeerState state;
+    if (it != peers_.end() && sample.tx_bytes >= it->second.tx_bytes && sample.rx_bytes >= it->second.rx_bytes) {
+      state = it->second;
+      if (sample.last_handshake != state.last_handshake || sample.rx_bytes != state.rx_bytes) {
+        state.unanswered_since = 0;
+      } else if (state.unanswered_since == 0 && sample.tx_bytes != state.tx_bytes) {
+        state.unanswered_since = now;
+      }
+    }
+    // Otherwise this is a new peer or its counters were reset by a reconfiguration: start tracking from here.
+    state.last_handshake = sample.last_handshake;
+    state.rx_bytes = sample.rx_bytes;
+    state.tx_bytes = sample.tx_bytes;
+
+    if (state.unanswered_since != 0 && now - state.unanswered_since >= kUnansweredTimeout && !any_stalled) {
+      any_stalled = true;
+      step.public_key = sample.public_key;
+    }
+    next_peers[sample.public_key] = state;
+  }
+  peers_ = std::move(next_peers);
+
+  if (!any_stalled) {
+    degraded_ = false;
+    attempt_ = 0;
+    next_attempt_at_ = 0;
+    return RecoveryStep();
+  }
+
+  degraded_ = true;
+  if (now < next_attempt_at_) {
+    return RecoveryStep();
+  }
+
+  switch (attempt_) {
+    case 0:
+      step.action = RecoveryAction::reresolve_endpoint;
+      break;
+    case 1:
+      step.action = RecoveryAction::reapply_peer;
+      break;
+    default:
+      step.action = RecoveryAction::restart_tunnel;
+      break;
+  }
+  next_attempt_at_ = now + NextBackoff();
+  attempt_++;
+  return step;
+}
+
+}  // namespace wireguard_dart
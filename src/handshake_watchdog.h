@@ -0,0 +1,76 @@
+#ifndef WIREGUARD_DART_HANDSHAKE_WATCHDOG_H
+#define WIREGUARD_DART_HANDSHAKE_WATCHDOG_H
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// WireGuard retransmits an unanswered handshake initiation every REKEY_TIMEOUT (whitepaper, section 6.1).
+const int64_t kRekeyTimeout = 5000;
+
+struct PeerSample {
+  WireguardKey public_key;
+  // Unix epoch milliseconds, 0 if no handshake has completed yet.
+  int64_t last_handshake;
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+};
+
+enum class RecoveryAction { none, reresolve_endpoint, reapply_peer, restart_tunnel };
+
+struct RecoveryStep {
+  RecoveryAction action = RecoveryAction::none;
+  WireguardKey public_key = {};
+};
+
+// Detects peers that stopped handshaking while the tunnel is nominally up and schedules a recovery ladder:
+// re-resolve the endpoint, reapply the peer, then restart the tunnel, with jittered exponential backoff between
+// attempts. Pure state machine: callers feed periodic samples and perform the returned steps.
+//
+// A peer is stalled once its transmit counter keeps growing for kUnansweredTimeout while its last handshake stays the
+// same and nothing is received from it. A live peer answers data within KEEPALIVE_TIMEOUT, if only with a keepalive;
+// otherwise WireGuard starts a handshake REKEY_TIMEOUT later and retransmits it, so the timeout covers both and three
+// unanswered initiations. Initiations count as transmitted bytes like any other message, so a peer that never
+// completed a handshake or whose session expired is judged the same way, whatever the sizes of the messages. Blind
+// spots: a peer we send nothing to is never stalled, as there is nothing to judge it by; anything received from the
+// peer, a cookie reply under load included, starts the wait over; and a stall is found up to one sampling interval
+// after the timeout.
+class HandshakeWatchdog {
+ public:
+  explicit HandshakeWatchdog(uint32_t seed = std::random_device()());
+
+  // Feeds the current counters of all peers at `now` (Unix epoch milliseconds). Returns the step to perform now.
+  RecoveryStep Observe(const std::vector<PeerSample> &peers, int64_t now);
+
+  // Clears all state, e.g. after a reconnect.
+  void Reset();
+
+  // True while at least one peer is stalled.
+  bool degraded() const { return degraded_; }
+
+ private:
+  struct PeerState {
+    int64_t last_handshake = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    // When we first saw bytes sent to the peer go unanswered, 0 while nothing is outstanding.
+    int64_t unanswered_since = 0;
+  };
+
+  int64_t NextBackoff();
+
+  std::map<WireguardKey, PeerState> peers_;
+  std::mt19937 random_;
+  bool degraded_ = false;
+  int attempt_ = 0;
+  int64_t next_attempt_at_ = 0;
+};
+
+}  // namespace wireguard_dart
+
+#endif
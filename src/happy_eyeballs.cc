@@ -0,0 +1,320 @@
+#include "happy_eyeballs.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+// How long a race winner stays preferred.
+const int64_t kFamilyCacheLifetime = 10 * 60 * 1000;
+// Passes over all candidates before settling for the most preferred one and leaving retries to WireGuard.
+const int kMaxRacePasses = 3;
+const auto kRaceTick = std::chrono::milliseconds(25);
+// Keepalive used while racing a peer configured without one: setting it makes WireGuard send right away, which starts
+// the handshake even when there is no traffic yet.
+const uint16_t kRacingKeepalive = 25;
+
+AddressFamily EndpointFamily(const std::string &endpoint) {
+  std::string host;
+  uint16_t port;
+  IpPrefix address;
+  if (!SplitEndpoint(endpoint, &host, &port) || !ParseIpPrefix(host, &address)) {
+    return AddressFamily::unspecified;
+  }
+  return address.version == 6 ? AddressFamily::ipv6 : AddressFamily::ipv4;
+}
+
+std::vector<std::string> InterleaveAddressFamilies(const std::vector<std::string> &ipv6,
+                                                   const std::vector<std::string> &ipv4, AddressFamily preferred) {
+  const auto &first = preferred == AddressFamily::ipv4 ? ipv4 : ipv6;
+  const auto &second = preferred == AddressFamily::ipv4 ? ipv6 : ipv4;
+  std::vector<std::string> ordered;
+  ordered.reserve(first.size() + second.size());
+  for (size_t i = 0; i < std::max(first.size(), second.size()); i++) {
+    if (i < first.size()) {
+      ordered.push_back(first[i]);
+    }
+    if (i < second.size()) {
+      ordered.push_back(second[i]);
+    }
+  }
+  return ordered;
+}
+
+namespace {
+
+// Shared between the resolver threads and the caller, which may stop waiting before both lookups finished.
+struct Lookup {
+  std::mutex mutex;
+  std::condition_variable done;
+  bool finished[2] = {false, false};
+  std::vector<std::string> endpoints[2];
+};
+
+void LookupFamily(std::shared_ptr<Lookup> lookup, int index, std::string host, uint16_t port) {
+  SocketRuntime runtime;
+  addrinfo hints = {};
+  hints.ai_family = index == 0 ? AF_INET6 : AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  addrinfo *results = nullptr;
+  std::vector<std::string> endpoints;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &results) == 0) {
+    for (addrinfo *result = results; result != nullptr; result = result->ai_next) {
+      char address[NI_MAXHOST] = {};
+      if (getnameinfo(result->ai_addr, static_cast<socklen_t>(result->ai_addrlen), address, sizeof(address), nullptr,
+                      0, NI_NUMERICHOST) != 0) {
+        continue;
+      }
+      std::string endpoint = JoinEndpoint(address, port);
+      if (std::find(endpoints.begin(), endpoints.end(), endpoint) == endpoints.end()) {
+        endpoints.push_back(endpoint);
+      }
+    }
+    freeaddrinfo(results);
+  }
+
+  std::lock_guard<std::mutex> lock(lookup->mutex);
+  lookup->endpoints[index] = std::move(endpoints);
+  lookup->finished[index] = true;
+  lookup->done.notify_all();
+}
+
+}  // namespace
+
+std::vector<std::string> ResolveEndpointCandidates(const std::string &host, uint16_t port, AddressFamily preferred) {
+  auto lookup = std::make_shared<Lookup>();
+  // Detached so that a resolver stuck on one family never holds up the other.
+  std::thread(LookupFamily, lookup, 0, host, port).detach();
+  std::thread(LookupFamily, lookup, 1, host, port).detach();
+
+  std::unique_lock<std::mutex> lock(lookup->mutex);
+  auto answered = [&lookup] {
+    return (lookup->finished[0] && !lookup->endpoints[0].empty()) ||
+           (lookup->finished[1] && !lookup->endpoints[1].empty()) || (lookup->finished[0] && lookup->finished[1]);
+  };
+  if (!lookup->done.wait_for(lock, std::chrono::milliseconds(kResolutionTimeout), answered)) {
+    return {};
+  }
+  lookup->done.wait_for(lock, std::chrono::milliseconds(kResolutionDelay),
+                        [&lookup] { return lookup->finished[0] && lookup->finished[1]; });
+  return InterleaveAddressFamilies(lookup->endpoints[0], lookup->endpoints[1], preferred);
+}
+
+AddressFamily AddressFamilyCache::Preferred(const std::string &host, int64_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(host);
+  if (it == entries_.end()) {
+    return AddressFamily::unspecified;
+  }
+  if (it->second.expires_at <= now) {
+    entries_.erase(it);
+    return AddressFamily::unspecified;
+  }
+  return it->second.family;
+}
+
+void AddressFamilyCache::Record(const std::string &host, AddressFamily family, int64_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[host] = {family, now + kFamilyCacheLifetime};
+}
+
+EndpointRacer::EndpointRacer(std::vector<std::string> candidates) : candidates_(std::move(candidates)) {}
+
+EndpointRacer::Step EndpointRacer::Start(int64_t now) {
+  index_ = 0;
+  passes_ = 0;
+  attempt_delay_ = kConnectionAttemptDelay;
+  next_attempt_at_ = now + attempt_delay_;
+  finished_ = candidates_.empty();
+  if (finished_) {
+    return Step();
+  }
+  return {Action::attempt, candidates_[0]};
+}
+
+EndpointRacer::Step EndpointRacer::Observe(int64_t last_handshake, int64_t now) {
+  if (finished_) {
+    return Step();
+  }
+  if (last_handshake != 0) {
+    finished_ = true;
+    return {Action::committed, candidates_[index_]};
+  }
+  if (now < next_attempt_at_) {
+    return Step();
+  }
+
+  if (++index_ == candidates_.size()) {
+    index_ = 0;
+    if (++passes_ == kMaxRacePasses) {
+      finished_ = true;
+      return {Action::exhausted, candidates_[0]};
+    }
+    // Nothing answered within the delay: the paths may just be slow, so give every candidate longer next time.
+    attempt_delay_ = std::min(attempt_delay_ * 2, kMaxConnectionAttemptDelay);
+  }
+  next_attempt_at_ = now + attempt_delay_;
+  return {Action::attempt, candidates_[index_]};
+}
+
+EndpointRace::~EndpointRace() { Stop(); }
+
+WireguardConfig EndpointRace::Prepare(const WireguardConfig &config) {
+  peers_.clear();
+  WireguardConfig prepared = config;
+  // All host names are resolved at once, so a config with several of them costs one lookup rather than one per peer.
+  std::vector<std::future<std::vector<std::string>>> lookups(prepared.peers.size());
+  std::vector<std::string> hosts(prepared.peers.size());
+  for (size_t i = 0; i < prepared.peers.size(); i++) {
+    const auto &peer = prepared.peers[i];
+    uint16_t port;
+    if (peer.endpoint.empty() || EndpointFamily(peer.endpoint) != AddressFamily::unspecified ||
+        !SplitEndpoint(peer.endpoint, &hosts[i], &port)) {
+      continue;
+    }
+    lookups[i] = std::async(std::launch::async, resolver_, hosts[i], port,
+                            cache_->Preferred(hosts[i], SteadyMillisNow()));
+  }
+  for (size_t i = 0; i < prepared.peers.size(); i++) {
+    if (!lookups[i].valid()) {
+      continue;
+    }
+    auto &peer = prepared.peers[i];
+    auto candidates = lookups[i].get();
+    if (candidates.empty()) {
+      // Leave the host name to whoever configures the tunnel; it will report the failure.
+      continue;
+    }
+    peer.endpoint = candidates.front();
+
+    WireguardKey public_key;
+    if (candidates.size() > 1 && DecodeKey(peer.public_key, &public_key)) {
+      peers_.push_back({peer, public_key, hosts[i], candidates});
+    }
+  }
+  return prepared;
+}
+
+void EndpointRace::Start(ApplyPeer apply_peer, SamplePeers sample_peers) {
+  Stop();
+  if (peers_.empty()) {
+    return;
+  }
+  apply_peer_ = apply_peer;
+  sample_peers_ = sample_peers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+  thread_ = std::thread(&EndpointRace::Run, this);
+}
+
+void EndpointRace::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void EndpointRace::Apply(const RacedPeer &raced, const EndpointRacer::Step &step) {
+  PeerConfig peer = raced.peer;
+  peer.endpoint = step.endpoint;
+  switch (step.action) {
+    case EndpointRacer::Action::none:
+      break;
+    case EndpointRacer::Action::attempt:
+      if (peer.persistent_keepalive == 0) {
+        peer.persistent_keepalive = kRacingKeepalive;
+      }
+      apply_peer_(peer, true);
+      break;
+    case EndpointRacer::Action::committed:
+      cache_->Record(raced.host, EndpointFamily(step.endpoint), SteadyMillisNow());
+      if (raced.peer.persistent_keepalive == 0) {
+        // Drop the racing keepalive without touching the session that just came up.
+        apply_peer_(peer, false);
+      }
+      break;
+    case EndpointRacer::Action::exhausted:
+      apply_peer_(peer, true);
+      break;
+  }
+}
+
+void EndpointRace::Run() {
+  std::vector<EndpointRacer> racers;
+  for (const auto &raced : peers_) {
+    racers.emplace_back(raced.candidates);
+  }
+  bool started = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_condition_.wait_for(lock, kRaceTick, [this] { return stop_; })) {
+    lock.unlock();
+    try {
+      int64_t now = SteadyMillisNow();
+      if (!started) {
+        for (size_t i = 0; i < peers_.size(); i++) {
+          Apply(peers_[i], racers[i].Start(now));
+        }
+        started = true;
+      } else {
+        auto samples = sample_peers_();
+        for (size_t i = 0; i < peers_.size(); i++) {
+          auto sample = std::find_if(samples.begin(), samples.end(), [&](const PeerSample &candidate) {
+            return candidate.public_key == peers_[i].public_key;
+          });
+          Apply(peers_[i], racers[i].Observe(sample != samples.end() ? sample->last_handshake : 0, now));
+        }
+      }
+    } catch (std::exception &e) {
+      // The tunnel may still be coming up; try again on the next tick.
+      std::cerr << "Endpoint race: " << e.what() << std::endl;
+    }
+    if (std::all_of(racers.begin(), racers.end(), [](const EndpointRacer &racer) { return racer.finished(); })) {
+      return;
+    }
+    lock.lock();
+  }
+}
+
+std::vector<std::string> ResolveEndpoints(const std::vector<std::string> &endpoints, AddressFamilyCache *cache,
+                                          const EndpointRace::Resolver &resolver) {
+  std::vector<std::future<std::vector<std::string>>> lookups(endpoints.size());
+  for (size_t i = 0; i < endpoints.size(); i++) {
+    std::string host;
+    uint16_t port;
+    if (endpoints[i].empty() || EndpointFamily(endpoints[i]) != AddressFamily::unspecified ||
+        !SplitEndpoint(endpoints[i], &host, &port)) {
+      continue;
+    }
+    lookups[i] = std::async(std::launch::async, resolver, host, port, cache->Preferred(host, SteadyMillisNow()));
+  }
+  std::vector<std::string> resolved = endpoints;
+  for (size_t i = 0; i < endpoints.size(); i++) {
+    if (!lookups[i].valid()) {
+      continue;
+    }
+    std::vector<std::string> candidates = lookups[i].get();
+    if (candidates.empty()) {
+      throw std::invalid_argument("Cannot resolve endpoint '" + endpoints[i] + "'");
+    }
+    resolved[i] = candidates.front();
+  }
+  return resolved;
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,147 @@
+#ifndef WIREGUARD_DART_HAPPY_EYEBALLS_H
+#define WIREGUARD_DART_HAPPY_EYEBALLS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+enum class AddressFamily { unspecified, ipv4, ipv6 };
+
+// RFC 8305 section 3: once one family answered, how long to wait for the other before going ahead.
+const int64_t kResolutionDelay = 50;
+// How long a host name may take to resolve at all before it is left as it is, so that a stuck resolver never holds up
+// connect.
+const int64_t kResolutionTimeout = 5000;
+// RFC 8305 section 5: delay between two attempts, grown for every pass over all candidates up to the maximum.
+const int64_t kConnectionAttemptDelay = 250;
+const int64_t kMaxConnectionAttemptDelay = 2000;
+
+// Family of an IP literal endpoint such as "192.0.2.1:51820" or "[2001:db8::1]:51820"; unspecified for host names.
+AddressFamily EndpointFamily(const std::string &endpoint);
+
+// Orders candidates per RFC 8305 section 4: alternate between the families, starting with `preferred` (IPv6 when
+// unspecified).
+std::vector<std::string> InterleaveAddressFamilies(const std::vector<std::string> &ipv6,
+                                                   const std::vector<std::string> &ipv4, AddressFamily preferred);
+
+// Looks up AAAA and A records of `host` concurrently and returns "address:port" endpoints in attempt order. Waits at
+// most kResolutionDelay for the second family once the first one answered. Empty if the host did not resolve within
+// kResolutionTimeout.
+std::vector<std::string> ResolveEndpointCandidates(const std::string &host, uint16_t port, AddressFamily preferred);
+
+// Remembers which address family won the last race per host, so later connects try it first.
+class AddressFamilyCache {
+ public:
+  AddressFamily Preferred(const std::string &host, int64_t now);
+  void Record(const std::string &host, AddressFamily family, int64_t now);
+
+ private:
+  struct Entry {
+    AddressFamily family;
+    int64_t expires_at;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+};
+
+// Attempt schedule for one peer with several candidate endpoints. A WireGuard peer has a single endpoint and a single
+// pending handshake, so attempts are staggered rather than overlapping: every attempt recreates the peer with the
+// next candidate and the first one whose handshake completes wins. Pure state machine driven by EndpointRace.
+class EndpointRacer {
+ public:
+  enum class Action { none, attempt, committed, exhausted };
+
+  struct Step {
+    Action action = Action::none;
+    std::string endpoint;
+  };
+
+  explicit EndpointRacer(std::vector<std::string> candidates);
+
+  // Returns the first attempt.
+  Step Start(int64_t now);
+
+  // Feeds the last handshake time of the peer as recreated by the current attempt, 0 while none has completed.
+  Step Observe(int64_t last_handshake, int64_t now);
+
+  bool finished() const { return finished_; }
+
+ private:
+  std::vector<std::string> candidates_;
+  size_t index_ = 0;
+  int passes_ = 0;
+  int64_t attempt_delay_ = kConnectionAttemptDelay;
+  int64_t next_attempt_at_ = 0;
+  bool finished_ = false;
+};
+
+// Resolves the endpoint host names of a config and races their addresses once the tunnel is up.
+class EndpointRace {
+ public:
+  // Called concurrently for the peers of a config.
+  using Resolver =
+      std::function<std::vector<std::string>(const std::string &host, uint16_t port, AddressFamily preferred)>;
+  // Applies `peer`. With `restart` the peer is removed and added again so it starts a fresh handshake right away;
+  // otherwise it is updated in place.
+  using ApplyPeer = std::function<void(const PeerConfig &peer, bool restart)>;
+  // Returns the current state of the tunnel's peers. May throw while the tunnel is still coming up.
+  using SamplePeers = std::function<std::vector<PeerSample>()>;
+
+  explicit EndpointRace(AddressFamilyCache *cache, Resolver resolver = ResolveEndpointCandidates)
+      : cache_(cache), resolver_(resolver) {}
+  ~EndpointRace();
+
+  EndpointRace(const EndpointRace &) = delete;
+  EndpointRace &operator=(const EndpointRace &) = delete;
+
+  // Returns a copy of `config` whose host name endpoints are replaced by their most preferred address. Peers with more
+  // than one address are remembered for Start.
+  WireguardConfig Prepare(const WireguardConfig &config);
+
+  // Races the peers found by Prepare on a background thread until each committed to an address.
+  void Start(ApplyPeer apply_peer, SamplePeers sample_peers);
+  void Stop();
+
+ private:
+  struct RacedPeer {
+    PeerConfig peer;
+    WireguardKey public_key;
+    std::string host;
+    std::vector<std::string> candidates;
+  };
+
+  void Run();
+  void Apply(const RacedPeer &raced, const EndpointRacer::Step &step);
+
+  AddressFamilyCache *cache_;
+  Resolver resolver_;
+  std::vector<RacedPeer> peers_;
+  ApplyPeer apply_peer_;
+  SamplePeers sample_peers_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_ = false;
+};
+
+// Replaces host name endpoints with their most preferred address, looking all of them up at once with `resolver` and
+// preferring the family that last won the race for each host. IP literals, empty entries and entries without a port
+// are kept. Throws std::invalid_argument naming the first host name that did not resolve.
+std::vector<std::string> ResolveEndpoints(const std::vector<std::string> &endpoints, AddressFamilyCache *cache,
+                                          const EndpointRace::Resolver &resolver = ResolveEndpointCandidates);
+
+}  // namespace wireguard_dart
+
+#endif
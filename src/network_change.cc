@@ -0,0 +1,30 @@
+#include "network_change.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace wireguard_dart {
+
+void NetworkChangeDebouncer::Notify(int64_t now) {
+  if (first_ < 0) {
+    first_ = now;
+  }
+  last_ = now;
+}
+
+int64_t NetworkChangeDebouncer::deadline() const {
+  if (first_ < 0) {
+    return -1;
+  }
+  return std::min(last_ + settle_, first_ + max_delay_);
+}
+
+bool NetworkChangeDebouncer::Due(int64_t now) {
+  if (first_ < 0 || now < deadline()) {
+    return false;
+  }
+  first_ = -1;
+  return true;
+}
+
+}  // namespace wireguard_dart
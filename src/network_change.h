@@ -0,0 +1,40 @@
+#ifndef WIREGUARD_DART_NETWORK_CHANGE_H
+#define WIREGUARD_DART_NETWORK_CHANGE_H
+
+#include <cstdint>
+
+namespace wireguard_dart {
+
+// Coalesces the bursts of link, address and route notifications the OS sends while Wi-Fi roams or a cable is plugged
+// in into a single rebind of the running tunnel. A rebind is due once the notifications have been quiet for `settle`
+// milliseconds, but no later than `max_delay` after the first of the burst, so that recovery stays under a second
+// even while the network keeps changing. Pure state machine: callers feed notifications with a monotonic clock and
+// ask when to act.
+class NetworkChangeDebouncer {
+ public:
+  explicit NetworkChangeDebouncer(int64_t settle = 200, int64_t max_delay = 750)
+      : settle_(settle), max_delay_(max_delay) {}
+
+  // Records a notification at `now`.
+  void Notify(int64_t now);
+
+  // True if a rebind is due at `now`. The burst is then consumed.
+  bool Due(int64_t now);
+
+  // When the pending rebind becomes due, -1 if none is pending.
+  int64_t deadline() const;
+
+  // Drops a pending rebind, e.g. when the tunnel goes down.
+  void Reset() { first_ = -1; }
+
+ private:
+  int64_t settle_;
+  int64_t max_delay_;
+  // First and last notification of the pending burst; first_ is -1 if there is none.
+  int64_t first_ = -1;
+  int64_t last_ = -1;
+};
+
+}  // namespace wireguard_dart
+
+#endif
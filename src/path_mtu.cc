@@ -0,0 +1,147 @@
+#include "path_mtu.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "socket_util.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+#ifdef _WIN32
+const int kMessageTooBig = WSAEMSGSIZE;
+#else
+const int kMessageTooBig = EMSGSIZE;
+#endif
+
+// Forbids fragmentation of the socket's datagrams, so that oversized ones fail instead.
+bool SetDontFragment(Socket fd, int family) {
+#ifdef _WIN32
+  DWORD enabled = 1;
+  if (family == AF_INET) {
+    return setsockopt(fd, IPPROTO_IP, IP_DONTFRAGMENT, reinterpret_cast<const char *>(&enabled), sizeof(enabled)) == 0;
+  }
+  return setsockopt(fd, IPPROTO_IPV6, IPV6_DONTFRAG, reinterpret_cast<const char *>(&enabled), sizeof(enabled)) == 0;
+#else
+  if (family == AF_INET) {
+    int mode = IP_PMTUDISC_DO;
+    return setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == 0;
+  }
+  int mode = IPV6_PMTUDISC_DO;
+  return setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &mode, sizeof(mode)) == 0;
+#endif
+}
+
+// The path MTU the stack learned for the connected socket, 0 if it cannot tell.
+int KnownPathMtu(Socket fd, int family) {
+#if defined(IP_MTU) && defined(IPV6_MTU)
+#ifdef _WIN32
+  DWORD mtu = 0;
+#else
+  int mtu = 0;
+#endif
+  socklen_t length = sizeof(mtu);
+  int result = family == AF_INET
+                   ? getsockopt(fd, IPPROTO_IP, IP_MTU, reinterpret_cast<char *>(&mtu), &length)
+                   : getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, reinterpret_cast<char *>(&mtu), &length);
+  return result == 0 ? static_cast<int>(mtu) : 0;
+#else
+  return 0;
+#endif
+}
+
+// Records that `size` did not pass, and that anything above the path MTU the stack learned will not either.
+void RecordTooBig(PathMtuSearch *search, Socket fd, int family, int size) {
+  search->TooBig(size);
+  int known = KnownPathMtu(fd, family);
+  if (known > 0 && known < size) {
+    search->TooBig(known + 1);
+  }
+}
+
+}  // namespace
+
+void PathMtuSearch::Passed(int size) { low_ = std::max(low_, std::min(size, high_)); }
+
+void PathMtuSearch::TooBig(int size) { high_ = std::max(low_, std::min(high_, size - 1)); }
+
+int DiscoverPathMtu(const std::string &endpoint, const PathMtuOptions &options) {
+  std::string host;
+  uint16_t port = 0;
+  if (!SplitEndpoint(endpoint, &host, &port)) {
+    return 0;
+  }
+  SocketRuntime runtime;
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  addrinfo *results = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0 || results == nullptr) {
+    return 0;
+  }
+  sockaddr_storage address = {};
+  std::memcpy(&address, results->ai_addr, results->ai_addrlen);
+  auto address_length = static_cast<socklen_t>(results->ai_addrlen);
+  freeaddrinfo(results);
+  int family = address.ss_family;
+
+  Socket fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd == kInvalidSocket) {
+    return 0;
+  }
+  if (options.prepare_socket) {
+    options.prepare_socket(fd, family);
+  }
+  if (!SetDontFragment(fd, family) || connect(fd, reinterpret_cast<const sockaddr *>(&address), address_length) != 0 ||
+      !SetNonBlocking(fd)) {
+    CloseSocket(fd);
+    return 0;
+  }
+
+  int headers = family == AF_INET ? 20 + 8 : 40 + 8;
+  std::vector<char> probe(options.max_mtu, 0);
+  PathMtuSearch search(options.min_mtu, options.max_mtu);
+  bool sent_any = false;
+  while (!search.done()) {
+    if (options.cancelled != nullptr && *options.cancelled) {
+      CloseSocket(fd);
+      return 0;
+    }
+    int size = search.Next();
+    if (send(fd, probe.data(), size - headers, 0) < 0) {
+      if (LastSocketError() != kMessageTooBig) {
+        break;
+      }
+      RecordTooBig(&search, fd, family, size);
+      continue;
+    }
+    sent_any = true;
+
+    pollfd descriptor = {};
+    descriptor.fd = fd;
+    descriptor.events = POLLIN;
+    if (Poll(&descriptor, 1, static_cast<int>(options.timeout)) > 0) {
+      char reply[64];
+      // Anything but an error for a too big datagram means it arrived, e.g. a port unreachable from the far end.
+      if (recv(fd, reply, sizeof(reply), 0) < 0 && LastSocketError() == kMessageTooBig) {
+        RecordTooBig(&search, fd, family, size);
+        continue;
+      }
+    }
+    search.Passed(size);
+  }
+  CloseSocket(fd);
+  return sent_any || search.done() ? search.result() : 0;
+}
+
+uint32_t TunnelMtu(int path_mtu, int family) {
+  return static_cast<uint32_t>(path_mtu - (family == AF_INET ? kWireguardOverheadIpv4 : kWireguardOverheadIpv6));
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,69 @@
+#ifndef WIREGUARD_DART_PATH_MTU_H
+#define WIREGUARD_DART_PATH_MTU_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+// Bytes WireGuard adds to every packet it tunnels: the outer IP and UDP headers, and 32 bytes of data message header
+// and authentication tag.
+const int kWireguardOverheadIpv4 = 20 + 8 + 32;
+const int kWireguardOverheadIpv6 = 40 + 8 + 32;
+
+struct PathMtuOptions {
+  // Range of path MTUs to search, in bytes of outer IP packet. The smallest is assumed to pass; 1280 is the least a
+  // tunnel carrying IPv6 can work with anyway.
+  int min_mtu = 1280;
+  int max_mtu = 1500;
+  // Milliseconds to wait for an ICMP "fragmentation needed" or "packet too big" after a probe went out.
+  int64_t timeout = 200;
+  // Called with the probe socket and its address family before it is connected, e.g. to set the firewall mark or
+  // interface that routes the tunnel's own packets around the tunnel.
+  std::function<void(Socket fd, int family)> prepare_socket;
+  // Checked before every probe; once set, the search gives up and finds nothing. Lets the caller stop a discovery
+  // within one timeout without waiting for it.
+  const std::atomic<bool> *cancelled = nullptr;
+};
+
+// Binary search over packet sizes between one known to pass and an upper bound. Pure state machine: callers probe
+// Next() and report the outcome.
+class PathMtuSearch {
+ public:
+  // `low` is assumed to pass; `high` is the largest size worth trying.
+  PathMtuSearch(int low, int high) : low_(low), high_(high) {}
+
+  bool done() const { return low_ >= high_; }
+
+  // The size to probe next, halfway into the unknown range.
+  int Next() const { return low_ + (high_ - low_ + 1) / 2; }
+
+  void Passed(int size);
+  void TooBig(int size);
+
+  // The largest size known to pass.
+  int result() const { return low_; }
+
+ private:
+  int low_;
+  int high_;
+};
+
+// Finds the path MTU to `endpoint` ("host:port") with UDP probes that must not be fragmented, the way RFC 1191 and
+// RFC 8201 describe: a probe the local stack refuses, or that is answered by an ICMP "too big", is too big, and every
+// other probe is taken to have passed. The WireGuard peer itself drops the probes. Takes up to about log2(max_mtu -
+// min_mtu) probes, each waiting at most `timeout` unless the stack reports the limit right away. Returns the largest
+// size in [min_mtu, max_mtu] that passed, or 0 if the endpoint does not resolve, probes cannot be sent or the search
+// was cancelled.
+int DiscoverPathMtu(const std::string &endpoint, const PathMtuOptions &options = PathMtuOptions());
+
+// The tunnel MTU for a path MTU to an endpoint of the given family (AF_INET or AF_INET6).
+uint32_t TunnelMtu(int path_mtu, int family);
+
+}  // namespace wireguard_dart
+
+#endif
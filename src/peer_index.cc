@@ -0,0 +1,150 @@
+#include "peer_index.h"
+
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace wireguard_dart {
+
+namespace {
+
+WireguardKey RequireKey(const std::string &base64) {
+  WireguardKey key;
+  if (!DecodeKey(base64, &key)) {
+    throw std::invalid_argument("Invalid key: " + base64);
+  }
+  return key;
+}
+
+void ValidateEndpoint(const std::string &endpoint) {
+  std::string host;
+  uint16_t port;
+  if (!endpoint.empty() && !SplitEndpoint(endpoint, &host, &port)) {
+    throw std::invalid_argument("Invalid endpoint: " + endpoint);
+  }
+}
+
+void ValidateAllowedIps(const std::vector<std::string> &allowed_ips) {
+  for (const auto &text : allowed_ips) {
+    IpPrefix prefix;
+    if (!ParseIpPrefix(text, &prefix)) {
+      throw std::invalid_argument("Invalid allowed IP: " + text);
+    }
+  }
+}
+
+}  // namespace
+
+void PeerIndex::Reset(const std::vector<PeerConfig> &peers) {
+  std::unordered_map<WireguardKey, PeerConfig, WireguardKeyHash> index;
+  index.reserve(peers.size());
+  for (const auto &peer : peers) {
+    index[RequireKey(peer.public_key)] = peer;
+  }
+  peers_ = std::move(index);
+}
+
+const PeerConfig *PeerIndex::Find(const std::string &public_key) const {
+  WireguardKey key;
+  if (!DecodeKey(public_key, &key)) {
+    return nullptr;
+  }
+  auto found = peers_.find(key);
+  return found != peers_.end() ? &found->second : nullptr;
+}
+
+void PeerIndex::Add(const std::vector<PeerConfig> &peers, const Apply &apply) {
+  std::vector<WireguardKey> keys;
+  keys.reserve(peers.size());
+  std::vector<PeerChange> changes;
+  changes.reserve(peers.size());
+  for (const auto &peer : peers) {
+    keys.push_back(RequireKey(peer.public_key));
+    if (!peer.preshared_key.empty()) {
+      RequireKey(peer.preshared_key);
+    }
+    ValidateEndpoint(peer.endpoint);
+    ValidateAllowedIps(peer.allowed_ips);
+    changes.push_back({PeerChange::Kind::add, peer});
+  }
+  if (changes.empty()) {
+    return;
+  }
+
+  apply(changes);
+  for (size_t i = 0; i < peers.size(); i++) {
+    peers_[keys[i]] = peers[i];
+  }
+}
+
+void PeerIndex::Update(const std::vector<PeerUpdate> &updates, const Apply &apply) {
+  std::vector<PeerChange> changes;
+  changes.reserve(updates.size());
+  // The settings after the update, in the order of `updates`. Repeated keys see the earlier updates of the batch.
+  std::unordered_map<WireguardKey, PeerConfig, WireguardKeyHash> updated;
+  for (const auto &update : updates) {
+    WireguardKey key = RequireKey(update.public_key);
+    auto current = updated.find(key);
+    if (current == updated.end()) {
+      auto recorded = peers_.find(key);
+      if (recorded == peers_.end()) {
+        throw std::invalid_argument("Unknown peer: " + update.public_key);
+      }
+      current = updated.emplace(key, recorded->second).first;
+    }
+    PeerConfig &peer = current->second;
+
+    PeerChange change = {PeerChange::Kind::update, PeerConfig()};
+    change.peer.public_key = peer.public_key;
+    if (update.endpoint.has_value()) {
+      ValidateEndpoint(*update.endpoint);
+      peer.endpoint = *update.endpoint;
+      change.peer.endpoint = *update.endpoint;
+    }
+    if (update.persistent_keepalive.has_value()) {
+      peer.persistent_keepalive = *update.persistent_keepalive;
+    }
+    change.peer.persistent_keepalive = peer.persistent_keepalive;
+    if (update.allowed_ips.has_value()) {
+      ValidateAllowedIps(*update.allowed_ips);
+      peer.allowed_ips = *update.allowed_ips;
+      change.peer.allowed_ips = *update.allowed_ips;
+      change.replace_allowed_ips = true;
+    }
+    changes.push_back(std::move(change));
+  }
+  if (changes.empty()) {
+    return;
+  }
+
+  apply(changes);
+  for (auto &entry : updated) {
+    peers_[entry.first] = std::move(entry.second);
+  }
+}
+
+void PeerIndex::Remove(const std::vector<std::string> &public_keys, const Apply &apply) {
+  std::vector<PeerChange> changes;
+  std::unordered_set<WireguardKey, WireguardKeyHash> removed;
+  for (const auto &public_key : public_keys) {
+    WireguardKey key = RequireKey(public_key);
+    if (peers_.count(key) == 0 || !removed.insert(key).second) {
+      continue;
+    }
+    PeerChange change = {PeerChange::Kind::remove, PeerConfig()};
+    change.peer.public_key = public_key;
+    changes.push_back(std::move(change));
+  }
+  if (changes.empty()) {
+    return;
+  }
+
+  apply(changes);
+  for (const auto &key : removed) {
+    peers_.erase(key);
+  }
+}
+
+}  // namespace wireguard_dart
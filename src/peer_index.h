@@ -0,0 +1,83 @@
+#ifndef WIREGUARD_DART_PEER_INDEX_H
+#define WIREGUARD_DART_PEER_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Keys are uniformly random, so any 8 of their bytes make a good hash.
+struct WireguardKeyHash {
+  size_t operator()(const WireguardKey &key) const {
+    uint64_t hash;
+    memcpy(&hash, key.data(), sizeof(hash));
+    return static_cast<size_t>(hash);
+  }
+};
+
+// Fields of a peer to change; unset ones keep their current value.
+struct PeerUpdate {
+  std::string public_key;
+  std::optional<std::string> endpoint;
+  std::optional<uint16_t> persistent_keepalive;
+  std::optional<std::vector<std::string>> allowed_ips;
+};
+
+// A change of one peer, in the terms both the Linux and the Windows device APIs take.
+struct PeerChange {
+  enum class Kind {
+    // Creates the peer, or replaces all settings of an existing one without resetting its session.
+    add,
+    // Changes an existing peer: its keepalive, and its endpoint and allowed IPs where `peer` has them.
+    update,
+    remove,
+  };
+
+  Kind kind;
+  PeerConfig peer;
+  // For updates: `peer.allowed_ips` replaces the current ones.
+  bool replace_allowed_ips = false;
+};
+
+// The peers of a running tunnel keyed by public key, so that peers can be added, updated and removed in batches of
+// deltas instead of rewriting the whole configuration.
+class PeerIndex {
+ public:
+  // Applies changes to the device, throwing if that fails.
+  using Apply = std::function<void(const std::vector<PeerChange> &)>;
+
+  // Starts over with the peers of a freshly applied configuration. Throws std::invalid_argument on a malformed key.
+  void Reset(const std::vector<PeerConfig> &peers);
+
+  size_t size() const { return peers_.size(); }
+
+  // The recorded peer, or nullptr.
+  const PeerConfig *Find(const std::string &public_key) const;
+
+  // Adds `peers`, replacing the settings of those that exist already.
+  void Add(const std::vector<PeerConfig> &peers, const Apply &apply);
+
+  // Changes existing peers.
+  void Update(const std::vector<PeerUpdate> &updates, const Apply &apply);
+
+  // Removes peers. Keys of peers that are not there are skipped.
+  void Remove(const std::vector<std::string> &public_keys, const Apply &apply);
+
+  // All three validate the whole batch first and throw std::invalid_argument, with nothing applied, on a malformed key,
+  // endpoint or allowed IP, or on an update of an unknown peer. The index only changes once `apply` succeeds.
+
+ private:
+  std::unordered_map<WireguardKey, PeerConfig, WireguardKeyHash> peers_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,301 @@
+#include "quality_prober.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Probe: magic, sequence number and per-run nonce, echoed back verbatim by the responder.
+const uint32_t kProbeMagic = 0x77676471;  // "wgdq"
+const size_t kProbeSize = 12;
+
+// Round trip times in milliseconds the sketches hold.
+const double kSketchAccuracy = 0.02;
+const double kMinRtt = 0.01;
+const double kMaxRtt = 60000;
+
+void PutU32(uint8_t *out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+  }
+}
+
+uint32_t GetU32(const uint8_t *in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+bool SameAddress(const sockaddr_storage &a, const sockaddr_storage &b) {
+  if (a.ss_family != b.ss_family) {
+    return false;
+  }
+  if (a.ss_family == AF_INET) {
+    auto x = reinterpret_cast<const sockaddr_in *>(&a);
+    auto y = reinterpret_cast<const sockaddr_in *>(&b);
+    return x->sin_port == y->sin_port && memcmp(&x->sin_addr, &y->sin_addr, sizeof(x->sin_addr)) == 0;
+  }
+  auto x = reinterpret_cast<const sockaddr_in6 *>(&a);
+  auto y = reinterpret_cast<const sockaddr_in6 *>(&b);
+  return x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+}
+
+}  // namespace
+
+QuantileSketch::QuantileSketch(double relative_accuracy, double min, double max)
+    : gamma_((1 + relative_accuracy) / (1 - relative_accuracy)), log_gamma_(std::log(gamma_)), min_(min), max_(max) {
+  counts_.resize(static_cast<size_t>(std::ceil(std::log(max_ / min_) / log_gamma_)) + 1);
+}
+
+void QuantileSketch::Add(double value) {
+  value = std::min(std::max(value, min_), max_);
+  size_t bucket = static_cast<size_t>(std::ceil(std::log(value / min_) / log_gamma_));
+  counts_[std::min(bucket, counts_.size() - 1)]++;
+  count_++;
+}
+
+void QuantileSketch::Merge(const QuantileSketch &other) {
+  for (size_t i = 0; i < counts_.size() && i < other.counts_.size(); i++) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+}
+
+void QuantileSketch::Clear() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  count_ = 0;
+}
+
+double QuantileSketch::Quantile(double q) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  // Rank of the wanted value, counted from 0.
+  uint64_t rank = static_cast<uint64_t>(std::max(0.0, std::min(q, 1.0)) * static_cast<double>(count_ - 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    seen += counts_[i];
+    if (seen > rank) {
+      // Bucket i holds (min * gamma^(i-1), min * gamma^i]; the point that is within the accuracy of both ends.
+      return i == 0 ? min_ : 2 * min_ * std::pow(gamma_, static_cast<double>(i)) / (gamma_ + 1);
+    }
+  }
+  return max_;
+}
+
+QualityEstimator::QualityEstimator()
+    : current_(kSketchAccuracy, kMinRtt, kMaxRtt), previous_(kSketchAccuracy, kMinRtt, kMaxRtt) {}
+
+void QualityEstimator::OnReply(double rtt) {
+  if (current_.count() >= static_cast<uint64_t>(kRttWindow)) {
+    std::swap(current_, previous_);
+    current_.Clear();
+  }
+  current_.Add(rtt);
+  if (last_rtt_ >= 0) {
+    jitter_ += (std::fabs(rtt - last_rtt_) - jitter_) / 16;
+  }
+  last_rtt_ = rtt;
+  received_++;
+  Record(false);
+}
+
+void QualityEstimator::OnLoss() { Record(true); }
+
+void QualityEstimator::Record(bool lost) {
+  lost_[sent_ % kLossWindow] = lost;
+  sent_++;
+}
+
+LinkQuality QualityEstimator::quality() const {
+  LinkQuality quality;
+  QuantileSketch rtts = current_;
+  rtts.Merge(previous_);
+  quality.rtt_median = rtts.Quantile(0.5);
+  quality.rtt_p90 = rtts.Quantile(0.9);
+  quality.rtt_p99 = rtts.Quantile(0.99);
+  quality.jitter = jitter_;
+  uint64_t outcomes = std::min<uint64_t>(sent_, kLossWindow);
+  quality.loss = outcomes == 0 ? 0 : static_cast<double>(lost_.count()) / static_cast<double>(outcomes);
+  quality.sent = sent_;
+  quality.received = received_;
+  return quality;
+}
+
+QualityProber::~QualityProber() { Stop(); }
+
+void QualityProber::Start(const QualityProbeOptions &options, OnQuality on_quality) {
+  Stop();
+  std::string host;
+  uint16_t port = 0;
+  addrinfo hints = {};
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  addrinfo *results = nullptr;
+  if (!SplitEndpoint(options.target, &host, &port) ||
+      getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0 || results == nullptr) {
+    throw std::invalid_argument("Invalid probe target: " + options.target);
+  }
+  memcpy(&target_, results->ai_addr, results->ai_addrlen);
+  target_length_ = static_cast<socklen_t>(results->ai_addrlen);
+  freeaddrinfo(results);
+
+  Socket fd = socket(target_.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd == kInvalidSocket) {
+    throw std::system_error(LastSocketError(), std::system_category(), "Failed to open probe socket");
+  }
+  // Bound to the wildcard address, the socket also takes datagrams from loopback, which Stop wakes it with.
+  sockaddr_storage local = {};
+  local.ss_family = target_.ss_family;
+  socklen_t local_length =
+      target_.ss_family == AF_INET ? sizeof(sockaddr_in) : static_cast<socklen_t>(sizeof(sockaddr_in6));
+  if (!SetNonBlocking(fd) || bind(fd, reinterpret_cast<sockaddr *>(&local), local_length) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&local), &local_length) != 0) {
+    int error = LastSocketError();
+    CloseSocket(fd);
+    throw std::system_error(error, std::system_category(), "Failed to open probe socket");
+  }
+  if (local.ss_family == AF_INET) {
+    reinterpret_cast<sockaddr_in *>(&local)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  } else {
+    reinterpret_cast<sockaddr_in6 *>(&local)->sin6_addr = in6addr_loopback;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+  options_.interval = std::max<int64_t>(options_.interval, 1);
+  options_.timeout = std::max<int64_t>(options_.timeout, 1);
+  on_quality_ = on_quality;
+  estimator_ = QualityEstimator();
+  socket_ = fd;
+  wake_address_ = local;
+  wake_address_length_ = local_length;
+  stop_ = false;
+  running_ = true;
+  thread_ = std::thread(&QualityProber::Run, this);
+}
+
+void QualityProber::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    stop_ = true;
+    char wake = 0;
+    sendto(socket_, &wake, 1, 0, reinterpret_cast<const sockaddr *>(&wake_address_), wake_address_length_);
+  }
+  thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  CloseSocket(socket_);
+  socket_ = kInvalidSocket;
+  running_ = false;
+}
+
+std::optional<LinkQuality> QualityProber::quality() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!running_) {
+    return std::nullopt;
+  }
+  return estimator_.quality();
+}
+
+void QualityProber::Run() {
+  const std::chrono::milliseconds interval(options_.interval);
+  const std::chrono::milliseconds timeout(options_.timeout);
+  const uint32_t nonce = std::random_device()();
+  uint32_t sequence = 0;
+  // Probes in flight by sequence number; at most timeout / interval + 1 of them.
+  std::map<uint32_t, Clock::time_point> in_flight;
+  Clock::time_point next_probe = Clock::now();
+  uint8_t probe[kProbeSize];
+  uint8_t buffer[64];
+
+  for (;;) {
+    Clock::time_point now = Clock::now();
+    bool changed = false;
+    while (!in_flight.empty() && now - in_flight.begin()->second >= timeout) {
+      in_flight.erase(in_flight.begin());
+      std::lock_guard<std::mutex> lock(mutex_);
+      estimator_.OnLoss();
+      changed = true;
+    }
+    if (now >= next_probe) {
+      PutU32(probe, kProbeMagic);
+      PutU32(probe + 4, sequence);
+      PutU32(probe + 8, nonce);
+      // A probe that cannot be sent, e.g. while the tunnel is being set up again, is lost like one without reply.
+      sendto(socket_, reinterpret_cast<const char *>(probe), sizeof(probe), 0,
+             reinterpret_cast<const sockaddr *>(&target_), target_length_);
+      in_flight[sequence++] = now;
+      // Probes keep their pace after a stall rather than catching up in a burst.
+      next_probe = std::max(next_probe + interval, now);
+    }
+
+    Clock::time_point wake = next_probe;
+    if (!in_flight.empty()) {
+      wake = std::min(wake, in_flight.begin()->second + timeout);
+    }
+    pollfd fds = {};
+    fds.fd = socket_;
+    fds.events = POLLIN;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+    int ready = Poll(&fds, 1, static_cast<int>(wait));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        return;
+      }
+    }
+    while (ready > 0) {
+      sockaddr_storage from = {};
+      socklen_t from_length = sizeof(from);
+      int length = static_cast<int>(recvfrom(socket_, reinterpret_cast<char *>(buffer), sizeof(buffer), 0,
+                                             reinterpret_cast<sockaddr *>(&from), &from_length));
+      if (length < 0) {
+        break;
+      }
+      Clock::time_point received_at = Clock::now();
+      if (static_cast<size_t>(length) != kProbeSize || !SameAddress(from, target_) || GetU32(buffer) != kProbeMagic ||
+          GetU32(buffer + 8) != nonce) {
+        continue;
+      }
+      // Late replies to probes already counted as lost are ignored.
+      auto probe_sent = in_flight.find(GetU32(buffer + 4));
+      if (probe_sent == in_flight.end()) {
+        continue;
+      }
+      double rtt = std::chrono::duration<double, std::milli>(received_at - probe_sent->second).count();
+      in_flight.erase(probe_sent);
+      std::lock_guard<std::mutex> lock(mutex_);
+      estimator_.OnReply(rtt);
+      changed = true;
+    }
+
+    if (changed && on_quality_) {
+      LinkQuality quality;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quality = estimator_.quality();
+      }
+      try {
+        on_quality_(quality);
+      } catch (std::exception &e) {
+        std::cerr << "Quality prober: " << e.what() << std::endl;
+      }
+    }
+  }
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,172 @@
+#include "route_calculator.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+namespace {
+
+int Bit(const IpPrefix &prefix, int index) { return (prefix.address[index / 8] >> (7 - index % 8)) & 1; }
+
+void SetBit(IpPrefix &prefix, int index, int value) {
+  uint8_t mask = static_cast<uint8_t>(0x80 >> (index % 8));
+  if (value != 0) {
+    prefix.address[index / 8] |= mask;
+  } else {
+    prefix.address[index / 8] &= static_cast<uint8_t>(~mask);
+  }
+}
+
+std::vector<IpPrefix> ParsePrefixes(const std::vector<std::string> &texts, const char *what) {
+  std::vector<IpPrefix> prefixes;
+  prefixes.reserve(texts.size());
+  for (const auto &text : texts) {
+    IpPrefix prefix;
+    if (!ParseIpPrefix(text, &prefix)) {
+      throw std::invalid_argument(std::string("Invalid ") + what + ": " + text);
+    }
+    prefixes.push_back(prefix);
+  }
+  return prefixes;
+}
+
+}  // namespace
+
+PrefixTrie::PrefixTrie(int version) : version_(version), nodes_(1) {}
+
+uint32_t PrefixTrie::AddNode(uint32_t first, uint32_t second) {
+  nodes_.emplace_back();
+  nodes_.back().children[0] = first;
+  nodes_.back().children[1] = second;
+  return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+void PrefixTrie::Include(const IpPrefix &prefix) {
+  if (prefix.version != version_) {
+    return;
+  }
+  // Where every node on the way down hangs, to collapse it once both its halves are covered. kEmpty as parent
+  // stands for the root slot.
+  uint32_t parents[128];
+  int bits[128];
+  uint32_t parent = kEmpty;
+  int bit = 0;
+  for (int depth = 0; depth < prefix.length; depth++) {
+    uint32_t slot = Slot(parent, bit);
+    if (slot == kFull) {
+      return;
+    }
+    if (slot == kEmpty) {
+      slot = AddNode(kEmpty, kEmpty);
+      Slot(parent, bit) = slot;
+    }
+    parents[depth] = parent;
+    bits[depth] = bit;
+    parent = slot;
+    bit = Bit(prefix, depth);
+  }
+  // Whatever was below is covered now; its nodes stay in the arena unused.
+  Slot(parent, bit) = kFull;
+  for (int depth = prefix.length; parent != kEmpty && nodes_[parent].children[0] == kFull &&
+                                  nodes_[parent].children[1] == kFull;) {
+    depth--;
+    Slot(parents[depth], bits[depth]) = kFull;
+    parent = parents[depth];
+  }
+}
+
+void PrefixTrie::Exclude(const IpPrefix &prefix) {
+  if (prefix.version != version_) {
+    return;
+  }
+  uint32_t parents[128];
+  int bits[128];
+  uint32_t parent = kEmpty;
+  int bit = 0;
+  for (int depth = 0; depth < prefix.length; depth++) {
+    uint32_t slot = Slot(parent, bit);
+    if (slot == kEmpty) {
+      // Nothing included here.
+      return;
+    }
+    if (slot == kFull) {
+      // Split the covering prefix into its halves and keep descending into the one holding `prefix`.
+      slot = AddNode(kFull, kFull);
+      Slot(parent, bit) = slot;
+    }
+    parents[depth] = parent;
+    bits[depth] = bit;
+    parent = slot;
+    bit = Bit(prefix, depth);
+  }
+  Slot(parent, bit) = kEmpty;
+  for (int depth = prefix.length; parent != kEmpty && nodes_[parent].children[0] == kEmpty &&
+                                  nodes_[parent].children[1] == kEmpty;) {
+    depth--;
+    Slot(parents[depth], bits[depth]) = kEmpty;
+    parent = parents[depth];
+  }
+}
+
+void PrefixTrie::Emit(uint32_t slot, IpPrefix &prefix, std::vector<IpPrefix> &out) const {
+  if (slot == kEmpty) {
+    return;
+  }
+  if (slot == kFull) {
+    out.push_back(prefix);
+    return;
+  }
+  for (int bit = 0; bit < 2; bit++) {
+    SetBit(prefix, prefix.length, bit);
+    prefix.length++;
+    Emit(nodes_[slot].children[bit], prefix, out);
+    prefix.length--;
+    SetBit(prefix, prefix.length, 0);
+  }
+}
+
+std::vector<IpPrefix> PrefixTrie::Prefixes() const {
+  std::vector<IpPrefix> out;
+  IpPrefix prefix;
+  prefix.version = version_;
+  Emit(root_, prefix, out);
+  return out;
+}
+
+std::vector<IpPrefix> CalculateRoutes(const std::vector<IpPrefix> &include, const std::vector<IpPrefix> &exclude) {
+  std::vector<IpPrefix> routes;
+  for (int version : {4, 6}) {
+    PrefixTrie trie(version);
+    for (const auto &prefix : include) {
+      trie.Include(prefix);
+    }
+    for (const auto &prefix : exclude) {
+      trie.Exclude(prefix);
+    }
+    auto prefixes = trie.Prefixes();
+    routes.insert(routes.end(), prefixes.begin(), prefixes.end());
+  }
+  return routes;
+}
+
+WireguardConfig ApplyExcludedIps(const WireguardConfig &config) {
+  WireguardConfig applied = config;
+  for (auto &peer : applied.peers) {
+    if (peer.excluded_ips.empty()) {
+      continue;
+    }
+    auto routes = CalculateRoutes(ParsePrefixes(peer.allowed_ips, "allowed IP"),
+                                  ParsePrefixes(peer.excluded_ips, "excluded IP"));
+    peer.allowed_ips.clear();
+    peer.allowed_ips.reserve(routes.size());
+    for (const auto &route : routes) {
+      peer.allowed_ips.push_back(FormatIpPrefix(route));
+    }
+    peer.excluded_ips.clear();
+  }
+  return applied;
+}
+
+}  // namespace wireguard_dart
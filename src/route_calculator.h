@@ -0,0 +1,58 @@
+#ifndef WIREGUARD_DART_ROUTE_CALCULATOR_H
+#define WIREGUARD_DART_ROUTE_CALCULATOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Address space of one IP version as a binary prefix trie. Fully covered subtrees are collapsed into a marker in
+// their parent's child slot, and nodes live in a single arena addressed by index, so building a set of 100k prefixes
+// costs a handful of allocations.
+class PrefixTrie {
+ public:
+  // `version` is 4 or 6; prefixes of the other version are ignored.
+  explicit PrefixTrie(int version);
+
+  // Adds the addresses of `prefix`. Host bits beyond its length are ignored.
+  void Include(const IpPrefix &prefix);
+
+  // Removes the addresses of `prefix`, splitting included prefixes that cover more than it.
+  void Exclude(const IpPrefix &prefix);
+
+  // The smallest list of prefixes covering exactly the included addresses, in address order. Adjacent prefixes are
+  // merged into their common parent.
+  std::vector<IpPrefix> Prefixes() const;
+
+ private:
+  // A slot is kEmpty, kFull or the index of a node whose two halves are neither both kFull nor both kEmpty.
+  static const uint32_t kEmpty = 0;
+  static const uint32_t kFull = UINT32_MAX;
+
+  struct Node {
+    uint32_t children[2] = {kEmpty, kEmpty};
+  };
+
+  uint32_t AddNode(uint32_t first, uint32_t second);
+  uint32_t &Slot(uint32_t parent, int bit) { return parent == kEmpty ? root_ : nodes_[parent].children[bit]; }
+  void Emit(uint32_t slot, IpPrefix &prefix, std::vector<IpPrefix> &out) const;
+
+  int version_;
+  uint32_t root_ = kEmpty;
+  // nodes_[0] is a placeholder, so that no node has the index kEmpty.
+  std::vector<Node> nodes_;
+};
+
+// Computes the union of `include` minus the union of `exclude`, for IPv4 and IPv6 at once. IPv4 prefixes come first.
+std::vector<IpPrefix> CalculateRoutes(const std::vector<IpPrefix> &include, const std::vector<IpPrefix> &exclude);
+
+// Returns a copy of `config` where every peer with ExcludedIPs has its AllowedIPs replaced by AllowedIPs minus
+// ExcludedIPs, e.g. "0.0.0.0/0, ::/0" minus the LAN. Throws std::invalid_argument on a malformed prefix.
+WireguardConfig ApplyExcludedIps(const WireguardConfig &config);
+
+}  // namespace wireguard_dart
+
+#endif
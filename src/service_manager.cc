@@ -0,0 +1,305 @@
+#include "service_manager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace wireguard_dart {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t MillisUntil(Clock::time_point deadline) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+}
+
+// The query interval of WaitStrategy::wait_hint.
+int64_t WaitHintInterval(int64_t wait_hint) {
+  return std::min<int64_t>(std::max<int64_t>(wait_hint / 10, 1000), 10000);
+}
+
+// Waits for the service to leave `status.state` according to `options`, but not past `deadline`.
+ServiceStatus Wait(ServiceManager *manager, const std::wstring &name, const ServiceStatus &status,
+                   const WaitOptions &options, Clock::time_point deadline) {
+  int64_t remaining = std::max<int64_t>(MillisUntil(deadline), 0);
+  int64_t interval = options.poll_interval;
+  switch (options.strategy) {
+    case WaitStrategy::notify:
+      return manager->WaitForChange(name, status.state, remaining);
+    case WaitStrategy::wait_hint:
+      interval = WaitHintInterval(status.wait_hint);
+      break;
+    case WaitStrategy::poll:
+      break;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(std::min(interval, remaining)));
+  return manager->Query(name);
+}
+
+}  // namespace
+
+void StopService(ServiceManager *manager, const std::wstring &name, const WaitOptions &options) {
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(options.timeout);
+  ServiceStatus status = manager->Query(name);
+  // A stop requested by someone else is waited out; sending another would fail.
+  while (status.state == ServiceState::stop_pending) {
+    if (Clock::now() >= deadline) {
+      throw ServiceError("Disconnect timed out");
+    }
+    status = Wait(manager, name, status, options, deadline);
+  }
+  if (status.state == ServiceState::stopped) {
+    return;
+  }
+
+  manager->Stop(name);
+  status = manager->Query(name);
+  while (status.state != ServiceState::stopped) {
+    if (Clock::now() >= deadline) {
+      throw ServiceError("Disconnect timed out");
+    }
+    status = Wait(manager, name, status, options, deadline);
+  }
+}
+
+ServiceWatcher::ServiceWatcher(ServiceManager *manager, const std::wstring &name, const WaitOptions &options,
+                               OnChange on_change)
+    : manager_(manager), name_(name), options_(options), on_change_(std::move(on_change)) {
+  if (options_.strategy == WaitStrategy::notify) {
+    changes_ = manager_->WatchChanges(name_);
+  }
+  thread_ = std::thread(&ServiceWatcher::Run, this);
+}
+
+ServiceWatcher::~ServiceWatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (changes_ != nullptr) {
+    changes_->Cancel();
+  }
+  thread_.join();
+}
+
+bool ServiceWatcher::Sleep(int64_t milliseconds) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return !stop_condition_.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return stop_; });
+}
+
+void ServiceWatcher::Run() {
+  bool reported = false;
+  ServiceStatus last;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        return;
+      }
+    }
+    ServiceStatus status;
+    try {
+      if (!reported) {
+        status = manager_->Query(name_);
+      } else if (options_.strategy == WaitStrategy::notify) {
+        status = changes_->Wait(last.state, ServiceChangeWait::kNoTimeout);
+      } else {
+        int64_t interval =
+            options_.strategy == WaitStrategy::poll ? options_.poll_interval : WaitHintInterval(last.wait_hint);
+        if (!Sleep(interval)) {
+          return;
+        }
+        status = manager_->Query(name_);
+      }
+    } catch (std::exception &e) {
+      std::cerr << "Service watcher: " << e.what() << std::endl;
+      if (!Sleep(options_.poll_interval)) {
+        return;
+      }
+      continue;
+    }
+    if (!reported || status.state != last.state) {
+      on_change_(status.state);
+      reported = true;
+    }
+    last = status;
+  }
+}
+
+void SimulatedServiceManager::Install(const std::wstring &name, const SimulatedServiceBehavior &behavior) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Service &service = services_[name];
+  service.behavior = behavior;
+  if (service.since == Clock::time_point()) {
+    service.since = Clock::now();
+  }
+}
+
+void SimulatedServiceManager::Start(const std::wstring &name) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Service *service = Find(name);
+    if (service == nullptr) {
+      throw ServiceError("Failed to start: service does not exist");
+    }
+    if (service->behavior.fail_start) {
+      throw ServiceError("Failed to start the service");
+    }
+    if (service->state != ServiceState::stopped) {
+      throw ServiceError("Failed to start the service: an instance is already running");
+    }
+    service->state = ServiceState::start_pending;
+    service->since = Clock::now();
+  }
+  changed_.notify_all();
+}
+
+void SimulatedServiceManager::Stop(const std::wstring &name) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Service *service = Find(name);
+    if (service == nullptr || service->state == ServiceState::stop_pending) {
+      return;
+    }
+    if (service->state == ServiceState::stopped) {
+      throw ServiceError("Stop service command failed: the service has not been started");
+    }
+    if (service->state == ServiceState::start_pending) {
+      throw ServiceError("Stop service command failed: the service cannot accept control messages at this time");
+    }
+    service->state = ServiceState::stop_pending;
+    service->since = Clock::now();
+  }
+  changed_.notify_all();
+}
+
+ServiceStatus SimulatedServiceManager::Query(const std::wstring &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ServiceStatus status;
+  Service *service = Find(name);
+  if (service != nullptr) {
+    status.state = service->state;
+    if (status.state == ServiceState::start_pending || status.state == ServiceState::stop_pending) {
+      status.wait_hint = service->behavior.wait_hint;
+    }
+  }
+  return status;
+}
+
+ServiceStatus SimulatedServiceManager::WaitForChange(const std::wstring &name, ServiceState state, int64_t timeout) {
+  return Wait(name, state, timeout, nullptr);
+}
+
+// Waits through the condition variable of its manager.
+class SimulatedChangeWait : public ServiceChangeWait {
+ public:
+  SimulatedChangeWait(SimulatedServiceManager *manager, const std::wstring &name) : manager_(manager), name_(name) {}
+
+  ServiceStatus Wait(ServiceState state, int64_t timeout) override {
+    return manager_->Wait(name_, state, timeout, &cancelled_);
+  }
+  void Cancel() override { manager_->Cancel(&cancelled_); }
+
+ private:
+  SimulatedServiceManager *manager_;
+  const std::wstring name_;
+  bool cancelled_ = false;
+};
+
+std::unique_ptr<ServiceChangeWait> SimulatedServiceManager::WatchChanges(const std::wstring &name) {
+  return std::make_unique<SimulatedChangeWait>(this, name);
+}
+
+ServiceStatus SimulatedServiceManager::Wait(const std::wstring &name, ServiceState state, int64_t timeout,
+                                            const bool *cancelled) {
+  Clock::time_point deadline = timeout == ServiceChangeWait::kNoTimeout
+                                   ? Clock::time_point::max()
+                                   : Clock::now() + std::chrono::milliseconds(timeout);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (cancelled != nullptr && *cancelled) {
+      ServiceStatus unchanged;
+      unchanged.state = state;
+      return unchanged;
+    }
+    Service *service = Find(name);
+    ServiceState current = service != nullptr ? service->state : ServiceState::stopped;
+    Clock::time_point now = Clock::now();
+    if (current != state || now >= deadline) {
+      break;
+    }
+    Clock::time_point wake = deadline;
+    if (service != nullptr) {
+      wake = std::min(wake, NextTransition(*service));
+    }
+    if (wake == Clock::time_point::max()) {
+      changed_.wait(lock);
+    } else {
+      changed_.wait_until(lock, wake);
+    }
+  }
+  lock.unlock();
+  return Query(name);
+}
+
+void SimulatedServiceManager::Cancel(bool *cancelled) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *cancelled = true;
+  }
+  changed_.notify_all();
+}
+
+SimulatedServiceManager::Clock::time_point SimulatedServiceManager::state_since(const std::wstring &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Service *service = Find(name);
+  return service != nullptr ? service->since : Clock::time_point();
+}
+
+void SimulatedServiceManager::Advance(Service *service, Clock::time_point now) {
+  for (;;) {
+    Clock::time_point due = NextTransition(*service);
+    if (due > now) {
+      return;
+    }
+    service->since = due;
+    if (service->state == ServiceState::start_pending) {
+      service->state = service->behavior.exit_on_start ? ServiceState::stopped : ServiceState::running;
+    } else {
+      service->state = ServiceState::stopped;
+    }
+  }
+}
+
+SimulatedServiceManager::Clock::time_point SimulatedServiceManager::NextTransition(const Service &service) {
+  switch (service.state) {
+    case ServiceState::start_pending:
+      return service.since + std::chrono::milliseconds(service.behavior.start_delay);
+    case ServiceState::stop_pending:
+      if (!service.behavior.hang_stop) {
+        return service.since + std::chrono::milliseconds(service.behavior.stop_delay);
+      }
+      return Clock::time_point::max();
+    default:
+      return Clock::time_point::max();
+  }
+}
+
+SimulatedServiceManager::Service *SimulatedServiceManager::Find(const std::wstring &name) {
+  auto found = services_.find(name);
+  if (found == services_.end()) {
+    return nullptr;
+  }
+  // Transitions are applied lazily, whenever a service is looked at.
+  Advance(&found->second, Clock::now());
+  return &found->second;
+}
+
+}  // namespace wireguard_dart
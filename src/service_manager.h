@@ -0,0 +1,185 @@
+#ifndef WIREGUARD_DART_SERVICE_MANAGER_H
+#define WIREGUARD_DART_SERVICE_MANAGER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace wireguard_dart {
+
+// The states of a tunnel service that connect and disconnect go through, as the Windows service control manager
+// reports them. Paused services count as stopped.
+enum class ServiceState { stopped, start_pending, running, stop_pending };
+
+struct ServiceStatus {
+  ServiceState state = ServiceState::stopped;
+  // How long the service expects its pending operation to take, in milliseconds; 0 if it gave no estimate.
+  int64_t wait_hint = 0;
+};
+
+class ServiceError : public std::runtime_error {
+ public:
+  explicit ServiceError(const std::string &message) : std::runtime_error(message) {}
+};
+
+// Waits for state changes of one service again and again, keeping what that takes open in between, e.g. the service
+// handle and change notification registration of the Win32 service control manager.
+class ServiceChangeWait {
+ public:
+  // Passed as the timeout of Wait to wait without one.
+  static const int64_t kNoTimeout = -1;
+
+  virtual ~ServiceChangeWait() = default;
+
+  // Blocks until the service is no longer in `state`, for at most `timeout` milliseconds, or until Cancel. Returns the
+  // status at that point, or a status in `state` once cancelled. Called from one thread at a time.
+  virtual ServiceStatus Wait(ServiceState state, int64_t timeout) = 0;
+
+  // Makes the Wait in progress and every later one return at once. Callable from any thread.
+  virtual void Cancel() = 0;
+};
+
+// The operations of a service manager that connecting, disconnecting and watching a tunnel need. Implemented over the
+// Win32 service control manager, and by SimulatedServiceManager to measure and test their timing anywhere.
+class ServiceManager {
+ public:
+  virtual ~ServiceManager() = default;
+
+  // Asks the service to start and returns while it is still start pending. Throws ServiceError.
+  virtual void Start(const std::wstring &name) = 0;
+
+  // Sends the stop control and returns while the service is still stop pending. Throws ServiceError.
+  virtual void Stop(const std::wstring &name) = 0;
+
+  // A service that does not exist counts as stopped.
+  virtual ServiceStatus Query(const std::wstring &name) = 0;
+
+  // Blocks until the service is no longer in `state`, or for at most `timeout` milliseconds. Returns the status at
+  // that point.
+  virtual ServiceStatus WaitForChange(const std::wstring &name, ServiceState state, int64_t timeout) = 0;
+
+  // Starts waiting for changes of the service, which need not exist yet. Throws ServiceError.
+  virtual std::unique_ptr<ServiceChangeWait> WatchChanges(const std::wstring &name) = 0;
+};
+
+// How callers learn that a pending operation finished.
+enum class WaitStrategy {
+  // Query again after a fixed interval.
+  poll,
+  // Query again after a tenth of the service's wait hint, but no less than a second and no more than ten, as the
+  // service control manager documentation suggests.
+  wait_hint,
+  // Block on a state change notification.
+  notify,
+};
+
+struct WaitOptions {
+  WaitStrategy strategy = WaitStrategy::notify;
+  // Milliseconds between queries with WaitStrategy::poll.
+  int64_t poll_interval = 1000;
+  // Milliseconds StopService waits for the service to stop.
+  int64_t timeout = 15000;
+};
+
+// Stops a service and waits until it is stopped: a stop already pending is waited out rather than sent again. Returns
+// at once if the service is stopped or does not exist. Throws ServiceError, also if it does not stop within
+// `options.timeout`, e.g. because it hangs in stop pending.
+void StopService(ServiceManager *manager, const std::wstring &name, const WaitOptions &options = WaitOptions());
+
+// Watches the state of a service on a background thread and reports every change, starting with the state found when
+// watching starts. With WaitStrategy::notify it blocks in a single ServiceChangeWait that the destructor cancels.
+// Query errors are logged and retried after the poll interval.
+class ServiceWatcher {
+ public:
+  using OnChange = std::function<void(ServiceState state)>;
+
+  ServiceWatcher(ServiceManager *manager, const std::wstring &name, const WaitOptions &options, OnChange on_change);
+  ~ServiceWatcher();
+
+  ServiceWatcher(const ServiceWatcher &) = delete;
+  ServiceWatcher &operator=(const ServiceWatcher &) = delete;
+
+ private:
+  void Run();
+  // Waits `milliseconds` unless stopped first. Returns false once stopped.
+  bool Sleep(int64_t milliseconds);
+
+  ServiceManager *manager_;
+  const std::wstring name_;
+  const WaitOptions options_;
+  OnChange on_change_;
+  // Set with WaitStrategy::notify.
+  std::unique_ptr<ServiceChangeWait> changes_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_ = false;
+};
+
+// How a simulated service behaves. Durations are in milliseconds.
+struct SimulatedServiceBehavior {
+  int64_t start_delay = 0;
+  int64_t stop_delay = 0;
+  // Reported while start or stop pending.
+  int64_t wait_hint = 0;
+  // Start is refused, as StartService fails for a broken service binary.
+  bool fail_start = false;
+  // The service goes from start pending back to stopped, as one does that exits during startup.
+  bool exit_on_start = false;
+  // The service never leaves stop pending.
+  bool hang_stop = false;
+};
+
+// A service manager in memory that moves services through start pending, running and stop pending with the delays of
+// their SimulatedServiceBehavior, on the steady clock. Thread safe; WaitForChange wakes exactly when a transition is
+// due, as a notification from the real service control manager would.
+class SimulatedServiceManager : public ServiceManager {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Creates or reconfigures a stopped service.
+  void Install(const std::wstring &name, const SimulatedServiceBehavior &behavior);
+
+  void Start(const std::wstring &name) override;
+  void Stop(const std::wstring &name) override;
+  ServiceStatus Query(const std::wstring &name) override;
+  ServiceStatus WaitForChange(const std::wstring &name, ServiceState state, int64_t timeout) override;
+  std::unique_ptr<ServiceChangeWait> WatchChanges(const std::wstring &name) override;
+
+  // When the service entered its current state, to measure how late a watcher reports it.
+  Clock::time_point state_since(const std::wstring &name);
+
+ private:
+  struct Service {
+    SimulatedServiceBehavior behavior;
+    ServiceState state = ServiceState::stopped;
+    Clock::time_point since;
+  };
+
+  // Applies the transitions due by `now`.
+  static void Advance(Service *service, Clock::time_point now);
+  // When the next transition is due, or Clock::time_point::max() if none is.
+  static Clock::time_point NextTransition(const Service &service);
+  Service *Find(const std::wstring &name);
+  // WaitForChange that also returns once `*cancelled`, read under `mutex_`, is set.
+  ServiceStatus Wait(const std::wstring &name, ServiceState state, int64_t timeout, const bool *cancelled);
+  void Cancel(bool *cancelled);
+
+  friend class SimulatedChangeWait;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::map<std::wstring, Service> services_;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef WIREGUARD_DART_SOCKET_UTIL_H
+#define WIREGUARD_DART_SOCKET_UTIL_H
+
+// Minimal portability layer over BSD sockets and Winsock for the platform-neutral sources.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace wireguard_dart {
+
+#ifdef _WIN32
+using Socket = SOCKET;
+const Socket kInvalidSocket = INVALID_SOCKET;
+
+inline int LastSocketError() { return WSAGetLastError(); }
+
+inline void CloseSocket(Socket fd) { closesocket(fd); }
+
+inline bool SetNonBlocking(Socket fd) {
+  u_long enabled = 1;
+  return ioctlsocket(fd, FIONBIO, &enabled) == 0;
+}
+
+inline int Poll(pollfd *fds, size_t count, int timeout) { return WSAPoll(fds, static_cast<ULONG>(count), timeout); }
+
+// Winsock reference counts initialization, so every user holds its own for as long as it needs sockets or name
+// resolution.
+class SocketRuntime {
+ public:
+  SocketRuntime() {
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+  }
+  ~SocketRuntime() { WSACleanup(); }
+};
+#else
+using Socket = int;
+const Socket kInvalidSocket = -1;
+
+inline int LastSocketError() { return errno; }
+
+inline void CloseSocket(Socket fd) { close(fd); }
+
+inline bool SetNonBlocking(Socket fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+inline int Poll(pollfd *fds, size_t count, int timeout) { return poll(fds, count, timeout); }
+
+class SocketRuntime {
+ public:
+  SocketRuntime() {}
+};
+#endif
+
+// Milliseconds on the monotonic clock, the time base of every deadline and timer.
+inline int64_t SteadyMillisNow() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace wireguard_dart
+
+#endif
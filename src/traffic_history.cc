@@ -0,0 +1,191 @@
+#include "traffic_history.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <unordered_set>
+
+namespace wireguard_dart {
+
+namespace {
+
+int64_t UnixSecondsNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Bytes since `previous` of a counter that restarts from 0 when the peer or device is recreated.
+uint64_t CounterDelta(uint64_t current, uint64_t previous) { return current >= previous ? current - previous : current; }
+
+}  // namespace
+
+void TrafficRing::Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes) {
+  int64_t capacity = static_cast<int64_t>(buckets_.size());
+  int64_t bucket = std::max<int64_t>(now / step_, newest_);
+  if (bucket > newest_) {
+    // Buckets skipped since the previous sample had no traffic; at most the whole ring is cleared.
+    int64_t first = std::max(newest_ + 1, bucket - capacity + 1);
+    for (int64_t skipped = first; skipped <= bucket; skipped++) {
+      buckets_[skipped % capacity] = {0, 0};
+    }
+    newest_ = bucket;
+  }
+  std::array<uint64_t, 2> &counts = buckets_[bucket % capacity];
+  counts[0] += rx_bytes;
+  counts[1] += tx_bytes;
+}
+
+TrafficWindow TrafficRing::Window(int64_t from, int64_t to, int64_t now) const {
+  int64_t capacity = static_cast<int64_t>(buckets_.size());
+  int64_t current = std::max<int64_t>(now / step_, newest_);
+  int64_t first = std::max<int64_t>(std::max<int64_t>(from, 0) / step_, current - capacity + 1);
+  int64_t last = std::min<int64_t>((to - 1) / step_, current);
+
+  TrafficWindow window;
+  window.step = step_;
+  window.start = first * step_;
+  if (to <= from || last < first) {
+    return window;
+  }
+  window.samples.reserve(2 * (last - first + 1));
+  for (int64_t bucket = first; bucket <= last; bucket++) {
+    // Buckets past the newest were not written yet, those a ring length before it were overwritten.
+    if (bucket > newest_ || bucket <= newest_ - capacity) {
+      window.samples.push_back(0);
+      window.samples.push_back(0);
+    } else {
+      const std::array<uint64_t, 2> &counts = buckets_[bucket % capacity];
+      window.samples.push_back(static_cast<int64_t>(counts[0]));
+      window.samples.push_back(static_cast<int64_t>(counts[1]));
+    }
+  }
+  return window;
+}
+
+void TrafficSeries::Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes) {
+  seconds_.Add(now, rx_bytes, tx_bytes);
+  minutes_.Add(now, rx_bytes, tx_bytes);
+  hours_.Add(now, rx_bytes, tx_bytes);
+}
+
+const TrafficRing &TrafficSeries::ring(TrafficResolution resolution) const {
+  switch (resolution) {
+    case TrafficResolution::second:
+      return seconds_;
+    case TrafficResolution::minute:
+      return minutes_;
+    case TrafficResolution::hour:
+      break;
+  }
+  return hours_;
+}
+
+TrafficDelta TrafficHistory::Observe(const std::vector<PeerSample> &samples, int64_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t tunnel_rx = 0;
+  uint64_t tunnel_tx = 0;
+  std::unordered_set<WireguardKey, WireguardKeyHash> present;
+  for (const PeerSample &sample : samples) {
+    present.insert(sample.public_key);
+    auto found = peers_.find(sample.public_key);
+    if (found == peers_.end()) {
+      // A new peer's counters so far were not seen accumulating; they only set the baseline.
+      Peer &peer = peers_[sample.public_key];
+      peer.rx_bytes = sample.rx_bytes;
+      peer.tx_bytes = sample.tx_bytes;
+      peer.series.Add(now, 0, 0);
+      continue;
+    }
+    Peer &peer = found->second;
+    uint64_t rx = restarted_ ? 0 : CounterDelta(sample.rx_bytes, peer.rx_bytes);
+    uint64_t tx = restarted_ ? 0 : CounterDelta(sample.tx_bytes, peer.tx_bytes);
+    peer.rx_bytes = sample.rx_bytes;
+    peer.tx_bytes = sample.tx_bytes;
+    peer.series.Add(now, rx, tx);
+    tunnel_rx += rx;
+    tunnel_tx += tx;
+  }
+  for (auto it = peers_.begin(); it != peers_.end();) {
+    it = present.count(it->first) != 0 ? std::next(it) : peers_.erase(it);
+  }
+  tunnel_.Add(now, tunnel_rx, tunnel_tx);
+  restarted_ = false;
+  return TrafficDelta{tunnel_rx, tunnel_tx};
+}
+
+void TrafficHistory::Restart() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  restarted_ = true;
+}
+
+void TrafficHistory::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  restarted_ = true;
+  tunnel_ = TrafficSeries();
+  peers_.clear();
+}
+
+std::optional<TrafficWindow> TrafficHistory::Query(const WireguardKey *peer, TrafficResolution resolution,
+                                                   int64_t from, int64_t to, int64_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (peer == nullptr) {
+    return tunnel_.ring(resolution).Window(from, to, now);
+  }
+  auto found = peers_.find(*peer);
+  if (found == peers_.end()) {
+    return std::nullopt;
+  }
+  return found->second.series.ring(resolution).Window(from, to, now);
+}
+
+constexpr std::chrono::seconds TrafficRecorder::kSampleInterval;
+
+TrafficRecorder::~TrafficRecorder() { Stop(); }
+
+void TrafficRecorder::Start(SamplePeers sample_peers, OnTraffic on_traffic) {
+  Stop();
+  sample_peers_ = sample_peers;
+  on_traffic_ = on_traffic;
+  // Whatever went through the tunnel while nobody sampled has no time to be counted at.
+  history_->Restart();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+  thread_ = std::thread(&TrafficRecorder::Run, this);
+}
+
+void TrafficRecorder::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TrafficRecorder::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    lock.unlock();
+    try {
+      int64_t now = UnixSecondsNow();
+      TrafficDelta traffic = history_->Observe(sample_peers_(), now);
+      if (on_traffic_) {
+        on_traffic_(now, traffic);
+      }
+    } catch (std::exception &e) {
+      // The tunnel may be going down or reconfigured; the next sample starts over from its counters.
+      std::cerr << "Traffic recorder: " << e.what() << std::endl;
+      history_->Restart();
+    }
+    lock.lock();
+    if (stop_condition_.wait_for(lock, kSampleInterval, [this] { return stop_; })) {
+      return;
+    }
+  }
+}
+
+}  // namespace wireguard_dart
@@ -0,0 +1,144 @@
+#ifndef WIREGUARD_DART_TRAFFIC_HISTORY_H
+#define WIREGUARD_DART_TRAFFIC_HISTORY_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "peer_index.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+enum class TrafficResolution { second, minute, hour };
+
+// Traffic of consecutive buckets of equal length.
+struct TrafficWindow {
+  // Unix epoch seconds at which the first bucket starts.
+  int64_t start = 0;
+  // Seconds per bucket.
+  int64_t step = 0;
+  // Bytes received and sent in each bucket, interleaved: rx of the first bucket, tx of the first bucket, rx of the
+  // second and so on. Buckets without traffic or before recording started are 0.
+  std::vector<int64_t> samples;
+};
+
+struct TrafficDelta {
+  uint64_t rx_bytes = 0;
+  uint64_t tx_bytes = 0;
+};
+
+// Bytes per bucket of `step` seconds for the last `capacity` buckets, in a ring allocated once. Buckets are aligned to
+// multiples of `step` since the epoch, so minute and hour buckets start on the minute and the hour.
+class TrafficRing {
+ public:
+  TrafficRing(int64_t step, size_t capacity) : step_(step), buckets_(capacity) {}
+
+  // Counts bytes at `now` (Unix epoch seconds), clearing the buckets skipped since the previous call. Time going
+  // backwards counts into the newest bucket.
+  void Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes);
+
+  // The buckets overlapping [from, to) that are still held at `now`.
+  TrafficWindow Window(int64_t from, int64_t to, int64_t now) const;
+
+  int64_t step() const { return step_; }
+
+ private:
+  int64_t step_;
+  std::vector<std::array<uint64_t, 2>> buckets_;
+  // Bucket number, i.e. time / step, of the newest bucket; -1 before anything was counted.
+  int64_t newest_ = -1;
+};
+
+// A tunnel's or peer's traffic at 1 second resolution for 10 minutes, 1 minute resolution for 24 hours and 1 hour
+// resolution for 30 days, about 43 KiB however long it is recorded. Every sample goes into all three rings at once,
+// so coarser resolutions need no rollup pass and their newest bucket is always current.
+class TrafficSeries {
+ public:
+  void Add(int64_t now, uint64_t rx_bytes, uint64_t tx_bytes);
+  const TrafficRing &ring(TrafficResolution resolution) const;
+
+ private:
+  TrafficRing seconds_{1, 600};
+  TrafficRing minutes_{60, 1440};
+  TrafficRing hours_{3600, 720};
+};
+
+// The traffic history of a tunnel and each of its peers, fed with cumulative peer counters. A peer's history is kept
+// for as long as it appears in the samples. Thread safe.
+class TrafficHistory {
+ public:
+  // Feeds the counters of all peers at `now` (Unix epoch seconds). The traffic since the previous samples is added to
+  // the peers and the tunnel; the first samples after Restart only set the baseline. Returns the tunnel's traffic added.
+  TrafficDelta Observe(const std::vector<PeerSample> &samples, int64_t now);
+
+  // Makes the next samples a new baseline, e.g. after a gap in sampling whose traffic would otherwise land in a
+  // single bucket.
+  void Restart();
+
+  // Forgets everything, for another tunnel.
+  void Clear();
+
+  // The tunnel's traffic, or that of `peer` if given, over [from, to) at `resolution` as far as it is still held at
+  // `now`. std::nullopt if `peer` has no history.
+  std::optional<TrafficWindow> Query(const WireguardKey *peer, TrafficResolution resolution, int64_t from, int64_t to,
+                                     int64_t now);
+
+ private:
+  struct Peer {
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    TrafficSeries series;
+  };
+
+  std::mutex mutex_;
+  bool restarted_ = true;
+  TrafficSeries tunnel_;
+  std::unordered_map<WireguardKey, Peer, WireguardKeyHash> peers_;
+};
+
+// Samples the peers of the running tunnel into a TrafficHistory every second on a background thread, so the history
+// keeps growing while the UI is not polling.
+class TrafficRecorder {
+ public:
+  using SamplePeers = std::function<std::vector<PeerSample>()>;
+  // Called with the tunnel's traffic of every sample and its time in Unix epoch seconds.
+  using OnTraffic = std::function<void(int64_t now, const TrafficDelta &traffic)>;
+
+  static constexpr std::chrono::seconds kSampleInterval{1};
+
+  explicit TrafficRecorder(TrafficHistory *history) : history_(history) {}
+  ~TrafficRecorder();
+
+  TrafficRecorder(const TrafficRecorder &) = delete;
+  TrafficRecorder &operator=(const TrafficRecorder &) = delete;
+
+  // Starts recording, stopping a previous run.
+  void Start(SamplePeers sample_peers, OnTraffic on_traffic = nullptr);
+  void Stop();
+
+ private:
+  void Run();
+
+  TrafficHistory *history_;
+  SamplePeers sample_peers_;
+  OnTraffic on_traffic_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_ = false;
+};
+
+}  // namespace wireguard_dart
+
+#endif
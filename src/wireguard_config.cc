@@ -0,0 +1,323 @@
+#include "wireguard_config.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace wireguard_dart {
+
+static const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string Trim(const std::string &str) {
+  auto begin = std::find_if_not(str.begin(), str.end(), [](unsigned char c) { return std::isspace(c); });
+  auto end = std::find_if_not(str.rbegin(), str.rend(), [](unsigned char c) { return std::isspace(c); }).base();
+  return begin < end ? std::string(begin, end) : std::string();
+}
+
+static std::string ToLower(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+  return str;
+}
+
+static std::vector<std::string> SplitList(const std::string &value) {
+  std::vector<std::string> items;
+  std::istringstream stream(value);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    item = Trim(item);
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+static uint32_t ParseNumber(const std::string &key, const std::string &value, uint32_t max) {
+  if (value.empty() || !std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c); }) ||
+      value.size() > 10 || std::stoull(value) > max) {
+    throw std::invalid_argument("Invalid value for " + key + ": " + value);
+  }
+  return static_cast<uint32_t>(std::stoul(value));
+}
+
+static std::string JoinList(const std::vector<std::string> &items) {
+  std::string joined;
+  for (const auto &item : items) {
+    if (!joined.empty()) {
+      joined += ", ";
+    }
+    joined += item;
+  }
+  return joined;
+}
+
+WireguardConfig WireguardConfig::Parse(const std::string &text) {
+  enum class Section { none, interface_section, peer_section };
+
+  WireguardConfig config;
+  Section section = Section::none;
+  std::istringstream stream(text);
+  std::string line;
+  int line_number = 0;
+  while (std::getline(stream, line)) {
+    line_number++;
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.resize(comment);
+    }
+    line = Trim(line);
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line.front() == '[') {
+      auto name = ToLower(line);
+      if (name == "[interface]") {
+        section = Section::interface_section;
+      } else if (name == "[peer]") {
+        section = Section::peer_section;
+        config.peers.emplace_back();
+      } else {
+        throw std::invalid_argument("Unknown section on line " + std::to_string(line_number) + ": " + line);
+      }
+      continue;
+    }
+
+    auto separator = line.find('=');
+    if (separator == std::string::npos || section == Section::none) {
+      throw std::invalid_argument("Unexpected line " + std::to_string(line_number) + ": " + line);
+    }
+    auto key = Trim(line.substr(0, separator));
+    auto value = Trim(line.substr(separator + 1));
+    auto lower_key = ToLower(key);
+
+    if (section == Section::interface_section) {
+      auto &iface = config.interface_config;
+      if (lower_key == "privatekey") {
+        iface.private_key = value;
+      } else if (lower_key == "address") {
+        auto addresses = SplitList(value);
+        iface.addresses.insert(iface.addresses.end(), addresses.begin(), addresses.end());
+      } else if (lower_key == "dns") {
+        auto dns = SplitList(value);
+        iface.dns.insert(iface.dns.end(), dns.begin(), dns.end());
+      } else if (lower_key == "listenport") {
+        iface.listen_port = static_cast<uint16_t>(ParseNumber(key, value, 65535));
+      } else if (lower_key == "mtu") {
+        iface.mtu = ParseNumber(key, value, 65535);
+      } else {
+        iface.extra.emplace_back(key, value);
+      }
+    } else {
+      auto &peer = config.peers.back();
+      if (lower_key == "publickey") {
+        peer.public_key = value;
+      } else if (lower_key == "presharedkey") {
+        peer.preshared_key = value;
+      } else if (lower_key == "allowedips") {
+        auto allowed_ips = SplitList(value);
+        peer.allowed_ips.insert(peer.allowed_ips.end(), allowed_ips.begin(), allowed_ips.end());
+      } else if (lower_key == "excludedips") {
+        auto excluded_ips = SplitList(value);
+        peer.excluded_ips.insert(peer.excluded_ips.end(), excluded_ips.begin(), excluded_ips.end());
+      } else if (lower_key == "endpoint") {
+        peer.endpoint = value;
+      } else if (lower_key == "persistentkeepalive") {
+        peer.persistent_keepalive =
+            ToLower(value) == "off" ? 0 : static_cast<uint16_t>(ParseNumber(key, value, 65535));
+      } else {
+        peer.extra.emplace_back(key, value);
+      }
+    }
+  }
+  return config;
+}
+
+std::string WireguardConfig::ToString() const {
+  std::ostringstream out;
+  out << "[Interface]\n";
+  if (!interface_config.private_key.empty()) {
+    out << "PrivateKey = " << interface_config.private_key << "\n";
+  }
+  if (!interface_config.addresses.empty()) {
+    out << "Address = " << JoinList(interface_config.addresses) << "\n";
+  }
+  if (!interface_config.dns.empty()) {
+    out << "DNS = " << JoinList(interface_config.dns) << "\n";
+  }
+  if (interface_config.listen_port != 0) {
+    out << "ListenPort = " << interface_config.listen_port << "\n";
+  }
+  if (interface_config.mtu != 0) {
+    out << "MTU = " << interface_config.mtu << "\n";
+  }
+  for (const auto &entry : interface_config.extra) {
+    out << entry.first << " = " << entry.second << "\n";
+  }
+
+  for (const auto &peer : peers) {
+    out << "\n[Peer]\n";
+    out << "PublicKey = " << peer.public_key << "\n";
+    if (!peer.preshared_key.empty()) {
+      out << "PresharedKey = " << peer.preshared_key << "\n";
+    }
+    if (!peer.allowed_ips.empty()) {
+      out << "AllowedIPs = " << JoinList(peer.allowed_ips) << "\n";
+    }
+    if (!peer.excluded_ips.empty()) {
+      out << "ExcludedIPs = " << JoinList(peer.excluded_ips) << "\n";
+    }
+    if (!peer.endpoint.empty()) {
+      out << "Endpoint = " << peer.endpoint << "\n";
+    }
+    if (peer.persistent_keepalive != 0) {
+      out << "PersistentKeepalive = " << peer.persistent_keepalive << "\n";
+    }
+    for (const auto &entry : peer.extra) {
+      out << entry.first << " = " << entry.second << "\n";
+    }
+  }
+  return out.str();
+}
+
+bool SplitEndpoint(const std::string &endpoint, std::string *host, uint16_t *port) {
+  auto separator = endpoint.rfind(':');
+  if (separator == std::string::npos || separator == 0) {
+    return false;
+  }
+  auto host_part = endpoint.substr(0, separator);
+  if (host_part.front() == '[') {
+    if (host_part.back() != ']') {
+      return false;
+    }
+    host_part = host_part.substr(1, host_part.size() - 2);
+  } else if (host_part.find(':') != std::string::npos) {
+    // Bare IPv6 addresses must be bracketed.
+    return false;
+  }
+
+  auto port_part = endpoint.substr(separator + 1);
+  if (port_part.empty() || port_part.size() > 5 ||
+      !std::all_of(port_part.begin(), port_part.end(), [](unsigned char c) { return std::isdigit(c); })) {
+    return false;
+  }
+  auto port_value = std::stoul(port_part);
+  if (port_value == 0 || port_value > 65535 || host_part.empty()) {
+    return false;
+  }
+  *host = host_part;
+  *port = static_cast<uint16_t>(port_value);
+  return true;
+}
+
+std::string JoinEndpoint(const std::string &host, uint16_t port) {
+  if (host.find(':') != std::string::npos) {
+    return "[" + host + "]:" + std::to_string(port);
+  }
+  return host + ":" + std::to_string(port);
+}
+
+bool ParseIpPrefix(const std::string &text, IpPrefix *prefix) {
+  // Parsed in place rather than through substrings, as large configs carry tens of thousands of prefixes.
+  auto slash = text.find('/');
+  size_t address_length = slash == std::string::npos ? text.size() : slash;
+  char address[INET6_ADDRSTRLEN];
+  if (address_length >= sizeof(address)) {
+    return false;
+  }
+  memcpy(address, text.data(), address_length);
+  address[address_length] = '\0';
+  IpPrefix parsed;
+  if (inet_pton(AF_INET, address, parsed.address.data()) == 1) {
+    parsed.version = 4;
+  } else if (inet_pton(AF_INET6, address, parsed.address.data()) == 1) {
+    parsed.version = 6;
+  } else {
+    return false;
+  }
+
+  unsigned long max_length = parsed.version == 4 ? 32 : 128;
+  parsed.length = static_cast<uint8_t>(max_length);
+  if (slash != std::string::npos) {
+    size_t digits = text.size() - slash - 1;
+    if (digits == 0 || digits > 3) {
+      return false;
+    }
+    unsigned long length = 0;
+    for (size_t i = slash + 1; i < text.size(); i++) {
+      if (!std::isdigit(static_cast<unsigned char>(text[i]))) {
+        return false;
+      }
+      length = length * 10 + static_cast<unsigned long>(text[i] - '0');
+    }
+    if (length > max_length) {
+      return false;
+    }
+    parsed.length = static_cast<uint8_t>(length);
+  }
+  *prefix = parsed;
+  return true;
+}
+
+std::string FormatIpPrefix(const IpPrefix &prefix) {
+  char address[INET6_ADDRSTRLEN] = {};
+  inet_ntop(prefix.version == 4 ? AF_INET : AF_INET6, prefix.address.data(), address, sizeof(address));
+  return std::string(address) + "/" + std::to_string(prefix.length);
+}
+
+bool DecodeKey(const std::string &base64, WireguardKey *key) {
+  // 32 bytes encode to 43 characters plus one '=' of padding.
+  if (base64.size() != 44 || base64[43] != '=') {
+    return false;
+  }
+  uint32_t accumulator = 0;
+  int bits = 0;
+  size_t out = 0;
+  for (size_t i = 0; i < 43; i++) {
+    const char *position = std::char_traits<char>::find(kBase64Alphabet, 64, base64[i]);
+    if (position == nullptr) {
+      return false;
+    }
+    accumulator = (accumulator << 6) | static_cast<uint32_t>(position - kBase64Alphabet);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (out < key->size()) {
+        (*key)[out++] = static_cast<uint8_t>((accumulator >> bits) & 0xff);
+      }
+    }
+  }
+  return out == key->size();
+}
+
+std::string EncodeKey(const WireguardKey &key) {
+  std::string base64;
+  base64.reserve(44);
+  uint32_t accumulator = 0;
+  int bits = 0;
+  for (uint8_t byte : key) {
+    accumulator = (accumulator << 8) | byte;
+    bits += 8;
+    while (bits >= 6) {
+      bits -= 6;
+      base64.push_back(kBase64Alphabet[(accumulator >> bits) & 0x3f]);
+    }
+  }
+  base64.push_back(kBase64Alphabet[(accumulator << (6 - bits)) & 0x3f]);
+  base64.push_back('=');
+  return base64;
+}
+
+}  // namespace wireguard_dart
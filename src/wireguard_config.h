@@ -0,0 +1,74 @@
+#ifndef WIREGUARD_DART_WIREGUARD_CONFIG_H
+#define WIREGUARD_DART_WIREGUARD_CONFIG_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wireguard_dart {
+
+using WireguardKey = std::array<uint8_t, 32>;
+
+// An address with a prefix length, e.g. an Address or AllowedIPs entry. `version` is 4 or 6; IPv4 addresses use the
+// first 4 bytes of `address`.
+struct IpPrefix {
+  int version = 0;
+  std::array<uint8_t, 16> address = {};
+  uint8_t length = 0;
+};
+
+using ConfigEntries = std::vector<std::pair<std::string, std::string>>;
+
+struct InterfaceConfig {
+  std::string private_key;
+  std::vector<std::string> addresses;
+  std::vector<std::string> dns;
+  uint16_t listen_port = 0;
+  uint32_t mtu = 0;
+  // Keys not interpreted by the plugin, kept so the config round-trips unchanged.
+  ConfigEntries extra;
+};
+
+struct PeerConfig {
+  std::string public_key;
+  std::string preshared_key;
+  std::vector<std::string> allowed_ips;
+  // Not part of wg-quick: addresses carved out of AllowedIPs by ApplyExcludedIps before the config is applied.
+  std::vector<std::string> excluded_ips;
+  // As written in the config: "host:port" or "[v6]:port".
+  std::string endpoint;
+  uint16_t persistent_keepalive = 0;
+  ConfigEntries extra;
+};
+
+// A wg-quick style configuration as passed to `connect`.
+struct WireguardConfig {
+  InterfaceConfig interface_config;
+  std::vector<PeerConfig> peers;
+
+  // Throws std::invalid_argument on malformed input.
+  static WireguardConfig Parse(const std::string &text);
+
+  std::string ToString() const;
+};
+
+// Splits "host:port" or "[v6]:port". Returns false if the port is missing or invalid.
+bool SplitEndpoint(const std::string &endpoint, std::string *host, uint16_t *port);
+
+std::string JoinEndpoint(const std::string &host, uint16_t port);
+
+// Parses "10.0.0.2/32", "fd00::/8" or a bare address, which gets the full prefix length. Returns false on malformed
+// input or a prefix length out of range.
+bool ParseIpPrefix(const std::string &text, IpPrefix *prefix);
+
+std::string FormatIpPrefix(const IpPrefix &prefix);
+
+bool DecodeKey(const std::string &base64, WireguardKey *key);
+
+std::string EncodeKey(const WireguardKey &key);
+
+}  // namespace wireguard_dart
+
+#endif
@@ -1,3 +1,6 @@
+import 'dart:typed_data';
+
+import 'package:flutter/foundation.dart';
 import 'package:flutter_test/flutter_test.dart';
 import 'package:mockito/annotations.dart';
 import 'package:mockito/mockito.dart';
@@ -106,6 +109,14 @@ void main() {
       verify(mockWireGuardDartPlatform.connect(cfg: 'config')).called(1);
     });
 
+    test('should reject a profileId off Linux', () async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.windows;
+      addTearDown(() => debugDefaultTargetPlatformOverride = null);
+
+      expect(() => wireguardDart.connect(profileId: 1), throwsUnsupportedError);
+      verifyNever(mockWireGuardDartPlatform.connect(profileId: anyNamed('profileId')));
+    });
+
     test('should disconnect successfully', () async {
       when(mockWireGuardDartPlatform.disconnect()).thenAnswer((_) async => Future.value());
 
@@ -292,6 +303,201 @@ void main() {
     verify(mockWireGuardDartPlatform.checkNotificationPermission()).called(1);
   });
 
+  test('should run batch successfully', () async {
+    final calls = [const BatchCall.nativeInit(), const BatchCall.status()];
+    when(mockWireGuardDartPlatform.batch(any)).thenAnswer((_) async => [null, 'connected']);
+
+    final result = await wireguardDart.batch(calls);
+
+    expect(result, [null, 'connected']);
+    verify(mockWireGuardDartPlatform.batch(calls)).called(1);
+  });
+
+  test('should batch a connect to a stored profile', () {
+    expect(BatchCall.connect(profileId: 7).toMap(), {
+      'method': 'connect',
+      'arguments': {'profileId': 7},
+    });
+    expect(BatchCall.connect(cfg: '[Interface]').toMap(), {
+      'method': 'connect',
+      'arguments': {'cfg': '[Interface]'},
+    });
+  });
+
+  test('should handle error when running batch', () async {
+    when(mockWireGuardDartPlatform.batch(any)).thenThrow(Exception('Failed to run batch'));
+
+    expect(() => wireguardDart.batch([const BatchCall.status()]), throwsException);
+    verify(mockWireGuardDartPlatform.batch(any)).called(1);
+  });
+
+  test('should rank endpoints successfully', () async {
+    const probes = [EndpointProbe('198.51.100.1:51820'), EndpointProbe('203.0.113.7:51820')];
+    const ranking = [
+      EndpointRanking(
+          endpoint: '203.0.113.7:51820',
+          address: '203.0.113.7',
+          sent: 3,
+          received: 3,
+          rttMs: 12.5,
+          jitterMs: 0.4,
+          loss: 0,
+          samplesMs: [12.1, 12.5, 12.9]),
+    ];
+    when(mockWireGuardDartPlatform.rankEndpoints(any,
+            samples: anyNamed('samples'), interval: anyNamed('interval'), timeout: anyNamed('timeout')))
+        .thenAnswer((_) async => ranking);
+
+    final result = await wireguardDart.rankEndpoints(probes, samples: 5);
+
+    expect(result, ranking);
+    verify(mockWireGuardDartPlatform.rankEndpoints(probes,
+            samples: 5, interval: const Duration(milliseconds: 100), timeout: const Duration(seconds: 1)))
+        .called(1);
+  });
+
+  test('should handle error when ranking endpoints', () async {
+    when(mockWireGuardDartPlatform.rankEndpoints(any,
+            samples: anyNamed('samples'), interval: anyNamed('interval'), timeout: anyNamed('timeout')))
+        .thenThrow(Exception('Failed to rank endpoints'));
+
+    expect(() => wireguardDart.rankEndpoints(const [EndpointProbe('198.51.100.1:51820')]), throwsException);
+  });
+
+  test('should prefetch endpoints successfully', () async {
+    const endpoints = ['vpn1.example.com:51820', 'vpn2.example.com:51820'];
+    when(mockWireGuardDartPlatform.prefetchEndpoints(any)).thenAnswer((_) async {});
+
+    await wireguardDart.prefetchEndpoints(endpoints);
+
+    verify(mockWireGuardDartPlatform.prefetchEndpoints(endpoints)).called(1);
+  });
+
+  test('should get traffic history', () async {
+    final history = TrafficHistory(
+        start: DateTime.utc(2024), step: const Duration(minutes: 1), samples: Int64List.fromList([10, 20, 30, 40]));
+    when(mockWireGuardDartPlatform.trafficHistory(
+            resolution: anyNamed('resolution'),
+            publicKey: anyNamed('publicKey'),
+            from: anyNamed('from'),
+            to: anyNamed('to')))
+        .thenAnswer((_) async => history);
+
+    final result = await wireguardDart.trafficHistory(resolution: TrafficResolution.minute);
+
+    expect(result.length, 2);
+    expect(result.received(1), 30);
+    expect(result.sent(1), 40);
+    verify(mockWireGuardDartPlatform.trafficHistory(resolution: TrafficResolution.minute)).called(1);
+  });
+
+  test('should import profiles and connect to one by ID', () async {
+    when(mockWireGuardDartPlatform.importProfiles(any)).thenAnswer((_) async => [1, 2]);
+    when(mockWireGuardDartPlatform.findProfiles(name: anyNamed('name'))).thenAnswer((_) async => [2]);
+    when(mockWireGuardDartPlatform.connect(profileId: anyNamed('profileId'))).thenAnswer((_) async {});
+
+    final ids = await wireguardDart.importProfiles({'a': 'config a', 'b': 'config b'});
+    final found = await wireguardDart.findProfiles(name: 'b');
+    await wireguardDart.connect(profileId: found.single);
+
+    expect(ids, [1, 2]);
+    verify(mockWireGuardDartPlatform.importProfiles({'a': 'config a', 'b': 'config b'})).called(1);
+    verify(mockWireGuardDartPlatform.connect(profileId: 2)).called(1);
+  });
+
+  test('should get data usage', () async {
+    when(mockWireGuardDartPlatform.dataUsage(since: anyNamed('since')))
+        .thenAnswer((_) async => const DataUsage(received: 1000, sent: 200));
+
+    final since = DateTime.utc(2024, 1, 1);
+    final result = await wireguardDart.dataUsage(since: since);
+
+    expect(result.total, 1200);
+    verify(mockWireGuardDartPlatform.dataUsage(since: since)).called(1);
+  });
+
+  test('should start probing the tunnel quality and report it with the statistics', () async {
+    when(mockWireGuardDartPlatform.setQualityProbe(any,
+            interval: anyNamed('interval'), timeout: anyNamed('timeout')))
+        .thenAnswer((_) async {});
+    when(mockWireGuardDartPlatform.getTunnelStatistics()).thenAnswer((_) async => TunnelStatistics.fromJson({
+          'totalDownload': 1,
+          'totalUpload': 2,
+          'latestHandshake': 3,
+          'quality': {
+            'rttMedian': 25.5,
+            'rttP90': 31,
+            'rttP99': 80.25,
+            'jitter': 1.5,
+            'loss': 0.02,
+            'probesSent': 50,
+            'probesReceived': 49,
+          },
+        }));
+
+    await wireguardDart.setQualityProbe('10.0.0.1:7', interval: const Duration(milliseconds: 500));
+    final statistics = await wireguardDart.getTunnelStatistics();
+
+    verify(mockWireGuardDartPlatform.setQualityProbe('10.0.0.1:7',
+            interval: const Duration(milliseconds: 500), timeout: const Duration(seconds: 2)))
+        .called(1);
+    expect(statistics!.quality!.rttP90, 31.0);
+    expect(statistics.quality!.probesReceived, 49);
+  });
+
+  test('should turn the kill switch on and off', () async {
+    when(mockWireGuardDartPlatform.setKillSwitch(any)).thenAnswer((_) async {});
+
+    await wireguardDart.setKillSwitch(true);
+    await wireguardDart.setKillSwitch(false);
+
+    verify(mockWireGuardDartPlatform.setKillSwitch(true)).called(1);
+    verify(mockWireGuardDartPlatform.setKillSwitch(false)).called(1);
+  });
+
+  test('should start and stop serving metrics', () async {
+    when(mockWireGuardDartPlatform.setMetricsSocket(any)).thenAnswer((_) async {});
+
+    await wireguardDart.setMetricsSocket('/run/user/1000/wireguard_dart.sock');
+    await wireguardDart.setMetricsSocket(null);
+
+    verify(mockWireGuardDartPlatform.setMetricsSocket('/run/user/1000/wireguard_dart.sock')).called(1);
+    verify(mockWireGuardDartPlatform.setMetricsSocket(null)).called(1);
+  });
+
+  test('should add, update and remove peers', () async {
+    const peers = [
+      PeerConfig('xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=',
+          endpoint: '198.51.100.1:51820', allowedIps: ['10.0.0.2/32'], persistentKeepalive: 25),
+    ];
+    const updates = [
+      PeerUpdate('xTIBA5rboUvnH4htodjb6e697QjLERt1NAB4mZqp8Dg=', allowedIps: ['10.0.0.2/32', '10.0.1.0/24']),
+    ];
+    when(mockWireGuardDartPlatform.addPeers(any)).thenAnswer((_) async => 1);
+    when(mockWireGuardDartPlatform.updatePeers(any)).thenAnswer((_) async => 1);
+    when(mockWireGuardDartPlatform.removePeers(any)).thenAnswer((_) async => 0);
+
+    expect(await wireguardDart.addPeers(peers), 1);
+    expect(await wireguardDart.updatePeers(updates), 1);
+    expect(await wireguardDart.removePeers([peers.first.publicKey]), 0);
+
+    verify(mockWireGuardDartPlatform.addPeers(peers)).called(1);
+    verify(mockWireGuardDartPlatform.updatePeers(updates)).called(1);
+    verify(mockWireGuardDartPlatform.removePeers([peers.first.publicKey])).called(1);
+  });
+
+  test('should leave unset peer fields out of the channel arguments', () {
+    expect(const PeerUpdate('key', persistentKeepalive: 0).toMap(), {'publicKey': 'key', 'persistentKeepalive': 0});
+    expect(const PeerConfig('key', allowedIps: ['10.0.0.2/32']).toMap(),
+        {'publicKey': 'key', 'allowedIps': ['10.0.0.2/32'], 'persistentKeepalive': 0});
+  });
+
+  test('should handle error when adding peers', () async {
+    when(mockWireGuardDartPlatform.addPeers(any)).thenThrow(Exception('INVALID_ARGUMENT'));
+
+    expect(() => wireguardDart.addPeers(const [PeerConfig('bad')]), throwsException);
+  });
+
   test('request push notification permission', () async {
     when(mockWireGuardDartPlatform.requestNotificationPermission())
         .thenAnswer((_) async => NotificationPermission.denied);
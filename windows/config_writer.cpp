@@ -1,6 +1,8 @@
 #include <windows.h>
 
 #include <codecvt>
+#include <fstream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -36,4 +38,14 @@ std::wstring WriteConfigToTempFile(std::string config) {
   return temp_filename;
 }
 
+std::string ReadConfigFile(const std::wstring &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return "";
+  }
+  std::ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
 }
@@ -4,4 +4,7 @@ namespace wireguard_dart {
 
 std::wstring WriteConfigToTempFile(std::string config);
 
+// Returns an empty string if the file cannot be read.
+std::string ReadConfigFile(const std::wstring &path);
+
 }
@@ -16,6 +16,8 @@ std::string ConnectionStatusToString(const ConnectionStatus status) {
       return "connecting";
     case ConnectionStatus::disconnecting:
       return "disconnecting";
+    case ConnectionStatus::degraded:
+      return "degraded";
     default:
       return "unknown";
   }
@@ -39,4 +41,17 @@ ConnectionStatus ConnectionStatusFromWinSvcState(DWORD dwCurrentState) {
   }
 }
 
+ConnectionStatus ConnectionStatusFromServiceState(ServiceState state) {
+  switch (state) {
+    case ServiceState::running:
+      return ConnectionStatus::connected;
+    case ServiceState::start_pending:
+      return ConnectionStatus::connecting;
+    case ServiceState::stop_pending:
+      return ConnectionStatus::disconnecting;
+    default:
+      return ConnectionStatus::disconnected;
+  }
+}
+
 }  // namespace wireguard_dart
@@ -5,14 +5,18 @@
 
 #include <string>
 
+#include "service_manager.h"
+
 namespace wireguard_dart {
 
-enum ConnectionStatus { connected, disconnected, connecting, disconnecting, unknown };
+enum ConnectionStatus { connected, disconnected, connecting, disconnecting, degraded, unknown };
 
 std::string ConnectionStatusToString(const ConnectionStatus status);
 
 ConnectionStatus ConnectionStatusFromWinSvcState(DWORD dwCurrentState);
 
+ConnectionStatus ConnectionStatusFromServiceState(ServiceState state);
+
 }  // namespace wireguard_dart
 
 #endif
@@ -1,19 +1,20 @@
 #include "connection_status_observer.h"
 
-#include <winsvc.h>
-
 #include <iostream>
-#include <thread>
+#include <memory>
+#include <utility>
 
 #include "connection_status.h"
+
 namespace wireguard_dart {
 
-ConnectionStatusObserver::ConnectionStatusObserver() {}
+ConnectionStatusObserver::ConnectionStatusObserver(PostTask post_to_platform, ServiceManager* manager)
+    : post_to_platform_(std::move(post_to_platform)), manager_(manager) {}
 
-ConnectionStatusObserver::~ConnectionStatusObserver() { Shutdown(); }
+ConnectionStatusObserver::~ConnectionStatusObserver() { StopObserving(); }
 
 void ConnectionStatusObserver::StartObserving(std::wstring service_name) {
-  if (m_running.load() == true) {
+  if (watcher_ != nullptr) {
     return;
   }
 
@@ -26,76 +27,33 @@ void ConnectionStatusObserver::StartObserving(std::wstring service_name) {
     return;
   }
 
-  SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-  if (service_manager == NULL) {
-    std::cerr << "Failed to open service manager: " << GetLastError() << std::endl;
-    return;
-  }
-  SC_HANDLE service = OpenService(service_manager, &m_service_name[0], SERVICE_QUERY_STATUS | SERVICE_INTERROGATE);
-  if (service == NULL) {
-    std::cerr << "Failed to open service: " << GetLastError() << std::endl;
-    CloseServiceHandle(service_manager);
-    return;
-  }
-
-  m_running.store(true);
-  m_watch_thread_stop.store(false);
-  watch_thread = std::thread(&ConnectionStatusObserver::StartObservingThreadProc, this, service_manager, service);
+  // Notifications report a transition as it happens; polling would lag by up to a second.
+  WaitOptions options;
+  options.strategy = WaitStrategy::notify;
+  watcher_ = std::make_unique<ServiceWatcher>(manager_, m_service_name, options, [this](ServiceState state) {
+    UpdateStatus(ConnectionStatusFromServiceState(state));
+  });
 }
 
-void ConnectionStatusObserver::StopObserving() {
-  m_watch_thread_stop.store(true);
-  if (watch_thread.joinable()) {
-    watch_thread.join();
-  }
-}
-
-void ConnectionStatusObserver::Shutdown() {
-  StopObserving();
-  m_running.store(false);
-}
+void ConnectionStatusObserver::StopObserving() { watcher_.reset(); }
 
-void ConnectionStatusObserver::StartObservingThreadProc(SC_HANDLE service_manager, SC_HANDLE service) {
-  SERVICE_NOTIFY s_notify = {0};
-  s_notify.dwVersion = SERVICE_NOTIFY_STATUS_CHANGE;
-  s_notify.pfnNotifyCallback = &ServiceNotifyCallback;
-  s_notify.pContext = static_cast<void*>(this);
-  while (!m_watch_thread_stop.load()) {
-    if (NotifyServiceStatusChange(service,
-                                  SERVICE_NOTIFY_RUNNING | SERVICE_NOTIFY_START_PENDING | SERVICE_NOTIFY_STOPPED |
-                                      SERVICE_NOTIFY_STOP_PENDING,
-                                  &s_notify) == ERROR_SUCCESS) {
-      ::SleepEx(INFINITE, true);
-    } else {
-      std::cerr << "Failed to notify service status change: " << GetLastError() << std::endl;
-      break;
+void ConnectionStatusObserver::UpdateStatus(ConnectionStatus status) {
+  m_last_status.store(status);
+  // The watcher and the tunnel watchdog report from threads of their own.
+  post_to_platform_([this, status] {
+    if (sink_) {
+      sink_->Success(flutter::EncodableValue(ConnectionStatusToString(status)));
     }
-  }
-  CloseServiceHandle(service);
-  CloseServiceHandle(service_manager);
-  m_running.store(false);
-}
-
-void CALLBACK ConnectionStatusObserver::ServiceNotifyCallback(void* ptr) {
-  SERVICE_NOTIFY* serviceNotify = static_cast<SERVICE_NOTIFY*>(ptr);
-  ConnectionStatusObserver* instance = static_cast<ConnectionStatusObserver*>(serviceNotify->pContext);
-
-  if (!instance || serviceNotify->dwNotificationStatus != ERROR_SUCCESS) {
-    std::cerr << "Service notification failed: " << serviceNotify->dwNotificationStatus << std::endl;
-    return;
-  }
-
-  auto service_status = &serviceNotify->ServiceStatus;
-  auto status = ConnectionStatusFromWinSvcState(service_status->dwCurrentState);
-
-  if (instance->sink_) {
-    instance->sink_->Success(flutter::EncodableValue(ConnectionStatusToString(status)));
-  }
+  });
 }
 
 std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> ConnectionStatusObserver::OnListenInternal(
     const flutter::EncodableValue* arguments, std::unique_ptr<flutter::EventSink<flutter::EncodableValue>>&& events) {
   sink_ = std::move(events);
+  auto last_status = m_last_status.load();
+  if (last_status != ConnectionStatus::unknown) {
+    sink_->Success(flutter::EncodableValue(ConnectionStatusToString(last_status)));
+  }
   return nullptr;
 }
 
@@ -5,17 +5,33 @@
 #include <flutter/event_channel.h>
 #include <windows.h>
 
-#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "connection_status.h"
+#include "service_control.h"
+#include "service_manager.h"
 
 namespace wireguard_dart {
 
+// Forwards the state of the tunnel service to the status event channel, as a ServiceWatcher on `manager` reports it.
+// Event sinks may only be used on the platform thread, so statuses reported on other threads are sent from there.
 class ConnectionStatusObserver : public flutter::StreamHandler<flutter::EncodableValue> {
  public:
-  ConnectionStatusObserver();
+  // Runs a task on the platform thread soon. Called on any thread.
+  using PostTask = std::function<void(std::function<void()> task)>;
+
+  explicit ConnectionStatusObserver(PostTask post_to_platform,
+                                    ServiceManager* manager = ScmServiceManager::Instance());
   virtual ~ConnectionStatusObserver();
+  // Starts watching `service_name`, or the service watched before if it is empty. Does nothing while watching.
   void StartObserving(std::wstring service_name);
   void StopObserving();
-  static void CALLBACK ServiceNotifyCallback(void* ptr);
+  // Records the latest status and forwards it to the listener, if any, from the platform thread. New listeners receive
+  // it immediately. May be called on any thread.
+  void UpdateStatus(ConnectionStatus status);
 
  protected:
   virtual std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> OnListenInternal(
@@ -25,15 +41,13 @@ class ConnectionStatusObserver : public flutter::StreamHandler<flutter::Encodabl
       const flutter::EncodableValue* arguments);
 
  private:
+  PostTask post_to_platform_;
+  // Only used on the platform thread.
   std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> sink_;
-  PSC_NOTIFICATION_REGISTRATION subscription_;
-  void StartObservingThreadProc(SC_HANDLE service_manager, SC_HANDLE service);
-
-  void Shutdown();
-  std::thread watch_thread;
-  std::atomic_bool m_watch_thread_stop;
-  std::atomic_bool m_running;
+  ServiceManager* manager_;
+  std::unique_ptr<ServiceWatcher> watcher_;
   std::wstring m_service_name;
+  std::atomic<ConnectionStatus> m_last_status{ConnectionStatus::unknown};
 };
 
 }  // namespace wireguard_dart
@@ -2,8 +2,13 @@
 
 #include <windows.h>
 
+#include <algorithm>
+#include <climits>
+#include <cwctype>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "utils.h"
 
@@ -82,124 +87,221 @@ void ServiceControl::Create(CreateArgs args) {
   CloseServiceHandle(service_manager);
 }
 
-void ServiceControl::Start() {
-  SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-  if (service_manager == NULL) {
-    throw ServiceControlException("Failed to open service manager", GetLastError());
+// Maps a SERVICE_* state as ConnectionStatusFromWinSvcState does.
+static ServiceState ServiceStateFromWinSvcState(DWORD state) {
+  switch (state) {
+    case SERVICE_START_PENDING:
+    case SERVICE_CONTINUE_PENDING:
+      return ServiceState::start_pending;
+    case SERVICE_RUNNING:
+      return ServiceState::running;
+    case SERVICE_STOP_PENDING:
+    case SERVICE_PAUSE_PENDING:
+      return ServiceState::stop_pending;
+    default:
+      return ServiceState::stopped;
   }
+}
 
-  SC_HANDLE service = OpenService(service_manager, this->service_name_.c_str(), SC_MANAGER_ALL_ACCESS);
-  if (service == NULL) {
-    CloseServiceHandle(service_manager);
-    throw ServiceControlException("Failed to start: service does not exist");
-  }
+static ServiceStatus ServiceStatusFromProcess(const SERVICE_STATUS_PROCESS &status) {
+  ServiceStatus result;
+  result.state = ServiceStateFromWinSvcState(status.dwCurrentState);
+  result.wait_hint = status.dwWaitHint;
+  return result;
+}
 
-  if (!StartService(service, 0, NULL)) {
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    throw ServiceControlException("Failed to start the service", GetLastError());
+// Closes the service manager and service handles of a single operation on every path.
+class ServiceHandles {
+ public:
+  // Opens `name` with `access`; service() is NULL if it does not exist.
+  ServiceHandles(const std::wstring &name, DWORD access) {
+    service_manager_ = OpenSCManager(NULL, NULL, SC_MANAGER_CONNECT);
+    if (service_manager_ == NULL) {
+      throw ServiceControlException("Failed to open service manager", GetLastError());
+    }
+    service_ = OpenService(service_manager_, name.c_str(), access);
+  }
+  ~ServiceHandles() {
+    if (service_ != NULL) {
+      CloseServiceHandle(service_);
+    }
+    CloseServiceHandle(service_manager_);
   }
 
-  CloseServiceHandle(service);
-  CloseServiceHandle(service_manager);
-}
+  ServiceHandles(const ServiceHandles &) = delete;
+  ServiceHandles &operator=(const ServiceHandles &) = delete;
 
-void ServiceControl::Stop() {
-  SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-  if (service_manager == NULL) {
-    throw ServiceControlException("Failed to open service manager", GetLastError());
-  }
+  SC_HANDLE service() const { return service_; }
 
-  SC_HANDLE service = OpenService(service_manager, &service_name_[0], SERVICE_STOP | SERVICE_QUERY_STATUS);
-  if (service == NULL) {
-    CloseServiceHandle(service_manager);
-    return;
-  }
+ private:
+  SC_HANDLE service_manager_;
+  SC_HANDLE service_;
+};
 
+static ServiceStatus QueryStatus(SC_HANDLE service) {
   SERVICE_STATUS_PROCESS service_status;
   DWORD service_status_bytes_needed;
   if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)&service_status, sizeof(SERVICE_STATUS_PROCESS),
                             &service_status_bytes_needed)) {
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
     throw ServiceControlException("Failed to query service status", GetLastError());
   }
-  if (service_status.dwCurrentState == SERVICE_STOPPED) {
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    return;
-  }
+  return ServiceStatusFromProcess(service_status);
+}
 
-  DWORD start_time = GetTickCount();
-  DWORD wait_for_stop_timeout = 15000;
-  DWORD wait_time;
-  while (service_status.dwCurrentState == SERVICE_STOP_PENDING) {
-    // Sometimes dwWaitHint gives unreasonably large values (e.g. 120s), thus just checking every 1s.
-    // Original logic:
-    // wait_time = service_status.dwWaitHint / 10;
-    // if (wait_time < 1000)
-    //   wait_time = 1000;
-    // else if (wait_time > 10000)
-    //   wait_time = 10000;
-    wait_time = 1000;
+ScmServiceManager *ScmServiceManager::Instance() {
+  static ScmServiceManager instance;
+  return &instance;
+}
 
-    Sleep(wait_time);
+void ScmServiceManager::Start(const std::wstring &name) {
+  ServiceHandles handles(name, SERVICE_START);
+  if (handles.service() == NULL) {
+    throw ServiceControlException("Failed to start: service does not exist");
+  }
+  if (!StartService(handles.service(), 0, NULL)) {
+    throw ServiceControlException("Failed to start the service", GetLastError());
+  }
+}
 
-    if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)&service_status, sizeof(SERVICE_STATUS_PROCESS),
-                              &service_status_bytes_needed)) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      throw ServiceControlException("Failed to query service status when stop pending", GetLastError());
-    }
+void ScmServiceManager::Stop(const std::wstring &name) {
+  ServiceHandles handles(name, SERVICE_STOP);
+  if (handles.service() == NULL) {
+    return;
+  }
+  SERVICE_STATUS service_status;
+  if (!ControlService(handles.service(), SERVICE_CONTROL_STOP, &service_status)) {
+    throw ServiceControlException("Stop service command failed", GetLastError());
+  }
+}
 
-    if (service_status.dwCurrentState == SERVICE_STOPPED) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      return;
-    }
+ServiceStatus ScmServiceManager::Query(const std::wstring &name) {
+  ServiceHandles handles(name, SERVICE_QUERY_STATUS);
+  if (handles.service() == NULL) {
+    return ServiceStatus();
+  }
+  return QueryStatus(handles.service());
+}
 
-    if (GetTickCount() - start_time > wait_for_stop_timeout) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      throw ServiceControlException("Disconnect timed out");
+// Keeps the service open and registered for status change notifications from one wait to the next. A registration
+// notifies once, so NotifyServiceStatusChange is called again only after a notification came. Notifications are APCs
+// on the waiting thread, which waits alertably on an event that Cancel sets.
+class ScmChangeWait : public ServiceChangeWait {
+ public:
+  explicit ScmChangeWait(const std::wstring &name) : name_(name) {
+    cancelled_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (cancelled_ == NULL) {
+      throw ServiceControlException("Failed to create event", GetLastError());
     }
   }
-  if (!ControlService(service, SERVICE_CONTROL_STOP, (LPSERVICE_STATUS)&service_status)) {
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    throw ServiceControlException("Stop service command failed", GetLastError());
+
+  ~ScmChangeWait() override {
+    Close();
+    // A callback queued before the registration was cancelled runs now, while the object is still alive, if this is
+    // the waiting thread; otherwise that thread is gone and the callback with it.
+    SleepEx(0, TRUE);
+    CloseHandle(cancelled_);
   }
 
-  while (service_status.dwCurrentState != SERVICE_STOPPED) {
-    // Sometimes dwWaitHint gives unreasonably large values (e.g. 120s), thus just checking every 1s.
-    // Original logic:
-    // Sleep(service_status.dwWaitHint);
-    Sleep(1000);
+  ServiceStatus Wait(ServiceState state, int64_t timeout) override;
 
-    if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)&service_status, sizeof(SERVICE_STATUS_PROCESS),
-                              &service_status_bytes_needed)) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      throw ServiceControlException("Failed to query service status after issuing stop command", GetLastError());
-    }
+  void Cancel() override { SetEvent(cancelled_); }
 
-    if (service_status.dwCurrentState == SERVICE_STOPPED) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      return;
-    }
+ private:
+  // How often a service that does not exist, and so cannot be registered for, is looked for again.
+  static const DWORD kReopenInterval = 1000;
 
-    if (GetTickCount() - start_time > wait_for_stop_timeout) {
-      CloseServiceHandle(service);
-      CloseServiceHandle(service_manager);
-      throw ServiceControlException("Disconnect timed out");
+  static void CALLBACK OnNotification(void *parameter);
+
+  // Closing the service handle also cancels the registration.
+  void Close() {
+    handles_.reset();
+    registered_ = false;
+  }
+
+  const std::wstring name_;
+  HANDLE cancelled_;
+  std::unique_ptr<ServiceHandles> handles_;
+  SERVICE_NOTIFY notify_ = {0};
+  bool registered_ = false;
+  // Set by OnNotification.
+  bool fired_ = false;
+};
+
+void CALLBACK ScmChangeWait::OnNotification(void *parameter) {
+  auto *notify = static_cast<SERVICE_NOTIFY *>(parameter);
+  static_cast<ScmChangeWait *>(notify->pContext)->fired_ = true;
+}
+
+ServiceStatus ScmChangeWait::Wait(ServiceState state, int64_t timeout) {
+  const DWORD kMask = SERVICE_NOTIFY_STOPPED | SERVICE_NOTIFY_START_PENDING | SERVICE_NOTIFY_STOP_PENDING |
+                      SERVICE_NOTIFY_RUNNING | SERVICE_NOTIFY_CONTINUE_PENDING | SERVICE_NOTIFY_PAUSE_PENDING |
+                      SERVICE_NOTIFY_PAUSED;
+  ULONGLONG deadline = timeout == kNoTimeout ? ULLONG_MAX : GetTickCount64() + timeout;
+  ServiceStatus unchanged;
+  unchanged.state = state;
+  for (;;) {
+    if (WaitForSingleObject(cancelled_, 0) == WAIT_OBJECT_0) {
+      return unchanged;
+    }
+    if (fired_) {
+      fired_ = false;
+      registered_ = false;
+      if (notify_.dwNotificationStatus != ERROR_SUCCESS) {
+        // E.g. the service was deleted; it is opened again below.
+        Close();
+      } else {
+        ServiceStatus status = ServiceStatusFromProcess(notify_.ServiceStatus);
+        if (status.state != state) {
+          return status;
+        }
+      }
+    }
+    if (handles_ == nullptr) {
+      handles_ = std::make_unique<ServiceHandles>(name_, SERVICE_QUERY_STATUS);
+      if (handles_->service() == NULL) {
+        handles_.reset();
+      }
+    }
+    ServiceStatus status = handles_ != nullptr ? QueryStatus(handles_->service()) : ServiceStatus();
+    ULONGLONG now = GetTickCount64();
+    if (status.state != state || now >= deadline) {
+      return status;
     }
+    if (handles_ != nullptr && !registered_) {
+      notify_ = {0};
+      notify_.dwVersion = SERVICE_NOTIFY_STATUS_CHANGE;
+      notify_.pfnNotifyCallback = &OnNotification;
+      notify_.pContext = this;
+      DWORD result = NotifyServiceStatusChange(handles_->service(), kMask, &notify_);
+      if (result == ERROR_SUCCESS) {
+        registered_ = true;
+      } else if (result == ERROR_SERVICE_MARKED_FOR_DELETE || result == ERROR_SERVICE_NOTIFY_CLIENT_LAGGING) {
+        Close();
+      } else {
+        throw ServiceControlException("Failed to register for service status changes", result);
+      }
+    }
+    DWORD milliseconds = registered_ ? INFINITE : kReopenInterval;
+    if (deadline != ULLONG_MAX) {
+      milliseconds = static_cast<DWORD>(std::min<ULONGLONG>(milliseconds, deadline - now));
+    }
+    // Returns early for a notification, WAIT_IO_COMPLETION, or Cancel.
+    WaitForSingleObjectEx(cancelled_, milliseconds, TRUE);
   }
+}
 
-  CloseServiceHandle(service);
-  CloseServiceHandle(service_manager);
+ServiceStatus ScmServiceManager::WaitForChange(const std::wstring &name, ServiceState state, int64_t timeout) {
+  return ScmChangeWait(name).Wait(state, timeout);
+}
+
+std::unique_ptr<ServiceChangeWait> ScmServiceManager::WatchChanges(const std::wstring &name) {
+  return std::make_unique<ScmChangeWait>(name);
 }
 
+void ServiceControl::Start() { manager_->Start(service_name_); }
+
+void ServiceControl::Stop() { StopService(manager_, service_name_, wait_options_); }
+
 void ServiceControl::Disable() {
   SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
   if (service_manager == NULL) {
@@ -222,31 +324,85 @@ void ServiceControl::Disable() {
 }
 
 ConnectionStatus ServiceControl::Status() {
-  SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
+  return ConnectionStatusFromServiceState(manager_->Query(service_name_).state);
+}
+
+static std::wstring ToLower(std::wstring str) {
+  std::transform(str.begin(), str.end(), str.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+  return str;
+}
+
+// Extracts the value of -config-file="..." from a tunnel service command line.
+static std::wstring ConfigFileFromCommandLine(const std::wstring &command_line) {
+  const std::wstring flag = L"-config-file=\"";
+  auto start = command_line.find(flag);
+  if (start == std::wstring::npos) {
+    return L"";
+  }
+  start += flag.size();
+  auto end = command_line.find(L'"', start);
+  if (end == std::wstring::npos) {
+    return L"";
+  }
+  return command_line.substr(start, end - start);
+}
+
+std::vector<TunnelServiceInfo> FindActiveTunnelServices(const std::wstring &executable) {
+  std::vector<TunnelServiceInfo> tunnels;
+  SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ENUMERATE_SERVICE | SC_MANAGER_CONNECT);
   if (service_manager == NULL) {
     throw ServiceControlException("Failed to open service manager", GetLastError());
   }
 
-  SC_HANDLE service = OpenService(service_manager, &service_name_[0], SERVICE_QUERY_STATUS);
-  if (service == NULL) {
-    CloseServiceHandle(service_manager);
-    return ConnectionStatus::disconnected;
-  }
+  DWORD bytes_needed = 0;
+  DWORD services_returned = 0;
+  DWORD resume_handle = 0;
+  std::vector<BYTE> services_buffer;
+  for (;;) {
+    BOOL ok = EnumServicesStatusEx(service_manager, SC_ENUM_PROCESS_INFO, SERVICE_WIN32, SERVICE_ACTIVE,
+                                   services_buffer.empty() ? NULL : services_buffer.data(),
+                                   static_cast<DWORD>(services_buffer.size()), &bytes_needed, &services_returned,
+                                   &resume_handle, NULL);
+    DWORD error_code = ok ? ERROR_SUCCESS : GetLastError();
+    if (!ok && error_code != ERROR_MORE_DATA) {
+      CloseServiceHandle(service_manager);
+      throw ServiceControlException("Failed to enumerate services", error_code);
+    }
 
-  SERVICE_STATUS_PROCESS service_status;
-  DWORD service_status_bytes_needed;
-  if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)&service_status, sizeof(SERVICE_STATUS_PROCESS),
-                            &service_status_bytes_needed)) {
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    throw ServiceControlException("Failed to query service status", GetLastError());
-  }
+    auto services = reinterpret_cast<ENUM_SERVICE_STATUS_PROCESS *>(services_buffer.data());
+    for (DWORD i = 0; i < services_returned; i++) {
+      SC_HANDLE service = OpenService(service_manager, services[i].lpServiceName, SERVICE_QUERY_CONFIG);
+      if (service == NULL) {
+        continue;
+      }
+      DWORD config_bytes_needed = 0;
+      QueryServiceConfig(service, NULL, 0, &config_bytes_needed);
+      std::vector<BYTE> config_buffer(config_bytes_needed);
+      auto config = reinterpret_cast<QUERY_SERVICE_CONFIG *>(config_buffer.data());
+      if (config_bytes_needed > 0 &&
+          QueryServiceConfig(service, config, config_bytes_needed, &config_bytes_needed) &&
+          config->lpBinaryPathName != NULL) {
+        std::wstring command_line = config->lpBinaryPathName;
+        if (ToLower(command_line).find(ToLower(executable)) == 0) {
+          TunnelServiceInfo info;
+          info.service_name = services[i].lpServiceName;
+          info.config_file = ConfigFileFromCommandLine(command_line);
+          info.status = ConnectionStatusFromWinSvcState(services[i].ServiceStatusProcess.dwCurrentState);
+          tunnels.push_back(info);
+        }
+      }
+      CloseServiceHandle(service);
+    }
 
-  ConnectionStatus status = ConnectionStatusFromWinSvcState(service_status.dwCurrentState);
+    if (ok) {
+      break;
+    }
+    // First pass only sizes the buffer; later passes continue from resume_handle.
+    services_buffer.resize(bytes_needed);
+  }
 
-  CloseServiceHandle(service);
   CloseServiceHandle(service_manager);
-  return status;
+  return tunnels;
 }
 
 }  // namespace wireguard_dart
@@ -1,9 +1,12 @@
 #ifndef WIREGUARD_DART_SERVICE_CONTROL_H
 #define WIREGUARD_DART_SERVICE_CONTROL_H
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "connection_status.h"
+#include "service_manager.h"
 
 namespace wireguard_dart {
 
@@ -11,19 +14,48 @@ struct CreateArgs {
   std::wstring description, executable_and_args, dependencies;
 };
 
+// ServiceManager over the Win32 service control manager. WaitForChange and WatchChanges block on
+// NotifyServiceStatusChange.
+class ScmServiceManager : public ServiceManager {
+ public:
+  // The process-wide instance; the class has no state of its own.
+  static ScmServiceManager *Instance();
+
+  void Start(const std::wstring &name) override;
+  void Stop(const std::wstring &name) override;
+  ServiceStatus Query(const std::wstring &name) override;
+  ServiceStatus WaitForChange(const std::wstring &name, ServiceState state, int64_t timeout) override;
+  std::unique_ptr<ServiceChangeWait> WatchChanges(const std::wstring &name) override;
+};
+
 class ServiceControl {
  public:
   const std::wstring service_name_;
 
-  ServiceControl(const std::wstring service_name) : service_name_(service_name) {}
+  // Start, Stop and Status go through `manager`; Stop waits as `wait_options` say.
+  ServiceControl(const std::wstring service_name, ServiceManager *manager = ScmServiceManager::Instance(),
+                 WaitOptions wait_options = WaitOptions())
+      : service_name_(service_name), manager_(manager), wait_options_(wait_options) {}
 
   void Create(CreateArgs args);
   void Start();
   void Stop();
   void Disable();
   ConnectionStatus Status();
+
+ private:
+  ServiceManager *manager_;
+  WaitOptions wait_options_;
 };
 
+struct TunnelServiceInfo {
+  std::wstring service_name, config_file;
+  ConnectionStatus status;
+};
+
+// Lists active services whose binary is `executable`, i.e. tunnels started by a previous instance of the app.
+std::vector<TunnelServiceInfo> FindActiveTunnelServices(const std::wstring &executable);
+
 }  // namespace wireguard_dart
 
 #endif
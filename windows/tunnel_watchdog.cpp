@@ -0,0 +1,331 @@
+#include "tunnel_watchdog.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#include <netioapi.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "connection_status.h"
+#include "path_mtu.h"
+#include "socket_util.h"
+
+namespace wireguard_dart {
+
+const int64_t kPollInterval = 1000;
+
+static int64_t UnixMillisNow() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// The default route the adapter's own packets take: the one with the lowest metric that does not go through the
+// adapter. Null if there is none.
+static const MIB_IPFORWARD_ROW2 *UnderlayRoute(const MIB_IPFORWARD_TABLE2 *table, uint64_t tunnel_luid) {
+  const MIB_IPFORWARD_ROW2 *best = nullptr;
+  for (ULONG i = 0; i < table->NumEntries; i++) {
+    const MIB_IPFORWARD_ROW2 &row = table->Table[i];
+    if (row.DestinationPrefix.PrefixLength == 0 && row.InterfaceLuid.Value != tunnel_luid &&
+        (best == nullptr || row.Metric < best->Metric)) {
+      best = &row;
+    }
+  }
+  return best;
+}
+
+// Tells networks apart by their underlay route, as "<interface LUID> <next hop>". Empty if there is none.
+static std::string UnderlayNetworkId(uint64_t tunnel_luid) {
+  MIB_IPFORWARD_TABLE2 *table = nullptr;
+  if (GetIpForwardTable2(AF_UNSPEC, &table) != NO_ERROR) {
+    return "";
+  }
+  const MIB_IPFORWARD_ROW2 *best = UnderlayRoute(table, tunnel_luid);
+  std::string id;
+  if (best != nullptr) {
+    char next_hop[INET6_ADDRSTRLEN] = "";
+    if (best->NextHop.si_family == AF_INET) {
+      inet_ntop(AF_INET, &best->NextHop.Ipv4.sin_addr, next_hop, sizeof(next_hop));
+    } else if (best->NextHop.si_family == AF_INET6) {
+      inet_ntop(AF_INET6, &best->NextHop.Ipv6.sin6_addr, next_hop, sizeof(next_hop));
+    }
+    id = std::to_string(best->InterfaceLuid.Value) + " " + next_hop;
+  }
+  FreeMibTable(table);
+  return id;
+}
+
+// The interface of the underlay route of `family`, 0 if there is none.
+static NET_IFINDEX UnderlayInterface(uint64_t tunnel_luid, ADDRESS_FAMILY family) {
+  MIB_IPFORWARD_TABLE2 *table = nullptr;
+  if (GetIpForwardTable2(family, &table) != NO_ERROR) {
+    return 0;
+  }
+  const MIB_IPFORWARD_ROW2 *best = UnderlayRoute(table, tunnel_luid);
+  NET_IFINDEX index = best != nullptr ? best->InterfaceIndex : 0;
+  FreeMibTable(table);
+  return index;
+}
+
+TunnelWatchdog::~TunnelWatchdog() { Stop(); }
+
+void TunnelWatchdog::Start(const std::wstring &tunnel_name, const WireguardConfig &config,
+                           RestartTunnel restart_tunnel) {
+  Stop();
+  tunnel_name_ = tunnel_name;
+  config_ = config;
+  restart_tunnel_ = std::move(restart_tunnel);
+  adapter_.reset();
+  watchdog_.Reset();
+  keepalive_tuner_.Reset(config.peers);
+  degraded_.store(false);
+  tunnel_luid_.store(0);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    woken_ = false;
+    network_changes_.Reset();
+  }
+  thread_ = std::thread(&TunnelWatchdog::Run, this);
+  Subscribe();
+}
+
+void TunnelWatchdog::Stop() {
+  // Waits for running callbacks, which take mutex_.
+  Unsubscribe();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TunnelWatchdog::Run() {
+  WSADATA wsa_data;
+  bool winsock = WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+
+  int64_t next_poll = SteadyMillisNow() + kPollInterval;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    int64_t wake_at = next_poll;
+    if (network_changes_.deadline() >= 0) {
+      wake_at = (std::min)(wake_at, network_changes_.deadline());
+    }
+    auto timeout = std::chrono::milliseconds((std::max)(wake_at - SteadyMillisNow(), int64_t(0)));
+    stop_condition_.wait_for(lock, timeout, [this] { return stop_ || woken_; });
+    woken_ = false;
+    if (stop_) {
+      break;
+    }
+    int64_t now = SteadyMillisNow();
+    bool rebind = network_changes_.Due(now);
+    bool poll = now >= next_poll;
+    if (!rebind && !poll) {
+      continue;
+    }
+    if (poll) {
+      next_poll = now + kPollInterval;
+    }
+    lock.unlock();
+    try {
+      bool network_changed = rebind;
+      if (adapter_ == nullptr) {
+        adapter_ = WireguardAdapter::Open(tunnel_name_);
+        if (adapter_ != nullptr) {
+          tunnel_luid_.store(adapter_->Luid().Value);
+          network_changed = true;
+        }
+      }
+      if (adapter_ != nullptr && rebind) {
+        adapter_->Rebind();
+      }
+      if (adapter_ != nullptr && network_changed) {
+        auto changes = keepalive_tuner_.SetNetwork(UnderlayNetworkId(tunnel_luid_.load()), now);
+        if (!changes.empty()) {
+          adapter_->ApplyPeerChanges(KeepaliveUpdates(changes));
+        }
+        if (config_.interface_config.mtu == 0) {
+          AdaptMtu();
+        }
+      }
+      if (adapter_ != nullptr && poll) {
+        auto samples = adapter_->PeerSamples();
+        auto changes = keepalive_tuner_.Observe(samples, now);
+        if (!changes.empty()) {
+          adapter_->ApplyPeerChanges(KeepaliveUpdates(changes));
+        }
+        auto step = watchdog_.Observe(samples, UnixMillisNow());
+        if (watchdog_.degraded() != degraded_.exchange(watchdog_.degraded())) {
+          observer_->UpdateStatus(watchdog_.degraded() ? ConnectionStatus::degraded : ConnectionStatus::connected);
+        }
+        Perform(step);
+      }
+    } catch (std::exception &e) {
+      // The adapter goes away while the service restarts; reopen it on the next poll.
+      std::cerr << "Tunnel watchdog: " << e.what() << std::endl;
+      adapter_.reset();
+    }
+    lock.lock();
+  }
+  lock.unlock();
+
+  if (winsock) {
+    WSACleanup();
+  }
+}
+
+void TunnelWatchdog::Subscribe() {
+  // Failures only cost the fast recovery; the handshake watchdog still notices a dead path.
+  if (NotifyIpInterfaceChange(AF_UNSPEC, OnInterfaceChange, this, FALSE, &notifications_[0]) != NO_ERROR) {
+    notifications_[0] = NULL;
+  }
+  if (NotifyUnicastIpAddressChange(AF_UNSPEC, OnAddressChange, this, FALSE, &notifications_[1]) != NO_ERROR) {
+    notifications_[1] = NULL;
+  }
+  if (NotifyRouteChange2(AF_UNSPEC, OnRouteChange, this, FALSE, &notifications_[2]) != NO_ERROR) {
+    notifications_[2] = NULL;
+  }
+}
+
+void TunnelWatchdog::Unsubscribe() {
+  for (auto &notification : notifications_) {
+    if (notification != NULL) {
+      CancelMibChangeNotify2(notification);
+      notification = NULL;
+    }
+  }
+}
+
+void TunnelWatchdog::OnNetworkChange(const NET_LUID &luid) {
+  if (luid.Value == tunnel_luid_.load()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    network_changes_.Notify(SteadyMillisNow());
+    woken_ = true;
+  }
+  stop_condition_.notify_all();
+}
+
+void WINAPI TunnelWatchdog::OnInterfaceChange(void *context, MIB_IPINTERFACE_ROW *row, MIB_NOTIFICATION_TYPE type) {
+  if (row != nullptr && type != MibInitialNotification) {
+    static_cast<TunnelWatchdog *>(context)->OnNetworkChange(row->InterfaceLuid);
+  }
+}
+
+void WINAPI TunnelWatchdog::OnAddressChange(void *context, MIB_UNICASTIPADDRESS_ROW *row,
+                                            MIB_NOTIFICATION_TYPE type) {
+  // Link-local addresses come and go with every interface and are never used to reach an endpoint.
+  if (row == nullptr || type == MibInitialNotification ||
+      (row->Address.si_family == AF_INET6 && IN6_IS_ADDR_LINKLOCAL(&row->Address.Ipv6.sin6_addr))) {
+    return;
+  }
+  static_cast<TunnelWatchdog *>(context)->OnNetworkChange(row->InterfaceLuid);
+}
+
+void WINAPI TunnelWatchdog::OnRouteChange(void *context, MIB_IPFORWARD_ROW2 *row, MIB_NOTIFICATION_TYPE type) {
+  if (row != nullptr && type != MibInitialNotification) {
+    static_cast<TunnelWatchdog *>(context)->OnNetworkChange(row->InterfaceLuid);
+  }
+}
+
+void TunnelWatchdog::AdaptMtu() {
+  uint64_t tunnel_luid = tunnel_luid_.load();
+  uint32_t mtu = 0;
+  for (const auto &peer : config_.peers) {
+    PathMtuOptions options;
+    int family = AF_UNSPEC;
+    options.prepare_socket = [tunnel_luid, &family](Socket fd, int probe_family) {
+      // The tunnel's routes would take the probes into the tunnel; the service binds its own socket the same way.
+      family = probe_family;
+      DWORD index = UnderlayInterface(tunnel_luid, static_cast<ADDRESS_FAMILY>(family));
+      if (family == AF_INET) {
+        // IP_UNICAST_IF takes the IPv4 interface index in network byte order.
+        index = htonl(index);
+        setsockopt(fd, IPPROTO_IP, IP_UNICAST_IF, reinterpret_cast<const char *>(&index), sizeof(index));
+      } else {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_UNICAST_IF, reinterpret_cast<const char *>(&index), sizeof(index));
+      }
+    };
+    int path_mtu = DiscoverPathMtu(peer.endpoint, options);
+    if (path_mtu != 0 && (mtu == 0 || TunnelMtu(path_mtu, family) < mtu)) {
+      mtu = TunnelMtu(path_mtu, family);
+    }
+  }
+  if (mtu != 0) {
+    adapter_->SetMtu(mtu);
+  }
+}
+
+void TunnelWatchdog::Perform(const RecoveryStep &step) {
+  switch (step.action) {
+    case RecoveryAction::none:
+      break;
+    case RecoveryAction::reresolve_endpoint:
+      // Endpoints given as IP literals have nothing to re-resolve; reapplying the peer is the next best step.
+      if (!ReresolveEndpoint(step.public_key)) {
+        ReapplyPeer(step.public_key);
+      }
+      break;
+    case RecoveryAction::reapply_peer:
+      ReapplyPeer(step.public_key);
+      break;
+    case RecoveryAction::restart_tunnel: {
+      adapter_.reset();
+      // Restarting the service here would race connect and disconnect, and could undo a disconnect; it is left to the
+      // platform thread, and not asked for at all once Stop was.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!stop_) {
+        restart_tunnel_();
+      }
+      break;
+    }
+  }
+}
+
+bool TunnelWatchdog::ReresolveEndpoint(const WireguardKey &public_key) {
+  for (const auto &peer : config_.peers) {
+    WireguardKey key;
+    if (!DecodeKey(peer.public_key, &key) || key != public_key) {
+      continue;
+    }
+    // An IP literal has nothing to look up, and the peer is reapplied instead.
+    if (peer.endpoint.empty() || EndpointFamily(peer.endpoint) != AddressFamily::unspecified) {
+      return false;
+    }
+
+    // Looked up afresh rather than from the DNS cache, whose address is the one that stopped answering.
+    std::string endpoint;
+    try {
+      endpoint = ResolveEndpoints({peer.endpoint}, family_cache_)[0];
+    } catch (std::invalid_argument &e) {
+      std::cerr << "Tunnel watchdog: " << e.what() << std::endl;
+      return false;
+    }
+
+    ConfigurationBuilder builder;
+    auto &update = builder.AddPeer(public_key, WIREGUARD_PEER_UPDATE | WIREGUARD_PEER_HAS_ENDPOINT);
+    update.Endpoint = EndpointToSockaddr(endpoint);
+    adapter_->SetConfiguration(builder.Build());
+    return true;
+  }
+  return false;
+}
+
+void TunnelWatchdog::ReapplyPeer(const WireguardKey &public_key) {
+  // Rewriting the endpoint drops any stale roaming state. The driver only sends a keepalive, and with it a fresh
+  // handshake for the unusable session, when the keepalive is raised from 0; writing back the same value does nothing,
+  // so the keepalive is pulsed the way Rebind does it.
+  adapter_->Rebind(&public_key);
+}
+
+}  // namespace wireguard_dart
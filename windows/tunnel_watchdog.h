@@ -0,0 +1,89 @@
+#ifndef WIREGUARD_DART_TUNNEL_WATCHDOG_H
+#define WIREGUARD_DART_TUNNEL_WATCHDOG_H
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "adaptive_keepalive.h"
+#include "connection_status_observer.h"
+#include "handshake_watchdog.h"
+#include "happy_eyeballs.h"
+#include "network_change.h"
+#include "wireguard_adapter.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+// Polls the tunnel adapter while connected and drives HandshakeWatchdog recovery steps against it. Also subscribes to
+// interface, address and route change notifications and rebinds the adapter's peers once a burst of them has
+// settled, so that a roam between networks is recovered within a second instead of after the next failed handshake.
+// Its samples also drive a KeepaliveTuner, which learns the NAT binding timeout of every network the tunnel runs on.
+// Unless the config sets an MTU, the adapter's MTU follows the path MTU to the peers on every network.
+class TunnelWatchdog {
+ public:
+  // Asks for the tunnel service to be restarted, the last step of the recovery ladder. Called on the watchdog thread,
+  // so it must hand the restart to whoever starts and stops the service rather than block.
+  using RestartTunnel = std::function<void()>;
+
+  // `family_cache` orders the addresses of re-resolved endpoints.
+  TunnelWatchdog(ConnectionStatusObserver *observer, AddressFamilyCache *family_cache)
+      : observer_(observer), family_cache_(family_cache) {}
+  ~TunnelWatchdog();
+
+  // `config` provides endpoint hostnames for re-resolution.
+  void Start(const std::wstring &tunnel_name, const WireguardConfig &config, RestartTunnel restart_tunnel);
+  // Once this returns, `restart_tunnel` is not called again.
+  void Stop();
+
+  bool degraded() const { return degraded_.load(); }
+
+ private:
+  void Run();
+  void Perform(const RecoveryStep &step);
+  // Sets the adapter MTU from the smallest path MTU to the configured endpoints.
+  void AdaptMtu();
+  // Called by the notification threads of the IP helper API.
+  void OnNetworkChange(const NET_LUID &luid);
+  static void WINAPI OnInterfaceChange(void *context, MIB_IPINTERFACE_ROW *row, MIB_NOTIFICATION_TYPE type);
+  static void WINAPI OnAddressChange(void *context, MIB_UNICASTIPADDRESS_ROW *row, MIB_NOTIFICATION_TYPE type);
+  static void WINAPI OnRouteChange(void *context, MIB_IPFORWARD_ROW2 *row, MIB_NOTIFICATION_TYPE type);
+  void Subscribe();
+  void Unsubscribe();
+  bool ReresolveEndpoint(const WireguardKey &public_key);
+  void ReapplyPeer(const WireguardKey &public_key);
+
+  ConnectionStatusObserver *observer_;
+  AddressFamilyCache *family_cache_;
+  RestartTunnel restart_tunnel_;
+  std::wstring tunnel_name_;
+  WireguardConfig config_;
+  std::unique_ptr<WireguardAdapter> adapter_;
+  HandshakeWatchdog watchdog_;
+  KeepaliveTuner keepalive_tuner_;
+  std::atomic_bool degraded_{false};
+  // Notifications about the adapter itself are not underlay changes. 0 until the adapter was opened.
+  std::atomic<uint64_t> tunnel_luid_{0};
+  HANDLE notifications_[3] = {};
+  // Guarded by mutex_, like stop_.
+  NetworkChangeDebouncer network_changes_;
+  bool woken_ = false;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_condition_;
+  bool stop_ = false;
+};
+
+}  // namespace wireguard_dart
+
+#endif
@@ -0,0 +1,346 @@
+#include "wireguard_adapter.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <iphlpapi.h>
+#include <netioapi.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+// wireguard.h only declares function types; the symbols are resolved through wireguard.lib.
+extern "C" {
+WIREGUARD_OPEN_ADAPTER_FUNC WireGuardOpenAdapter;
+WIREGUARD_CLOSE_ADAPTER_FUNC WireGuardCloseAdapter;
+WIREGUARD_GET_CONFIGURATION_FUNC WireGuardGetConfiguration;
+WIREGUARD_SET_CONFIGURATION_FUNC WireGuardSetConfiguration;
+WIREGUARD_GET_ADAPTER_LUID_FUNC WireGuardGetAdapterLUID;
+}
+
+namespace wireguard_dart {
+
+// Difference between the Windows (1601-01-01) and Unix (1970-01-01) epochs in 100ns intervals.
+const DWORD64 kUnixEpochInFileTime = 116444736000000000ULL;
+
+std::unique_ptr<WireguardAdapter> WireguardAdapter::Open(const std::wstring &name) {
+  WIREGUARD_ADAPTER_HANDLE handle = WireGuardOpenAdapter(name.c_str());
+  if (handle == NULL) {
+    return nullptr;
+  }
+  return std::make_unique<WireguardAdapter>(handle);
+}
+
+WireguardAdapter::~WireguardAdapter() { WireGuardCloseAdapter(handle_); }
+
+std::vector<BYTE> WireguardAdapter::GetConfiguration() {
+  DWORD bytes = sizeof(WIREGUARD_INTERFACE) + 8 * (sizeof(WIREGUARD_PEER) + 8 * sizeof(WIREGUARD_ALLOWED_IP));
+  std::vector<BYTE> buffer;
+  for (;;) {
+    buffer.resize(bytes);
+    if (WireGuardGetConfiguration(handle_, reinterpret_cast<WIREGUARD_INTERFACE *>(buffer.data()), &bytes)) {
+      buffer.resize(bytes);
+      return buffer;
+    }
+    DWORD error_code = GetLastError();
+    if (error_code != ERROR_MORE_DATA) {
+      throw std::runtime_error(ErrorWithCode("Failed to get adapter configuration", error_code));
+    }
+  }
+}
+
+void WireguardAdapter::SetConfiguration(const std::vector<BYTE> &config) {
+  if (!WireGuardSetConfiguration(handle_, reinterpret_cast<const WIREGUARD_INTERFACE *>(config.data()),
+                                 static_cast<DWORD>(config.size()))) {
+    throw std::runtime_error(ErrorWithCode("Failed to set adapter configuration", GetLastError()));
+  }
+}
+
+std::vector<WIREGUARD_PEER> WireguardAdapter::Peers() {
+  std::vector<BYTE> config = GetConfiguration();
+  const auto *wg_interface = reinterpret_cast<const WIREGUARD_INTERFACE *>(config.data());
+  const auto *peer = reinterpret_cast<const WIREGUARD_PEER *>(wg_interface + 1);
+
+  std::vector<WIREGUARD_PEER> peers;
+  peers.reserve(wg_interface->PeersCount);
+  for (DWORD i = 0; i < wg_interface->PeersCount; i++) {
+    peers.push_back(*peer);
+    const auto *allowed_ip = reinterpret_cast<const WIREGUARD_ALLOWED_IP *>(peer + 1);
+    peer = reinterpret_cast<const WIREGUARD_PEER *>(allowed_ip + peer->AllowedIPsCount);
+  }
+  return peers;
+}
+
+std::vector<PeerSample> WireguardAdapter::PeerSamples() {
+  std::vector<PeerSample> samples;
+  for (const auto &peer : Peers()) {
+    PeerSample sample;
+    memcpy(sample.public_key.data(), peer.PublicKey, sample.public_key.size());
+    sample.last_handshake = HandshakeTimeToUnixMillis(peer.LastHandshake);
+    sample.rx_bytes = peer.RxBytes;
+    sample.tx_bytes = peer.TxBytes;
+    samples.push_back(sample);
+  }
+  return samples;
+}
+
+static WireguardKey RequireKey(const std::string &base64) {
+  WireguardKey key;
+  if (!DecodeKey(base64, &key)) {
+    throw std::invalid_argument("Invalid key: " + base64);
+  }
+  return key;
+}
+
+SOCKADDR_INET EndpointToSockaddr(const std::string &endpoint) {
+  std::string host;
+  uint16_t port;
+  IpPrefix address;
+  if (!SplitEndpoint(endpoint, &host, &port) || !ParseIpPrefix(host, &address)) {
+    throw std::invalid_argument("Invalid endpoint: " + endpoint);
+  }
+  SOCKADDR_INET sockaddr = {};
+  if (address.version == 4) {
+    sockaddr.Ipv4.sin_family = AF_INET;
+    sockaddr.Ipv4.sin_port = htons(port);
+    memcpy(&sockaddr.Ipv4.sin_addr, address.address.data(), sizeof(sockaddr.Ipv4.sin_addr));
+  } else {
+    sockaddr.Ipv6.sin6_family = AF_INET6;
+    sockaddr.Ipv6.sin6_port = htons(port);
+    memcpy(&sockaddr.Ipv6.sin6_addr, address.address.data(), sizeof(sockaddr.Ipv6.sin6_addr));
+  }
+  return sockaddr;
+}
+
+static void AddAllowedIps(ConfigurationBuilder *builder, const std::vector<std::string> &allowed_ips) {
+  for (const auto &text : allowed_ips) {
+    IpPrefix prefix;
+    if (!ParseIpPrefix(text, &prefix)) {
+      throw std::invalid_argument("Invalid allowed IP: " + text);
+    }
+    builder->AddAllowedIp(prefix);
+  }
+}
+
+void WireguardAdapter::ApplyPeer(const PeerConfig &peer, bool restart) {
+  WireguardKey public_key = RequireKey(peer.public_key);
+  DWORD flags = WIREGUARD_PEER_HAS_PERSISTENT_KEEPALIVE;
+  if (!peer.endpoint.empty()) {
+    flags |= WIREGUARD_PEER_HAS_ENDPOINT;
+  }
+  if (!restart) {
+    ConfigurationBuilder update;
+    auto &entry = update.AddPeer(public_key, flags | WIREGUARD_PEER_UPDATE);
+    entry.PersistentKeepalive = peer.persistent_keepalive;
+    if (!peer.endpoint.empty()) {
+      entry.Endpoint = EndpointToSockaddr(peer.endpoint);
+    }
+    SetConfiguration(update.Build());
+    return;
+  }
+
+  // The removal and the add go in one delta, so the peer is never missing between two calls, and a malformed peer is
+  // rejected before anything is applied. The driver applies the entries in order.
+  ConfigurationBuilder delta;
+  delta.AddPeer(public_key, WIREGUARD_PEER_REMOVE);
+  if (!peer.preshared_key.empty()) {
+    flags |= WIREGUARD_PEER_HAS_PRESHARED_KEY;
+  }
+  auto &entry = delta.AddPeer(public_key, flags | WIREGUARD_PEER_REPLACE_ALLOWED_IPS);
+  entry.PersistentKeepalive = peer.persistent_keepalive;
+  if (!peer.endpoint.empty()) {
+    entry.Endpoint = EndpointToSockaddr(peer.endpoint);
+  }
+  if (!peer.preshared_key.empty()) {
+    WireguardKey preshared_key = RequireKey(peer.preshared_key);
+    memcpy(entry.PresharedKey, preshared_key.data(), preshared_key.size());
+  }
+  AddAllowedIps(&delta, peer.allowed_ips);
+  SetConfiguration(delta.Build());
+}
+
+void WireguardAdapter::ApplyPeerChanges(const std::vector<PeerChange> &changes) {
+  ConfigurationBuilder delta;
+  for (const auto &change : changes) {
+    const PeerConfig &peer = change.peer;
+    WireguardKey public_key = RequireKey(peer.public_key);
+    if (change.kind == PeerChange::Kind::remove) {
+      delta.AddPeer(public_key, WIREGUARD_PEER_REMOVE);
+      continue;
+    }
+
+    DWORD flags = WIREGUARD_PEER_HAS_PERSISTENT_KEEPALIVE;
+    if (!peer.endpoint.empty()) {
+      flags |= WIREGUARD_PEER_HAS_ENDPOINT;
+    }
+    if (change.kind == PeerChange::Kind::update) {
+      flags |= WIREGUARD_PEER_UPDATE;
+      if (change.replace_allowed_ips) {
+        flags |= WIREGUARD_PEER_REPLACE_ALLOWED_IPS;
+      }
+    } else {
+      // An add is a full replacement: a peer without a preshared key gets the zero key, which disables it.
+      flags |= WIREGUARD_PEER_HAS_PRESHARED_KEY | WIREGUARD_PEER_REPLACE_ALLOWED_IPS;
+    }
+    auto &entry = delta.AddPeer(public_key, flags);
+    entry.PersistentKeepalive = peer.persistent_keepalive;
+    if (!peer.endpoint.empty()) {
+      entry.Endpoint = EndpointToSockaddr(peer.endpoint);
+    }
+    if (!peer.preshared_key.empty()) {
+      WireguardKey preshared_key = RequireKey(peer.preshared_key);
+      memcpy(entry.PresharedKey, preshared_key.data(), preshared_key.size());
+    }
+    if (change.kind == PeerChange::Kind::add || change.replace_allowed_ips) {
+      AddAllowedIps(&delta, peer.allowed_ips);
+    }
+  }
+  SetConfiguration(delta.Build());
+}
+
+std::vector<PeerConfig> WireguardAdapter::ConfiguredPeers() {
+  std::vector<BYTE> config = GetConfiguration();
+  const auto *wg_interface = reinterpret_cast<const WIREGUARD_INTERFACE *>(config.data());
+  const auto *peer = reinterpret_cast<const WIREGUARD_PEER *>(wg_interface + 1);
+
+  std::vector<PeerConfig> peers;
+  peers.reserve(wg_interface->PeersCount);
+  for (DWORD i = 0; i < wg_interface->PeersCount; i++) {
+    PeerConfig entry;
+    WireguardKey public_key;
+    memcpy(public_key.data(), peer->PublicKey, public_key.size());
+    entry.public_key = EncodeKey(public_key);
+    entry.persistent_keepalive = peer->PersistentKeepalive;
+    const auto *allowed_ip = reinterpret_cast<const WIREGUARD_ALLOWED_IP *>(peer + 1);
+    for (DWORD j = 0; j < peer->AllowedIPsCount; j++, allowed_ip++) {
+      IpPrefix prefix;
+      prefix.version = allowed_ip->AddressFamily == AF_INET ? 4 : 6;
+      prefix.length = allowed_ip->Cidr;
+      memcpy(prefix.address.data(), &allowed_ip->Address, prefix.version == 4 ? 4 : 16);
+      entry.allowed_ips.push_back(FormatIpPrefix(prefix));
+    }
+    peers.push_back(std::move(entry));
+    peer = reinterpret_cast<const WIREGUARD_PEER *>(allowed_ip);
+  }
+  return peers;
+}
+
+void WireguardAdapter::Rebind(const WireguardKey *only) {
+  ConfigurationBuilder builder;
+  bool any = false;
+  for (const auto &peer : Peers()) {
+    if (peer.Endpoint.si_family != AF_INET && peer.Endpoint.si_family != AF_INET6) {
+      continue;
+    }
+    WireguardKey public_key;
+    memcpy(public_key.data(), peer.PublicKey, public_key.size());
+    if (only != nullptr && public_key != *only) {
+      continue;
+    }
+    auto &reset = builder.AddPeer(public_key, WIREGUARD_PEER_UPDATE | WIREGUARD_PEER_HAS_ENDPOINT |
+                                                  WIREGUARD_PEER_HAS_PERSISTENT_KEEPALIVE);
+    reset.Endpoint = peer.Endpoint;
+    reset.PersistentKeepalive = 0;
+    auto &pulse = builder.AddPeer(public_key, WIREGUARD_PEER_UPDATE | WIREGUARD_PEER_HAS_PERSISTENT_KEEPALIVE);
+    pulse.PersistentKeepalive = peer.PersistentKeepalive != 0 ? peer.PersistentKeepalive : 1;
+    if (peer.PersistentKeepalive == 0) {
+      builder.AddPeer(public_key, WIREGUARD_PEER_UPDATE | WIREGUARD_PEER_HAS_PERSISTENT_KEEPALIVE);
+    }
+    any = true;
+  }
+  if (any) {
+    SetConfiguration(builder.Build());
+  }
+}
+
+NET_LUID WireguardAdapter::Luid() {
+  NET_LUID luid = {};
+  WireGuardGetAdapterLUID(handle_, &luid);
+  return luid;
+}
+
+void WireguardAdapter::SetMtu(uint32_t mtu) {
+  NET_LUID luid = Luid();
+  bool any = false;
+  for (ADDRESS_FAMILY family : {AF_INET, AF_INET6}) {
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+    row.InterfaceLuid = luid;
+    row.Family = family;
+    // The interface of a family the tunnel has no address in may not exist.
+    if (GetIpInterfaceEntry(&row) != NO_ERROR) {
+      continue;
+    }
+    row.NlMtu = mtu;
+    // Must be zeroed before writing back what GetIpInterfaceEntry read.
+    row.SitePrefixLength = 0;
+    any |= SetIpInterfaceEntry(&row) == NO_ERROR;
+  }
+  if (!any) {
+    throw std::runtime_error("Failed to set the adapter MTU");
+  }
+}
+
+TunnelStatistics WireguardAdapter::Statistics() {
+  TunnelStatistics statistics;
+  for (const auto &peer : Peers()) {
+    statistics.total_download += peer.RxBytes;
+    statistics.total_upload += peer.TxBytes;
+    statistics.latest_handshake =
+        (std::max)(statistics.latest_handshake, HandshakeTimeToUnixMillis(peer.LastHandshake));
+  }
+  return statistics;
+}
+
+ConfigurationBuilder::ConfigurationBuilder(DWORD interface_flags) : buffer_(sizeof(WIREGUARD_INTERFACE)) {
+  Interface()->Flags = static_cast<WIREGUARD_INTERFACE_FLAG>(interface_flags);
+}
+
+WIREGUARD_PEER &ConfigurationBuilder::AddPeer(const WireguardKey &public_key, DWORD flags) {
+  last_peer_offset_ = buffer_.size();
+  buffer_.resize(buffer_.size() + sizeof(WIREGUARD_PEER));
+  Interface()->PeersCount++;
+
+  auto *peer = reinterpret_cast<WIREGUARD_PEER *>(buffer_.data() + last_peer_offset_);
+  peer->Flags = static_cast<WIREGUARD_PEER_FLAG>(flags | WIREGUARD_PEER_HAS_PUBLIC_KEY);
+  memcpy(peer->PublicKey, public_key.data(), public_key.size());
+  return *peer;
+}
+
+void ConfigurationBuilder::AddAllowedIp(const WIREGUARD_ALLOWED_IP &allowed_ip) {
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + sizeof(WIREGUARD_ALLOWED_IP));
+  memcpy(buffer_.data() + offset, &allowed_ip, sizeof(WIREGUARD_ALLOWED_IP));
+  reinterpret_cast<WIREGUARD_PEER *>(buffer_.data() + last_peer_offset_)->AllowedIPsCount++;
+}
+
+void ConfigurationBuilder::AddAllowedIp(const IpPrefix &prefix) {
+  WIREGUARD_ALLOWED_IP allowed_ip = {};
+  allowed_ip.AddressFamily = prefix.version == 4 ? AF_INET : AF_INET6;
+  memcpy(&allowed_ip.Address, prefix.address.data(), prefix.version == 4 ? 4 : 16);
+  allowed_ip.Cidr = prefix.length;
+  AddAllowedIp(allowed_ip);
+}
+
+std::wstring TunnelNameFromConfigPath(const std::wstring &config_path) {
+  auto name = config_path.substr(config_path.find_last_of(L"\\/") + 1);
+  const std::wstring extension = L".conf";
+  if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0) {
+    name.resize(name.size() - extension.size());
+  }
+  return name;
+}
+
+int64_t HandshakeTimeToUnixMillis(DWORD64 handshake_time) {
+  if (handshake_time <= kUnixEpochInFileTime) {
+    return 0;
+  }
+  return static_cast<int64_t>((handshake_time - kUnixEpochInFileTime) / 10000);
+}
+
+}  // namespace wireguard_dart
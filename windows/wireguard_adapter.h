@@ -0,0 +1,109 @@
+#ifndef WIREGUARD_DART_WIREGUARD_ADAPTER_H
+#define WIREGUARD_DART_WIREGUARD_ADAPTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "handshake_watchdog.h"
+#include "peer_index.h"
+#include "wireguard.h"
+#include "wireguard_config.h"
+
+namespace wireguard_dart {
+
+struct TunnelStatistics {
+  uint64_t total_download = 0;
+  uint64_t total_upload = 0;
+  // Unix epoch milliseconds of the most recent handshake of any peer, 0 if none.
+  int64_t latest_handshake = 0;
+};
+
+// Owns a handle to a WireGuard adapter created by the tunnel service.
+class WireguardAdapter {
+ public:
+  // Returns nullptr if no adapter with the given name exists.
+  static std::unique_ptr<WireguardAdapter> Open(const std::wstring &name);
+
+  explicit WireguardAdapter(WIREGUARD_ADAPTER_HANDLE handle) : handle_(handle) {}
+  ~WireguardAdapter();
+
+  WireguardAdapter(const WireguardAdapter &) = delete;
+  WireguardAdapter &operator=(const WireguardAdapter &) = delete;
+
+  // Returns the raw configuration: a WIREGUARD_INTERFACE followed by its peers, each followed by its allowed IPs.
+  std::vector<BYTE> GetConfiguration();
+
+  void SetConfiguration(const std::vector<BYTE> &config);
+
+  // Peers of the current configuration, without their allowed IPs.
+  std::vector<WIREGUARD_PEER> Peers();
+
+  std::vector<PeerSample> PeerSamples();
+
+  // Applies a single peer of a parsed config. With `restart` the peer is removed and added again, which resets its
+  // handshake state so that it initiates right away; otherwise only its endpoint and keepalive are updated. Throws
+  // std::invalid_argument on malformed keys, endpoints or allowed IPs.
+  void ApplyPeer(const PeerConfig &peer, bool restart);
+
+  // Applies peer deltas computed by PeerIndex with a single SetConfiguration call; other peers are left alone. Throws
+  // std::invalid_argument on malformed keys, endpoints or allowed IPs before anything is applied.
+  void ApplyPeerChanges(const std::vector<PeerChange> &changes);
+
+  // Peers of the current configuration with key, keepalive and allowed IPs, e.g. to index an adopted tunnel.
+  std::vector<PeerConfig> ConfiguredPeers();
+
+  // Moves all peers onto the current network after a link, address or route change, in a single SetConfiguration
+  // call that keeps their sessions. Every peer with an endpoint gets it set again, which drops the source address the
+  // driver cached for it, and its keepalive raised from 0, which sends a keepalive at once and with it a handshake
+  // initiation if the session has gone stale. The last entry of each peer restores its keepalive. Only the peer of
+  // `public_key` if one is given.
+  void Rebind(const WireguardKey *public_key = nullptr);
+
+  // The LUID of the adapter's network interface, to tell its own notifications apart from those of the underlay.
+  NET_LUID Luid();
+
+  // Sets the MTU of the adapter's IPv4 and IPv6 interfaces. Throws std::runtime_error if neither could be set.
+  void SetMtu(uint32_t mtu);
+
+  TunnelStatistics Statistics();
+
+ private:
+  WIREGUARD_ADAPTER_HANDLE handle_;
+};
+
+// Builds a configuration buffer for WireguardAdapter::SetConfiguration, e.g. a delta of a few peers.
+class ConfigurationBuilder {
+ public:
+  explicit ConfigurationBuilder(DWORD interface_flags = 0);
+
+  // Appends a peer identified by `public_key`. The returned reference is valid until the next Add call.
+  WIREGUARD_PEER &AddPeer(const WireguardKey &public_key, DWORD flags);
+
+  // Appends an allowed IP to the last added peer.
+  void AddAllowedIp(const WIREGUARD_ALLOWED_IP &allowed_ip);
+  void AddAllowedIp(const IpPrefix &prefix);
+
+  const std::vector<BYTE> &Build() const { return buffer_; }
+
+ private:
+  WIREGUARD_INTERFACE *Interface() { return reinterpret_cast<WIREGUARD_INTERFACE *>(buffer_.data()); }
+
+  std::vector<BYTE> buffer_;
+  size_t last_peer_offset_ = 0;
+};
+
+// The embeddable tunnel service names the adapter after its config file, without the .conf extension.
+std::wstring TunnelNameFromConfigPath(const std::wstring &config_path);
+
+// Converts an IP literal endpoint such as "192.0.2.1:51820" or "[2001:db8::1]:51820". Endpoints are IP literals by the
+// time they reach the adapter; EndpointRace resolves host names beforehand. Throws std::invalid_argument otherwise.
+SOCKADDR_INET EndpointToSockaddr(const std::string &endpoint);
+
+// Converts a WireGuard handshake timestamp (100ns intervals since 1601-01-01 UTC) to Unix epoch milliseconds.
+int64_t HandshakeTimeToUnixMillis(DWORD64 handshake_time);
+
+}  // namespace wireguard_dart
+
+#endif
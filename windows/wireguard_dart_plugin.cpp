@@ -9,29 +9,173 @@
 #include <libbase64.h>
 #include <windows.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <utility>
 
 #include "config_writer.h"
 #include "connection_status.h"
 #include "connection_status_observer.h"
+#include "endpoint_prober.h"
 #include "key_generator.h"
+#include "route_calculator.h"
 #include "service_control.h"
 #include "tunnel.h"
+#include "tunnel_watchdog.h"
 #include "utils.h"
 #include "wireguard.h"
+#include "wireguard_adapter.h"
 
 // Declare the function prototype
 std::string GetLastErrorAsString(DWORD error_code);
 
 namespace wireguard_dart {
 
+namespace {
+
+// Posted to the window of the app when RunInBackground has tasks for the platform thread.
+const UINT kRunPlatformTasks = WM_APP + 0x5744;
+
+// Outcome of a single call executed as part of a batch.
+struct BatchCallOutcome {
+  bool success = false;
+  flutter::EncodableValue value;
+  std::string error_code;
+  std::string error_message;
+  flutter::EncodableValue error_details;
+};
+
+// MethodResult that hands the reply of a nested call to the batch instead of sending it over the channel, whenever
+// the call replies.
+class BatchCallResult : public flutter::MethodResult<flutter::EncodableValue> {
+ public:
+  using OnReply = std::function<void(BatchCallOutcome outcome)>;
+
+  explicit BatchCallResult(OnReply on_reply) : on_reply_(std::move(on_reply)) {}
+
+ protected:
+  void SuccessInternal(const flutter::EncodableValue *result) override {
+    BatchCallOutcome outcome;
+    outcome.success = true;
+    if (result != nullptr) {
+      outcome.value = *result;
+    }
+    on_reply_(std::move(outcome));
+  }
+
+  void ErrorInternal(const std::string &error_code, const std::string &error_message,
+                     const flutter::EncodableValue *error_details) override {
+    BatchCallOutcome outcome;
+    outcome.error_code = error_code;
+    outcome.error_message = error_message;
+    if (error_details != nullptr) {
+      outcome.error_details = *error_details;
+    }
+    on_reply_(std::move(outcome));
+  }
+
+  void NotImplementedInternal() override {
+    BatchCallOutcome outcome;
+    outcome.error_code = "NOT_IMPLEMENTED";
+    outcome.error_message = "Method is not implemented";
+    on_reply_(std::move(outcome));
+  }
+
+ private:
+  OnReply on_reply_;
+};
+
+// Path of the tunnel service binary shipped next to the app executable.
+std::wstring TunnelServiceExecutable() {
+  wchar_t module_filename[MAX_PATH];
+  GetModuleFileName(NULL, module_filename, MAX_PATH);
+  auto current_exec_dir = std::wstring(module_filename);
+  current_exec_dir = current_exec_dir.substr(0, current_exec_dir.find_last_of(L"\\/"));
+  return current_exec_dir + L"\\wireguard_svc.exe";
+}
+
+std::optional<TunnelServiceInfo> FindAttachableTunnel() {
+  try {
+    auto tunnels = FindActiveTunnelServices(TunnelServiceExecutable());
+    if (!tunnels.empty()) {
+      return tunnels.front();
+    }
+  } catch (std::exception &e) {
+    std::cerr << "Failed to discover running tunnels: " << e.what() << std::endl;
+  }
+  return std::nullopt;
+}
+
+// Quality estimates are added while the quality prober runs.
+std::string TunnelStatisticsToJson(const TunnelStatistics &statistics, const std::optional<LinkQuality> &quality) {
+  std::ostringstream json;
+  json << "{\"totalDownload\":" << statistics.total_download << ",\"totalUpload\":" << statistics.total_upload
+       << ",\"latestHandshake\":" << statistics.latest_handshake;
+  if (quality.has_value()) {
+    json << std::fixed << std::setprecision(3) << ",\"quality\":{\"rttMedian\":" << quality->rtt_median
+         << ",\"rttP90\":" << quality->rtt_p90 << ",\"rttP99\":" << quality->rtt_p99
+         << ",\"jitter\":" << quality->jitter << ",\"loss\":" << std::setprecision(4) << quality->loss
+         << ",\"probesSent\":" << quality->sent << ",\"probesReceived\":" << quality->received << "}";
+  }
+  json << "}";
+  return json.str();
+}
+
+// Reads an integer argument, which the codec sends as int32 or int64 depending on its magnitude.
+std::optional<int64_t> IntArgument(const flutter::EncodableMap &args, const char *key) {
+  const auto *value = ValueOrNull(args, key);
+  if (value == nullptr) {
+    return std::nullopt;
+  }
+  if (const auto *int32_value = std::get_if<int32_t>(value)) {
+    return *int32_value;
+  }
+  if (const auto *int64_value = std::get_if<int64_t>(value)) {
+    return *int64_value;
+  }
+  return std::nullopt;
+}
+
+flutter::EncodableValue ProbeResultToEncodable(const ProbeResult &probe) {
+  flutter::EncodableList samples;
+  for (double rtt : probe.samples) {
+    samples.push_back(flutter::EncodableValue(rtt));
+  }
+  flutter::EncodableMap value;
+  value[flutter::EncodableValue("endpoint")] = flutter::EncodableValue(probe.endpoint);
+  value[flutter::EncodableValue("address")] = flutter::EncodableValue(probe.address);
+  value[flutter::EncodableValue("sent")] = flutter::EncodableValue(probe.sent);
+  value[flutter::EncodableValue("received")] = flutter::EncodableValue(probe.received);
+  value[flutter::EncodableValue("rttMs")] = flutter::EncodableValue(probe.rtt);
+  value[flutter::EncodableValue("jitterMs")] = flutter::EncodableValue(probe.jitter);
+  value[flutter::EncodableValue("loss")] = flutter::EncodableValue(probe.loss());
+  value[flutter::EncodableValue("samplesMs")] = flutter::EncodableValue(samples);
+  return flutter::EncodableValue(value);
+}
+
+}  // namespace
+
 // static
 void WireguardDartPlugin::RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar) {
   auto channel = std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
       registrar->messenger(), "wireguard_dart", &flutter::StandardMethodCodec::GetInstance());
 
   auto plugin = std::make_unique<WireguardDartPlugin>();
+  plugin->registrar_ = registrar;
+  plugin->window_ = GetAncestor(registrar->GetView()->GetNativeWindow(), GA_ROOT);
+  plugin->window_proc_id_ = registrar->RegisterTopLevelWindowProcDelegate(
+      [plugin_pointer = plugin.get()](HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) {
+        return plugin_pointer->HandleWindowProc(hwnd, message, wparam, lparam);
+      });
 
   channel->SetMethodCallHandler([plugin_pointer = plugin.get()](const auto &call, auto result) {
     plugin_pointer->HandleMethodCall(call, std::move(result));
@@ -40,7 +184,8 @@ void WireguardDartPlugin::RegisterWithRegistrar(flutter::PluginRegistrarWindows
   auto status_channel = std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
       registrar->messenger(), "wireguard_dart/status", &flutter::StandardMethodCodec::GetInstance());
 
-  plugin->connection_status_observer_ = std::make_unique<ConnectionStatusObserver>();
+  plugin->connection_status_observer_ = std::make_unique<ConnectionStatusObserver>(
+      [plugin_pointer = plugin.get()](std::function<void()> task) { plugin_pointer->PostToPlatformThread(task); });
   auto status_channel_handler = std::make_unique<flutter::StreamHandlerFunctions<>>(
       [plugin_pointer = plugin.get()](
           const flutter::EncodableValue *args,
@@ -54,17 +199,144 @@ void WireguardDartPlugin::RegisterWithRegistrar(flutter::PluginRegistrarWindows
 
   status_channel->SetStreamHandler(std::move(status_channel_handler));
 
+  plugin->Attach();
   registrar->AddPlugin(std::move(plugin));
 }
 
 WireguardDartPlugin::WireguardDartPlugin() {}
 
-WireguardDartPlugin::~WireguardDartPlugin() { this->connection_status_observer_.get()->StopObserving(); }
+WireguardDartPlugin::~WireguardDartPlugin() {
+  this->registrar_->UnregisterTopLevelWindowProcDelegate(this->window_proc_id_);
+  // Both report statuses through PostToPlatformThread, whose queue goes away before them.
+  if (this->watchdog_ != nullptr) {
+    this->watchdog_->Stop();
+  }
+  this->connection_status_observer_.get()->StopObserving();
+}
+
+void WireguardDartPlugin::RunInBackground(std::function<void()> work, std::function<void()> then) {
+  this->background_.remove_if([](const std::future<void> &task) {
+    return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  });
+  this->background_.push_back(std::async(std::launch::async, [this, work, then] {
+    work();
+    PostToPlatformThread(then);
+  }));
+}
+
+void WireguardDartPlugin::PostToPlatformThread(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(this->platform_tasks_mutex_);
+    this->platform_tasks_.push_back(std::move(task));
+  }
+  PostMessage(this->window_, kRunPlatformTasks, 0, 0);
+}
+
+std::optional<LRESULT> WireguardDartPlugin::HandleWindowProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) {
+  if (message != kRunPlatformTasks) {
+    return std::nullopt;
+  }
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(this->platform_tasks_mutex_);
+    tasks.swap(this->platform_tasks_);
+  }
+  for (const auto &task : tasks) {
+    task();
+  }
+  return 0;
+}
+
+void WireguardDartPlugin::Attach() {
+  auto tunnel = std::make_shared<std::optional<TunnelServiceInfo>>();
+  this->attaching_ = true;
+  RunInBackground([tunnel] { *tunnel = FindAttachableTunnel(); },
+                  [this, tunnel] {
+                    if (tunnel->has_value()) {
+                      Adopt(**tunnel);
+                    }
+                    this->attaching_ = false;
+                    std::vector<AwaitingCall> calls;
+                    calls.swap(this->calls_awaiting_attach_);
+                    for (auto &awaiting : calls) {
+                      HandleMethodCall(*awaiting.call, std::move(awaiting.result));
+                    }
+                  });
+}
+
+void WireguardDartPlugin::Adopt(const TunnelServiceInfo &tunnel) {
+  if (this->tunnel_service_ != nullptr) {
+    return;
+  }
+
+  this->tunnel_service_ = std::make_unique<ServiceControl>(tunnel.service_name);
+  this->tunnel_name_ = TunnelNameFromConfigPath(tunnel.config_file);
+  this->connection_status_observer_.get()->UpdateStatus(tunnel.status);
+  this->connection_status_observer_.get()->StartObserving(tunnel.service_name);
+  if (tunnel.status == ConnectionStatus::connected) {
+    StartWatchdog(ReadConfigFile(tunnel.config_file));
+  }
+}
+
+void WireguardDartPlugin::StartWatchdog(const std::string &cfg) {
+  WireguardConfig config;
+  try {
+    config = WireguardConfig::Parse(cfg);
+  } catch (std::exception &e) {
+    // The tunnel service is the authority on config validity; without a parsed config the watchdog only skips
+    // endpoint re-resolution.
+    std::cerr << "Tunnel watchdog: " << e.what() << std::endl;
+  }
+  if (this->watchdog_ == nullptr) {
+    this->watchdog_ = std::make_unique<TunnelWatchdog>(this->connection_status_observer_.get(), &this->family_cache_);
+  }
+  std::wstring tunnel_name = this->tunnel_name_;
+  this->traffic_recorder_.Start([tunnel_name] {
+    auto adapter = WireguardAdapter::Open(tunnel_name);
+    if (adapter == nullptr) {
+      throw std::runtime_error("Tunnel adapter is not up");
+    }
+    return adapter->PeerSamples();
+  });
+  this->watching_ = true;
+  StartQualityProbe();
+  uint64_t generation = this->tunnel_generation_;
+  this->watchdog_->Start(this->tunnel_name_, config, [this, generation] {
+    PostToPlatformThread([this, generation] { RestartTunnel(generation); });
+  });
+}
+
+void WireguardDartPlugin::RestartTunnel(uint64_t generation) {
+  // Serialized with connect and disconnect on the platform thread, and dropped if either came since the watchdog
+  // asked.
+  if (generation != this->tunnel_generation_ || this->tunnel_service_ == nullptr) {
+    return;
+  }
+  try {
+    this->tunnel_service_->Stop();
+    this->tunnel_service_->Start();
+  } catch (std::exception &e) {
+    std::cerr << "Tunnel watchdog: " << e.what() << std::endl;
+  }
+}
 
 void WireguardDartPlugin::HandleMethodCall(const flutter::MethodCall<flutter::EncodableValue> &call,
                                            std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  if (this->attaching_) {
+    this->calls_awaiting_attach_.push_back(
+        {std::make_unique<flutter::MethodCall<flutter::EncodableValue>>(
+             call.method_name(), std::make_unique<flutter::EncodableValue>(
+                                     call.arguments() != nullptr ? *call.arguments() : flutter::EncodableValue())),
+         std::move(result)});
+    return;
+  }
   const auto *args = std::get_if<flutter::EncodableMap>(call.arguments());
 
+  if (call.method_name() == "batch") {
+    HandleBatch(args, std::move(result));
+    return;
+  }
+
   if (call.method_name() == "generateKeyPair") {
     std::pair public_private_keypair = GenerateKeyPair();
     std::map<flutter::EncodableValue, flutter::EncodableValue> return_value;
@@ -124,77 +396,7 @@ void WireguardDartPlugin::HandleMethodCall(const flutter::MethodCall<flutter::En
   }
 
   if (call.method_name() == "connect") {
-    auto tunnel_service = this->tunnel_service_.get();
-    if (tunnel_service == nullptr) {
-      result->Error("Invalid state: call 'setupTunnel' first");
-      return;
-    }
-    const auto *cfg = std::get_if<std::string>(ValueOrNull(*args, "cfg"));
-    if (cfg == NULL) {
-      result->Error("Argument 'cfg' is required");
-      return;
-    }
-
-    std::wstring wg_config_filename;
-    try {
-      wg_config_filename = WriteConfigToTempFile(*cfg);
-    } catch (std::exception &e) {
-      result->Error(std::string("Could not write wireguard config: ").append(e.what()));
-      return;
-    }
-
-    wchar_t module_filename[MAX_PATH];
-    GetModuleFileName(NULL, module_filename, MAX_PATH);
-    auto current_exec_dir = std::wstring(module_filename);
-    current_exec_dir = current_exec_dir.substr(0, current_exec_dir.find_last_of(L"\\/"));
-
-    std::wostringstream service_exec_builder;
-    service_exec_builder << current_exec_dir << "\\wireguard_svc.exe" << L" -service" << L" -config-file=\""
-                         << wg_config_filename << "\"";
-    std::wstring service_exec = service_exec_builder.str();
-
-    try {
-      CreateArgs csa = {};
-      csa.description = tunnel_service->service_name_ + L" WireGuard tunnel";
-      csa.executable_and_args = service_exec;
-      csa.dependencies = L"Nsi\0TcpIp\0";
-      tunnel_service->Create(csa);
-    } catch (std::exception &e) {
-      result->Error(std::string(e.what()));
-      return;
-    }
-    this->connection_status_observer_.get()->StartObserving(L"");
-    try {
-      tunnel_service->Start();
-    } catch (const std::runtime_error &e) {
-      // Handle runtime errors with a specific error code and detailed message
-      std::string error_message = "Runtime error while starting the tunnel service: ";
-      error_message += e.what();
-      result->Error("RUNTIME_ERROR", error_message);  // Error code: RUNTIME_ERROR
-      return;
-    } catch (const std::exception &e) {
-      // Handle service exceptions with a specific error code and detailed message
-      DWORD error_code = GetLastError();  // Retrieve the last Windows error code
-      std::string error_message = "Exception while starting the tunnel service: ";
-      error_message += e.what();
-      if (error_code != 0) {
-        error_message += " Windows Error Code: " + std::to_string(error_code) + ".";
-        error_message += " Description: " + GetLastErrorAsString(error_code);
-      }
-      result->Error("SERVICE_EXCEPTION", error_message);  // Error code: SERVICE_EXCEPTION
-      return;
-    } catch (...) {
-      // Handle unknown exceptions with additional details
-      DWORD error_code = GetLastError();  // Retrieve the last Windows error code
-      std::string error_message = "An unknown error occurred while starting the tunnel service.";
-      if (error_code != 0) {
-        error_message += " Windows Error Code: " + std::to_string(error_code) + ".";
-        error_message += " Description: " + GetLastErrorAsString(error_code);
-      }
-      result->Error("UNKNOWN_ERROR", error_message);  // Error code: UNKNOWN_ERROR
-      return;
-    }
-    result->Success();
+    HandleConnect(args, std::move(result));
     return;
   }
 
@@ -205,6 +407,17 @@ void WireguardDartPlugin::HandleMethodCall(const flutter::MethodCall<flutter::En
       return;
     }
 
+    if (this->endpoint_race_ != nullptr) {
+      this->endpoint_race_->Stop();
+    }
+    if (this->watchdog_ != nullptr) {
+      this->watchdog_->Stop();
+    }
+    this->traffic_recorder_.Stop();
+    this->quality_prober_.Stop();
+    this->watching_ = false;
+    this->peers_.reset();
+    this->tunnel_generation_++;
     try {
       tunnel_service->Stop();
     } catch (const std::runtime_error &e) {
@@ -248,6 +461,9 @@ void WireguardDartPlugin::HandleMethodCall(const flutter::MethodCall<flutter::En
 
     try {
       auto status = tunnel_service->Status();
+      if (status == ConnectionStatus::connected && this->watchdog_ != nullptr && this->watchdog_->degraded()) {
+        status = ConnectionStatus::degraded;
+      }
       result->Success(ConnectionStatusToString(status));
     } catch (std::exception &e) {
       result->Error(std::string(e.what()));
@@ -255,9 +471,547 @@ void WireguardDartPlugin::HandleMethodCall(const flutter::MethodCall<flutter::En
     return;
   }
 
+  if (call.method_name() == "tunnelStatistics") {
+    if (this->tunnel_service_ == nullptr || this->tunnel_name_.empty()) {
+      result->Error("Invalid state: call 'setupTunnel' and 'connect' first");
+      return;
+    }
+
+    try {
+      auto adapter = WireguardAdapter::Open(this->tunnel_name_);
+      TunnelStatistics statistics = adapter != nullptr ? adapter->Statistics() : TunnelStatistics();
+      result->Success(flutter::EncodableValue(TunnelStatisticsToJson(statistics, this->quality_prober_.quality())));
+    } catch (std::exception &e) {
+      result->Error(std::string(e.what()));
+    }
+    return;
+  }
+
+  if (call.method_name() == "prefetchEndpoints") {
+    // Resolves the host names of a server list in the background so that a later connect does not wait for DNS.
+    const auto *entries =
+        args != nullptr ? std::get_if<flutter::EncodableList>(ValueOrNull(*args, "endpoints")) : nullptr;
+    if (entries == nullptr) {
+      result->Error("Argument 'endpoints' is required");
+      return;
+    }
+    std::vector<std::string> endpoints;
+    for (const auto &entry : *entries) {
+      if (const auto *endpoint = std::get_if<std::string>(&entry)) {
+        endpoints.push_back(*endpoint);
+      }
+    }
+    this->dns_cache_.Prefetch(EndpointHosts(endpoints));
+    result->Success();
+    return;
+  }
+
+  if (call.method_name() == "rankEndpoints") {
+    HandleRankEndpoints(args, std::move(result));
+    return;
+  }
+
+  if (call.method_name() == "setQualityProbe") {
+    HandleSetQualityProbe(args, std::move(result));
+    return;
+  }
+
+  if (call.method_name() == "trafficHistory") {
+    HandleTrafficHistory(args, std::move(result));
+    return;
+  }
+
+  if (call.method_name() == "addPeers" || call.method_name() == "updatePeers" ||
+      call.method_name() == "removePeers") {
+    HandleChangePeers(call.method_name(), args, std::move(result));
+    return;
+  }
+
   result->NotImplemented();
 }
 
+void WireguardDartPlugin::HandleConnect(const flutter::EncodableMap *args,
+                                        std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  if (this->tunnel_service_ == nullptr) {
+    result->Error("Invalid state: call 'setupTunnel' first");
+    return;
+  }
+  // Profiles are stored by the Linux plugin only; the Dart layer rejects profileId before it gets here.
+  if (args != nullptr && ValueOrNull(*args, "profileId") != nullptr) {
+    result->Error("UNSUPPORTED", "Argument 'profileId' is supported on Linux only");
+    return;
+  }
+  const auto *cfg = args != nullptr ? std::get_if<std::string>(ValueOrNull(*args, "cfg")) : nullptr;
+  if (cfg == nullptr) {
+    result->Error("Argument 'cfg' is required");
+    return;
+  }
+
+  if (this->endpoint_race_ != nullptr) {
+    this->endpoint_race_->Stop();
+  }
+  this->peers_.reset();
+  uint64_t generation = ++this->tunnel_generation_;
+
+  // ExcludedIPs are carved out of AllowedIPs and endpoint host names are resolved in the background, both families at
+  // once, so the tunnel service is handed plain prefixes and addresses and neither DNS nor a broken family holds up
+  // the platform thread. A config that does not parse is left for the tunnel service to reject. Every connect
+  // resolves with a race of its own, so that two connects in flight never share one.
+  auto race = std::make_shared<EndpointRace>(&this->family_cache_, CachedResolver(&this->dns_cache_));
+  struct Prepared {
+    std::string service_cfg;
+    std::optional<PeerIndex> peers;
+  };
+  auto prepared = std::make_shared<Prepared>();
+  prepared->service_cfg = *cfg;
+  std::string config_text = *cfg;
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> reply = std::move(result);
+  RunInBackground(
+      [race, prepared, config_text] {
+        try {
+          WireguardConfig config = race->Prepare(ApplyExcludedIps(WireguardConfig::Parse(config_text)));
+          prepared->service_cfg = config.ToString();
+          PeerIndex peers;
+          peers.Reset(config.peers);
+          prepared->peers = std::move(peers);
+        } catch (std::exception &e) {
+          std::cerr << "Endpoint race: " << e.what() << std::endl;
+        }
+      },
+      [this, generation, race, config_text, prepared, reply] {
+        if (generation != this->tunnel_generation_) {
+          reply->Error("CANCELLED", "A later connect or disconnect came first");
+          return;
+        }
+        this->endpoint_race_ = race;
+        this->peers_ = std::move(prepared->peers);
+        FinishConnect(config_text, prepared->service_cfg, reply.get());
+      });
+}
+
+void WireguardDartPlugin::FinishConnect(const std::string &cfg, const std::string &service_cfg,
+                                        flutter::MethodResult<flutter::EncodableValue> *result) {
+  auto tunnel_service = this->tunnel_service_.get();
+  std::wstring wg_config_filename;
+  try {
+    wg_config_filename = WriteConfigToTempFile(service_cfg);
+  } catch (std::exception &e) {
+    result->Error(std::string("Could not write wireguard config: ").append(e.what()));
+    return;
+  }
+
+  std::wostringstream service_exec_builder;
+  service_exec_builder << TunnelServiceExecutable() << L" -service" << L" -config-file=\"" << wg_config_filename
+                       << "\"";
+  std::wstring service_exec = service_exec_builder.str();
+  this->tunnel_name_ = TunnelNameFromConfigPath(wg_config_filename);
+
+  try {
+    CreateArgs csa = {};
+    csa.description = tunnel_service->service_name_ + L" WireGuard tunnel";
+    csa.executable_and_args = service_exec;
+    csa.dependencies = L"Nsi\0TcpIp\0";
+    tunnel_service->Create(csa);
+  } catch (std::exception &e) {
+    result->Error(std::string(e.what()));
+    return;
+  }
+  this->connection_status_observer_.get()->StartObserving(L"");
+  try {
+    tunnel_service->Start();
+  } catch (const std::runtime_error &e) {
+    // Handle runtime errors with a specific error code and detailed message
+    std::string error_message = "Runtime error while starting the tunnel service: ";
+    error_message += e.what();
+    result->Error("RUNTIME_ERROR", error_message);  // Error code: RUNTIME_ERROR
+    return;
+  } catch (const std::exception &e) {
+    // Handle service exceptions with a specific error code and detailed message
+    DWORD error_code = GetLastError();  // Retrieve the last Windows error code
+    std::string error_message = "Exception while starting the tunnel service: ";
+    error_message += e.what();
+    if (error_code != 0) {
+      error_message += " Windows Error Code: " + std::to_string(error_code) + ".";
+      error_message += " Description: " + GetLastErrorAsString(error_code);
+    }
+    result->Error("SERVICE_EXCEPTION", error_message);  // Error code: SERVICE_EXCEPTION
+    return;
+  } catch (...) {
+    // Handle unknown exceptions with additional details
+    DWORD error_code = GetLastError();  // Retrieve the last Windows error code
+    std::string error_message = "An unknown error occurred while starting the tunnel service.";
+    if (error_code != 0) {
+      error_message += " Windows Error Code: " + std::to_string(error_code) + ".";
+      error_message += " Description: " + GetLastErrorAsString(error_code);
+    }
+    result->Error("UNKNOWN_ERROR", error_message);  // Error code: UNKNOWN_ERROR
+    return;
+  }
+  StartWatchdog(cfg);
+  std::wstring tunnel_name = this->tunnel_name_;
+  this->endpoint_race_->Start(
+      [tunnel_name](const PeerConfig &peer, bool restart) {
+        auto adapter = WireguardAdapter::Open(tunnel_name);
+        if (adapter == nullptr) {
+          throw std::runtime_error("Tunnel adapter is not up yet");
+        }
+        adapter->ApplyPeer(peer, restart);
+      },
+      [tunnel_name]() {
+        auto adapter = WireguardAdapter::Open(tunnel_name);
+        if (adapter == nullptr) {
+          throw std::runtime_error("Tunnel adapter is not up yet");
+        }
+        return adapter->PeerSamples();
+      });
+  result->Success();
+}
+
+void WireguardDartPlugin::HandleTrafficHistory(const flutter::EncodableMap *args,
+                                               std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto *resolution_name =
+      args != nullptr ? std::get_if<std::string>(ValueOrNull(*args, "resolution")) : nullptr;
+  TrafficResolution resolution;
+  if (resolution_name != nullptr && *resolution_name == "second") {
+    resolution = TrafficResolution::second;
+  } else if (resolution_name != nullptr && *resolution_name == "minute") {
+    resolution = TrafficResolution::minute;
+  } else if (resolution_name != nullptr && *resolution_name == "hour") {
+    resolution = TrafficResolution::hour;
+  } else {
+    result->Error("INVALID_ARGUMENT", "'resolution' must be one of 'second', 'minute' and 'hour'");
+    return;
+  }
+
+  int64_t now =
+      std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t from = IntArgument(*args, "from").value_or(0);
+  int64_t to = IntArgument(*args, "to").value_or(now + 1);
+  const auto *public_key = std::get_if<std::string>(ValueOrNull(*args, "publicKey"));
+  WireguardKey key;
+  if (public_key != nullptr && !DecodeKey(*public_key, &key)) {
+    result->Error("INVALID_ARGUMENT", "Invalid 'publicKey'");
+    return;
+  }
+
+  auto window = this->traffic_.Query(public_key != nullptr ? &key : nullptr, resolution, from, to, now);
+  if (!window.has_value()) {
+    result->Error("INVALID_ARGUMENT", "No traffic recorded for 'publicKey'");
+    return;
+  }
+  flutter::EncodableMap value;
+  value[flutter::EncodableValue("start")] = flutter::EncodableValue(window->start);
+  value[flutter::EncodableValue("step")] = flutter::EncodableValue(window->step);
+  value[flutter::EncodableValue("samples")] = flutter::EncodableValue(std::move(window->samples));
+  result->Success(flutter::EncodableValue(value));
+}
+
+void WireguardDartPlugin::HandleSetQualityProbe(const flutter::EncodableMap *args,
+                                                std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto *target = args != nullptr ? std::get_if<std::string>(ValueOrNull(*args, "target")) : nullptr;
+  if (target == nullptr) {
+    this->quality_probe_.reset();
+    StartQualityProbe();
+    result->Success();
+    return;
+  }
+  QualityProbeOptions options;
+  options.target = *target;
+  options.interval = IntArgument(*args, "intervalMs").value_or(options.interval);
+  options.timeout = IntArgument(*args, "timeoutMs").value_or(options.timeout);
+  if (options.interval <= 0 || options.timeout <= 0) {
+    result->Error("INVALID_ARGUMENT", "'intervalMs' and 'timeoutMs' must be positive");
+    return;
+  }
+  std::string host;
+  uint16_t port = 0;
+  if (!SplitEndpoint(options.target, &host, &port)) {
+    result->Error("INVALID_ARGUMENT", "'target' must be an address and port");
+    return;
+  }
+  this->quality_probe_ = options;
+  // A connected tunnel starts probing now, others when they connect.
+  if (this->watching_) {
+    StartQualityProbe();
+  }
+  result->Success();
+}
+
+void WireguardDartPlugin::StartQualityProbe() {
+  this->quality_prober_.Stop();
+  if (!this->quality_probe_.has_value()) {
+    return;
+  }
+  try {
+    this->quality_prober_.Start(*this->quality_probe_);
+  } catch (std::exception &e) {
+    std::cerr << "Cannot probe the tunnel quality: " << e.what() << std::endl;
+  }
+}
+
+void WireguardDartPlugin::HandleRankEndpoints(const flutter::EncodableMap *args,
+                                              std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto *entries = args != nullptr ? std::get_if<flutter::EncodableList>(ValueOrNull(*args, "targets")) : nullptr;
+  if (entries == nullptr) {
+    result->Error("Argument 'targets' is required");
+    return;
+  }
+
+  std::vector<ProbeTarget> targets;
+  targets.reserve(entries->size());
+  for (const auto &entry : *entries) {
+    const auto *target = std::get_if<flutter::EncodableMap>(&entry);
+    const auto *endpoint = target != nullptr ? std::get_if<std::string>(ValueOrNull(*target, "endpoint")) : nullptr;
+    if (endpoint == nullptr) {
+      result->Error("Every target needs an 'endpoint'");
+      return;
+    }
+    const auto *payload = std::get_if<std::vector<uint8_t>>(ValueOrNull(*target, "payload"));
+    targets.push_back({*endpoint, payload != nullptr ? *payload : std::vector<uint8_t>()});
+  }
+
+  ProbeOptions options;
+  options.samples = static_cast<int>(IntArgument(*args, "samples").value_or(options.samples));
+  options.interval = IntArgument(*args, "intervalMs").value_or(options.interval);
+  options.timeout = IntArgument(*args, "timeoutMs").value_or(options.timeout);
+  if (options.samples < 1 || options.interval < 0 || options.timeout < 0) {
+    result->Error("INVALID_ARGUMENT", "'samples' must be positive, 'intervalMs' and 'timeoutMs' not negative");
+    return;
+  }
+
+  struct Ranking {
+    flutter::EncodableList probes;
+    std::string error;
+  };
+  auto ranking = std::make_shared<Ranking>();
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> reply = std::move(result);
+  RunInBackground(
+      [ranking, targets, options] {
+        try {
+          for (const auto &probe : RankEndpoints(targets, options)) {
+            ranking->probes.push_back(ProbeResultToEncodable(probe));
+          }
+        } catch (std::exception &e) {
+          ranking->error = e.what();
+        }
+      },
+      [ranking, reply] {
+        if (ranking->error.empty()) {
+          reply->Success(flutter::EncodableValue(ranking->probes));
+        } else {
+          reply->Error(ranking->error);
+        }
+      });
+}
+
+void WireguardDartPlugin::HandleChangePeers(const std::string &method, const flutter::EncodableMap *args,
+                                            std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  if (this->tunnel_service_ == nullptr || this->tunnel_name_.empty()) {
+    result->Error("Invalid state: call 'setupTunnel' and 'connect' first");
+    return;
+  }
+  bool remove = method == "removePeers";
+  const char *list_key = remove ? "publicKeys" : "peers";
+  const auto *entries = args != nullptr ? std::get_if<flutter::EncodableList>(ValueOrNull(*args, list_key)) : nullptr;
+  if (entries == nullptr) {
+    result->Error(std::string("Argument '") + list_key + "' is required");
+    return;
+  }
+
+  std::vector<std::string> public_keys;
+  std::vector<PeerConfig> added;
+  std::vector<PeerUpdate> updates;
+  for (const auto &entry : *entries) {
+    if (remove) {
+      if (const auto *public_key = std::get_if<std::string>(&entry)) {
+        public_keys.push_back(*public_key);
+      }
+      continue;
+    }
+    const auto *peer = std::get_if<flutter::EncodableMap>(&entry);
+    const auto *public_key = peer != nullptr ? std::get_if<std::string>(ValueOrNull(*peer, "publicKey")) : nullptr;
+    if (public_key == nullptr) {
+      result->Error("INVALID_ARGUMENT", "Every peer needs a 'publicKey'");
+      return;
+    }
+    const auto *preshared_key = std::get_if<std::string>(ValueOrNull(*peer, "presharedKey"));
+    const auto *endpoint = std::get_if<std::string>(ValueOrNull(*peer, "endpoint"));
+    const auto *allowed_ip_list = std::get_if<flutter::EncodableList>(ValueOrNull(*peer, "allowedIps"));
+    std::optional<int64_t> keepalive = IntArgument(*peer, "persistentKeepalive");
+    if (keepalive.has_value() && (*keepalive < 0 || *keepalive > UINT16_MAX)) {
+      result->Error("INVALID_ARGUMENT", "'persistentKeepalive' must be within 0-65535");
+      return;
+    }
+    std::vector<std::string> allowed_ips;
+    if (allowed_ip_list != nullptr) {
+      for (const auto &allowed_ip : *allowed_ip_list) {
+        if (const auto *text = std::get_if<std::string>(&allowed_ip)) {
+          allowed_ips.push_back(*text);
+        }
+      }
+    }
+
+    if (method == "addPeers") {
+      PeerConfig config;
+      config.public_key = *public_key;
+      config.preshared_key = preshared_key != nullptr ? *preshared_key : "";
+      config.endpoint = endpoint != nullptr ? *endpoint : "";
+      config.allowed_ips = std::move(allowed_ips);
+      config.persistent_keepalive = static_cast<uint16_t>(keepalive.value_or(0));
+      added.push_back(std::move(config));
+    } else {
+      PeerUpdate update;
+      update.public_key = *public_key;
+      if (endpoint != nullptr) {
+        update.endpoint = *endpoint;
+      }
+      if (allowed_ip_list != nullptr) {
+        update.allowed_ips = std::move(allowed_ips);
+      }
+      if (keepalive.has_value()) {
+        update.persistent_keepalive = static_cast<uint16_t>(*keepalive);
+      }
+      updates.push_back(std::move(update));
+    }
+  }
+
+  // The endpoints of the added and updated peers, in that order.
+  std::vector<std::string> endpoints;
+  for (const auto &peer : added) {
+    endpoints.push_back(peer.endpoint);
+  }
+  for (const auto &update : updates) {
+    endpoints.push_back(update.endpoint.value_or(""));
+  }
+  bool has_host_names = std::any_of(endpoints.begin(), endpoints.end(), [](const std::string &endpoint) {
+    return !endpoint.empty() && EndpointFamily(endpoint) == AddressFamily::unspecified;
+  });
+  if (!has_host_names) {
+    ApplyPeers(method, public_keys, added, updates, result.get());
+    return;
+  }
+
+  // Host names are resolved in the background, as for connect, and the changes applied with their addresses.
+  struct Resolved {
+    std::vector<std::string> endpoints;
+    std::string error;
+  };
+  auto resolved = std::make_shared<Resolved>();
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> reply = std::move(result);
+  RunInBackground(
+      [this, resolved, endpoints] {
+        try {
+          resolved->endpoints = ResolveEndpoints(endpoints, &this->family_cache_, CachedResolver(&this->dns_cache_));
+        } catch (std::exception &e) {
+          resolved->error = e.what();
+        }
+      },
+      [this, method, public_keys, added, updates, resolved, reply]() mutable {
+        if (!resolved->error.empty()) {
+          reply->Error("INVALID_ARGUMENT", resolved->error);
+          return;
+        }
+        size_t i = 0;
+        for (auto &peer : added) {
+          peer.endpoint = resolved->endpoints[i++];
+        }
+        for (auto &update : updates) {
+          if (update.endpoint.has_value()) {
+            update.endpoint = resolved->endpoints[i];
+          }
+          i++;
+        }
+        ApplyPeers(method, public_keys, added, updates, reply.get());
+      });
+}
+
+void WireguardDartPlugin::ApplyPeers(const std::string &method, const std::vector<std::string> &public_keys,
+                                     const std::vector<PeerConfig> &added, const std::vector<PeerUpdate> &updates,
+                                     flutter::MethodResult<flutter::EncodableValue> *result) {
+  try {
+    auto adapter = WireguardAdapter::Open(this->tunnel_name_);
+    if (adapter == nullptr) {
+      throw std::runtime_error("Tunnel adapter is not up yet");
+    }
+    if (!this->peers_.has_value()) {
+      PeerIndex peers;
+      peers.Reset(adapter->ConfiguredPeers());
+      this->peers_ = std::move(peers);
+    }
+    auto apply = [&adapter](const std::vector<PeerChange> &changes) { adapter->ApplyPeerChanges(changes); };
+    if (method == "removePeers") {
+      this->peers_->Remove(public_keys, apply);
+    } else if (method == "addPeers") {
+      this->peers_->Add(added, apply);
+    } else {
+      this->peers_->Update(updates, apply);
+    }
+    result->Success(flutter::EncodableValue(static_cast<int64_t>(this->peers_->size())));
+  } catch (std::invalid_argument &e) {
+    result->Error("INVALID_ARGUMENT", e.what());
+  } catch (std::exception &e) {
+    result->Error(std::string(e.what()));
+  }
+}
+
+struct WireguardDartPlugin::BatchRun {
+  flutter::EncodableList calls;
+  flutter::EncodableList results;
+  std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result;
+};
+
+void WireguardDartPlugin::HandleBatch(const flutter::EncodableMap *args,
+                                      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  const auto *calls = args != nullptr ? std::get_if<flutter::EncodableList>(ValueOrNull(*args, "calls")) : nullptr;
+  if (calls == nullptr) {
+    result->Error("Argument 'calls' is required");
+    return;
+  }
+  // Calls that reply later outlive the arguments of the batch.
+  auto run = std::make_shared<BatchRun>();
+  run->calls = *calls;
+  run->results.reserve(calls->size());
+  run->result = std::move(result);
+  RunBatchFrom(run, 0);
+}
+
+void WireguardDartPlugin::RunBatchFrom(std::shared_ptr<BatchRun> run, size_t index) {
+  if (index == run->calls.size()) {
+    run->result->Success(flutter::EncodableValue(run->results));
+    return;
+  }
+  const auto *entry = std::get_if<flutter::EncodableMap>(&run->calls[index]);
+  const auto *method = entry != nullptr ? std::get_if<std::string>(ValueOrNull(*entry, "method")) : nullptr;
+  if (method == nullptr || *method == "batch") {
+    flutter::EncodableMap details;
+    details[flutter::EncodableValue("index")] = flutter::EncodableValue(static_cast<int32_t>(index));
+    details[flutter::EncodableValue("results")] = flutter::EncodableValue(run->results);
+    run->result->Error("INVALID_BATCH_CALL", "Batch entry " + std::to_string(index) + " has no valid 'method'",
+                       flutter::EncodableValue(details));
+    return;
+  }
+
+  const auto *arguments = ValueOrNull(*entry, "arguments");
+  auto call_arguments = std::make_unique<flutter::EncodableValue>(
+      arguments != nullptr ? *arguments : flutter::EncodableValue(flutter::EncodableMap()));
+  flutter::MethodCall<flutter::EncodableValue> call(*method, std::move(call_arguments));
+  std::string name = *method;
+  HandleMethodCall(call, std::make_unique<BatchCallResult>([this, run, index, name](BatchCallOutcome outcome) {
+    if (outcome.success) {
+      run->results.push_back(std::move(outcome.value));
+      RunBatchFrom(run, index + 1);
+      return;
+    }
+    // Surface the failing call's own error code so callers can handle it like a direct invocation.
+    flutter::EncodableMap details;
+    details[flutter::EncodableValue("index")] = flutter::EncodableValue(static_cast<int32_t>(index));
+    details[flutter::EncodableValue("method")] = flutter::EncodableValue(name);
+    details[flutter::EncodableValue("results")] = flutter::EncodableValue(run->results);
+    details[flutter::EncodableValue("details")] = outcome.error_details;
+    run->result->Error(outcome.error_code, name + ": " + outcome.error_message, flutter::EncodableValue(details));
+  }));
+}
+
 }  // namespace wireguard_dart
 
 std::string GetLastErrorAsString(DWORD error_code) {
@@ -3,11 +3,27 @@
 
 #include <flutter/method_channel.h>
 #include <flutter/plugin_registrar_windows.h>
+#include <windows.h>
 
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "service_control.h"
 #include "connection_status_observer.h"
+#include "dns_cache.h"
+#include "happy_eyeballs.h"
+#include "peer_index.h"
+#include "quality_prober.h"
+#include "traffic_history.h"
+#include "tunnel_watchdog.h"
+#include "wireguard_config.h"
 
 namespace wireguard_dart {
 
@@ -28,8 +44,114 @@ class WireguardDartPlugin : public flutter::Plugin {
   void HandleMethodCall(const flutter::MethodCall<flutter::EncodableValue> &method_call,
                         std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
 
+  struct BatchRun;
+
+  // Runs an ordered list of method calls in a single platform channel round trip, stopping at the first error.
+  void HandleBatch(const flutter::EncodableMap *args,
+                   std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  // Runs the calls of a batch from the one at `index` on, each once the one before replied.
+  void RunBatchFrom(std::shared_ptr<BatchRun> run, size_t index);
+
+  // Resolves the endpoint host names of 'cfg' in the background, then starts the tunnel service with the addresses and
+  // replies, unless a later connect or disconnect came first.
+  void HandleConnect(const flutter::EncodableMap *args,
+                     std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  // Writes `service_cfg`, the config with the addresses the race prepared, for the tunnel service, starts it, and races
+  // the endpoints. `cfg` is the config as given.
+  void FinishConnect(const std::string &cfg, const std::string &service_cfg,
+                     flutter::MethodResult<flutter::EncodableValue> *result);
+
+  // Probes candidate endpoints concurrently in the background and replies with them ranked best first, after at most
+  // one probing budget: (samples - 1) * intervalMs + timeoutMs.
+  void HandleRankEndpoints(const flutter::EncodableMap *args,
+                           std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Adds, updates or removes a batch of peers of the running tunnel with one configuration delta; the other peers are
+  // not touched. Endpoint host names are resolved in the background first. Changes are not written back to the config
+  // file, so connect or a service restart starts over.
+  void HandleChangePeers(const std::string &method, const flutter::EncodableMap *args,
+                         std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  // Applies parsed peer changes, whose endpoints are addresses, and replies with the number of peers.
+  void ApplyPeers(const std::string &method, const std::vector<std::string> &public_keys,
+                  const std::vector<PeerConfig> &added, const std::vector<PeerUpdate> &updates,
+                  flutter::MethodResult<flutter::EncodableValue> *result);
+
+  // Looks for a tunnel service left running by a previous instance of the app without blocking the platform thread,
+  // adopts it, then handles the method calls that came meanwhile.
+  void Attach();
+  // Adopts a tunnel service found by discovery, unless one was set up already.
+  void Adopt(const TunnelServiceInfo &tunnel);
+
+  // Starts watching handshakes and recording the traffic of the connected tunnel. `cfg` is the config text the tunnel
+  // was started with.
+  void StartWatchdog(const std::string &cfg);
+
+  // Replies with the recorded traffic of the tunnel, or of the peer 'publicKey', at 'resolution' ("second", "minute"
+  // or "hour") between the Unix times 'from' and 'to', by default everything still held. Samples are packed as rx and
+  // tx bytes of each bucket in turn.
+  void HandleTrafficHistory(const flutter::EncodableMap *args,
+                            std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  // Sends UDP echo probes to 'target', a literal "address:port" inside the tunnel, every 'intervalMs' while connected,
+  // counting those unanswered after 'timeoutMs' as lost. Stops probing without a target.
+  void HandleSetQualityProbe(const flutter::EncodableMap *args,
+                             std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  // Starts probing the quality of the connected tunnel, if a probe target is set.
+  void StartQualityProbe();
+  // Restarts the tunnel service for the watchdog, unless a connect or disconnect came after `generation`.
+  void RestartTunnel(uint64_t generation);
+
+  // Runs `work` on a thread of its own, then `then` on the platform thread, where replies may be sent. The destructor
+  // waits for running work, which may therefore use the plugin but must not throw.
+  void RunInBackground(std::function<void()> work, std::function<void()> then);
+  // Runs `task` on the platform thread soon. May be called on any thread.
+  void PostToPlatformThread(std::function<void()> task);
+  // Runs the tasks posted to the window of the app.
+  std::optional<LRESULT> HandleWindowProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
+
+  flutter::PluginRegistrarWindows *registrar_ = nullptr;
+  // The top-level window of the app, whose window procedure runs tasks posted to the platform thread.
+  HWND window_ = nullptr;
+  int window_proc_id_ = -1;
+
   std::unique_ptr<ServiceControl> tunnel_service_;
   std::unique_ptr<ConnectionStatusObserver> connection_status_observer_;
+  // A method call that came while discovery ran, handled once it finished.
+  struct AwaitingCall {
+    std::unique_ptr<flutter::MethodCall<flutter::EncodableValue>> call;
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result;
+  };
+  // Set while discovery of a tunnel left running by a previous instance of the app runs, from registration on. Method
+  // calls that come meanwhile wait for it, in order, so that they see the adopted tunnel.
+  bool attaching_ = false;
+  std::vector<AwaitingCall> calls_awaiting_attach_;
+  // Name of the WireGuard adapter created by the tunnel service.
+  std::wstring tunnel_name_;
+  std::unique_ptr<TunnelWatchdog> watchdog_;
+  // Traffic of the tunnel and its peers, sampled from the adapter every second while connected. Kept across reconnects
+  // but not across app restarts.
+  TrafficHistory traffic_;
+  TrafficRecorder traffic_recorder_{&traffic_};
+  // Set from StartWatchdog until disconnect, while the connected tunnel is watched, recorded and probed.
+  bool watching_ = false;
+  // Where to send quality probes while connected, if anywhere.
+  std::optional<QualityProbeOptions> quality_probe_;
+  QualityProber quality_prober_;
+  AddressFamilyCache family_cache_;
+  // Endpoint host names resolved ahead of connect. Declared before the race, which resolves through it.
+  DnsCache dns_cache_;
+  // Races the addresses of endpoint host names after connect.
+  std::shared_ptr<EndpointRace> endpoint_race_;
+  // Changes with every connect and disconnect, so that a connect that finishes in the background finds out whether
+  // another call came first.
+  uint64_t tunnel_generation_ = 0;
+  // Peers of the running tunnel for addPeers, updatePeers and removePeers. Seeded by connect, or from the adapter on
+  // first use after attaching.
+  std::optional<PeerIndex> peers_;
+  std::mutex platform_tasks_mutex_;
+  std::vector<std::function<void()>> platform_tasks_;
+  // Method calls running off the platform thread. Declared last so that destruction waits for them before anything
+  // they use goes away.
+  std::list<std::future<void>> background_;
 };
 
 }  // namespace wireguard_dart